@@ -0,0 +1,450 @@
+// -------------------------------------------------------------------
+// include's
+// -------------------------------------------------------------------
+
+#include "fake6502.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+
+// -------------------------------------------------------------------
+// define's
+// -------------------------------------------------------------------
+
+#define BENCH_INSTRUCTIONS              20000000
+#define BENCH_WORKLOAD_INSTRUCTIONS     5000000
+#define BENCH_EVALUATIONS               (1 << 20)
+#define BENCH_CONTEXTS                  64
+
+
+// -------------------------------------------------------------------
+// typedef's
+// -------------------------------------------------------------------
+
+// a program run from $0200 forever, with an interrupt handler at $0300
+// raised by an event every irq_period cycles when that is not 0
+
+typedef struct bench_workload {
+    const char *name;
+    const uint8_t *program;
+    size_t program_size;
+    const uint8_t *handler;
+    size_t handler_size;
+    int irq_period;
+} bench_workload;
+
+typedef struct bench_result {
+    double seconds;
+    double mips;
+    double mhz;
+} bench_result;
+
+
+// -------------------------------------------------------------------
+// global's
+// -------------------------------------------------------------------
+
+uint8_t bench_mem[65536];
+
+fake6502_cache bench_cache;
+
+fake6502_events bench_events;
+
+#ifndef FAKE6502_BUS_FLAT
+fake6502_batch bench_batch;
+#endif
+
+fake6502_context bench_contexts[BENCH_CONTEXTS];
+uint8_t bench_contexts_mem[BENCH_CONTEXTS][65536];
+
+// the machine readable results, when a file is given
+FILE *bench_csv;
+
+// ldx #$00
+// loop: lda $1000,x; adc #$01; sta $1100,x; eor $20; asl a; rol $21
+//       inx; bne loop
+// jmp $0200
+
+uint8_t bench_program[] = {
+    0xa2, 0x00,
+    0xbd, 0x00, 0x10,
+    0x69, 0x01,
+    0x9d, 0x00, 0x11,
+    0x45, 0x20,
+    0x0a,
+    0x26, 0x21,
+    0xe8,
+    0xd0, 0xf0,
+    0x4c, 0x00, 0x02};
+
+// 8x8 bit shift and add multiplies of x by x ^ $5a
+// ldx #$00
+// loop: stx $10; txa; eor #$5a; sta $11; lda #$00; ldy #$08
+// bit: lsr $11; bcc skip; clc; adc $10
+// skip: ror a; ror $12; dey; bne bit
+//       inx; jmp loop
+
+uint8_t bench_arith[] = {
+    0xa2, 0x00,
+    0x86, 0x10, 0x8a, 0x49, 0x5a, 0x85, 0x11, 0xa9, 0x00, 0xa0, 0x08,
+    0x46, 0x11, 0x90, 0x03, 0x18, 0x65, 0x10,
+    0x6a, 0x66, 0x12, 0x88, 0xd0, 0xf3,
+    0xe8, 0x4c, 0x02, 0x02};
+
+// 4 pages copied from $1000 to $2000 through ($00),y and ($02),y
+// start: lda #$00; sta $00; sta $02; lda #$10; sta $01; lda #$20; sta $03
+//        ldx #$04; ldy #$00
+// copy:  lda ($00),y; sta ($02),y; iny; bne copy
+//        inc $01; inc $03; dex; bne copy
+//        jmp start
+
+uint8_t bench_copy[] = {
+    0xa9, 0x00, 0x85, 0x00, 0x85, 0x02, 0xa9, 0x10, 0x85, 0x01, 0xa9, 0x20, 0x85, 0x03,
+    0xa2, 0x04, 0xa0, 0x00,
+    0xb1, 0x00, 0x91, 0x02, 0xc8, 0xd0, 0xf9,
+    0xe6, 0x01, 0xe6, 0x03, 0xca, 0xd0, 0xf2,
+    0x4c, 0x00, 0x02};
+
+// a 3 byte decimal counter, and a decimal subtraction of its low byte
+// sed
+// loop: clc; lda $10; adc #$01; sta $10; lda $11; adc #$00; sta $11
+//       lda $12; adc #$00; sta $12
+//       sec; lda $13; sbc $10; sta $13; jmp loop
+
+uint8_t bench_bcd[] = {
+    0xf8,
+    0x18, 0xa5, 0x10, 0x69, 0x01, 0x85, 0x10, 0xa5, 0x11, 0x69, 0x00, 0x85, 0x11,
+    0xa5, 0x12, 0x69, 0x00, 0x85, 0x12,
+    0x38, 0xa5, 0x13, 0xe5, 0x10, 0x85, 0x13, 0x4c, 0x01, 0x02};
+
+// branches on the bits of an 8 bit LFSR, taken about half the time
+// lda #$01
+// loop: asl a; bcc nox; eor #$1d
+// nox:  sta $10; bit $10; bmi m1; inc $11
+// m1:   bvc m2; inc $12
+// m2:   lsr a; bcs m3; inc $13
+// m3:   lda $10; cmp #$80; bcc m4; inc $14
+// m4:   bne loop; jmp $0200
+
+uint8_t bench_branch[] = {
+    0xa9, 0x01,
+    0x0a, 0x90, 0x02, 0x49, 0x1d,
+    0x85, 0x10, 0x24, 0x10, 0x30, 0x02, 0xe6, 0x11,
+    0x50, 0x02, 0xe6, 0x12,
+    0x4a, 0xb0, 0x02, 0xe6, 0x13,
+    0xa5, 0x10, 0xc9, 0x80, 0x90, 0x02, 0xe6, 0x14,
+    0xd0, 0xe0, 0x4c, 0x00, 0x02};
+
+// a counting loop interrupted by a handler saving every register
+// cli
+// loop: inc $10; bne loop; inc $11; jmp loop
+
+uint8_t bench_irq[] = {
+    0x58,
+    0xe6, 0x10, 0xd0, 0xfc, 0xe6, 0x11, 0x4c, 0x01, 0x02};
+
+// pha; txa; pha; tya; pha; inc $20; bne +2; inc $21
+// pla; tay; pla; tax; pla; rti
+
+uint8_t bench_irq_handler[] = {
+    0x48, 0x8a, 0x48, 0x98, 0x48, 0xe6, 0x20, 0xd0, 0x02, 0xe6, 0x21,
+    0x68, 0xa8, 0x68, 0xaa, 0x68, 0x40};
+
+bench_workload bench_workloads[] = {
+    {"mixed", bench_program, sizeof(bench_program), NULL, 0, 0},
+    {"arith", bench_arith, sizeof(bench_arith), NULL, 0, 0},
+    {"copy", bench_copy, sizeof(bench_copy), NULL, 0, 0},
+    {"bcd", bench_bcd, sizeof(bench_bcd), NULL, 0, 0},
+    {"branch", bench_branch, sizeof(bench_branch), NULL, 0, 0},
+    {"irq", bench_irq, sizeof(bench_irq), bench_irq_handler, sizeof(bench_irq_handler), 200}};
+
+#ifdef FAKE6502_BUS_FLAT
+const char *bench_buses[] = {"flat"};
+#else
+const char *bench_buses[] = {"callback", "paged"};
+#endif
+const char *bench_engines[] = {"table", "fused", "cached", "jit"};
+const char *bench_variants[] = {"nmos", "cmos", "2a03"};
+
+// the options this was built with, to tell the results of builds apart
+
+const char *bench_options[] = {
+#ifdef FAKE6502_LAZY_FLAGS
+    "lazy",
+#endif
+#ifdef FAKE6502_JIT
+    "jit",
+#endif
+#ifdef __AVX2__
+    "avx2",
+#endif
+    NULL};
+
+char bench_build[64];
+
+// a candidate a superoptimizer might check, over many inputs:
+// clc; lda $00; adc $02; sta $04; lda $01; adc $03; sta $05
+// lda $04; eor #$ff; and $05; tax; inx; stx $06; brk
+
+uint8_t bench_candidate[] = {
+    0x18, 0xa5, 0x00, 0x65, 0x02, 0x85, 0x04, 0xa5, 0x01, 0x65, 0x03, 0x85, 0x05,
+    0xa5, 0x04, 0x49, 0xff, 0x25, 0x05, 0xaa, 0xe8, 0x86, 0x06, 0x00};
+
+
+// -------------------------------------------------------------------
+// function's
+// -------------------------------------------------------------------
+
+// emulator support
+
+uint8_t bench_mem_read(fake6502_context *c, uint16_t addr)
+{ return( ((uint8_t*)c->state_host)[addr] ); }
+
+void bench_mem_write(fake6502_context *c, uint16_t addr, uint8_t val)
+{ ((uint8_t*)c->state_host)[addr] = val; }
+
+
+// -------------------------------------------------------------------
+
+// benchmark core
+
+// a workload for a number of instructions on an engine and variant, with
+// the callback bus or the page table; returns false if it stopped early,
+// which is a bug in the workload
+
+int bench_workload_run(bench_workload *w, fake6502_engine engine, fake6502_variant variant,
+                       int paged, int instructions, bench_result *result)
+{
+    fake6502_context c;
+    fake6502_jit *jit = NULL;
+    fake6502_stop_reason reason;
+    clock_t start;
+
+    memset(bench_mem, 0, sizeof(bench_mem));
+    memcpy(bench_mem + 0x0200, w->program, w->program_size);
+    if (w->handler)
+        memcpy(bench_mem + 0x0300, w->handler, w->handler_size);
+    bench_mem[0xfffc] = 0x00;
+    bench_mem[0xfffd] = 0x02;
+    bench_mem[0xfffe] = 0x00;
+    bench_mem[0xffff] = 0x03;
+
+    fake6502_init(&c, bench_mem_read, bench_mem_write, bench_mem);
+    c.bus.memory = bench_mem;
+    c.engine = engine;
+    c.variant = variant;
+    if (paged)
+        fake6502_pages_map(&c, 0x00, 256, bench_mem, bench_mem);
+    if (engine >= FAKE6502_ENGINE_CACHED)
+        fake6502_cache_attach(&c, &bench_cache);
+    if (engine == FAKE6502_ENGINE_JIT)
+        fake6502_jit_attach(&c, jit = fake6502_jit_create());
+    fake6502_reset(&c);
+    if (w->irq_period)
+    {
+        fake6502_events_attach(&c, &bench_events);
+        fake6502_event_add(&c, w->irq_period, w->irq_period, FAKE6502_EVENT_IRQ, NULL, NULL);
+    }
+
+    start = clock();
+    reason = fake6502_run(&c, 0, instructions);
+    result->seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+    result->mips = c.emu.instructions / result->seconds / 1e6;
+    result->mhz = (unsigned)c.emu.clockticks / result->seconds / 1e6;
+
+    fake6502_events_attach(&c, NULL);
+    fake6502_jit_attach(&c, NULL);
+    fake6502_jit_destroy(jit);
+    fake6502_cache_attach(&c, NULL);
+
+    if (reason != FAKE6502_STOP_BUDGET)
+        printf("%s stopped at $%04x\n", w->name, c.cpu.pc);
+
+    if (bench_csv)
+        fprintf(bench_csv, "%s,%s,%s,%s,%s,%d,%u,%.4f,%.2f,%.2f\n", bench_build,
+                bench_buses[paged], w->name, bench_variants[variant],
+                bench_engines[engine], c.emu.instructions, (unsigned)c.emu.clockticks,
+                result->seconds, result->mips, result->mhz);
+
+    return(reason == FAKE6502_STOP_BUDGET);
+}
+
+double bench_engine(fake6502_engine engine, int paged)
+{
+    bench_result result;
+
+    bench_workload_run(&bench_workloads[0], engine, FAKE6502_VARIANT_NMOS, paged,
+                       BENCH_INSTRUCTIONS, &result);
+    return( result.mips );
+}
+
+// the program in each of BENCH_CONTEXTS contexts, one after another (0
+// threads) or on a thread pool (less than 0 for one per CPU); returns
+// aggregate MIPS
+
+double bench_pool(int threads)
+{
+    fake6502_pool *pool = threads ? fake6502_pool_create(threads, true) : NULL;
+    fake6502_pool_stats stats;
+
+    for (int i = 0; i < BENCH_CONTEXTS; i++)
+    {
+        fake6502_context *c = &bench_contexts[i];
+        uint8_t *mem = bench_contexts_mem[i];
+
+        memset(mem, 0, 65536);
+        memcpy(mem + 0x0200, bench_program, sizeof(bench_program));
+        mem[0xfffc] = 0x00;
+        mem[0xfffd] = 0x02;
+
+        fake6502_init(c, bench_mem_read, bench_mem_write, mem);
+        c->bus.memory = mem;
+        c->engine = FAKE6502_ENGINE_FUSED;
+#ifndef FAKE6502_BUS_FLAT
+        fake6502_pages_map(c, 0x00, 256, mem, mem);
+#endif
+        fake6502_reset(c);
+    }
+
+    fake6502_pool_run(pool, bench_contexts, BENCH_CONTEXTS, 0, BENCH_INSTRUCTIONS / 8,
+                      NULL, NULL, &stats);
+    fake6502_pool_destroy(pool);
+    return( stats.instructions_per_second / 1e6 );
+}
+
+#ifndef FAKE6502_BUS_FLAT
+
+// the candidate over BENCH_EVALUATIONS inputs, one context at a time or
+// a batch of lanes at a time; returns millions of evaluations a second
+
+double bench_candidate_run(int batch)
+{
+    fake6502_context c;
+    clock_t start;
+    double seconds;
+
+    memset(bench_mem, 0, sizeof(bench_mem));
+    memcpy(bench_mem + 0x0200, bench_candidate, sizeof(bench_candidate));
+
+    fake6502_init(&c, bench_mem_read, bench_mem_write, bench_mem);
+    c.engine = FAKE6502_ENGINE_FUSED;
+    fake6502_pages_map(&c, 0x00, 256, bench_mem, bench_mem);
+
+    fake6502_batch_init(&bench_batch, FAKE6502_VARIANT_NMOS, bench_mem, FAKE6502_BATCH_LANES);
+
+    start = clock();
+    for (int i = 0; i < BENCH_EVALUATIONS; i += batch ? FAKE6502_BATCH_LANES : 1)
+    {
+        if (batch)
+        {
+            fake6502_batch_reset(&bench_batch);
+            for (int lane = 0; lane < FAKE6502_BATCH_LANES; lane++)
+            {
+                bench_batch.pc[lane] = 0x0200;
+                for (int k = 0; k < 4; k++)
+                    fake6502_batch_poke(&bench_batch, lane, k, (i + lane) >> (k * 4));
+            }
+            fake6502_batch_run(&bench_batch, 0);
+        }
+        else
+        {
+            c.cpu.pc = 0x0200;
+            c.cpu.flags = FAKE6502_CONSTANT_FLAG;
+            for (int k = 0; k < 4; k++)
+                bench_mem[k] = i >> (k * 4);
+            fake6502_run(&c, 0, 0);
+        }
+    }
+    seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    return( BENCH_EVALUATIONS / seconds / 1e6 );
+}
+
+#endif
+
+// with a file name, results are also appended to it as CSV, a header
+// first if it is empty
+
+int main(int argc, char **argv)
+{
+    int failed = 0;
+
+    for (int i = 0; bench_options[i]; i++)
+    {
+        if (i)
+            strcat(bench_build, "+");
+        strcat(bench_build, bench_options[i]);
+    }
+    if (!bench_build[0])
+        strcpy(bench_build, "default");
+
+    if (argc > 1)
+    {
+        if (!(bench_csv = fopen(argv[1], "a")))
+            return( printf("can not open %s\n", argv[1]) );
+        if (ftell(bench_csv) == 0)
+            fprintf(bench_csv, "build,bus,workload,variant,engine,instructions,cycles,"
+                               "seconds,mips,mhz\n");
+    }
+
+    for (int paged = 0; paged < sizeof(bench_buses) / sizeof(bench_buses[0]); paged++)
+    {
+        double table = bench_engine(FAKE6502_ENGINE_TABLE, paged);
+        double fused = bench_engine(FAKE6502_ENGINE_FUSED, paged);
+        double cached = bench_engine(FAKE6502_ENGINE_CACHED, paged);
+        double jit = bench_engine(FAKE6502_ENGINE_JIT, paged);
+
+        printf("%-8s bus, table engine:  %8.2f MIPS\n", bench_buses[paged], table);
+        printf("%-8s bus, fused engine:  %8.2f MIPS (%.2fx)\n", bench_buses[paged],
+               fused, fused / table);
+        printf("%-8s bus, cached engine: %8.2f MIPS (%.2fx)\n", bench_buses[paged],
+               cached, cached / table);
+        printf("%-8s bus, JIT engine:    %8.2f MIPS (%.2fx)\n", bench_buses[paged],
+               jit, jit / table);
+    }
+
+    {
+        double single = bench_pool(0);
+        double pooled = bench_pool(-1);
+
+        printf("%d contexts, one thread:   %8.2f MIPS\n", BENCH_CONTEXTS, single);
+        printf("%d contexts, thread pool:  %8.2f MIPS (%.2fx)\n", BENCH_CONTEXTS, pooled,
+               pooled / single);
+    }
+
+#ifndef FAKE6502_BUS_FLAT
+    {
+        double single = bench_candidate_run(0);
+        double batch = bench_candidate_run(1);
+
+        printf("candidate, one context:    %8.2f M evaluations/s\n", single);
+        printf("candidate, batch engine:   %8.2f M evaluations/s (%.2fx)\n", batch,
+               batch / single);
+    }
+#endif
+
+    // every workload on the fastest bus, for each variant and engine
+    printf("\nworkload  variant  engine      MIPS       MHz\n");
+    for (int w = 0; w < sizeof(bench_workloads) / sizeof(bench_workloads[0]); w++)
+        for (int variant = 0; variant < 3; variant++)
+            for (int engine = 0; engine < 4; engine++)
+            {
+                bench_result result;
+                int paged = sizeof(bench_buses) / sizeof(bench_buses[0]) - 1;
+
+                failed |= !bench_workload_run(&bench_workloads[w], engine, variant, paged,
+                                              BENCH_WORKLOAD_INSTRUCTIONS, &result);
+                printf("%-8s  %-7s  %-6s  %8.2f  %8.2f\n", bench_workloads[w].name,
+                       bench_variants[variant], bench_engines[engine], result.mips,
+                       result.mhz);
+            }
+
+    if (bench_csv)
+        fclose(bench_csv);
+    return(failed);
+}
+
+// -------------------------------------------------------------------
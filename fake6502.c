@@ -36,45 +36,130 @@ v2.4.0 - 19-07-2022
 
 \section f6502_building Building this emulator
 
-Fake6502 requires you to provide two external functions:
+Fake6502 requires you to provide two memory accessing functions,
+which are passed to fake6502_init() and stored in the context:
 
-uint8_t fake6502_mem_read(uint16_t address)
+uint8_t read(fake6502_context *c, uint16_t address)
 
-void fake6502_mem_write(uint16_t address, uint8_t value)
+void write(fake6502_context *c, uint16_t address, uint8_t value)
 
 
-There are a couple of compile-time options:
+All three variants of the CPU are always built in, and each context
+chooses one at runtime with `c->variant`:
+
+ - FAKE6502_VARIANT_NMOS, the NMOS 6502
 
- - NES_CPU
+ - FAKE6502_VARIANT_CMOS, the CMOS 65C02, which adds bugfixes and several
+instructions
 
-when this is defined, the binary-coded decimal (BCD) status flag is not
-honored by ADC and SBC. The 2A03 CPU in the Nintendo Entertainment System
-does not support BCD operation.
+ - FAKE6502_VARIANT_2A03, the 2A03 CPU in the Nintendo Entertainment
+System, which is an NMOS 6502 where the binary-coded decimal (BCD) status
+flag is not honored by ADC and SBC.
 
 See:
 <a href='https://www.nesdev.com/2A03%20technical%20reference.txt'>2A03 technical reference</a>
 
 
- - NMOS6502 or CMOS6502
-
-define one or other of these. This will configure the emulator to emulate
-either the NMOS or CMOS variants (CMOS adds bugfixes and several
-instructions)
-
+There are a couple of compile-time options:
 
-- DECIMALMODE
+ - NES_CPU, NMOS6502, CMOS6502 and DECIMALMODE
 
-when this is defined, BCD mode is implemented (in adc and rra).
+these now only choose the variant fake6502_init() gives a new context:
+CMOS6502 for the CMOS variant, NES_CPU (or NMOS6502 without DECIMALMODE)
+for the 2A03, otherwise the NMOS variant.
 
 
 - FAKE6502_OPS_STATIC
 
 when this is defined, al the addressing and opcode functions are declared
 as 'static'. This can be used to avoid any global name conflicts.
-You can still access/call any opcode function, via the opcode table:
+You can still access/call any opcode function, via the opcode tables:
+
+    fake6502_opcode_tables[c->variant][opcode].addr_mode(c);
+    fake6502_opcode_tables[c->variant][opcode].opcode(c);
+
+
+- FAKE6502_BUS_FLAT
+
+when this is defined, the memory accessing functions are not used.
+Instead, all 64K is plain RAM pointed to by `c->bus.memory`, and
+fake6502_mem_read() / fake6502_mem_write() are inline functions in
+fake6502.h, so every load and store is inlined into the emulator.
+The host must be compiled with the same option.
+
+
+- FAKE6502_LAZY_FLAGS
+
+when this is defined, instructions do not work out N, Z, C and V as they
+execute. They store the result the flag depends on in `c->emu.flag_n`
+etc., and the flag is only worked out when something reads it: a branch,
+ADC/SBC/rotates taking the carry in, PHP/BRK pushing the flags, and
+fake6502_step()/fake6502_run() packing them back into `c->cpu.flags`
+before they return. `c->cpu.flags` is therefore always correct when the
+host looks at it between calls, and the host may change it there; only
+the memory accessing functions, called in the middle of an instruction,
+can see stale N, Z, C and V bits.
+
+
+- FAKE6502_JIT
+
+when this is defined on x86-64 Linux, fake6502_jit_create() gives a JIT
+for FAKE6502_ENGINE_JIT. Elsewhere, with FAKE6502_BUS_FLAT, or where the
+system does not let memory be made executable (such as SELinux denying
+execmem), it returns NULL and the JIT engine runs the cached engine
+instead. The translated code is never writable and executable at once.
+FAKE6502_JIT_HOT sets how often a block is run before it is translated.
+
 
-    fake6502_opcodes[opcode].addr_mode(c);
-    fake6502_opcodes[opcode].opcode(c);
+- FAKE6502_TRACE
+
+when this is defined, a context with a `fake6502_trace` given to
+fake6502_trace_attach() records every instruction it runs in it, a ring
+buffer of the last FAKE6502_TRACE_SIZE. Without it nothing is recorded
+and the run loops are exactly as before. While a trace is attached the
+JIT engine runs the cached engine, as translated blocks can not be seen
+into.
+
+
+- FAKE6502_COUNTERS
+
+when this is defined, a context with `fake6502_counters` given to
+fake6502_counters_attach() counts how often each opcode runs and the
+cycles it takes, including page crossing and branch penalties.
+fake6502_counters_report() writes them out, most cycles first. As with
+a trace, the JIT engine runs the cached engine while they are attached.
+
+
+- FAKE6502_PROFILE
+
+when this is defined, a context with a `fake6502_profile` given to
+fake6502_profile_attach() keeps a shadow call stack, pushed by JSR, BRK,
+fake6502_irq() and fake6502_nmi() and popped by RTS and RTI, and charges
+each routine's entry address with the cycles run inside it (inclusive)
+and in its own code (exclusive). fake6502_profile_folded() writes one
+line per call stack for flame graph tools. Returns pop every frame whose
+return stack pointer has been reached, rather than just the top one, so
+RTS used as a jump, or a return address dropped with PLA, leave the
+stack as it should be. The JIT engine runs the cached engine while a
+profile is attached.
+
+
+- FAKE6502_BREAKPOINTS
+
+when this is defined, a context with `fake6502_breakpoints` given to
+fake6502_breakpoints_attach() checks them on every bus access and after
+every instruction: a bitmap per kind, set with fake6502_breakpoint_set().
+fake6502_run() returns FAKE6502_STOP_BREAKPOINT with the pc at an
+execution breakpoint, before running the instruction there, and
+FAKE6502_STOP_READ_WATCH or FAKE6502_STOP_WRITE_WATCH after an
+instruction that read or wrote a watched address, which is left in the
+breakpoints with the value. Running again carries on from there. Reads
+include instruction fetches and the reads of the vectors. A watchpoint
+hit by a BRK, or by an interrupt an event raises, is reported instead of
+FAKE6502_STOP_BRK. One hit when the host calls fake6502_reset(),
+fake6502_irq() or fake6502_nmi() itself is only left in the breakpoints.
+The cached and JIT engines do not fetch code they have decoded again, so
+while breakpoints are attached both run the fused engine.
 
 - - -
 
@@ -82,6 +167,15 @@ You can still access/call any opcode function, via the opcode table:
 
 There are only a few functions you need to call, to use this emulator.
 
+\code{.unparsed}
+void fake6502_init(c, read, write, state_host)
+\endcode
+
+Call this once to clear the context and to give it the host's
+memory accessing functions and data. The first call also builds the
+ADC/SBC result tables (1MB); calls from other threads at the same time
+wait for it.
+
 \code{.unparsed}
 void fake6502_reset()
 \endcode
@@ -94,6 +188,15 @@ void fake6502_step()
 
 Execute the next (single) instrution.
 
+\code{.unparsed}
+fake6502_stop_reason fake6502_run(c, cycle_budget, instr_budget)
+\endcode
+
+Execute instructions until the cycle or instruction budget is used up
+(a budget of 0 means no limit), a BRK has been executed, a halt opcode
+has been reached, or the host has called fake6502_stop() from one of its
+memory accessing functions. Returns the reason execution stopped.
+
 \code{.unparsed}
 void fake6502_irq()
 \endcode
@@ -106,6 +209,67 @@ void fake6502_nmi()
 
 Trigger an NMI in the 6502 core.
 
+\code{.unparsed}
+uint32_t fake6502_event_add(c, cycle, period, kind, fn, user)
+\endcode
+
+With a `fake6502_events` given to fake6502_events_attach(), have an IRQ
+(FAKE6502_EVENT_IRQ) or NMI (FAKE6502_EVENT_NMI) raised, or fn(c, user)
+called (FAKE6502_EVENT_CALL), once the cycle count from
+fake6502_events_now() reaches cycle, and then every period cycles if
+that is not 0. fake6502_run() runs straight through to each event, so
+the host need not check its timers between instructions. An event fires
+once at the boundary it falls due at, even when a long instruction has
+taken it past several of its periods. Unlike fake6502_irq(), an IRQ
+event that falls due while interrupts are disabled is held, as the IRQ
+line is, and taken straight after the CLI, PLP or RTI that enables
+them. Returns an id for fake6502_event_cancel().
+
+\code{.unparsed}
+void fake6502_idle_attach(c, idle)
+\endcode
+
+With a `fake6502_idle` attached, fake6502_run() looks for a loop at the
+pc after every FAKE6502_IDLE_CHUNK cycles: a branch or jump to itself,
+or a loop of up to FAKE6502_IDLE_LENGTH instructions that only reads
+memory mapped into the page table and writes none, and comes back round
+with the registers and flags as they were. Such a loop goes the same way
+until an interrupt, so the rounds of it that fit before the next event
+or the end of the budget are skipped, adding their cycles and
+instructions to the counts without running them. `skipped_cycles`,
+`skipped_instructions` and `skips` count what was left out. Loops that
+poll the host's callbacks always run, and nothing is skipped while a
+trace, counters, profile or breakpoints are recording.
+
+\code{.unparsed}
+bool fake6502_device_add(c, first, last, read, write, state)
+\endcode
+
+With a `fake6502_devices` given to fake6502_devices_attach(), have reads
+of first to last go to read(c, state, address) and writes to
+write(c, state, address, val), in place of the memory accessing
+functions. The devices sit behind those functions, so pages mapped with
+fake6502_pages_map() never reach them: the pages a device covers are
+unmapped when it is added, and the rest of each page still goes to the
+memory that was mapped there. Whole pages are found through a table of
+256 entries, and up to FAKE6502_DEVICES_FINE pages split between devices
+through a table of 256 addresses each, so a lookup is the same cost for
+any number of devices. A device added later covers the ones before it,
+and a NULL read or write leaves that side to what is underneath. Returns
+false once FAKE6502_DEVICES_MAX devices or the split pages are used up.
+Not available under FAKE6502_BUS_FLAT.
+
+- - -
+
+\code{.unparsed}
+void fake6502_pool_run(pool, contexts, count, cycle_budget, instr_budget, done, user, stats)
+\endcode
+
+Run an array of contexts, each with fake6502_run() and the same budgets,
+on the worker threads of a pool from fake6502_pool_create(), calling
+done() from the worker as each one stops. The contexts must not share
+anything the memory accessing functions write to.
+
 - - -
 
 \section f6502_design Design of this emulator
@@ -120,9 +284,146 @@ Each instance of these tasks are implemented in seperate functions,
 and accessed via a table of function pointers,
 indexed by the 6502 instruction opcode to be executed.
 
+There is one opcode table per variant, generated from a list of
+(opcode, addressing mode, operation, clockticks) entries,
+FAKE6502_OPCODES_NMOS(), FAKE6502_OPCODES_CMOS() and
+FAKE6502_OPCODES_2A03().
+The same list is also expanded into a switch statement with one case
+per opcode, the "fused" engine, in which the addressing mode and
+operation functions are inlined together. Set `engine` in the
+`fake6502_context` to choose between them:
+
+  - FAKE6502_ENGINE_TABLE, dispatch through the opcode table
+
+  - FAKE6502_ENGINE_FUSED, dispatch through the switch statement
+
+  - FAKE6502_ENGINE_CACHED, the decoded instruction cache below
+
+  - FAKE6502_ENGINE_JIT, native code for hot blocks, also below
+
+All give the same results; `make build/bench` compares their speed.
+
+Set `mode` to FAKE6502_MODE_FAST to leave out the bus accesses that
+change nothing the program can see: the dummy reads fake6502_reset()
+makes, and the write of the unchanged value that ROL, ROR, RLA, SRE and
+RRA make before writing their result. That saves time, and on a host
+with memory mapped devices it stops those accesses from having side
+effects. The default, FAKE6502_MODE_ACCURATE, makes them. Cycle counts
+are the same in both.
+
+The cached engine needs a `fake6502_cache`, allocated by the host and
+given to fake6502_cache_attach(). The first time an instruction in a
+page mapped with fake6502_pages_map() is executed, its opcode and
+operand are decoded into the cache entry for its address, and from
+then on it runs from that entry without being fetched or decoded again.
+Pages holding cached code are write protected in the page table, so
+every write to them invalidates the entries it hits, and self-modifying
+code still works. Code outside mapped pages is not cached.
+If the host changes mapped memory itself, it has to call
+fake6502_cache_invalidate() or fake6502_cache_flush().
+
+The JIT engine builds on the cache. It needs a cache attached and a
+`fake6502_jit` from fake6502_jit_create() given to fake6502_jit_attach().
+Straight-line blocks of cached code that run often are translated into
+native code which calls the same addressing mode and operation functions
+without fetching, decoding or dispatching. A block is only entered when
+the cycle and instruction budgets can take all of it, so fake6502_run()
+stops at exactly the same instruction as with the other engines; writes
+to translated code end the block after the writing instruction.
+
+The batch engine runs one program over many machine states at once,
+for hosts such as a superoptimiser that try a candidate program on many
+inputs. fake6502_batch_init() gives it the shared memory image; the host
+then sets each lane's registers and pokes its inputs, and calls
+fake6502_batch_run(). Registers are held as one array per register, and
+the common documented instructions run as SSE2 or AVX2 kernels (which one
+follows the compiler flags) over all lanes at the same pc; the rest run
+in a scratch context one lane at a time. Each address a lane writes to
+gets a column holding its value in every lane, and a lane that writes to
+more addresses than there are columns stops with FAKE6502_STOP_FAULT.
+fake6502_batch_reset() clears the lanes and their memory for the next
+batch. The batch engine is not built under FAKE6502_BUS_FLAT.
+
+fake6502_sliced_run() runs straight-line code that only uses A, X, Y
+and the flags, with no memory operands, over FAKE6502_SLICED_LANES
+states at once (256, or 64 times FAKE6502_SLICED_WORDS). Each bit of
+each register is held bitsliced, as a word with one bit per lane, and
+ADC, SBC, the compares, shifts and logic are written out as the gates of
+add8(), sub8(), compare() and the rest, so one pass over the code works
+out every lane, for example every A at once. The host fills the lanes
+with fake6502_sliced_set() after fake6502_sliced_init(), and reads them
+back with fake6502_sliced_get(); the run stops at the first instruction
+that needs memory, the stack or the pc. It is not built under
+FAKE6502_BUS_FLAT either.
+
+fake6502_equiv_check() compares two programs for the same host, running
+each on the inputs given until the outputs picked by a
+`fake6502_equiv_mask` differ. The `fake6502_equiv` it works in, set up
+once by fake6502_equiv_init(), holds a context and 64K of memory for
+each program; the bytes each writes are logged and put back after every
+input, so nothing is allocated or copied wholesale per input. Inputs
+that have found differences before move to the front. Programs should
+end with a BRK, and as it pushes the pc, the stack bytes it writes
+should not be outputs. The programs' own bytes, from the origin to the
+end of the longer of them, are never compared. Like the batch engine, it is not built under
+FAKE6502_BUS_FLAT.
+
+fake6502_pool_create() starts a thread per CPU, or as many as asked
+for, optionally pinned one to a CPU. fake6502_pool_run() gives each
+worker an equal share of the contexts; a worker that runs out takes half
+of what is left of another worker's share, so a few long runs do not
+hold up the rest. It returns once every context has stopped, with the
+total instructions and instructions a second in `stats`. Without POSIX
+threads fake6502_pool_create() returns NULL, and fake6502_pool_run() with
+a NULL pool runs every context on the calling thread.
+
+Each variant has its own entry points, fake6502_step_nmos(),
+fake6502_run_cmos() etc., in which the variant and its opcode table
+are constants, so each variant gets its own specialized loop.
+fake6502_step() and fake6502_run() pick one of them from `c->variant`,
+once per call.
+
+`fake6502_opcode_infos[variant][opcode]` describes every opcode as
+static data: its size, mnemonic and addressing mode (named in
+fake6502_mnemonic_names[] and fake6502_addressing_names[]), its base
+cycles and which page crossing or branch penalties apply, the registers
+and flags it reads and writes, whether it reads, writes or modifies its
+operand or uses the stack, and whether it branches, jumps, calls or
+returns. It is generated from the same opcode lists as the engines, so
+tools can prune and decode code without running it.
+
 The memory accessing of the 6502 core (for all instructions
 and data) is provided by the host code, via the functions
+`c->bus.read` and `c->bus.write`, which the core calls through
 fake6502_mem_read() and fake6502_mem_write().
+Each context has its own, so a process can run machines with
+different memory maps side by side.
+
+Pages of plain RAM or ROM can be mapped straight into the context's
+page table with fake6502_pages_map(), then reads and writes to those
+pages use the host memory directly and only the remaining (I/O) pages
+go through the memory accessing functions.
+
+Instead of mapping its own memory, the host can give a context RAM of
+its own with fake6502_pages_alloc(). These pages can be shared:
+fake6502_fork() copies a context into another, registers and page table,
+and both share the pages write protected. The first write to a shared
+page, from either side, goes through the memory accessing code, which
+copies the page for the writer alone. A fork that is kept and not run
+is a snapshot: fake6502_restore() puts a context back to it, touching
+only the pages written since. Pages the host mapped itself, and the
+host's `state_host`, are shared as they are, not copied.
+fake6502_pages_release() gives up a context's pages when it is done.
+None of this is available under FAKE6502_BUS_FLAT.
+
+fake6502_save() writes the registers and every mapped page of a context
+into a versioned save state, with all fields little endian. The page
+data starts at a fixed offset after the header. fake6502_load() maps a
+save state's pages straight into a context in the same way as shared
+pages, so a save state mmap'd read-only is loaded without copying and
+in the same time whatever its size, and each page is only copied when
+the context first writes to it. Pages that were read-only when saved,
+such as ROM, are read-only again once loaded.
 
 It is up to the host code to map the address provided,
 into it's own 64K memory space. The host code has the use of
@@ -144,11 +445,41 @@ ie. at the next call to fake6502_step().
 // include's
 // -------------------------------------------------------------------
 
+// for pthread_setaffinity_np()
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #include "fake6502.h"
 
+#include <limits.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <stdatomic.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#define FAKE6502_POOL_PTHREADS
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#if defined(FAKE6502_JIT) && defined(__x86_64__) && defined(__linux__) && \
+    !defined(FAKE6502_BUS_FLAT)
+#define FAKE6502_JIT_X86_64
+#include <stddef.h>
+#include <sys/mman.h>
+#endif
 
 
 // -------------------------------------------------------------------
@@ -167,11 +498,6 @@ ie. at the next call to fake6502_step().
 #endif
 
 
-#if !defined(NMOS6502) && !defined(CMOS6502)
-#error one of NMOS6502 or CMOS6502 must be defined
-#endif
-
-
 #if defined(NMOS6502) && defined(CMOS6502)
 #error can not have both NMOS6502 and CMOS6502 defined
 #endif
@@ -182,6 +508,43 @@ ie. at the next call to fake6502_step().
 #endif
 
 
+// the JIT only generates x86-64 code, and needs the page table to find
+// code it can translate; anywhere else fake6502_jit_create() returns NULL.
+// A block is translated once it has been reached this many times
+
+#ifndef FAKE6502_JIT_HOT
+#define FAKE6502_JIT_HOT                8
+#endif
+
+
+// the variant fake6502_init() gives a new context
+
+#if defined(CMOS6502)
+#define FAKE6502_VARIANT_DEFAULT        FAKE6502_VARIANT_CMOS
+#define FAKE6502_OPCODES_DEFAULT        fake6502_opcodes_cmos
+#elif defined(NES_CPU) || (defined(NMOS6502) && !defined(DECIMALMODE))
+#define FAKE6502_VARIANT_DEFAULT        FAKE6502_VARIANT_2A03
+#define FAKE6502_OPCODES_DEFAULT        fake6502_opcodes_2a03
+#else
+#define FAKE6502_VARIANT_DEFAULT        FAKE6502_VARIANT_NMOS
+#define FAKE6502_OPCODES_DEFAULT        fake6502_opcodes_nmos
+#endif
+
+
+// -------------------------------------------------------------------
+// macro's
+// -------------------------------------------------------------------
+
+// inline everything called by a function into it, where the compiler
+// supports this
+
+#ifdef __GNUC__
+#define FAKE6502_FLATTEN                __attribute__((flatten))
+#else
+#define FAKE6502_FLATTEN
+#endif
+
+
 // -------------------------------------------------------------------
 // global's
 // -------------------------------------------------------------------
@@ -192,1397 +555,5905 @@ ie. at the next call to fake6502_step().
 // function's
 // -------------------------------------------------------------------
 
-// a few general functions used by various other functions
+// the JIT's translated blocks, see fake6502_jit_compile()
+
+#ifdef FAKE6502_JIT_X86_64
+
+#define FAKE6502_JIT_CODE_SIZE          (4 << 20)
+#define FAKE6502_JIT_BLOCKS             65536
+#define FAKE6502_JIT_PAGE               4096        // x86-64 base pages
+#define FAKE6502_JIT_BLOCK_MAX          32
+
+// the longest block: prologue, 32 instructions, epilogue
+#define FAKE6502_JIT_BLOCK_CODE         (64 + FAKE6502_JIT_BLOCK_MAX * 128)
+
+// the code buffer is never writable and executable at once: it is read
+// and execute only, but for the pages a new block is written to while it
+// is written. The block headers are kept apart from it, as they change
+// while translated code runs
+
+// each block is on the list of the page it starts in, through next[0],
+// and of the page it ends in if that is another, through next[1]
+
+typedef struct fake6502_jit_block {
+    int (*fn)(fake6502_context *c);
+    struct fake6502_jit_block *next[2];
+    uint16_t start;
+    uint16_t end;                   // the last byte of its last instruction
+    uint16_t max_ticks;
+    uint8_t count;
+    uint8_t first_page;
+    uint8_t last_page;
+    uint8_t live;
+} fake6502_jit_block;
+
+struct fake6502_jit {
+    fake6502_jit_block *blocks[65536];
+    uint8_t heat[65536];
+    uint16_t page_blocks[256];
+    fake6502_jit_block *page_lists[256];
+    fake6502_jit_block headers[FAKE6502_JIT_BLOCKS];
+    int header_count;
+    size_t code_used;
+    uint8_t *code;
+};
+
+fake6502_jit *fake6502_jit_create(void)
+{
+    fake6502_jit *jit = mmap(NULL, sizeof(fake6502_jit), PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (jit == MAP_FAILED)
+        return(NULL);
+
+    // find out now if the system lets memory be made executable, rather
+    // than on the first block
+    jit->code = mmap(NULL, FAKE6502_JIT_CODE_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (jit->code == MAP_FAILED ||
+        mprotect(jit->code, FAKE6502_JIT_CODE_SIZE, PROT_READ | PROT_EXEC))
+    {
+        if (jit->code != MAP_FAILED)
+            munmap(jit->code, FAKE6502_JIT_CODE_SIZE);
+        munmap(jit, sizeof(fake6502_jit));
+        return(NULL);
+    }
 
-void fake6502_push_8(fake6502_context *c, uint8_t pushval)
+    return(jit);
+}
+
+void fake6502_jit_destroy(fake6502_jit *jit)
 {
-    fake6502_mem_write(c, FAKE6502_STACK_BASE + c->cpu.s--, pushval);
+    if (!jit)
+        return;
+
+    munmap(jit->code, FAKE6502_JIT_CODE_SIZE);
+    munmap(jit, sizeof(fake6502_jit));
 }
 
-void fake6502_push_16(fake6502_context *c, uint16_t pushval)
+static void fake6502_jit_flush(fake6502_jit *jit)
 {
-    fake6502_push_8(c, (pushval >> 8) & 0xFF);
-    fake6502_push_8(c, pushval & 0xFF);
+    memset(jit->blocks, 0, sizeof(jit->blocks));
+    memset(jit->heat, 0, sizeof(jit->heat));
+    memset(jit->page_blocks, 0, sizeof(jit->page_blocks));
+    memset(jit->page_lists, 0, sizeof(jit->page_lists));
+    jit->header_count = 0;
+    jit->code_used = 0;
 }
 
-uint8_t fake6502_pull_8(fake6502_context *c)
-{ return(fake6502_mem_read(c, FAKE6502_STACK_BASE + ++c->cpu.s)); }
+// set the protection of the pages a block written at offset can reach
 
-uint16_t fake6502_pull_16(fake6502_context *c)
+static bool fake6502_jit_protect(fake6502_jit *jit, size_t offset, int prot)
 {
-    uint8_t t;
-    t = fake6502_pull_8(c);
-    return(fake6502_pull_8(c) << 8 | t);
+    size_t first = offset & ~(size_t)(FAKE6502_JIT_PAGE - 1);
+
+    return(mprotect(jit->code + first, offset + FAKE6502_JIT_BLOCK_CODE - first, prot) == 0);
 }
 
-uint16_t fake6502_mem_read16(fake6502_context *c, uint16_t addr)
+static inline bool fake6502_jit_within(uint16_t address, uint16_t first, uint16_t last)
 {
-    // Read two consecutive bytes from memory
-    return((uint16_t)fake6502_mem_read(c, addr) |
-           ((uint16_t)fake6502_mem_read(c, addr + 1) << 8));
+    return((uint16_t)(address - first) <= (uint16_t)(last - first));
 }
 
+// drop every block with code in first..last, returning whether there were
+// any; their native code stays where it is until the next flush, as one
+// of them may be running right now. Dropped blocks are taken off the lists
+// of the pages looked at, and off the others the next time they are
 
-// -------------------------------------------------------------------
+static bool fake6502_jit_invalidate(fake6502_jit *jit, uint16_t first, uint16_t last)
+{
+    bool hit = false;
 
-// supporting addressing mode functions,
-// calculates effective addresses (ea)
+    for (uint8_t page = first >> 8;; page++)
+    {
+        fake6502_jit_block **link = &jit->page_lists[page];
+
+        while (jit->page_blocks[page] && *link)
+        {
+            fake6502_jit_block *block = *link;
+            int side = block->first_page == page ? 0 : 1;
+
+            if (block->live && (fake6502_jit_within(block->start, first, last) ||
+                                fake6502_jit_within(first, block->start, block->end)))
+            {
+                block->live = 0;
+                jit->blocks[block->start] = NULL;
+                jit->heat[block->start] = 0;
+                jit->page_blocks[block->first_page]--;
+                if (block->last_page != block->first_page)
+                    jit->page_blocks[block->last_page]--;
+                hit = true;
+            }
+
+            if (block->live)
+                link = &block->next[side];
+            else
+                *link = block->next[side];
+        }
+
+        if (page == (uint8_t)(last >> 8))
+            break;
+    }
 
-FAKE6502_FN_ADDR_MODE(imp)
-{ // implied
+    return(hit);
 }
 
-FAKE6502_FN_ADDR_MODE(acc)
-{ // accumulator
-}
+#else
 
-FAKE6502_FN_ADDR_MODE(imm)
-{ // immediate
-    c->emu.ea = c->cpu.pc++;
-}
+fake6502_jit *fake6502_jit_create(void)
+{ return(NULL); }
 
-FAKE6502_FN_ADDR_MODE(zp)
-{ // zero-page
-    c->emu.ea = (uint16_t)fake6502_mem_read(c, (uint16_t)c->cpu.pc++);
+void fake6502_jit_destroy(fake6502_jit *jit)
+{
+    (void)jit;
 }
 
-FAKE6502_FN_ADDR_MODE(zpx)
-{ // zero-page,X
-    // do zero-page wraparound
-    c->emu.ea = ((uint16_t)fake6502_mem_read(c, (uint16_t)c->cpu.pc++) + (uint16_t)c->cpu.x) &
-            0xFF;
-}
+#endif
 
-FAKE6502_FN_ADDR_MODE(zpy)
-{ // zero-page,Y
-    // do zero-page wraparound
-    c->emu.ea = ((uint16_t)fake6502_mem_read(c, (uint16_t)c->cpu.pc++) + (uint16_t)c->cpu.y) &
-            0xFF;
+void fake6502_jit_attach(fake6502_context *c, fake6502_jit *jit)
+{
+    c->jit = jit;
+#ifdef FAKE6502_JIT_X86_64
+    if (jit)
+        fake6502_jit_flush(jit);
+#endif
 }
 
-FAKE6502_FN_ADDR_MODE(rel)
-{ // relative for branch ops (8-bit immediate value, sign-extended)
-    uint16_t rel = (uint16_t)fake6502_mem_read(c, c->cpu.pc++);
-    if (rel & 0x80)
-        rel |= 0xFF00;
-    c->emu.ea = c->cpu.pc + rel;
-}
 
-FAKE6502_FN_ADDR_MODE(abso)
-{ // absolute
-    c->emu.ea = fake6502_mem_read16(c, c->cpu.pc);
-    c->cpu.pc += 2;
-}
+// -------------------------------------------------------------------
 
-FAKE6502_FN_ADDR_MODE(absx)
-{ // absolute,X
-    c->emu.ea = fake6502_mem_read16(c, c->cpu.pc);
-    c->emu.ea += (uint16_t)c->cpu.x;
+// the instruction trace, see FAKE6502_TRACE
 
-    c->cpu.pc += 2;
+void fake6502_trace_attach(fake6502_context *c, fake6502_trace *trace)
+{
+    if (trace)
+        trace->next = 0;
+    c->trace = trace;
 }
 
-FAKE6502_FN_ADDR_MODE(absx_p)
-{ // absolute,X with cycle penalty
-    uint16_t startpage;
-    c->emu.ea = fake6502_mem_read16(c, c->cpu.pc);
-    startpage = c->emu.ea & 0xFF00;
-    c->emu.ea += (uint16_t)c->cpu.x;
-    if (startpage != (c->emu.ea & 0xff00))
-        c->emu.clockticks++;
+// copy up to count of the latest entries into entries, oldest first,
+// returning how many were copied
 
-    c->cpu.pc += 2;
-}
+int fake6502_trace_copy(fake6502_context *c, fake6502_trace_entry *entries, int count)
+{
+    fake6502_trace *trace = c->trace;
+    uint32_t recorded;
 
-FAKE6502_FN_ADDR_MODE(absxi)
-{ // (absolute,X)
-    c->emu.ea = fake6502_mem_read16(c, c->cpu.pc);
-    c->emu.ea += (uint16_t)c->cpu.x;
-    c->emu.ea = fake6502_mem_read16(c, c->emu.ea);
+    if (!trace)
+        return(0);
 
-    c->cpu.pc += 2;
+    recorded = trace->next < FAKE6502_TRACE_SIZE ? trace->next : FAKE6502_TRACE_SIZE;
+    if ((uint32_t)count > recorded)
+        count = recorded;
+
+    for (int i = 0; i < count; i++)
+        entries[i] = trace->entries[(trace->next - count + i) & (FAKE6502_TRACE_SIZE - 1)];
+    return(count);
 }
 
-FAKE6502_FN_ADDR_MODE(absy)
-{ // absolute,Y
-    c->emu.ea = fake6502_mem_read16(c, c->cpu.pc);
-    c->emu.ea += (uint16_t)c->cpu.y;
+// write the trace out, oldest first, one instruction a line
 
-    c->cpu.pc += 2;
-}
+void fake6502_trace_dump(fake6502_context *c, FILE *out)
+{
+    fake6502_trace *trace = c->trace;
+    uint32_t recorded;
 
-FAKE6502_FN_ADDR_MODE(absy_p)
-{ // absolute,Y
-    uint16_t startpage;
-    c->emu.ea = fake6502_mem_read16(c, c->cpu.pc);
-    startpage = c->emu.ea & 0xFF00;
-    c->emu.ea += (uint16_t)c->cpu.y;
-    if (startpage != (c->emu.ea & 0xff00))
-        c->emu.clockticks++;
+    if (!trace)
+        return;
+
+    recorded = trace->next < FAKE6502_TRACE_SIZE ? trace->next : FAKE6502_TRACE_SIZE;
+    fprintf(out, "   cycle   pc  op   ea  a  x  y  s  p\n");
+    for (uint32_t i = trace->next - recorded; i != trace->next; i++)
+    {
+        fake6502_trace_entry *e = &trace->entries[i & (FAKE6502_TRACE_SIZE - 1)];
 
-    c->cpu.pc += 2;
+        fprintf(out, "%8u %04x  %02x %04x %02x %02x %02x %02x %02x\n", (unsigned)e->clockticks,
+                e->pc, e->opcode, e->ea, e->a, e->x, e->y, e->s, e->flags);
+    }
 }
 
-#ifdef NMOS6502
-FAKE6502_FN_ADDR_MODE(ind)
-{ // indirect
-    uint16_t eahelp, eahelp2;
-    eahelp = fake6502_mem_read16(c, c->cpu.pc);
 
-    // replicate 6502 page-boundary wraparound bug
-    eahelp2 =
-        (eahelp & 0xFF00) | ((eahelp + 1) & 0x00FF);
-    c->emu.ea =
-        (uint16_t)fake6502_mem_read(c, eahelp) | ((uint16_t)fake6502_mem_read(c, eahelp2) << 8);
-    c->cpu.pc += 2;
-}
-#endif
+// -------------------------------------------------------------------
 
-#ifdef CMOS6502
-FAKE6502_FN_ADDR_MODE(ind)
-{ // indirect
-    uint16_t eahelp;
-    eahelp = fake6502_mem_read16(c, c->cpu.pc);
-    if ((eahelp & 0x00ff) == 0xff)
-        c->emu.clockticks++;
-    c->emu.ea = fake6502_mem_read16(c, eahelp);
-    c->cpu.pc += 2;
-}
+// the decoded instruction cache, see fake6502_execute_cached()
+
+void fake6502_cache_flush(fake6502_context *c)
+{
+    fake6502_cache *cache = c->cache;
+
+#ifdef FAKE6502_JIT_X86_64
+    // the JIT relies on the cache to see writes to its code
+    if (c->jit)
+    {
+        fake6502_jit_flush(c->jit);
+        c->emu.code_written = 1;
+    }
 #endif
 
-FAKE6502_FN_ADDR_MODE(indx)
-{ // (indirect,X)
-    uint16_t eahelp;
+    if (!cache)
+        return;
 
-    // do zero-page wraparound, for table pointer
-    eahelp = (uint16_t)(((uint16_t)fake6502_mem_read(c, c->cpu.pc++) + (uint16_t)c->cpu.x) &
-                        0xFF);
-    c->emu.ea = (uint16_t)fake6502_mem_read(c, eahelp & 0x00FF) |
-            ((uint16_t)fake6502_mem_read(c, (eahelp + 1) & 0x00FF) << 8);
+    for (int page = 0; page < 256; page++)
+    {
+        if (!cache->code[page])
+            continue;
+
+        memset(&cache->entries[page << 8], 0, 256 * sizeof(fake6502_decoded));
+        c->bus.write_pages[page] = cache->held_write[page];
+        cache->held_write[page] = NULL;
+        cache->code[page] = 0;
+    }
 }
 
-FAKE6502_FN_ADDR_MODE(indy)
-{ // (indirect),Y
-    uint16_t eahelp, eahelp2;
-    eahelp = (uint16_t)fake6502_mem_read(c, c->cpu.pc++);
+void fake6502_cache_attach(fake6502_context *c, fake6502_cache *cache)
+{
+    fake6502_cache_flush(c);
 
-    // do zero-page wraparound
-    eahelp2 =
-        (eahelp & 0xFF00) | ((eahelp + 1) & 0x00FF);
-    c->emu.ea =
-        (uint16_t)fake6502_mem_read(c, eahelp) | ((uint16_t)fake6502_mem_read(c, eahelp2) << 8);
-    c->emu.ea += (uint16_t)c->cpu.y;
+    if (cache)
+    {
+        memset(cache, 0, sizeof(*cache));
+        cache->variant = c->variant;
+    }
+    c->cache = cache;
 }
 
-FAKE6502_FN_ADDR_MODE(indy_p)
-{ // (indirect),Y
-    uint16_t eahelp, eahelp2, startpage;
-    eahelp = (uint16_t)fake6502_mem_read(c, c->cpu.pc++);
+// an instruction is up to 3 bytes long, so a write can hit one that
+// starts up to 2 bytes before it
 
-    // do zero-page wraparound
-    eahelp2 =
-        (eahelp & 0xFF00) | ((eahelp + 1) & 0x00FF);
-    c->emu.ea =
-        (uint16_t)fake6502_mem_read(c, eahelp) | ((uint16_t)fake6502_mem_read(c, eahelp2) << 8);
-    startpage = c->emu.ea & 0xFF00;
-    c->emu.ea += (uint16_t)c->cpu.y;
-    if (startpage != (c->emu.ea & 0xff00))
-        c->emu.clockticks++;
-}
+void fake6502_cache_invalidate(fake6502_context *c, uint16_t address, int count)
+{
+    if (!c->cache)
+        return;
 
-FAKE6502_FN_ADDR_MODE(zpi)
-{ // (zp)
-    uint16_t eahelp, eahelp2;
-    eahelp = (uint16_t)fake6502_mem_read(c, c->cpu.pc++);
+    for (int i = -2; i < count; i++)
+        c->cache->entries[(uint16_t)(address + i)].length = 0;
 
-    // do zero-page wraparound
-    eahelp2 =
-        (eahelp & 0xFF00) | ((eahelp + 1) & 0x00FF);
-    c->emu.ea =
-        (uint16_t)fake6502_mem_read(c, eahelp) | ((uint16_t)fake6502_mem_read(c, eahelp2) << 8);
+#ifdef FAKE6502_JIT_X86_64
+    // a running JIT block checks this after every instruction, so only
+    // stop it if the write hit translated code
+    if (c->jit && fake6502_jit_invalidate(c->jit, address - 2, address + count - 1))
+        c->emu.code_written = 1;
+#endif
 }
 
+#ifndef FAKE6502_BUS_FLAT
 
-// -------------------------------------------------------------------
+static void fake6502_page_write(fake6502_context *c, uint16_t address, uint8_t val);
 
-// supporting instruction handler functions
+// write to a page holding cached code
 
-uint16_t fake6502_get_value(fake6502_context *c)
+static void fake6502_cache_write(fake6502_context *c, uint16_t address, uint8_t val)
 {
-    if (fake6502_opcodes[c->emu.opcode].addr_mode == acc)
-        return((uint16_t)c->cpu.a);
-    else
-        return((uint16_t)fake6502_mem_read(c, c->emu.ea));
-}
+    uint8_t *page = c->cache->held_write[address >> 8];
 
-void fake6502_put_value(fake6502_context *c, uint16_t saveval)
-{
-    if (fake6502_opcodes[c->emu.opcode].addr_mode == acc)
-        c->cpu.a = (uint8_t)(saveval & 0x00FF);
+    fake6502_cache_invalidate(c, address, 1);
+    if (page)
+        page[address & 0xFF] = val;
+    else if (c->bus.pages[address >> 8])
+        fake6502_page_write(c, address, val);
     else
-        fake6502_mem_write(c, c->emu.ea, (saveval & 0x00FF));
+        c->bus.write(c, address, val);
 }
 
-uint8_t add8(fake6502_context *c, uint16_t a, uint16_t b, bool carry)
+static void fake6502_cache_protect(fake6502_context *c, uint8_t page)
 {
-    uint16_t result = a + b + (uint16_t)(carry ? 1 : 0);
+    fake6502_cache *cache = c->cache;
 
-    fake6502_zero_calc(c, result);
-    fake6502_overflow_calc(c, result, a, b);
-    fake6502_sign_calc(c, result);
+    if (cache->code[page])
+        return;
 
-    #ifdef DECIMALMODE
-    // Apply decimal mode fix from http://forum.6502.org/viewtopic.php?p=37758#p37758
-    if(c->cpu.flags & FAKE6502_DECIMAL_FLAG)
-        result += ((((result + 0x66) ^ (uint16_t)a ^ b) >> 3) & 0x22) * 3;
-    #endif
+    cache->code[page] = 1;
+    cache->held_write[page] = c->bus.write_pages[page];
+    c->bus.write_pages[page] = NULL;
+}
 
-    fake6502_carry_calc(c, result);
+#endif
 
-    return(result);
 
-}
+// -------------------------------------------------------------------
 
-uint8_t rotate_right(fake6502_context *c, uint16_t value)
+// the bus, see also FAKE6502_BUS_FLAT in fake6502.h
+
+#ifndef FAKE6502_BUS_FLAT
+uint8_t fake6502_mem_read(fake6502_context *c, uint16_t address)
 {
-    uint16_t result = (value >> 1) | ((c->cpu.flags & FAKE6502_CARRY_FLAG) << 7);
+    uint8_t *page = c->bus.read_pages[address >> 8];
+#ifdef FAKE6502_BREAKPOINTS
+    uint8_t val = page ? page[address & 0xFF] : c->bus.read(c, address);
 
-    if (value & 1)
-        fake6502_carry_set(c);
-    else
-        fake6502_carry_clear(c);
-    fake6502_zero_calc(c, result);
-    fake6502_sign_calc(c, result);
+    fake6502_watch(c, FAKE6502_BREAK_READ, address, val);
+    return(val);
+#else
 
-    return(result);
+    if (page)
+        return(page[address & 0xFF]);
+    return(c->bus.read(c, address));
+#endif
 }
 
-uint8_t rotate_left(fake6502_context *c, uint16_t value)
+void fake6502_mem_write(fake6502_context *c, uint16_t address, uint8_t val)
 {
-    uint16_t result = (value << 1) | (c->cpu.flags & FAKE6502_CARRY_FLAG);
+    uint8_t *page = c->bus.write_pages[address >> 8];
+
+    fake6502_watch(c, FAKE6502_BREAK_WRITE, address, val);
+    if (page)
+        page[address & 0xFF] = val;
+    else if (c->cache && c->cache->code[address >> 8])
+        fake6502_cache_write(c, address, val);
+    else if (c->bus.pages[address >> 8])
+        fake6502_page_write(c, address, val);
+    else
+        c->bus.write(c, address, val);
+}
 
-    fake6502_carry_calc(c, result);
-    fake6502_zero_calc(c, result);
-    fake6502_sign_calc(c, result);
+// -------------------------------------------------------------------
 
-    return(result);
-}
+// memory mapped devices, see fake6502_devices_attach(); these stand in
+// for the host's memory accessing functions, so pages of memory in the
+// page table never get here
 
-uint8_t logical_shift_right(fake6502_context *c, uint8_t value)
+// the device at address, or NULL
+
+static inline fake6502_device *fake6502_device_at(fake6502_devices *d, uint16_t address)
 {
-    uint16_t result = value >> 1;
-    if (value & 1)
-        fake6502_carry_set(c);
-    else
-        fake6502_carry_clear(c);
-    fake6502_zero_calc(c, result);
-    fake6502_sign_calc(c, result);
+    uint8_t n = d->pages[address >> 8];
 
-    return(result);
+    if (n & FAKE6502_DEVICE_SPLIT)
+        n = d->fine[n & ~FAKE6502_DEVICE_SPLIT][address & 0xFF];
+    return(n ? &d->devices[n - 1] : NULL);
 }
 
-uint8_t arithmetic_shift_left(fake6502_context *c, uint8_t value)
+static uint8_t fake6502_devices_read(fake6502_context *c, uint16_t address)
 {
-    uint16_t result = value << 1;
-
-    fake6502_carry_calc(c, result);
-    fake6502_zero_calc(c, result);
-    fake6502_sign_calc(c, result);
-    return(result);
+    fake6502_devices *d = c->devices;
+    fake6502_device *device = fake6502_device_at(d, address);
+    uint8_t *page = d->read_pages[address >> 8];
+
+    if (device && device->read)
+        return(device->read(c, device->state, address));
+    if (page)
+        return(page[address & 0xFF]);
+    return(d->read(c, address));
 }
 
-uint8_t exclusive_or(fake6502_context *c, uint8_t a, uint8_t b)
+static void fake6502_devices_write(fake6502_context *c, uint16_t address, uint8_t val)
 {
-    uint16_t result = a ^ b;
+    fake6502_devices *d = c->devices;
+    fake6502_device *device = fake6502_device_at(d, address);
+    uint8_t *page = d->write_pages[address >> 8];
+
+    if (device && device->write)
+        device->write(c, device->state, address, val);
+    else if (page)
+        page[address & 0xFF] = val;
+    else
+        d->write(c, address, val);
+}
+
+// the devices take over the memory accessing functions, and call the
+// host's for addresses they do not cover; NULL gives them back, along
+// with the memory mapped in the pages the devices took
+
+void fake6502_devices_attach(fake6502_context *c, fake6502_devices *devices)
+{
+    fake6502_devices *d = c->devices;
+
+    if (d)
+    {
+        c->bus.read = d->read;
+        c->bus.write = d->write;
+        for (int page = 0; page < 256; page++)
+            if (d->pages[page])
+                fake6502_pages_map(c, page, 1, d->read_pages[page], d->write_pages[page]);
+    }
+
+    c->devices = devices;
+    if (!devices)
+        return;
+
+    memset(devices, 0, sizeof(*devices));
+    devices->read = c->bus.read;
+    devices->write = c->bus.write;
+    c->bus.read = fake6502_devices_read;
+    c->bus.write = fake6502_devices_write;
+}
+
+// give the addresses from first to last to a device, over any device
+// added before; the pages are taken out of the page table, and whatever
+// memory was mapped there stays under the addresses no device covers.
+// False if there are no devices attached, no room for the device or
+// another split page, or the range has pages from fake6502_pages_alloc()
+
+bool fake6502_device_add(fake6502_context *c, uint16_t first, uint16_t last,
+                         fake6502_device_read_fn read, fake6502_device_write_fn write,
+                         void *state)
+{
+    fake6502_devices *d = c->devices;
+    uint8_t n;
+
+    if (!d || d->count == FAKE6502_DEVICES_MAX || first > last)
+        return(false);
+
+    // every partly covered page not split yet needs a table; the
+    // context's own pages would be freed when taken out of the page table
+    for (int page = first >> 8, split = 0; page <= last >> 8; page++)
+    {
+        bool whole = (page << 8) >= first && (page << 8 | 0xFF) <= last;
+
+        if (c->bus.pages[page])
+            return(false);
+        if (!whole && !(d->pages[page] & FAKE6502_DEVICE_SPLIT) &&
+            d->fine_count + ++split > FAKE6502_DEVICES_FINE)
+            return(false);
+    }
+
+    // so the write pointers of pages holding cached code are back in the
+    // page table
+    fake6502_cache_flush(c);
+
+    d->devices[d->count] = (fake6502_device){first, last, read, write, state};
+    n = ++d->count;
+
+    for (int page = first >> 8; page <= last >> 8; page++)
+    {
+        int from = page == first >> 8 ? first & 0xFF : 0;
+        int to = page == last >> 8 ? last & 0xFF : 0xFF;
+
+        if (!d->pages[page])
+        {
+            d->read_pages[page] = c->bus.read_pages[page];
+            d->write_pages[page] = c->bus.write_pages[page];
+            fake6502_pages_map(c, page, 1, NULL, NULL);
+        }
+
+        if (from == 0 && to == 0xFF)
+            d->pages[page] = n;
+        else
+        {
+            if (!(d->pages[page] & FAKE6502_DEVICE_SPLIT))
+            {
+                memset(d->fine[d->fine_count], d->pages[page], 256);
+                d->pages[page] = FAKE6502_DEVICE_SPLIT | d->fine_count++;
+            }
+            memset(&d->fine[d->pages[page] & ~FAKE6502_DEVICE_SPLIT][from], n, to - from + 1);
+        }
+    }
+
+    return(true);
+}
+
+
+// -------------------------------------------------------------------
+
+// copy-on-write pages, shared between a context and its forks; refs is
+// atomic as forks may run on different threads
+
+struct fake6502_page {
+    uint8_t data[256];
+    atomic_int refs;
+};
+
+// stands in for pages read straight from a save state, which are never
+// written to or freed; the first write copies from read_pages[]
+
+static fake6502_page fake6502_image_page;
+
+static void fake6502_page_share(fake6502_page *page)
+{
+    if (page && page != &fake6502_image_page)
+        atomic_fetch_add(&page->refs, 1);
+}
+
+static void fake6502_page_release(fake6502_page *page)
+{
+    if (page && page != &fake6502_image_page && atomic_fetch_sub(&page->refs, 1) == 1)
+        free(page);
+}
+
+// where the write pointer for a page lives, in the cache while it holds
+// cached code there
+
+static uint8_t **fake6502_page_writes(fake6502_context *c, uint8_t page)
+{
+    if (c->cache && c->cache->code[page])
+        return(&c->cache->held_write[page]);
+    return(&c->bus.write_pages[page]);
+}
+
+// the first write to a shared page copies it
+
+static void fake6502_page_write(fake6502_context *c, uint16_t address, uint8_t val)
+{
+    fake6502_page *page = c->bus.pages[address >> 8];
+
+    if (page == &fake6502_image_page || atomic_load(&page->refs) > 1)
+    {
+        fake6502_page *copy = malloc(sizeof(fake6502_page));
+
+        if (!copy)
+        {
+            c->emu.stop = FAKE6502_STOP_FAULT;
+            return;
+        }
+
+        memcpy(copy->data, c->bus.read_pages[address >> 8], 256);
+        atomic_init(&copy->refs, 1);
+        fake6502_page_release(page);
+        c->bus.pages[address >> 8] = page = copy;
+        c->bus.read_pages[address >> 8] = copy->data;
+    }
+
+    *fake6502_page_writes(c, address >> 8) = page->data;
+    page->data[address & 0xFF] = val;
+}
+
+// the context's own zeroed RAM for count pages from page, which forks
+// share until written to; false if out of memory
+
+bool fake6502_pages_alloc(fake6502_context *c, uint8_t page, int count)
+{
+    fake6502_cache_flush(c);
+
+    for (int i = 0; i < count && page + i < 256; i++)
+    {
+        fake6502_page *own = calloc(1, sizeof(fake6502_page));
+
+        if (!own)
+            return(false);
+
+        atomic_init(&own->refs, 1);
+        fake6502_page_release(c->bus.pages[page + i]);
+        c->bus.pages[page + i] = own;
+        c->bus.read_pages[page + i] = c->bus.write_pages[page + i] = own->data;
+    }
+
+    return(true);
+}
+
+// give up the context's own pages, before it is thrown away
+
+void fake6502_pages_release(fake6502_context *c)
+{
+    fake6502_cache_flush(c);
+
+    for (int page = 0; page < 256; page++)
+    {
+        if (!c->bus.pages[page])
+            continue;
+
+        fake6502_page_release(c->bus.pages[page]);
+        c->bus.pages[page] = NULL;
+        c->bus.read_pages[page] = c->bus.write_pages[page] = NULL;
+    }
+}
+
+// the child becomes a copy of the parent, sharing its own pages until
+// either writes to them; the child has no cache, JIT, trace, counters,
+// profile, events, breakpoints or idle detection attached, and shares
+// the parent's devices as it does the memory accessing functions.
+// Keeping a fork that is not run gives a snapshot to restore later
+
+void fake6502_fork(fake6502_context *parent, fake6502_context *child)
+{
+    *child = *parent;
+    child->cache = NULL;
+    child->jit = NULL;
+    child->trace = NULL;
+    child->counters = NULL;
+    child->profile = NULL;
+    child->events = NULL;
+    child->breakpoints = NULL;
+    child->idle = NULL;
+
+    for (int page = 0; page < 256; page++)
+    {
+        child->bus.write_pages[page] = *fake6502_page_writes(parent, page);
+
+        if (parent->bus.pages[page])
+        {
+            fake6502_page_share(parent->bus.pages[page]);
+            *fake6502_page_writes(parent, page) = NULL;
+            child->bus.write_pages[page] = NULL;
+        }
+    }
+}
+
+// put the context back to a snapshot taken with fake6502_fork(); only the
+// pages written since, or mapped differently, are touched. The context
+// keeps its own cache, JIT and engine
+
+void fake6502_restore(fake6502_context *c, fake6502_context *snapshot)
+{
+    for (int page = 0; page < 256; page++)
+    {
+        fake6502_page *shared = snapshot->bus.pages[page];
+        uint8_t *writes = shared ? NULL : snapshot->bus.write_pages[page];
+
+        // a page the context still shares with the snapshot is unchanged
+        if (shared == c->bus.pages[page] &&
+            c->bus.read_pages[page] == snapshot->bus.read_pages[page] &&
+            *fake6502_page_writes(c, page) == writes)
+            continue;
+
+        fake6502_page_share(shared);
+        fake6502_page_release(c->bus.pages[page]);
+        c->bus.pages[page] = shared;
+        c->bus.read_pages[page] = snapshot->bus.read_pages[page];
+        *fake6502_page_writes(c, page) = writes;
+        fake6502_cache_invalidate(c, page << 8, 256);
+    }
+
+    c->cpu = snapshot->cpu;
+    c->emu = snapshot->emu;
+}
+#endif
+
+void fake6502_pages_map(fake6502_context *c, uint8_t page, int count,
+                        uint8_t *read, uint8_t *write)
+{
+    // cached code may no longer be what is mapped
+    fake6502_cache_flush(c);
+
+    for (int i = 0; i < count && page + i < 256; i++)
+    {
+#ifndef FAKE6502_BUS_FLAT
+        fake6502_page_release(c->bus.pages[page + i]);
+        c->bus.pages[page + i] = NULL;
+#endif
+        c->bus.read_pages[page + i] = read ? read + i * 256 : NULL;
+        c->bus.write_pages[page + i] = write ? write + i * 256 : NULL;
+    }
+}
+
+
+// -------------------------------------------------------------------
+
+// save states; every field is little endian, whatever the host is:
+//
+//     0   8  "FAKE6502"
+//     8   2  version, FAKE6502_SAVE_VERSION
+//    10   2  the number of pages saved
+//    12   4  where the page data starts, FAKE6502_SAVE_HEADER
+//    16   1  variant
+//    17   5  a, x, y, s, flags
+//    22   2  pc
+//    24   4  instructions
+//    28   4  clockticks
+//    32   2  ea
+//    34   1  opcode
+//    64 512  for each page, 0 if it is not saved, else 1 + its place in
+//            the page data, with FAKE6502_SAVE_WRITABLE set if it was
+//            written to memory rather than a callback
+//
+// and then 256 bytes for each page saved. Every page that reads from
+// memory rather than a callback is saved (all of them under
+// FAKE6502_BUS_FLAT); reading them has no side effects.
+
+static const char fake6502_save_magic[8] = {'F', 'A', 'K', 'E', '6', '5', '0', '2'};
+
+static inline void save_put16(uint8_t *p, uint16_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static inline void save_put32(uint8_t *p, uint32_t v)
+{
+    save_put16(p, v);
+    save_put16(p + 2, v >> 16);
+}
+
+static inline uint16_t save_get16(const uint8_t *p)
+{ return(p[0] | (uint16_t)p[1] << 8); }
+
+static inline uint32_t save_get32(const uint8_t *p)
+{ return(save_get16(p) | (uint32_t)save_get16(p + 2) << 16); }
+
+static inline uint8_t *save_page(fake6502_context *c, int page)
+{
+#ifdef FAKE6502_BUS_FLAT
+    return(c->bus.memory + page * 256);
+#else
+    return(c->bus.read_pages[page]);
+#endif
+}
+
+static inline bool save_writable(fake6502_context *c, int page)
+{
+#ifdef FAKE6502_BUS_FLAT
+    (void)c;
+    (void)page;
+    return(true);
+#else
+    return(c->bus.pages[page] || *fake6502_page_writes(c, page));
+#endif
+}
+
+// the size of the save state for the context as it is mapped now
+
+size_t fake6502_save_size(fake6502_context *c)
+{
+    size_t size = FAKE6502_SAVE_HEADER;
+
+    for (int page = 0; page < 256; page++)
+        if (save_page(c, page))
+            size += 256;
+    return(size);
+}
+
+// write the save state into image, returning its size, or 0 if it does
+// not fit
+
+size_t fake6502_save(fake6502_context *c, uint8_t *image, size_t size)
+{
+    int pages = 0;
+
+    if (size < fake6502_save_size(c))
+        return(0);
+
+    memset(image, 0, FAKE6502_SAVE_HEADER);
+    memcpy(image, fake6502_save_magic, sizeof(fake6502_save_magic));
+    save_put16(image + 8, FAKE6502_SAVE_VERSION);
+    save_put32(image + 12, FAKE6502_SAVE_HEADER);
+    image[16] = c->variant;
+    image[17] = c->cpu.a;
+    image[18] = c->cpu.x;
+    image[19] = c->cpu.y;
+    image[20] = c->cpu.s;
+    image[21] = c->cpu.flags;
+    save_put16(image + 22, c->cpu.pc);
+    save_put32(image + 24, c->emu.instructions);
+    save_put32(image + 28, c->emu.clockticks);
+    save_put16(image + 32, c->emu.ea);
+    image[34] = c->emu.opcode;
+
+    for (int page = 0; page < 256; page++)
+    {
+        if (!save_page(c, page))
+            continue;
+
+        memcpy(image + FAKE6502_SAVE_HEADER + pages * 256, save_page(c, page), 256);
+        save_put16(image + 64 + page * 2,
+                   ++pages | (save_writable(c, page) ? FAKE6502_SAVE_WRITABLE : 0));
+    }
+    save_put16(image + 10, pages);
+
+    return(FAKE6502_SAVE_HEADER + pages * 256);
+}
+
+// set the context from a save state, which may be mmap'd read-only: its
+// pages are mapped straight into the context, and copied only when
+// written to, so it must outlive the context. Pages that were read-only
+// when saved stay so, with writes going to the memory writing function.
+// Pages it does not hold, and pages attached devices have taken, are
+// left as they are mapped. Under FAKE6502_BUS_FLAT the pages are copied
+// into `c->bus.memory`. False if the image is not a save state this
+// version can read
+
+bool fake6502_load(fake6502_context *c, const uint8_t *image, size_t size)
+{
+    uint32_t data;
+    int pages;
+
+    if (size < FAKE6502_SAVE_HEADER ||
+        memcmp(image, fake6502_save_magic, sizeof(fake6502_save_magic)) ||
+        save_get16(image + 8) != FAKE6502_SAVE_VERSION || image[16] > FAKE6502_VARIANT_2A03)
+        return(false);
+
+    pages = save_get16(image + 10);
+    data = save_get32(image + 12);
+    if (data < 64 + 512 || data > size || (size - data) / 256 < (size_t)pages)
+        return(false);
+    for (int page = 0; page < 256; page++)
+        if ((save_get16(image + 64 + page * 2) & ~FAKE6502_SAVE_WRITABLE) > pages)
+            return(false);
+
+    fake6502_cache_flush(c);
+
+    for (int page = 0; page < 256; page++)
+    {
+        int entry = save_get16(image + 64 + page * 2);
+        int index = entry & ~FAKE6502_SAVE_WRITABLE;
+        const uint8_t *saved = image + data + (index - 1) * 256;
+
+        if (!index)
+            continue;
+
+#ifdef FAKE6502_BUS_FLAT
+        memcpy(c->bus.memory + page * 256, saved, 256);
+#else
+        if (c->devices && c->devices->pages[page])
+            continue;
+
+        fake6502_page_release(c->bus.pages[page]);
+        c->bus.pages[page] = entry & FAKE6502_SAVE_WRITABLE ? &fake6502_image_page : NULL;
+        c->bus.read_pages[page] = (uint8_t *)saved;
+        c->bus.write_pages[page] = NULL;
+#endif
+    }
+
+    c->variant = image[16];
+    c->cpu.a = image[17];
+    c->cpu.x = image[18];
+    c->cpu.y = image[19];
+    c->cpu.s = image[20];
+    c->cpu.flags = image[21];
+    c->cpu.pc = save_get16(image + 22);
+    c->emu.instructions = save_get32(image + 24);
+    c->emu.clockticks = save_get32(image + 28);
+    c->emu.ea = save_get16(image + 32);
+    c->emu.opcode = image[34];
+    c->emu.stop = FAKE6502_STOP_NONE;
+
+    return(true);
+}
+
+
+// -------------------------------------------------------------------
+
+// a few general functions used by various other functions
+
+void fake6502_push_8(fake6502_context *c, uint8_t pushval)
+{
+    fake6502_mem_write(c, FAKE6502_STACK_BASE + c->cpu.s--, pushval);
+}
+
+void fake6502_push_16(fake6502_context *c, uint16_t pushval)
+{
+    fake6502_push_8(c, (pushval >> 8) & 0xFF);
+    fake6502_push_8(c, pushval & 0xFF);
+}
+
+uint8_t fake6502_pull_8(fake6502_context *c)
+{ return(fake6502_mem_read(c, FAKE6502_STACK_BASE + ++c->cpu.s)); }
+
+uint16_t fake6502_pull_16(fake6502_context *c)
+{
+    uint8_t t;
+    t = fake6502_pull_8(c);
+    return(fake6502_pull_8(c) << 8 | t);
+}
+
+uint16_t fake6502_mem_read16(fake6502_context *c, uint16_t addr)
+{
+#ifndef FAKE6502_BUS_FLAT
+    uint8_t *page = c->bus.read_pages[addr >> 8];
+
+#ifdef FAKE6502_BREAKPOINTS
+    // each byte has to go past the watchpoints
+    if (c->breakpoints)
+        page = NULL;
+#endif
+
+    // both bytes are in the same mapped page
+    if (page && (addr & 0xFF) != 0xFF)
+        return((uint16_t)page[addr & 0xFF] | ((uint16_t)page[(addr & 0xFF) + 1] << 8));
+#endif
+
+    // Read two consecutive bytes from memory
+    return((uint16_t)fake6502_mem_read(c, addr) |
+           ((uint16_t)fake6502_mem_read(c, addr + 1) << 8));
+}
+
+
+// -------------------------------------------------------------------
+
+// supporting addressing mode functions,
+// calculates effective addresses (ea)
+
+// each mode is first given its operand, once the pc has moved past the
+// instruction; the fetching forms further down read the operand and call
+// these, and the cache engine calls them with operands it decoded earlier
+
+#define FAKE6502_FN_ADDR_PRE(m_name)    \
+  static inline void m_name##_pre(fake6502_context *c, uint16_t operand)
+
+FAKE6502_FN_ADDR_PRE(imp)
+{ // implied
+    (void)c;
+    (void)operand;
+}
+
+FAKE6502_FN_ADDR_PRE(acc)
+{ // accumulator
+    (void)c;
+    (void)operand;
+}
+
+FAKE6502_FN_ADDR_PRE(imm)
+{ // immediate, the operand is the address of the byte after the opcode
+    c->emu.ea = operand;
+}
+
+FAKE6502_FN_ADDR_PRE(zp)
+{ // zero-page
+    c->emu.ea = operand;
+}
+
+FAKE6502_FN_ADDR_PRE(zpx)
+{ // zero-page,X
+    // do zero-page wraparound
+    c->emu.ea = (operand + (uint16_t)c->cpu.x) & 0xFF;
+}
+
+FAKE6502_FN_ADDR_PRE(zpy)
+{ // zero-page,Y
+    // do zero-page wraparound
+    c->emu.ea = (operand + (uint16_t)c->cpu.y) & 0xFF;
+}
+
+FAKE6502_FN_ADDR_PRE(rel)
+{ // relative for branch ops (8-bit immediate value, sign-extended)
+    uint16_t rel = operand;
+    if (rel & 0x80)
+        rel |= 0xFF00;
+    c->emu.ea = c->cpu.pc + rel;
+}
+
+FAKE6502_FN_ADDR_PRE(abso)
+{ // absolute
+    c->emu.ea = operand;
+}
+
+FAKE6502_FN_ADDR_PRE(absx)
+{ // absolute,X
+    c->emu.ea = operand + (uint16_t)c->cpu.x;
+}
+
+FAKE6502_FN_ADDR_PRE(absx_p)
+{ // absolute,X with cycle penalty
+    c->emu.ea = operand + (uint16_t)c->cpu.x;
+    if ((operand & 0xFF00) != (c->emu.ea & 0xff00))
+        c->emu.clockticks++;
+}
+
+FAKE6502_FN_ADDR_PRE(absxi)
+{ // (absolute,X)
+    c->emu.ea = fake6502_mem_read16(c, operand + (uint16_t)c->cpu.x);
+}
+
+FAKE6502_FN_ADDR_PRE(absy)
+{ // absolute,Y
+    c->emu.ea = operand + (uint16_t)c->cpu.y;
+}
+
+FAKE6502_FN_ADDR_PRE(absy_p)
+{ // absolute,Y with cycle penalty
+    c->emu.ea = operand + (uint16_t)c->cpu.y;
+    if ((operand & 0xFF00) != (c->emu.ea & 0xff00))
+        c->emu.clockticks++;
+}
+
+FAKE6502_FN_ADDR_PRE(ind_nmos)
+{ // indirect
+    uint16_t eahelp2;
+
+    // replicate 6502 page-boundary wraparound bug
+    eahelp2 =
+        (operand & 0xFF00) | ((operand + 1) & 0x00FF);
+    c->emu.ea =
+        (uint16_t)fake6502_mem_read(c, operand) | ((uint16_t)fake6502_mem_read(c, eahelp2) << 8);
+}
+
+FAKE6502_FN_ADDR_PRE(ind_cmos)
+{ // indirect, without the page-boundary bug
+    if ((operand & 0x00ff) == 0xff)
+        c->emu.clockticks++;
+    c->emu.ea = fake6502_mem_read16(c, operand);
+}
+
+FAKE6502_FN_ADDR_PRE(indx)
+{ // (indirect,X)
+    uint16_t eahelp;
+
+    // do zero-page wraparound, for table pointer
+    eahelp = (uint16_t)((operand + (uint16_t)c->cpu.x) & 0xFF);
+    c->emu.ea = (uint16_t)fake6502_mem_read(c, eahelp & 0x00FF) |
+            ((uint16_t)fake6502_mem_read(c, (eahelp + 1) & 0x00FF) << 8);
+}
+
+FAKE6502_FN_ADDR_PRE(zpi)
+{ // (zp)
+    // do zero-page wraparound
+    c->emu.ea = (uint16_t)fake6502_mem_read(c, operand) |
+            ((uint16_t)fake6502_mem_read(c, (operand + 1) & 0x00FF) << 8);
+}
+
+FAKE6502_FN_ADDR_PRE(indy)
+{ // (indirect),Y
+    zpi_pre(c, operand);
+    c->emu.ea += (uint16_t)c->cpu.y;
+}
+
+FAKE6502_FN_ADDR_PRE(indy_p)
+{ // (indirect),Y with cycle penalty
+    uint16_t startpage;
+
+    zpi_pre(c, operand);
+    startpage = c->emu.ea & 0xFF00;
+    c->emu.ea += (uint16_t)c->cpu.y;
+    if (startpage != (c->emu.ea & 0xff00))
+        c->emu.clockticks++;
+}
+
+
+// the fetching forms, for modes with no operand, an operand byte or an
+// operand word; immediate passes on the address of its operand instead
+
+#define FAKE6502_ADDR_MODE_NONE(m_name)                       \
+    FAKE6502_FN_ADDR_MODE(m_name)                             \
+    { m_name##_pre(c, 0); }
+
+#define FAKE6502_ADDR_MODE_BYTE(m_name)                       \
+    FAKE6502_FN_ADDR_MODE(m_name)                             \
+    {                                                         \
+        uint16_t operand = fake6502_mem_read(c, c->cpu.pc++); \
+        m_name##_pre(c, operand);                             \
+    }
+
+#define FAKE6502_ADDR_MODE_WORD(m_name)                       \
+    FAKE6502_FN_ADDR_MODE(m_name)                             \
+    {                                                         \
+        uint16_t operand = fake6502_mem_read16(c, c->cpu.pc); \
+        c->cpu.pc += 2;                                       \
+        m_name##_pre(c, operand);                             \
+    }
+
+FAKE6502_ADDR_MODE_NONE(imp)
+FAKE6502_ADDR_MODE_NONE(acc)
+
+FAKE6502_FN_ADDR_MODE(imm)
+{ imm_pre(c, c->cpu.pc++); }
+
+FAKE6502_ADDR_MODE_BYTE(zp)
+FAKE6502_ADDR_MODE_BYTE(zpx)
+FAKE6502_ADDR_MODE_BYTE(zpy)
+FAKE6502_ADDR_MODE_BYTE(rel)
+FAKE6502_ADDR_MODE_WORD(abso)
+FAKE6502_ADDR_MODE_WORD(absx)
+FAKE6502_ADDR_MODE_WORD(absx_p)
+FAKE6502_ADDR_MODE_WORD(absxi)
+FAKE6502_ADDR_MODE_WORD(absy)
+FAKE6502_ADDR_MODE_WORD(absy_p)
+FAKE6502_ADDR_MODE_WORD(ind_nmos)
+FAKE6502_ADDR_MODE_WORD(ind_cmos)
+FAKE6502_ADDR_MODE_BYTE(indx)
+FAKE6502_ADDR_MODE_BYTE(indy)
+FAKE6502_ADDR_MODE_BYTE(indy_p)
+FAKE6502_ADDR_MODE_BYTE(zpi)
+
+
+// the operand each addressing mode takes, used to decode instructions
+
+#define FAKE6502_OPERAND_NONE           0
+#define FAKE6502_OPERAND_BYTE           1
+#define FAKE6502_OPERAND_WORD           2
+#define FAKE6502_OPERAND_ADDR           3
+
+#define FAKE6502_OPERAND_imp            FAKE6502_OPERAND_NONE
+#define FAKE6502_OPERAND_acc            FAKE6502_OPERAND_NONE
+#define FAKE6502_OPERAND_imm            FAKE6502_OPERAND_ADDR
+#define FAKE6502_OPERAND_zp             FAKE6502_OPERAND_BYTE
+#define FAKE6502_OPERAND_zpx            FAKE6502_OPERAND_BYTE
+#define FAKE6502_OPERAND_zpy            FAKE6502_OPERAND_BYTE
+#define FAKE6502_OPERAND_rel            FAKE6502_OPERAND_BYTE
+#define FAKE6502_OPERAND_abso           FAKE6502_OPERAND_WORD
+#define FAKE6502_OPERAND_absx           FAKE6502_OPERAND_WORD
+#define FAKE6502_OPERAND_absx_p         FAKE6502_OPERAND_WORD
+#define FAKE6502_OPERAND_absxi          FAKE6502_OPERAND_WORD
+#define FAKE6502_OPERAND_absy           FAKE6502_OPERAND_WORD
+#define FAKE6502_OPERAND_absy_p         FAKE6502_OPERAND_WORD
+#define FAKE6502_OPERAND_ind_nmos       FAKE6502_OPERAND_WORD
+#define FAKE6502_OPERAND_ind_cmos       FAKE6502_OPERAND_WORD
+#define FAKE6502_OPERAND_indx           FAKE6502_OPERAND_BYTE
+#define FAKE6502_OPERAND_indy           FAKE6502_OPERAND_BYTE
+#define FAKE6502_OPERAND_indy_p         FAKE6502_OPERAND_BYTE
+#define FAKE6502_OPERAND_zpi            FAKE6502_OPERAND_BYTE
+
+
+// -------------------------------------------------------------------
+
+// supporting instruction handler functions
+
+// the accumulator forms of the read-modify-write instructions have their
+// own handlers (asl_acc etc.), so these only ever access memory
+
+uint16_t fake6502_get_value(fake6502_context *c)
+{ return((uint16_t)fake6502_mem_read(c, c->emu.ea)); }
+
+void fake6502_put_value(fake6502_context *c, uint16_t saveval)
+{ fake6502_mem_write(c, c->emu.ea, (saveval & 0x00FF)); }
+
+// the first write of a read-modify-write instruction, of the value it
+// read, which FAKE6502_MODE_FAST leaves out
+
+static inline void fake6502_put_unchanged(fake6502_context *c, uint16_t saveval)
+{
+    if (c->mode == FAKE6502_MODE_ACCURATE)
+        fake6502_put_value(c, saveval);
+}
+
+uint8_t add8(fake6502_context *c, uint16_t a, uint16_t b, bool carry, bool decimal)
+{
+    uint16_t result = a + b + (uint16_t)(carry ? 1 : 0);
+
+    fake6502_zero_calc(c, result);
+    fake6502_overflow_calc(c, result, a, b);
+    fake6502_sign_calc(c, result);
+
+    // Apply decimal mode fix from http://forum.6502.org/viewtopic.php?p=37758#p37758
+    if (decimal)
+        result += ((((result + 0x66) ^ (uint16_t)a ^ b) >> 3) & 0x22) * 3;
+
+    fake6502_carry_calc(c, result);
+
+    return(result);
+
+}
+
+uint8_t sub8(fake6502_context *c, uint16_t a, uint16_t b, bool carry, bool decimal)
+{
+    uint16_t value = b ^ 0x00ff; // ones complement
+
+    // Apply decimal mode fix from http://forum.6502.org/viewtopic.php?p=37758#p37758
+    if (decimal)
+        value -= 0x0066; // use nines complement for BCD
+
+    return(add8(c, a, value, carry, decimal));
+}
+
+// ADC and SBC look their result and N, V, Z, C up in a table built from
+// add8()/sub8() by fake6502_init(), indexed by decimal, carry, A, operand;
+// each entry is the result in the low byte and the flags in the high byte
+
+#define FAKE6502_ARITH_SIZE             (1 << 18)
+
+static uint16_t fake6502_adc_table[FAKE6502_ARITH_SIZE];
+static uint16_t fake6502_sbc_table[FAKE6502_ARITH_SIZE];
+
+static void arith_build(void)
+{
+    fake6502_context scratch;
+
+    memset(&scratch, 0, sizeof(scratch));
+
+    for (int i = 0; i < FAKE6502_ARITH_SIZE; i++)
+    {
+        uint8_t a = i >> 8, b = i;
+        bool carry = i & 0x10000, decimal = i & 0x20000;
+        uint8_t result;
+
+        result = add8(&scratch, a, b, carry, decimal);
+        fake6502_adc_table[i] = (fake6502_flags_get(&scratch) & FAKE6502_NVZC_FLAGS) << 8 | result;
+
+        result = sub8(&scratch, a, b, carry, decimal);
+        fake6502_sbc_table[i] = (fake6502_flags_get(&scratch) & FAKE6502_NVZC_FLAGS) << 8 | result;
+    }
+}
+
+// the tables are built once, by whichever thread sets up a context or
+// batch first; any others doing so at the same time wait until it is done
+
+#ifdef FAKE6502_POOL_PTHREADS
+static pthread_once_t fake6502_arith_once = PTHREAD_ONCE_INIT;
+#else
+static atomic_int fake6502_arith_state;     // 0 not built, 1 building, 2 built
+#endif
+
+static void arith_ready(void)
+{
+#ifdef FAKE6502_POOL_PTHREADS
+    pthread_once(&fake6502_arith_once, arith_build);
+#else
+    int expected = 0;
+
+    if (atomic_load_explicit(&fake6502_arith_state, memory_order_acquire) == 2)
+        return;
+
+    if (atomic_compare_exchange_strong(&fake6502_arith_state, &expected, 1))
+    {
+        arith_build();
+        atomic_store_explicit(&fake6502_arith_state, 2, memory_order_release);
+    }
+    else
+        while (atomic_load_explicit(&fake6502_arith_state, memory_order_acquire) != 2)
+            ;
+#endif
+}
+
+// decimal is the D flag as it sits in c->cpu.flags, or 0 to ignore it
+
+static inline void arith(fake6502_context *c, const uint16_t *table, uint8_t value,
+                         unsigned decimal)
+{
+    uint16_t entry = table[(decimal << 14) | (fake6502_carry_get(c) << 16) |
+                           (c->cpu.a << 8) | value];
+
+    c->cpu.a = (uint8_t)entry;
+    fake6502_nvzc_put(c, entry >> 8);
+}
+
+uint8_t rotate_right(fake6502_context *c, uint16_t value)
+{
+    uint16_t result = (value >> 1) | (fake6502_carry_get(c) << 7);
+
+    fake6502_carry_calc(c, (value & 1) << 8);
+    fake6502_zero_calc(c, result);
+    fake6502_sign_calc(c, result);
+
+    return(result);
+}
+
+uint8_t rotate_left(fake6502_context *c, uint16_t value)
+{
+    uint16_t result = (value << 1) | fake6502_carry_get(c);
+
+    fake6502_carry_calc(c, result);
+    fake6502_zero_calc(c, result);
+    fake6502_sign_calc(c, result);
+
+    return(result);
+}
+
+uint8_t logical_shift_right(fake6502_context *c, uint8_t value)
+{
+    uint16_t result = value >> 1;
+
+    fake6502_carry_calc(c, (value & 1) << 8);
+    fake6502_zero_calc(c, result);
+    fake6502_sign_calc(c, result);
+
+    return(result);
+}
+
+uint8_t arithmetic_shift_left(fake6502_context *c, uint8_t value)
+{
+    uint16_t result = value << 1;
+
+    fake6502_carry_calc(c, result);
+    fake6502_zero_calc(c, result);
+    fake6502_sign_calc(c, result);
+    return(result);
+}
+
+uint8_t exclusive_or(fake6502_context *c, uint8_t a, uint8_t b)
+{
+    uint16_t result = a ^ b;
+
+    fake6502_zero_calc(c, result);
+    fake6502_sign_calc(c, result);
+
+    return(result);
+}
+
+uint8_t boolean_and(fake6502_context *c, uint8_t a, uint8_t b)
+{
+    uint16_t result = (uint16_t)a & b;
+
+    fake6502_zero_calc(c, result);
+    fake6502_sign_calc(c, result);
+    return(result);
+}
+
+uint8_t increment(fake6502_context *c, uint8_t r)
+{
+    uint16_t result = r + 1;
+    fake6502_zero_calc(c, result);
+    fake6502_sign_calc(c, result);
+    return(result);
+}
+
+uint8_t decrement(fake6502_context *c, uint8_t r)
+{
+    uint16_t result = r - 1;
+    fake6502_zero_calc(c, result);
+    fake6502_sign_calc(c, result);
+    return(result);
+}
+
+void compare(fake6502_context *c, uint16_t r)
+{
+    uint16_t value = fake6502_get_value(c);
+    uint16_t result = r - value;
+
+    // r + 0x100 - value carries into bit 8 exactly when r >= value
+    fake6502_carry_calc(c, r + 0x100 - value);
+    fake6502_zero_calc(c, result);
+    fake6502_sign_calc(c, result);
+}
+
+// whether the events hold an IRQ that can be taken now
+
+static inline bool fake6502_irq_due(fake6502_context *c)
+{
+    return(c->events && c->events->irq_held &&
+           !(c->cpu.flags & FAKE6502_INTERRUPT_FLAG));
+}
+
+// after an instruction that can clear I: end the run there, as if its
+// budget were used up, so fake6502_run() takes a held IRQ straight away
+
+static inline void fake6502_irq_unmasked(fake6502_context *c)
+{
+    if (fake6502_irq_due(c) && !c->emu.stop)
+        c->emu.stop = FAKE6502_STOP_BUDGET;
+}
+
+
+// -------------------------------------------------------------------
+
+// instruction handler functions
+
+FAKE6502_FN_OPCODE(adc)
+{
+    arith(c, fake6502_adc_table, fake6502_get_value(c), c->cpu.flags & FAKE6502_DECIMAL_FLAG);
+}
+
+FAKE6502_FN_OPCODE(adc_2a03)
+{
+    arith(c, fake6502_adc_table, fake6502_get_value(c), 0);
+}
+
+FAKE6502_FN_OPCODE(and)
+{
+    uint8_t m = fake6502_get_value(c);
+    fake6502_accum_save(c, boolean_and(c, c->cpu.a, m));
+}
+
+FAKE6502_FN_OPCODE(asl)
+{ fake6502_put_value(c, arithmetic_shift_left(c, fake6502_get_value(c))); }
+
+FAKE6502_FN_OPCODE(asl_acc)
+{ c->cpu.a = arithmetic_shift_left(c, c->cpu.a); }
+
+FAKE6502_FN_OPCODE(bra)
+{
+    uint16_t oldpc = c->cpu.pc;
+    c->cpu.pc = c->emu.ea;
+
+    // check if jump crossed a page boundary
+
+    if ((oldpc & 0xFF00) != (c->cpu.pc & 0xFF00))
+        c->emu.clockticks += 2;
+    else
+        c->emu.clockticks++;
+}
+
+FAKE6502_FN_OPCODE(bcc)
+{
+    if (!fake6502_carry_get(c))
+        bra(c);
+}
+
+FAKE6502_FN_OPCODE(bcs)
+{
+    if (fake6502_carry_get(c))
+        bra(c);
+}
+
+FAKE6502_FN_OPCODE(beq)
+{
+    if (fake6502_zero_get(c))
+        bra(c);
+}
+
+FAKE6502_FN_OPCODE(bit)
+{
+    uint8_t value = fake6502_get_value(c);
+    uint8_t result = (uint16_t)c->cpu.a & value;
+
+    fake6502_zero_calc(c, result);
+    fake6502_sign_calc(c, value);
+
+    // V is bit 6 of the operand
+    fake6502_overflow_calc(c, (uint16_t)(value << 1), 0, 0);
+}
+
+void bit_imm(fake6502_context *c)
+{
+    uint8_t value = fake6502_get_value(c);
+    uint8_t result = (uint16_t)c->cpu.a & value;
+
+    fake6502_zero_calc(c, result);
+}
+
+FAKE6502_FN_OPCODE(bmi)
+{
+    if (fake6502_sign_get(c))
+        bra(c);
+}
+
+FAKE6502_FN_OPCODE(bne)
+{
+    if (!fake6502_zero_get(c))
+        bra(c);
+}
+
+FAKE6502_FN_OPCODE(bpl)
+{
+    if (!fake6502_sign_get(c))
+        bra(c);
+}
+
+FAKE6502_FN_OPCODE(brk)
+{
+    c->cpu.pc++;
+
+    // push next instruction address onto stack
+    fake6502_push_16(c, c->cpu.pc);
+
+    // push CPU flags to stack
+    fake6502_push_8(c, fake6502_flags_get(c) | FAKE6502_BREAK_FLAG);
+
+    // set interrupt flag
+    fake6502_interrupt_set(c);
+
+    c->cpu.pc = fake6502_mem_read16(c, 0xfffe);
+
+    // a watchpoint hit on the way is reported instead
+    if (!c->emu.stop)
+        c->emu.stop = FAKE6502_STOP_BRK;
+}
+
+FAKE6502_FN_OPCODE(bvc)
+{
+    if (!fake6502_overflow_get(c))
+        bra(c);
+}
+
+FAKE6502_FN_OPCODE(bvs)
+{
+    if (fake6502_overflow_get(c))
+        bra(c);
+}
+
+FAKE6502_FN_OPCODE(clc)
+{ fake6502_carry_clear(c); }
+
+FAKE6502_FN_OPCODE(cld)
+{ fake6502_decimal_clear(c); }
+
+FAKE6502_FN_OPCODE(cli)
+{
+    fake6502_interrupt_clear(c);
+    fake6502_irq_unmasked(c);
+}
+
+FAKE6502_FN_OPCODE(clv)
+{ fake6502_overflow_clear(c); }
+
+FAKE6502_FN_OPCODE(cmp)
+{ compare(c, c->cpu.a); }
+
+FAKE6502_FN_OPCODE(cpx)
+{ compare(c, c->cpu.x); }
+
+FAKE6502_FN_OPCODE(cpy)
+{ compare(c, c->cpu.y); }
+
+FAKE6502_FN_OPCODE(dec)
+{ fake6502_put_value(c, decrement(c, fake6502_get_value(c))); }
+
+FAKE6502_FN_OPCODE(dec_acc)
+{ c->cpu.a = decrement(c, c->cpu.a); }
+
+FAKE6502_FN_OPCODE(dex)
+{ c->cpu.x = decrement(c, c->cpu.x); }
+
+FAKE6502_FN_OPCODE(dey)
+{ c->cpu.y = decrement(c, c->cpu.y); }
+
+FAKE6502_FN_OPCODE(eor)
+{ fake6502_accum_save(c, exclusive_or(c, c->cpu.a, fake6502_get_value(c))); }
+
+FAKE6502_FN_OPCODE(hlt)
+{
+    // the CPU locks up, so stay on the halt opcode
+    c->cpu.pc--;
+    c->emu.stop = FAKE6502_STOP_HALT;
+}
+
+FAKE6502_FN_OPCODE(inc)
+{ fake6502_put_value(c, increment(c, fake6502_get_value(c))); }
+
+FAKE6502_FN_OPCODE(inc_acc)
+{ c->cpu.a = increment(c, c->cpu.a); }
+
+FAKE6502_FN_OPCODE(inx)
+{ c->cpu.x = increment(c, c->cpu.x); }
+
+FAKE6502_FN_OPCODE(iny)
+{ c->cpu.y = increment(c, c->cpu.y); }
+
+FAKE6502_FN_OPCODE(jmp)
+{ c->cpu.pc = c->emu.ea; }
+
+FAKE6502_FN_OPCODE(jsr)
+{
+    fake6502_push_16(c, c->cpu.pc - 1);
+    c->cpu.pc = c->emu.ea;
+}
+
+FAKE6502_FN_OPCODE(lda)
+{
+    uint16_t value = fake6502_get_value(c);
+    c->cpu.a = (uint8_t)(value & 0x00FF);
+
+    fake6502_zero_calc(c, c->cpu.a);
+    fake6502_sign_calc(c, c->cpu.a);
+}
+
+FAKE6502_FN_OPCODE(ldx)
+{
+    uint16_t value = fake6502_get_value(c);
+    c->cpu.x = (uint8_t)(value & 0x00FF);
+
+    fake6502_zero_calc(c, c->cpu.x);
+    fake6502_sign_calc(c, c->cpu.x);
+}
+
+FAKE6502_FN_OPCODE(ldy)
+{
+    uint16_t value = fake6502_get_value(c);
+    c->cpu.y = (uint8_t)(value & 0x00FF);
+
+    fake6502_zero_calc(c, c->cpu.y);
+    fake6502_sign_calc(c, c->cpu.y);
+}
+
+FAKE6502_FN_OPCODE(lsr)
+{ fake6502_put_value(c, logical_shift_right(c, fake6502_get_value(c))); }
+
+FAKE6502_FN_OPCODE(lsr_acc)
+{ c->cpu.a = logical_shift_right(c, c->cpu.a); }
+
+FAKE6502_FN_OPCODE(nop)
+{}
+
+FAKE6502_FN_OPCODE(ora)
+{
+    uint16_t value = fake6502_get_value(c);
+    uint16_t result = (uint16_t)c->cpu.a | value;
 
     fake6502_zero_calc(c, result);
     fake6502_sign_calc(c, result);
 
-    return(result);
+    fake6502_accum_save(c, result);
+}
+
+FAKE6502_FN_OPCODE(pha)
+{ fake6502_push_8(c, c->cpu.a); }
+
+FAKE6502_FN_OPCODE(phx)
+{ fake6502_push_8(c, c->cpu.x); }
+
+FAKE6502_FN_OPCODE(phy)
+{ fake6502_push_8(c, c->cpu.y); }
+
+FAKE6502_FN_OPCODE(php)
+{ fake6502_push_8(c, fake6502_flags_get(c) | FAKE6502_BREAK_FLAG); }
+
+FAKE6502_FN_OPCODE(pla)
+{
+    c->cpu.a = fake6502_pull_8(c);
+
+    fake6502_zero_calc(c, c->cpu.a);
+    fake6502_sign_calc(c, c->cpu.a);
+}
+
+FAKE6502_FN_OPCODE(plx)
+{
+    c->cpu.x = fake6502_pull_8(c);
+
+    fake6502_zero_calc(c, c->cpu.x);
+    fake6502_sign_calc(c, c->cpu.x);
+}
+
+FAKE6502_FN_OPCODE(ply)
+{
+    c->cpu.y = fake6502_pull_8(c);
+
+    fake6502_zero_calc(c, c->cpu.y);
+    fake6502_sign_calc(c, c->cpu.y);
+}
+
+FAKE6502_FN_OPCODE(plp)
+{
+    fake6502_flags_put(c, fake6502_pull_8(c) | FAKE6502_CONSTANT_FLAG | FAKE6502_BREAK_FLAG);
+    fake6502_irq_unmasked(c);
+}
+
+FAKE6502_FN_OPCODE(rol)
+{
+    uint16_t value = fake6502_get_value(c);
+
+    fake6502_put_unchanged(c, value);
+    fake6502_put_value(c, rotate_left(c, value));
+}
+
+FAKE6502_FN_OPCODE(rol_acc)
+{ c->cpu.a = rotate_left(c, c->cpu.a); }
+
+FAKE6502_FN_OPCODE(ror)
+{
+    uint16_t value = fake6502_get_value(c);
+
+    fake6502_put_unchanged(c, value);
+    fake6502_put_value(c, rotate_right(c, value));
+}
+
+FAKE6502_FN_OPCODE(ror_acc)
+{ c->cpu.a = rotate_right(c, c->cpu.a); }
+
+FAKE6502_FN_OPCODE(rti)
+{
+    fake6502_flags_put(c, fake6502_pull_8(c) | FAKE6502_CONSTANT_FLAG | FAKE6502_BREAK_FLAG);
+    c->cpu.pc = fake6502_pull_16(c);
+    fake6502_irq_unmasked(c);
+}
+
+FAKE6502_FN_OPCODE(rts)
+{ c->cpu.pc = fake6502_pull_16(c) + 1; }
+
+FAKE6502_FN_OPCODE(sbc)
+{
+    arith(c, fake6502_sbc_table, fake6502_get_value(c), c->cpu.flags & FAKE6502_DECIMAL_FLAG);
+}
+
+FAKE6502_FN_OPCODE(sbc_2a03)
+{
+    arith(c, fake6502_sbc_table, fake6502_get_value(c), 0);
+}
+
+FAKE6502_FN_OPCODE(sec)
+{ fake6502_carry_set(c); }
+
+FAKE6502_FN_OPCODE(sed)
+{ fake6502_decimal_set(c); }
+
+FAKE6502_FN_OPCODE(sei)
+{ fake6502_interrupt_set(c); }
+
+FAKE6502_FN_OPCODE(sta)
+{ fake6502_put_value(c, c->cpu.a); }
+
+FAKE6502_FN_OPCODE(stx)
+{ fake6502_put_value(c, c->cpu.x); }
+
+FAKE6502_FN_OPCODE(sty)
+{ fake6502_put_value(c, c->cpu.y); }
+
+FAKE6502_FN_OPCODE(stz)
+{ fake6502_put_value(c, 0); }
+
+FAKE6502_FN_OPCODE(tax)
+{
+    c->cpu.x = c->cpu.a;
+
+    fake6502_zero_calc(c, c->cpu.x);
+    fake6502_sign_calc(c, c->cpu.x);
+}
+
+FAKE6502_FN_OPCODE(tay)
+{
+    c->cpu.y = c->cpu.a;
+
+    fake6502_zero_calc(c, c->cpu.y);
+    fake6502_sign_calc(c, c->cpu.y);
+}
+
+FAKE6502_FN_OPCODE(tsx)
+{
+    c->cpu.x = c->cpu.s;
+
+    fake6502_zero_calc(c, c->cpu.x);
+    fake6502_sign_calc(c, c->cpu.x);
+}
+
+FAKE6502_FN_OPCODE(trb)
+{
+    uint16_t value = fake6502_get_value(c);
+    uint16_t result = (uint16_t)c->cpu.a & ~value;
+    fake6502_put_value(c, result);
+    fake6502_zero_calc(c, (c->cpu.a | result) & 0x00ff);
+}
+
+FAKE6502_FN_OPCODE(tsb)
+{
+    uint16_t value = fake6502_get_value(c);
+    uint16_t result = (uint16_t)c->cpu.a | value;
+    fake6502_put_value(c, result);
+    fake6502_zero_calc(c, (c->cpu.a | result) & 0x00ff);
+}
+
+FAKE6502_FN_OPCODE(txa)
+{
+    c->cpu.a = c->cpu.x;
+
+    fake6502_zero_calc(c, c->cpu.a);
+    fake6502_sign_calc(c, c->cpu.a);
+}
+
+FAKE6502_FN_OPCODE(txs)
+{ c->cpu.s = c->cpu.x; }
+
+FAKE6502_FN_OPCODE(tya)
+{
+    c->cpu.a = c->cpu.y;
+
+    fake6502_zero_calc(c, c->cpu.a);
+    fake6502_sign_calc(c, c->cpu.a);
+}
+
+FAKE6502_FN_OPCODE(lax)
+{
+    uint16_t value = fake6502_get_value(c);
+    c->cpu.x = c->cpu.a = (uint8_t)(value & 0x00FF);
+
+    fake6502_zero_calc(c, c->cpu.a);
+    fake6502_sign_calc(c, c->cpu.a);
+}
+
+FAKE6502_FN_OPCODE(sax)
+{ fake6502_put_value(c, c->cpu.a & c->cpu.x); }
+
+FAKE6502_FN_OPCODE(dcp)
+{
+    dec(c);
+    cmp(c);
+}
+
+FAKE6502_FN_OPCODE(isb)
+{
+    inc(c);
+    sbc(c);
+}
+
+FAKE6502_FN_OPCODE(isb_2a03)
+{
+    inc(c);
+    sbc_2a03(c);
+}
+
+FAKE6502_FN_OPCODE(slo)
+{
+    asl(c);
+    ora(c);
+}
+
+FAKE6502_FN_OPCODE(rla)
+{
+    uint16_t value = fake6502_get_value(c);
+    uint16_t result = rotate_left(c, value);
+    fake6502_put_unchanged(c, value);
+    fake6502_put_value(c, result);
+    fake6502_accum_save(c, boolean_and(c, c->cpu.a, result));
+}
+
+FAKE6502_FN_OPCODE(sre)
+{
+    uint16_t value = fake6502_get_value(c);
+    uint16_t result = logical_shift_right(c, value);
+    fake6502_put_unchanged(c, value);
+    fake6502_put_value(c, result);
+    fake6502_accum_save(c, exclusive_or(c, c->cpu.a, result));
+}
+
+FAKE6502_FN_OPCODE(rra)
+{
+    uint16_t value = fake6502_get_value(c);
+    uint16_t result = rotate_right(c, value);
+    fake6502_put_unchanged(c, value);
+    fake6502_put_value(c, result);
+    arith(c, fake6502_adc_table, result, c->cpu.flags & FAKE6502_DECIMAL_FLAG);
+}
+
+FAKE6502_FN_OPCODE(rra_2a03)
+{
+    uint16_t value = fake6502_get_value(c);
+    uint16_t result = rotate_right(c, value);
+    fake6502_put_unchanged(c, value);
+    fake6502_put_value(c, result);
+    arith(c, fake6502_adc_table, result, 0);
+}
+
+
+// -------------------------------------------------------------------
+// global's
+// -------------------------------------------------------------------
+
+// the opcode table - NMOS version
+//
+// the 2A03 is an NMOS 6502 without decimal mode, so the handlers that
+// honour the decimal flag are wrapped in D() and swapped for their
+// binary-only versions in FAKE6502_OPCODES_2A03
+
+#define FAKE6502_OPCODES_NMOS_LIST(X, D) \
+    /* 00 */                            \
+    X(0x00, imp, brk, 7)                \
+    X(0x01, indx, ora, 6)               \
+    X(0x02, imp, hlt, 2)                \
+    X(0x03, indx, slo, 8)               \
+    X(0x04, zp, nop, 3)                 \
+    X(0x05, zp, ora, 3)                 \
+    X(0x06, zp, asl, 5)                 \
+    X(0x07, zp, slo, 5)                 \
+    X(0x08, imp, php, 3)                \
+    X(0x09, imm, ora, 2)                \
+    X(0x0A, acc, asl_acc, 2)            \
+    X(0x0B, imm, nop, 2)                \
+    X(0x0C, abso, nop, 4)               \
+    X(0x0D, abso, ora, 4)               \
+    X(0x0E, abso, asl, 6)               \
+    X(0x0F, abso, slo, 6)               \
+    /* 10 */                            \
+    X(0x10, rel, bpl, 2)                \
+    X(0x11, indy_p, ora, 5)             \
+    X(0x12, imp, hlt, 2)                \
+    X(0x13, indy, slo, 8)               \
+    X(0x14, zpx, nop, 4)                \
+    X(0x15, zpx, ora, 4)                \
+    X(0x16, zpx, asl, 6)                \
+    X(0x17, zpx, slo, 6)                \
+    X(0x18, imp, clc, 2)                \
+    X(0x19, absy_p, ora, 4)             \
+    X(0x1A, imp, nop, 2)                \
+    X(0x1B, absy, slo, 7)               \
+    X(0x1C, absx, nop, 4)               \
+    X(0x1D, absx_p, ora, 4)             \
+    X(0x1E, absx, asl, 7)               \
+    X(0x1F, absx, slo, 7)               \
+    /* 20 */                            \
+    X(0x20, abso, jsr, 6)               \
+    X(0x21, indx, and, 6)               \
+    X(0x22, imp, hlt, 2)                \
+    X(0x23, indx, rla, 8)               \
+    X(0x24, zp, bit, 3)                 \
+    X(0x25, zp, and, 3)                 \
+    X(0x26, zp, rol, 5)                 \
+    X(0x27, zp, rla, 5)                 \
+    X(0x28, imp, plp, 4)                \
+    X(0x29, imm, and, 2)                \
+    X(0x2A, acc, rol_acc, 2)            \
+    X(0x2B, imm, nop, 2)                \
+    X(0x2C, abso, bit, 4)               \
+    X(0x2D, abso, and, 4)               \
+    X(0x2E, abso, rol, 6)               \
+    X(0x2F, abso, rla, 6)               \
+    /* 30 */                            \
+    X(0x30, rel, bmi, 2)                \
+    X(0x31, indy_p, and, 5)             \
+    X(0x32, imp, hlt, 2)                \
+    X(0x33, indy, rla, 8)               \
+    X(0x34, zpx, nop, 4)                \
+    X(0x35, zpx, and, 4)                \
+    X(0x36, zpx, rol, 6)                \
+    X(0x37, zpx, rla, 6)                \
+    X(0x38, imp, sec, 2)                \
+    X(0x39, absy_p, and, 4)             \
+    X(0x3A, imp, nop, 2)                \
+    X(0x3B, absy, rla, 7)               \
+    X(0x3C, absx, nop, 4)               \
+    X(0x3D, absx_p, and, 4)             \
+    X(0x3E, absx, rol, 7)               \
+    X(0x3F, absx, rla, 7)               \
+    /* 40 */                            \
+    X(0x40, imp, rti, 6)                \
+    X(0x41, indx, eor, 6)               \
+    X(0x42, imp, hlt, 2)                \
+    X(0x43, indx, sre, 8)               \
+    X(0x44, zp, nop, 3)                 \
+    X(0x45, zp, eor, 3)                 \
+    X(0x46, zp, lsr, 5)                 \
+    X(0x47, zp, sre, 5)                 \
+    X(0x48, imp, pha, 3)                \
+    X(0x49, imm, eor, 2)                \
+    X(0x4A, acc, lsr_acc, 2)            \
+    X(0x4B, imm, nop, 2)                \
+    X(0x4C, abso, jmp, 3)               \
+    X(0x4D, abso, eor, 4)               \
+    X(0x4E, abso, lsr, 6)               \
+    X(0x4F, abso, sre, 6)               \
+    /* 50 */                            \
+    X(0x50, rel, bvc, 2)                \
+    X(0x51, indy_p, eor, 5)             \
+    X(0x52, imp, hlt, 2)                \
+    X(0x53, indy, sre, 8)               \
+    X(0x54, zpx, nop, 4)                \
+    X(0x55, zpx, eor, 4)                \
+    X(0x56, zpx, lsr, 6)                \
+    X(0x57, zpx, sre, 6)                \
+    X(0x58, imp, cli, 2)                \
+    X(0x59, absy_p, eor, 4)             \
+    X(0x5A, imp, nop, 2)                \
+    X(0x5B, absy, sre, 7)               \
+    X(0x5C, absx, nop, 4)               \
+    X(0x5D, absx_p, eor, 4)             \
+    X(0x5E, absx, lsr, 7)               \
+    X(0x5F, absx, sre, 7)               \
+    /* 60 */                            \
+    X(0x60, imp, rts, 6)                \
+    X(0x61, indx, D(adc), 6)            \
+    X(0x62, imp, hlt, 2)                \
+    X(0x63, indx, D(rra), 8)            \
+    X(0x64, zp, nop, 3)                 \
+    X(0x65, zp, D(adc), 3)              \
+    X(0x66, zp, ror, 5)                 \
+    X(0x67, zp, D(rra), 5)              \
+    X(0x68, imp, pla, 4)                \
+    X(0x69, imm, D(adc), 2)             \
+    X(0x6A, acc, ror_acc, 2)            \
+    X(0x6B, imm, nop, 2)                \
+    X(0x6C, ind_nmos, jmp, 5)           \
+    X(0x6D, abso, D(adc), 4)            \
+    X(0x6E, abso, ror, 6)               \
+    X(0x6F, abso, D(rra), 6)            \
+    /* 70 */                            \
+    X(0x70, rel, bvs, 2)                \
+    X(0x71, indy_p, D(adc), 5)          \
+    X(0x72, imp, hlt, 2)                \
+    X(0x73, indy, D(rra), 8)            \
+    X(0x74, zpx, nop, 4)                \
+    X(0x75, zpx, D(adc), 4)             \
+    X(0x76, zpx, ror, 6)                \
+    X(0x77, zpx, D(rra), 6)             \
+    X(0x78, imp, sei, 2)                \
+    X(0x79, absy_p, D(adc), 4)          \
+    X(0x7A, imp, nop, 2)                \
+    X(0x7B, absy, D(rra), 7)            \
+    X(0x7C, absx, nop, 4)               \
+    X(0x7D, absx_p, D(adc), 4)          \
+    X(0x7E, absx, ror, 7)               \
+    X(0x7F, absx, D(rra), 7)            \
+    /* 80 */                            \
+    X(0x80, imm, nop, 2)                \
+    X(0x81, indx, sta, 6)               \
+    X(0x82, imm, nop, 2)                \
+    X(0x83, indx, sax, 6)               \
+    X(0x84, zp, sty, 3)                 \
+    X(0x85, zp, sta, 3)                 \
+    X(0x86, zp, stx, 3)                 \
+    X(0x87, zp, sax, 3)                 \
+    X(0x88, imp, dey, 2)                \
+    X(0x89, imm, nop, 2)                \
+    X(0x8A, imp, txa, 2)                \
+    X(0x8B, imm, nop, 2)                \
+    X(0x8C, abso, sty, 4)               \
+    X(0x8D, abso, sta, 4)               \
+    X(0x8E, abso, stx, 4)               \
+    X(0x8F, abso, sax, 4)               \
+    /* 90 */                            \
+    X(0x90, rel, bcc, 2)                \
+    X(0x91, indy, sta, 6)               \
+    X(0x92, imp, hlt, 2)                \
+    X(0x93, indy, nop, 6)               \
+    X(0x94, zpx, sty, 4)                \
+    X(0x95, zpx, sta, 4)                \
+    X(0x96, zpy, stx, 4)                \
+    X(0x97, zpy, sax, 4)                \
+    X(0x98, imp, tya, 2)                \
+    X(0x99, absy, sta, 5)               \
+    X(0x9A, imp, txs, 2)                \
+    X(0x9B, absy, nop, 5)               \
+    X(0x9C, absx, nop, 5)               \
+    X(0x9D, absx, sta, 5)               \
+    X(0x9E, absy, nop, 5)               \
+    X(0x9F, absy, nop, 5)               \
+    /* A0 */                            \
+    X(0xA0, imm, ldy, 2)                \
+    X(0xA1, indx, lda, 6)               \
+    X(0xA2, imm, ldx, 2)                \
+    X(0xA3, indx, lax, 6)               \
+    X(0xA4, zp, ldy, 3)                 \
+    X(0xA5, zp, lda, 3)                 \
+    X(0xA6, zp, ldx, 3)                 \
+    X(0xA7, zp, lax, 3)                 \
+    X(0xA8, imp, tay, 2)                \
+    X(0xA9, imm, lda, 2)                \
+    X(0xAA, imp, tax, 2)                \
+    X(0xAB, imm, nop, 2)                \
+    X(0xAC, abso, ldy, 4)               \
+    X(0xAD, abso, lda, 4)               \
+    X(0xAE, abso, ldx, 4)               \
+    X(0xAF, abso, lax, 4)               \
+    /* B0 */                            \
+    X(0xB0, rel, bcs, 2)                \
+    X(0xB1, indy_p, lda, 5)             \
+    X(0xB2, imp, hlt, 2)                \
+    X(0xB3, indy_p, lax, 5)             \
+    X(0xB4, zpx, ldy, 4)                \
+    X(0xB5, zpx, lda, 4)                \
+    X(0xB6, zpy, ldx, 4)                \
+    X(0xB7, zpy, lax, 4)                \
+    X(0xB8, imp, clv, 2)                \
+    X(0xB9, absy_p, lda, 4)             \
+    X(0xBA, imp, tsx, 2)                \
+    X(0xBB, absy_p, lax, 4)             \
+    X(0xBC, absx_p, ldy, 4)             \
+    X(0xBD, absx_p, lda, 4)             \
+    X(0xBE, absy_p, ldx, 4)             \
+    X(0xBF, absy_p, lax, 4)             \
+    /* C0 */                            \
+    X(0xC0, imm, cpy, 2)                \
+    X(0xC1, indx, cmp, 6)               \
+    X(0xC2, imm, nop, 2)                \
+    X(0xC3, indx, dcp, 8)               \
+    X(0xC4, zp, cpy, 3)                 \
+    X(0xC5, zp, cmp, 3)                 \
+    X(0xC6, zp, dec, 5)                 \
+    X(0xC7, zp, dcp, 5)                 \
+    X(0xC8, imp, iny, 2)                \
+    X(0xC9, imm, cmp, 2)                \
+    X(0xCA, imp, dex, 2)                \
+    X(0xCB, imm, nop, 2)                \
+    X(0xCC, abso, cpy, 4)               \
+    X(0xCD, abso, cmp, 4)               \
+    X(0xCE, abso, dec, 6)               \
+    X(0xCF, abso, dcp, 6)               \
+    /* D0 */                            \
+    X(0xD0, rel, bne, 2)                \
+    X(0xD1, indy_p, cmp, 5)             \
+    X(0xD2, imp, hlt, 2)                \
+    X(0xD3, indy, dcp, 8)               \
+    X(0xD4, zpx, nop, 4)                \
+    X(0xD5, zpx, cmp, 4)                \
+    X(0xD6, zpx, dec, 6)                \
+    X(0xD7, zpx, dcp, 6)                \
+    X(0xD8, imp, cld, 2)                \
+    X(0xD9, absy_p, cmp, 4)             \
+    X(0xDA, imp, nop, 2)                \
+    X(0xDB, absy, dcp, 7)               \
+    X(0xDC, absx, nop, 4)               \
+    X(0xDD, absx_p, cmp, 4)             \
+    X(0xDE, absx, dec, 7)               \
+    X(0xDF, absx, dcp, 7)               \
+    /* E0 */                            \
+    X(0xE0, imm, cpx, 2)                \
+    X(0xE1, indx, D(sbc), 6)            \
+    X(0xE2, imm, nop, 2)                \
+    X(0xE3, indx, D(isb), 8)            \
+    X(0xE4, zp, cpx, 3)                 \
+    X(0xE5, zp, D(sbc), 3)              \
+    X(0xE6, zp, inc, 5)                 \
+    X(0xE7, zp, D(isb), 5)              \
+    X(0xE8, imp, inx, 2)                \
+    X(0xE9, imm, D(sbc), 2)             \
+    X(0xEA, imp, nop, 2)                \
+    X(0xEB, imm, D(sbc), 2)             \
+    X(0xEC, abso, cpx, 4)               \
+    X(0xED, abso, D(sbc), 4)            \
+    X(0xEE, abso, inc, 6)               \
+    X(0xEF, abso, D(isb), 6)            \
+    /* F0 */                            \
+    X(0xF0, rel, beq, 2)                \
+    X(0xF1, indy_p, D(sbc), 5)          \
+    X(0xF2, imp, hlt, 2)                \
+    X(0xF3, indy, D(isb), 8)            \
+    X(0xF4, zpx, nop, 4)                \
+    X(0xF5, zpx, D(sbc), 4)             \
+    X(0xF6, zpx, inc, 6)                \
+    X(0xF7, zpx, D(isb), 6)             \
+    X(0xF8, imp, sed, 2)                \
+    X(0xF9, absy_p, D(sbc), 4)          \
+    X(0xFA, imp, nop, 2)                \
+    X(0xFB, absy, D(isb), 7)            \
+    X(0xFC, absx, nop, 4)               \
+    X(0xFD, absx_p, D(sbc), 4)          \
+    X(0xFE, absx, inc, 7)               \
+    X(0xFF, absx, D(isb), 7)
+
+
+// -------------------------------------------------------------------
+
+// the opcode table - CMOS version
+
+#define FAKE6502_OPCODES_CMOS(X)        \
+    /* 00 */                            \
+    X(0x00, imp, brk, 7)                \
+    X(0x01, indx, ora, 6)               \
+    X(0x02, imp, nop, 2)                \
+    X(0x03, indx, slo, 8)               \
+    X(0x04, zp, tsb, 5)                 \
+    X(0x05, zp, ora, 3)                 \
+    X(0x06, zp, asl, 5)                 \
+    X(0x07, zp, slo, 5)                 \
+    X(0x08, imp, php, 3)                \
+    X(0x09, imm, ora, 2)                \
+    X(0x0A, acc, asl_acc, 2)            \
+    X(0x0B, imm, nop, 2)                \
+    X(0x0C, abso, tsb, 6)               \
+    X(0x0D, abso, ora, 4)               \
+    X(0x0E, abso, asl, 6)               \
+    X(0x0F, abso, slo, 6)               \
+    /* 10 */                            \
+    X(0x10, rel, bpl, 2)                \
+    X(0x11, indy_p, ora, 5)             \
+    X(0x12, zpi, ora, 5)                \
+    X(0x13, indy, slo, 8)               \
+    X(0x14, zp, trb, 5)                 \
+    X(0x15, zpx, ora, 4)                \
+    X(0x16, zpx, asl, 6)                \
+    X(0x17, zpx, slo, 6)                \
+    X(0x18, imp, clc, 2)                \
+    X(0x19, absy_p, ora, 4)             \
+    X(0x1A, acc, inc_acc, 2)            \
+    X(0x1B, absy, slo, 7)               \
+    X(0x1C, abso, trb, 6)               \
+    X(0x1D, absx_p, ora, 4)             \
+    X(0x1E, absx, asl, 7)               \
+    X(0x1F, absx, slo, 7)               \
+    /* 20 */                            \
+    X(0x20, abso, jsr, 6)               \
+    X(0x21, indx, and, 6)               \
+    X(0x22, imp, nop, 2)                \
+    X(0x23, indx, rla, 8)               \
+    X(0x24, zp, bit, 3)                 \
+    X(0x25, zp, and, 3)                 \
+    X(0x26, zp, rol, 5)                 \
+    X(0x27, zp, rla, 5)                 \
+    X(0x28, imp, plp, 4)                \
+    X(0x29, imm, and, 2)                \
+    X(0x2A, acc, rol_acc, 2)            \
+    X(0x2B, imm, nop, 2)                \
+    X(0x2C, abso, bit, 4)               \
+    X(0x2D, abso, and, 4)               \
+    X(0x2E, abso, rol, 6)               \
+    X(0x2F, abso, rla, 6)               \
+    /* 30 */                            \
+    X(0x30, rel, bmi, 2)                \
+    X(0x31, indy_p, and, 5)             \
+    X(0x32, zpi, adc, 5)                \
+    X(0x33, indy, rla, 8)               \
+    X(0x34, zpx, bit, 4)                \
+    X(0x35, zpx, and, 4)                \
+    X(0x36, zpx, rol, 6)                \
+    X(0x37, zpx, rla, 6)                \
+    X(0x38, imp, sec, 2)                \
+    X(0x39, absy_p, and, 4)             \
+    X(0x3A, acc, dec_acc, 2)            \
+    X(0x3B, absy, rla, 7)               \
+    X(0x3C, absx_p, bit, 4)             \
+    X(0x3D, absx_p, and, 4)             \
+    X(0x3E, absx, rol, 7)               \
+    X(0x3F, absx, rla, 7)               \
+    /* 40 */                            \
+    X(0x40, imp, rti, 6)                \
+    X(0x41, indx, eor, 6)               \
+    X(0x42, imp, nop, 2)                \
+    X(0x43, indx, sre, 8)               \
+    X(0x44, zp, nop, 3)                 \
+    X(0x45, zp, eor, 3)                 \
+    X(0x46, zp, lsr, 5)                 \
+    X(0x47, zp, sre, 5)                 \
+    X(0x48, imp, pha, 3)                \
+    X(0x49, imm, eor, 2)                \
+    X(0x4A, acc, lsr_acc, 2)            \
+    X(0x4B, imm, nop, 2)                \
+    X(0x4C, abso, jmp, 3)               \
+    X(0x4D, abso, eor, 4)               \
+    X(0x4E, abso, lsr, 6)               \
+    X(0x4F, abso, sre, 6)               \
+    /* 50 */                            \
+    X(0x50, rel, bvc, 2)                \
+    X(0x51, indy_p, eor, 5)             \
+    X(0x52, zpi, eor, 5)                \
+    X(0x53, indy, sre, 8)               \
+    X(0x54, zpx, nop, 4)                \
+    X(0x55, zpx, eor, 4)                \
+    X(0x56, zpx, lsr, 6)                \
+    X(0x57, zpx, sre, 6)                \
+    X(0x58, imp, cli, 2)                \
+    X(0x59, absy_p, eor, 4)             \
+    X(0x5A, imp, phy, 2)                \
+    X(0x5B, absy, sre, 7)               \
+    X(0x5C, absx, nop, 4)               \
+    X(0x5D, absx_p, eor, 4)             \
+    X(0x5E, absx, lsr, 7)               \
+    X(0x5F, absx, sre, 7)               \
+    /* 60 */                            \
+    X(0x60, imp, rts, 6)                \
+    X(0x61, indx, adc, 6)               \
+    X(0x62, imp, nop, 2)                \
+    X(0x63, indx, rra, 8)               \
+    X(0x64, zp, stz, 3)                 \
+    X(0x65, zp, adc, 3)                 \
+    X(0x66, zp, ror, 5)                 \
+    X(0x67, zp, rra, 5)                 \
+    X(0x68, imp, pla, 4)                \
+    X(0x69, imm, adc, 2)                \
+    X(0x6A, acc, ror_acc, 2)            \
+    X(0x6B, imm, nop, 2)                \
+    X(0x6C, ind_cmos, jmp, 5)           \
+    X(0x6D, abso, adc, 4)               \
+    X(0x6E, abso, ror, 6)               \
+    X(0x6F, abso, rra, 6)               \
+    /* 70 */                            \
+    X(0x70, rel, bvs, 2)                \
+    X(0x71, indy_p, adc, 5)             \
+    X(0x72, zpi, adc, 5)                \
+    X(0x73, indy, rra, 8)               \
+    X(0x74, zpx, stz, 4)                \
+    X(0x75, zpx, adc, 4)                \
+    X(0x76, zpx, ror, 6)                \
+    X(0x77, zpx, rra, 6)                \
+    X(0x78, imp, sei, 2)                \
+    X(0x79, absy_p, adc, 4)             \
+    X(0x7A, imp, ply, 6)                \
+    X(0x7B, absy, rra, 7)               \
+    X(0x7C, absxi, jmp, 6)              \
+    X(0x7D, absx_p, adc, 4)             \
+    X(0x7E, absx, ror, 7)               \
+    X(0x7F, absx, rra, 7)               \
+    /* 80 */                            \
+    X(0x80, rel, bra, 3)                \
+    X(0x81, indx, sta, 6)               \
+    X(0x82, imm, nop, 2)                \
+    X(0x83, indx, sax, 6)               \
+    X(0x84, zp, sty, 3)                 \
+    X(0x85, zp, sta, 3)                 \
+    X(0x86, zp, stx, 3)                 \
+    X(0x87, zp, sax, 3)                 \
+    X(0x88, imp, dey, 2)                \
+    X(0x89, imm, bit_imm, 2)            \
+    X(0x8A, imp, txa, 2)                \
+    X(0x8B, imm, nop, 2)                \
+    X(0x8C, abso, sty, 4)               \
+    X(0x8D, abso, sta, 4)               \
+    X(0x8E, abso, stx, 4)               \
+    X(0x8F, abso, sax, 4)               \
+    /* 90 */                            \
+    X(0x90, rel, bcc, 2)                \
+    X(0x91, indy, sta, 6)               \
+    X(0x92, zpi, sta, 5)                \
+    X(0x93, indy, nop, 6)               \
+    X(0x94, zpx, sty, 4)                \
+    X(0x95, zpx, sta, 4)                \
+    X(0x96, zpy, stx, 4)                \
+    X(0x97, zpy, sax, 4)                \
+    X(0x98, imp, tya, 2)                \
+    X(0x99, absy, sta, 5)               \
+    X(0x9A, imp, txs, 2)                \
+    X(0x9B, absy, nop, 5)               \
+    X(0x9C, abso, stz, 4)               \
+    X(0x9D, absx, sta, 5)               \
+    X(0x9E, absx, stz, 5)               \
+    X(0x9F, absy, nop, 5)               \
+    /* A0 */                            \
+    X(0xA0, imm, ldy, 2)                \
+    X(0xA1, indx, lda, 6)               \
+    X(0xA2, imm, ldx, 2)                \
+    X(0xA3, indx, lax, 6)               \
+    X(0xA4, zp, ldy, 3)                 \
+    X(0xA5, zp, lda, 3)                 \
+    X(0xA6, zp, ldx, 3)                 \
+    X(0xA7, zp, lax, 3)                 \
+    X(0xA8, imp, tay, 2)                \
+    X(0xA9, imm, lda, 2)                \
+    X(0xAA, imp, tax, 2)                \
+    X(0xAB, imm, nop, 2)                \
+    X(0xAC, abso, ldy, 4)               \
+    X(0xAD, abso, lda, 4)               \
+    X(0xAE, abso, ldx, 4)               \
+    X(0xAF, abso, lax, 4)               \
+    /* B0 */                            \
+    X(0xB0, rel, bcs, 2)                \
+    X(0xB1, indy_p, lda, 5)             \
+    X(0xB2, zpi, lda, 5)                \
+    X(0xB3, indy_p, lax, 5)             \
+    X(0xB4, zpx, ldy, 4)                \
+    X(0xB5, zpx, lda, 4)                \
+    X(0xB6, zpy, ldx, 4)                \
+    X(0xB7, zpy, lax, 4)                \
+    X(0xB8, imp, clv, 2)                \
+    X(0xB9, absy_p, lda, 4)             \
+    X(0xBA, imp, tsx, 2)                \
+    X(0xBB, absy_p, lax, 4)             \
+    X(0xBC, absx_p, ldy, 4)             \
+    X(0xBD, absx_p, lda, 4)             \
+    X(0xBE, absy_p, ldx, 4)             \
+    X(0xBF, absy_p, lax, 4)             \
+    /* C0 */                            \
+    X(0xC0, imm, cpy, 2)                \
+    X(0xC1, indx, cmp, 6)               \
+    X(0xC2, imm, nop, 2)                \
+    X(0xC3, indx, dcp, 8)               \
+    X(0xC4, zp, cpy, 3)                 \
+    X(0xC5, zp, cmp, 3)                 \
+    X(0xC6, zp, dec, 5)                 \
+    X(0xC7, zp, dcp, 5)                 \
+    X(0xC8, imp, iny, 2)                \
+    X(0xC9, imm, cmp, 2)                \
+    X(0xCA, imp, dex, 2)                \
+    X(0xCB, imm, nop, 2)                \
+    X(0xCC, abso, cpy, 4)               \
+    X(0xCD, abso, cmp, 4)               \
+    X(0xCE, abso, dec, 6)               \
+    X(0xCF, abso, dcp, 6)               \
+    /* D0 */                            \
+    X(0xD0, rel, bne, 2)                \
+    X(0xD1, indy_p, cmp, 5)             \
+    X(0xD2, zpi, cmp, 5)                \
+    X(0xD3, indy, dcp, 8)               \
+    X(0xD4, zpx, nop, 4)                \
+    X(0xD5, zpx, cmp, 4)                \
+    X(0xD6, zpx, dec, 6)                \
+    X(0xD7, zpx, dcp, 6)                \
+    X(0xD8, imp, cld, 2)                \
+    X(0xD9, absy_p, cmp, 4)             \
+    X(0xDA, imp, phx, 3)                \
+    X(0xDB, absy, dcp, 7)               \
+    X(0xDC, absx, nop, 4)               \
+    X(0xDD, absx_p, cmp, 4)             \
+    X(0xDE, absx, dec, 7)               \
+    X(0xDF, absx, dcp, 7)               \
+    /* E0 */                            \
+    X(0xE0, imm, cpx, 2)                \
+    X(0xE1, indx, sbc, 6)               \
+    X(0xE2, imm, nop, 2)                \
+    X(0xE3, indx, isb, 8)               \
+    X(0xE4, zp, cpx, 3)                 \
+    X(0xE5, zp, sbc, 3)                 \
+    X(0xE6, zp, inc, 5)                 \
+    X(0xE7, zp, isb, 5)                 \
+    X(0xE8, imp, inx, 2)                \
+    X(0xE9, imm, sbc, 2)                \
+    X(0xEA, imp, nop, 2)                \
+    X(0xEB, imm, sbc, 2)                \
+    X(0xEC, abso, cpx, 4)               \
+    X(0xED, abso, sbc, 4)               \
+    X(0xEE, abso, inc, 6)               \
+    X(0xEF, abso, isb, 6)               \
+    /* F0 */                            \
+    X(0xF0, rel, beq, 2)                \
+    X(0xF1, indy_p, sbc, 5)             \
+    X(0xF2, zpi, sbc, 5)                \
+    X(0xF3, indy, isb, 8)               \
+    X(0xF4, zpx, nop, 4)                \
+    X(0xF5, zpx, sbc, 4)                \
+    X(0xF6, zpx, inc, 6)                \
+    X(0xF7, zpx, isb, 6)                \
+    X(0xF8, imp, sed, 2)                \
+    X(0xF9, absy_p, sbc, 4)             \
+    X(0xFA, imp, plx, 2)                \
+    X(0xFB, absy, isb, 7)               \
+    X(0xFC, absx, nop, 4)               \
+    X(0xFD, absx_p, sbc, 4)             \
+    X(0xFE, absx, inc, 7)               \
+    X(0xFF, absx, isb, 7)
+
+
+// -------------------------------------------------------------------
+
+// the opcode tables, one per variant
+
+#define FAKE6502_BCD(m_fn)              m_fn
+#define FAKE6502_NO_BCD(m_fn)           m_fn##_2a03
+
+#define FAKE6502_OPCODES_NMOS(X)        FAKE6502_OPCODES_NMOS_LIST(X, FAKE6502_BCD)
+#define FAKE6502_OPCODES_2A03(X)        FAKE6502_OPCODES_NMOS_LIST(X, FAKE6502_NO_BCD)
+
+#define FAKE6502_OPCODE_ENTRY(m_op, m_mode, m_fn, m_ticks)  \
+    [m_op] = {m_mode, m_fn, m_ticks},
+
+fake6502_opcode fake6502_opcodes_nmos[256] = {
+    FAKE6502_OPCODES_NMOS(FAKE6502_OPCODE_ENTRY)
+};
+
+fake6502_opcode fake6502_opcodes_cmos[256] = {
+    FAKE6502_OPCODES_CMOS(FAKE6502_OPCODE_ENTRY)
+};
+
+fake6502_opcode fake6502_opcodes_2a03[256] = {
+    FAKE6502_OPCODES_2A03(FAKE6502_OPCODE_ENTRY)
+};
+
+fake6502_opcode *fake6502_opcode_tables[] = {
+    [FAKE6502_VARIANT_NMOS] = fake6502_opcodes_nmos,
+    [FAKE6502_VARIANT_CMOS] = fake6502_opcodes_cmos,
+    [FAKE6502_VARIANT_2A03] = fake6502_opcodes_2a03
+};
+
+fake6502_opcode *const fake6502_opcodes = FAKE6502_OPCODES_DEFAULT;
+
+
+// the operand each opcode takes; the 2A03 shares the NMOS table
+
+#ifndef FAKE6502_BUS_FLAT
+
+#define FAKE6502_OPERAND_ENTRY(m_op, m_mode, m_fn, m_ticks)  \
+    [m_op] = FAKE6502_OPERAND_##m_mode,
+
+static const uint8_t fake6502_operands_nmos[256] = {
+    FAKE6502_OPCODES_NMOS(FAKE6502_OPERAND_ENTRY)
+};
+
+static const uint8_t fake6502_operands_cmos[256] = {
+    FAKE6502_OPCODES_CMOS(FAKE6502_OPERAND_ENTRY)
+};
+
+#endif
+
+
+// the addressing mode of each opcode, in the form taking its operand
+
+#ifdef FAKE6502_JIT_X86_64
+
+typedef void (*fake6502_addr_pre)(fake6502_context *c, uint16_t operand);
+
+#define FAKE6502_PRE_ENTRY(m_op, m_mode, m_fn, m_ticks)  \
+    [m_op] = m_mode##_pre,
+
+static const fake6502_addr_pre fake6502_pres_nmos[256] = {
+    FAKE6502_OPCODES_NMOS(FAKE6502_PRE_ENTRY)
+};
+
+static const fake6502_addr_pre fake6502_pres_cmos[256] = {
+    FAKE6502_OPCODES_CMOS(FAKE6502_PRE_ENTRY)
+};
+
+#endif
+
+
+// the names of each opcode's addressing mode and operation, for reports
+
+#define FAKE6502_NAME(m_name)           FAKE6502_NAME_STRING(m_name)
+#define FAKE6502_NAME_STRING(m_name)    #m_name
+#define FAKE6502_NAMES_ENTRY(m_op, m_mode, m_fn, m_ticks)  \
+    [m_op] = {FAKE6502_NAME(m_mode), FAKE6502_NAME(m_fn)},
+
+static const char *const fake6502_names[3][256][2] = {
+    [FAKE6502_VARIANT_NMOS] = {FAKE6502_OPCODES_NMOS(FAKE6502_NAMES_ENTRY)},
+    [FAKE6502_VARIANT_CMOS] = {FAKE6502_OPCODES_CMOS(FAKE6502_NAMES_ENTRY)},
+    [FAKE6502_VARIANT_2A03] = {FAKE6502_OPCODES_2A03(FAKE6502_NAMES_ENTRY)}
+};
+
+
+// what each opcode does: each addressing mode and each operation has a
+// list of what it adds, and the two are put together for every opcode in
+// the variant's list
+
+// the mode, the size, the index register read and the penalties
+
+#define FAKE6502_INFO_MODE_imp          FAKE6502_ADDR_IMP, 1, 0, 0
+#define FAKE6502_INFO_MODE_acc          FAKE6502_ADDR_ACC, 1, 0, 0
+#define FAKE6502_INFO_MODE_imm          FAKE6502_ADDR_IMM, 2, 0, 0
+#define FAKE6502_INFO_MODE_zp           FAKE6502_ADDR_ZP, 2, 0, 0
+#define FAKE6502_INFO_MODE_zpx          FAKE6502_ADDR_ZPX, 2, FAKE6502_REG_X, 0
+#define FAKE6502_INFO_MODE_zpy          FAKE6502_ADDR_ZPY, 2, FAKE6502_REG_Y, 0
+#define FAKE6502_INFO_MODE_rel          FAKE6502_ADDR_REL, 2, 0, FAKE6502_PENALTY_BRANCH
+#define FAKE6502_INFO_MODE_abso         FAKE6502_ADDR_ABS, 3, 0, 0
+#define FAKE6502_INFO_MODE_absx         FAKE6502_ADDR_ABSX, 3, FAKE6502_REG_X, 0
+#define FAKE6502_INFO_MODE_absx_p       FAKE6502_ADDR_ABSX, 3, FAKE6502_REG_X, FAKE6502_PENALTY_PAGE
+#define FAKE6502_INFO_MODE_absy         FAKE6502_ADDR_ABSY, 3, FAKE6502_REG_Y, 0
+#define FAKE6502_INFO_MODE_absy_p       FAKE6502_ADDR_ABSY, 3, FAKE6502_REG_Y, FAKE6502_PENALTY_PAGE
+#define FAKE6502_INFO_MODE_ind_nmos     FAKE6502_ADDR_IND, 3, 0, 0
+#define FAKE6502_INFO_MODE_ind_cmos     FAKE6502_ADDR_IND, 3, 0, FAKE6502_PENALTY_POINTER
+#define FAKE6502_INFO_MODE_indx         FAKE6502_ADDR_INDX, 2, FAKE6502_REG_X, 0
+#define FAKE6502_INFO_MODE_indy         FAKE6502_ADDR_INDY, 2, FAKE6502_REG_Y, 0
+#define FAKE6502_INFO_MODE_indy_p       FAKE6502_ADDR_INDY, 2, FAKE6502_REG_Y, FAKE6502_PENALTY_PAGE
+#define FAKE6502_INFO_MODE_zpi          FAKE6502_ADDR_ZPI, 2, 0, 0
+#define FAKE6502_INFO_MODE_absxi        FAKE6502_ADDR_ABSXI, 3, FAKE6502_REG_X, 0
+
+// the mnemonic, the registers read and written, the flags read and
+// written, the memory used and the flow, each spelt as below
+
+#define FAKE6502_INFO_OP(m_op, m_reads, m_writes, m_flags_read, m_flags_written,  \
+                         m_memory, m_flow)                                      \
+    FAKE6502_OP_##m_op, FAKE6502_INFO_REG_##m_reads, FAKE6502_INFO_REG_##m_writes, \
+    FAKE6502_INFO_FLAGS_##m_flags_read, FAKE6502_INFO_FLAGS_##m_flags_written,  \
+    FAKE6502_INFO_MEM_##m_memory, FAKE6502_FLOW_##m_flow
+
+#define FAKE6502_INFO_REG_NO            0
+#define FAKE6502_INFO_REG_A             FAKE6502_REG_A
+#define FAKE6502_INFO_REG_X             FAKE6502_REG_X
+#define FAKE6502_INFO_REG_Y             FAKE6502_REG_Y
+#define FAKE6502_INFO_REG_S             FAKE6502_REG_S
+#define FAKE6502_INFO_REG_AX            (FAKE6502_REG_A | FAKE6502_REG_X)
+#define FAKE6502_INFO_REG_AS            (FAKE6502_REG_A | FAKE6502_REG_S)
+#define FAKE6502_INFO_REG_XS            (FAKE6502_REG_X | FAKE6502_REG_S)
+#define FAKE6502_INFO_REG_YS            (FAKE6502_REG_Y | FAKE6502_REG_S)
+
+#define FAKE6502_INFO_FLAGS_NO          0
+#define FAKE6502_INFO_FLAGS_C           FAKE6502_CARRY_FLAG
+#define FAKE6502_INFO_FLAGS_Z           FAKE6502_ZERO_FLAG
+#define FAKE6502_INFO_FLAGS_I           FAKE6502_INTERRUPT_FLAG
+#define FAKE6502_INFO_FLAGS_D           FAKE6502_DECIMAL_FLAG
+#define FAKE6502_INFO_FLAGS_V           FAKE6502_OVERFLOW_FLAG
+#define FAKE6502_INFO_FLAGS_N           FAKE6502_SIGN_FLAG
+#define FAKE6502_INFO_FLAGS_CD          (FAKE6502_CARRY_FLAG | FAKE6502_DECIMAL_FLAG)
+#define FAKE6502_INFO_FLAGS_NZ          (FAKE6502_SIGN_FLAG | FAKE6502_ZERO_FLAG)
+#define FAKE6502_INFO_FLAGS_NZC         (FAKE6502_INFO_FLAGS_NZ | FAKE6502_CARRY_FLAG)
+#define FAKE6502_INFO_FLAGS_NVZ         (FAKE6502_INFO_FLAGS_NZ | FAKE6502_OVERFLOW_FLAG)
+#define FAKE6502_INFO_FLAGS_NVZC        FAKE6502_NVZC_FLAGS
+#define FAKE6502_INFO_FLAGS_P           (FAKE6502_NVZC_FLAGS | FAKE6502_INTERRUPT_FLAG | \
+                                         FAKE6502_DECIMAL_FLAG)
+#define FAKE6502_INFO_FLAGS_ALL         0xff    // PLP and RTI set B and bit 5 too
+
+#define FAKE6502_INFO_MEM_NO            0
+#define FAKE6502_INFO_MEM_READ          FAKE6502_MEM_READ
+#define FAKE6502_INFO_MEM_WRITE         FAKE6502_MEM_WRITE
+#define FAKE6502_INFO_MEM_RMW           FAKE6502_MEM_RMW
+#define FAKE6502_INFO_MEM_STACK         FAKE6502_MEM_STACK
+#define FAKE6502_INFO_MEM_VECTOR        (FAKE6502_MEM_STACK | FAKE6502_MEM_VECTOR)
+
+#define FAKE6502_INFO_OP_adc            FAKE6502_INFO_OP(ADC, A, A, CD, NVZC, READ, NONE)
+#define FAKE6502_INFO_OP_adc_2a03       FAKE6502_INFO_OP(ADC, A, A, C, NVZC, READ, NONE)
+#define FAKE6502_INFO_OP_and            FAKE6502_INFO_OP(AND, A, A, NO, NZ, READ, NONE)
+#define FAKE6502_INFO_OP_asl            FAKE6502_INFO_OP(ASL, NO, NO, NO, NZC, RMW, NONE)
+#define FAKE6502_INFO_OP_asl_acc        FAKE6502_INFO_OP(ASL, A, A, NO, NZC, NO, NONE)
+#define FAKE6502_INFO_OP_bcc            FAKE6502_INFO_OP(BCC, NO, NO, C, NO, NO, BRANCH)
+#define FAKE6502_INFO_OP_bcs            FAKE6502_INFO_OP(BCS, NO, NO, C, NO, NO, BRANCH)
+#define FAKE6502_INFO_OP_beq            FAKE6502_INFO_OP(BEQ, NO, NO, Z, NO, NO, BRANCH)
+#define FAKE6502_INFO_OP_bit            FAKE6502_INFO_OP(BIT, A, NO, NO, NVZ, READ, NONE)
+#define FAKE6502_INFO_OP_bit_imm        FAKE6502_INFO_OP(BIT, A, NO, NO, Z, READ, NONE)
+#define FAKE6502_INFO_OP_bmi            FAKE6502_INFO_OP(BMI, NO, NO, N, NO, NO, BRANCH)
+#define FAKE6502_INFO_OP_bne            FAKE6502_INFO_OP(BNE, NO, NO, Z, NO, NO, BRANCH)
+#define FAKE6502_INFO_OP_bpl            FAKE6502_INFO_OP(BPL, NO, NO, N, NO, NO, BRANCH)
+#define FAKE6502_INFO_OP_bra            FAKE6502_INFO_OP(BRA, NO, NO, NO, NO, NO, BRANCH)
+#define FAKE6502_INFO_OP_brk            FAKE6502_INFO_OP(BRK, S, S, P, I, VECTOR, INTERRUPT)
+#define FAKE6502_INFO_OP_bvc            FAKE6502_INFO_OP(BVC, NO, NO, V, NO, NO, BRANCH)
+#define FAKE6502_INFO_OP_bvs            FAKE6502_INFO_OP(BVS, NO, NO, V, NO, NO, BRANCH)
+#define FAKE6502_INFO_OP_clc            FAKE6502_INFO_OP(CLC, NO, NO, NO, C, NO, NONE)
+#define FAKE6502_INFO_OP_cld            FAKE6502_INFO_OP(CLD, NO, NO, NO, D, NO, NONE)
+#define FAKE6502_INFO_OP_cli            FAKE6502_INFO_OP(CLI, NO, NO, NO, I, NO, NONE)
+#define FAKE6502_INFO_OP_clv            FAKE6502_INFO_OP(CLV, NO, NO, NO, V, NO, NONE)
+#define FAKE6502_INFO_OP_cmp            FAKE6502_INFO_OP(CMP, A, NO, NO, NZC, READ, NONE)
+#define FAKE6502_INFO_OP_cpx            FAKE6502_INFO_OP(CPX, X, NO, NO, NZC, READ, NONE)
+#define FAKE6502_INFO_OP_cpy            FAKE6502_INFO_OP(CPY, Y, NO, NO, NZC, READ, NONE)
+#define FAKE6502_INFO_OP_dcp            FAKE6502_INFO_OP(DCP, A, NO, NO, NZC, RMW, NONE)
+#define FAKE6502_INFO_OP_dec            FAKE6502_INFO_OP(DEC, NO, NO, NO, NZ, RMW, NONE)
+#define FAKE6502_INFO_OP_dec_acc        FAKE6502_INFO_OP(DEC, A, A, NO, NZ, NO, NONE)
+#define FAKE6502_INFO_OP_dex            FAKE6502_INFO_OP(DEX, X, X, NO, NZ, NO, NONE)
+#define FAKE6502_INFO_OP_dey            FAKE6502_INFO_OP(DEY, Y, Y, NO, NZ, NO, NONE)
+#define FAKE6502_INFO_OP_eor            FAKE6502_INFO_OP(EOR, A, A, NO, NZ, READ, NONE)
+#define FAKE6502_INFO_OP_hlt            FAKE6502_INFO_OP(HLT, NO, NO, NO, NO, NO, HALT)
+#define FAKE6502_INFO_OP_inc            FAKE6502_INFO_OP(INC, NO, NO, NO, NZ, RMW, NONE)
+#define FAKE6502_INFO_OP_inc_acc        FAKE6502_INFO_OP(INC, A, A, NO, NZ, NO, NONE)
+#define FAKE6502_INFO_OP_inx            FAKE6502_INFO_OP(INX, X, X, NO, NZ, NO, NONE)
+#define FAKE6502_INFO_OP_iny            FAKE6502_INFO_OP(INY, Y, Y, NO, NZ, NO, NONE)
+#define FAKE6502_INFO_OP_isb            FAKE6502_INFO_OP(ISB, A, A, CD, NVZC, RMW, NONE)
+#define FAKE6502_INFO_OP_isb_2a03       FAKE6502_INFO_OP(ISB, A, A, C, NVZC, RMW, NONE)
+#define FAKE6502_INFO_OP_jmp            FAKE6502_INFO_OP(JMP, NO, NO, NO, NO, NO, JUMP)
+#define FAKE6502_INFO_OP_jsr            FAKE6502_INFO_OP(JSR, S, S, NO, NO, STACK, CALL)
+#define FAKE6502_INFO_OP_lax            FAKE6502_INFO_OP(LAX, NO, AX, NO, NZ, READ, NONE)
+#define FAKE6502_INFO_OP_lda            FAKE6502_INFO_OP(LDA, NO, A, NO, NZ, READ, NONE)
+#define FAKE6502_INFO_OP_ldx            FAKE6502_INFO_OP(LDX, NO, X, NO, NZ, READ, NONE)
+#define FAKE6502_INFO_OP_ldy            FAKE6502_INFO_OP(LDY, NO, Y, NO, NZ, READ, NONE)
+#define FAKE6502_INFO_OP_lsr            FAKE6502_INFO_OP(LSR, NO, NO, NO, NZC, RMW, NONE)
+#define FAKE6502_INFO_OP_lsr_acc        FAKE6502_INFO_OP(LSR, A, A, NO, NZC, NO, NONE)
+#define FAKE6502_INFO_OP_nop            FAKE6502_INFO_OP(NOP, NO, NO, NO, NO, NO, NONE)
+#define FAKE6502_INFO_OP_ora            FAKE6502_INFO_OP(ORA, A, A, NO, NZ, READ, NONE)
+#define FAKE6502_INFO_OP_pha            FAKE6502_INFO_OP(PHA, AS, S, NO, NO, STACK, NONE)
+#define FAKE6502_INFO_OP_php            FAKE6502_INFO_OP(PHP, S, S, P, NO, STACK, NONE)
+#define FAKE6502_INFO_OP_phx            FAKE6502_INFO_OP(PHX, XS, S, NO, NO, STACK, NONE)
+#define FAKE6502_INFO_OP_phy            FAKE6502_INFO_OP(PHY, YS, S, NO, NO, STACK, NONE)
+#define FAKE6502_INFO_OP_pla            FAKE6502_INFO_OP(PLA, S, AS, NO, NZ, STACK, NONE)
+#define FAKE6502_INFO_OP_plp            FAKE6502_INFO_OP(PLP, S, S, NO, ALL, STACK, NONE)
+#define FAKE6502_INFO_OP_plx            FAKE6502_INFO_OP(PLX, S, XS, NO, NZ, STACK, NONE)
+#define FAKE6502_INFO_OP_ply            FAKE6502_INFO_OP(PLY, S, YS, NO, NZ, STACK, NONE)
+#define FAKE6502_INFO_OP_rla            FAKE6502_INFO_OP(RLA, A, A, C, NZC, RMW, NONE)
+#define FAKE6502_INFO_OP_rol            FAKE6502_INFO_OP(ROL, NO, NO, C, NZC, RMW, NONE)
+#define FAKE6502_INFO_OP_rol_acc        FAKE6502_INFO_OP(ROL, A, A, C, NZC, NO, NONE)
+#define FAKE6502_INFO_OP_ror            FAKE6502_INFO_OP(ROR, NO, NO, C, NZC, RMW, NONE)
+#define FAKE6502_INFO_OP_ror_acc        FAKE6502_INFO_OP(ROR, A, A, C, NZC, NO, NONE)
+#define FAKE6502_INFO_OP_rra            FAKE6502_INFO_OP(RRA, A, A, CD, NVZC, RMW, NONE)
+#define FAKE6502_INFO_OP_rra_2a03       FAKE6502_INFO_OP(RRA, A, A, C, NVZC, RMW, NONE)
+#define FAKE6502_INFO_OP_rti            FAKE6502_INFO_OP(RTI, S, S, NO, ALL, STACK, RETURN)
+#define FAKE6502_INFO_OP_rts            FAKE6502_INFO_OP(RTS, S, S, NO, NO, STACK, RETURN)
+#define FAKE6502_INFO_OP_sax            FAKE6502_INFO_OP(SAX, AX, NO, NO, NO, WRITE, NONE)
+#define FAKE6502_INFO_OP_sbc            FAKE6502_INFO_OP(SBC, A, A, CD, NVZC, READ, NONE)
+#define FAKE6502_INFO_OP_sbc_2a03       FAKE6502_INFO_OP(SBC, A, A, C, NVZC, READ, NONE)
+#define FAKE6502_INFO_OP_sec            FAKE6502_INFO_OP(SEC, NO, NO, NO, C, NO, NONE)
+#define FAKE6502_INFO_OP_sed            FAKE6502_INFO_OP(SED, NO, NO, NO, D, NO, NONE)
+#define FAKE6502_INFO_OP_sei            FAKE6502_INFO_OP(SEI, NO, NO, NO, I, NO, NONE)
+#define FAKE6502_INFO_OP_slo            FAKE6502_INFO_OP(SLO, A, A, NO, NZC, RMW, NONE)
+#define FAKE6502_INFO_OP_sre            FAKE6502_INFO_OP(SRE, A, A, NO, NZC, RMW, NONE)
+#define FAKE6502_INFO_OP_sta            FAKE6502_INFO_OP(STA, A, NO, NO, NO, WRITE, NONE)
+#define FAKE6502_INFO_OP_stx            FAKE6502_INFO_OP(STX, X, NO, NO, NO, WRITE, NONE)
+#define FAKE6502_INFO_OP_sty            FAKE6502_INFO_OP(STY, Y, NO, NO, NO, WRITE, NONE)
+#define FAKE6502_INFO_OP_stz            FAKE6502_INFO_OP(STZ, NO, NO, NO, NO, WRITE, NONE)
+#define FAKE6502_INFO_OP_tax            FAKE6502_INFO_OP(TAX, A, X, NO, NZ, NO, NONE)
+#define FAKE6502_INFO_OP_tay            FAKE6502_INFO_OP(TAY, A, Y, NO, NZ, NO, NONE)
+#define FAKE6502_INFO_OP_trb            FAKE6502_INFO_OP(TRB, A, NO, NO, Z, RMW, NONE)
+#define FAKE6502_INFO_OP_tsb            FAKE6502_INFO_OP(TSB, A, NO, NO, Z, RMW, NONE)
+#define FAKE6502_INFO_OP_tsx            FAKE6502_INFO_OP(TSX, S, X, NO, NZ, NO, NONE)
+#define FAKE6502_INFO_OP_txa            FAKE6502_INFO_OP(TXA, X, A, NO, NZ, NO, NONE)
+#define FAKE6502_INFO_OP_txs            FAKE6502_INFO_OP(TXS, X, S, NO, NO, NO, NONE)
+#define FAKE6502_INFO_OP_tya            FAKE6502_INFO_OP(TYA, Y, A, NO, NZ, NO, NONE)
+
+// the operation's name goes through FAKE6502_INFO_FN() to expand D(),
+// and the lists through FAKE6502_INFO_MAKE() to be split into arguments
+
+#define FAKE6502_INFO_FN(m_fn)          FAKE6502_INFO_FN_PASTE(m_fn)
+#define FAKE6502_INFO_FN_PASTE(m_fn)    FAKE6502_INFO_OP_##m_fn
+#define FAKE6502_INFO_MAKE(...)         FAKE6502_INFO_BUILD(__VA_ARGS__)
+#define FAKE6502_INFO_BUILD(m_ticks, m_addressing, m_size, m_index, m_penalty,       \
+                            m_mnemonic, m_reads, m_writes, m_flags_read,            \
+                            m_flags_written, m_memory, m_flow)                      \
+    {m_size, m_mnemonic, m_addressing, m_ticks, (m_index) | (m_reads), m_writes,    \
+     m_flags_read, m_flags_written, m_memory, m_flow, m_penalty}
+
+#define FAKE6502_INFO_ENTRY(m_op, m_mode, m_fn, m_ticks)  \
+    [m_op] = FAKE6502_INFO_MAKE(m_ticks, FAKE6502_INFO_MODE_##m_mode, FAKE6502_INFO_FN(m_fn)),
+
+const fake6502_opcode_info fake6502_opcode_infos[3][256] = {
+    [FAKE6502_VARIANT_NMOS] = {FAKE6502_OPCODES_NMOS(FAKE6502_INFO_ENTRY)},
+    [FAKE6502_VARIANT_CMOS] = {FAKE6502_OPCODES_CMOS(FAKE6502_INFO_ENTRY)},
+    [FAKE6502_VARIANT_2A03] = {FAKE6502_OPCODES_2A03(FAKE6502_INFO_ENTRY)}
+};
+
+#define FAKE6502_MNEMONIC_NAME(m_name)  #m_name,
+
+const char *const fake6502_mnemonic_names[] = {
+    FAKE6502_MNEMONICS(FAKE6502_MNEMONIC_NAME)
+};
+
+const char *const fake6502_addressing_names[] = {
+    "imp", "acc", "imm", "zp", "zpx", "zpy", "rel", "abs",
+    "absx", "absy", "ind", "indx", "indy", "zpi", "absxi"
+};
+
+
+// -------------------------------------------------------------------
+
+// the opcode counters, see FAKE6502_COUNTERS
+
+void fake6502_counters_attach(fake6502_context *c, fake6502_counters *counters)
+{
+    if (counters)
+        memset(counters, 0, sizeof(*counters));
+    c->counters = counters;
+}
+
+void fake6502_counters_snapshot(fake6502_context *c, fake6502_counters *snapshot)
+{
+    if (c->counters)
+        *snapshot = *c->counters;
+    else
+        memset(snapshot, 0, sizeof(*snapshot));
+}
+
+void fake6502_counters_reset(fake6502_context *c)
+{
+    if (c->counters)
+        memset(c->counters, 0, sizeof(*c->counters));
+}
+
+// the report sorts these, as qsort() has no context argument in ANSI C
+// and reports may be written from several threads at once
+
+typedef struct fake6502_report_line {
+    uint64_t cycles;
+    uint8_t op;
+} fake6502_report_line;
+
+static int fake6502_report_order(const void *a, const void *b)
+{
+    const fake6502_report_line *la = a, *lb = b;
+
+    return(la->cycles < lb->cycles ? 1 : la->cycles > lb->cycles ? -1 : la->op - lb->op);
+}
+
+// every opcode that ran, most cycles first, with the cycles over its base
+// count from page crossings and taken branches
+
+void fake6502_counters_report(const fake6502_counters *counters,
+                              fake6502_variant variant, FILE *out)
+{
+    fake6502_report_line order[256];
+    uint64_t total = 0;
+
+    for (int op = 0; op < 256; op++)
+    {
+        order[op].cycles = counters->cycles[op];
+        order[op].op = op;
+        total += counters->cycles[op];
+    }
+
+    qsort(order, 256, sizeof(order[0]), fake6502_report_order);
+
+    fprintf(out, "op  operation  mode        executed          cycles  extra%%  total%%\n");
+    for (int i = 0; i < 256 && counters->executed[order[i].op]; i++)
+    {
+        uint8_t op = order[i].op;
+        uint64_t base = counters->executed[op] * fake6502_opcode_tables[variant][op].clockticks;
+
+        fprintf(out, "%02x  %-9s  %-6s  %12llu  %14llu  %6.2f  %6.2f\n", op,
+                fake6502_names[variant][op][1], fake6502_names[variant][op][0],
+                (unsigned long long)counters->executed[op],
+                (unsigned long long)counters->cycles[op],
+                100.0 * (counters->cycles[op] - base) / counters->cycles[op],
+                100.0 * counters->cycles[op] / total);
+    }
+}
+
+
+// -------------------------------------------------------------------
+
+// the call graph profile, see FAKE6502_PROFILE
+
+void fake6502_profile_attach(fake6502_context *c, fake6502_profile *profile)
+{
+    if (profile)
+    {
+        memset(profile, 0, sizeof(*profile));
+        profile->nodes[0].entry = c->cpu.pc;
+        profile->node_count = 1;
+        profile->last = (uint32_t)c->emu.clockticks;
+    }
+    c->profile = profile;
+}
+
+// charge the cycles since the last call or return to the routine on top
+
+static void fake6502_profile_flush(fake6502_context *c, fake6502_profile *p)
+{
+    uint32_t now = (uint32_t)c->emu.clockticks;
+    uint32_t node = p->depth ? p->frames[p->depth - 1].node : 0;
+
+    p->nodes[node].cycles += now - p->last;
+    if (p->depth)
+        p->exclusive[p->nodes[node].entry] += now - p->last;
+    p->last = now;
+}
+
+#ifdef FAKE6502_PROFILE
+
+// the node for entry called from parent, or UINT32_MAX when they are all
+// in use; the buckets hold the first node of each chain, 0 being the root
+// which is never in one
+
+static uint32_t fake6502_profile_find(fake6502_profile *p, uint32_t parent, uint16_t entry)
+{
+    uint32_t *bucket = &p->buckets[(parent * 0x9e37u ^ entry) & (FAKE6502_PROFILE_NODES - 1)];
+    uint32_t node;
+
+    for (node = *bucket; node; node = p->nodes[node].chain)
+        if (p->nodes[node].parent == parent && p->nodes[node].entry == entry)
+            return(node);
+
+    if (p->node_count == FAKE6502_PROFILE_NODES)
+        return(UINT32_MAX);
+
+    node = p->node_count++;
+    p->nodes[node].parent = parent;
+    p->nodes[node].entry = entry;
+    p->nodes[node].chain = *bucket;
+    *bucket = node;
+    return(node);
+}
+
+// a call to entry that returns when the stack pointer is back up to s
+
+static void fake6502_profile_call(fake6502_context *c, uint16_t entry, uint8_t s)
+{
+    fake6502_profile *p = c->profile;
+    uint32_t node;
+
+    fake6502_profile_flush(c, p);
+    node = p->depth < FAKE6502_PROFILE_DEPTH ?
+        fake6502_profile_find(p, p->depth ? p->frames[p->depth - 1].node : 0, entry) :
+        UINT32_MAX;
+    if (node == UINT32_MAX)
+    {
+        // the routine's cycles stay with its caller, and its return pops
+        // nothing as the caller's frame is further up the stack
+        p->dropped++;
+        return;
+    }
+
+    p->frames[p->depth].node = node;
+    p->frames[p->depth].start = p->last;
+    p->frames[p->depth].s = s;
+    p->depth++;
+    p->calls[entry]++;
+}
+
+// a return, popping every routine it has left, however the stack got there
+
+static void fake6502_profile_return(fake6502_context *c)
+{
+    fake6502_profile *p = c->profile;
+
+    fake6502_profile_flush(c, p);
+    while (p->depth && p->frames[p->depth - 1].s <= c->cpu.s)
+    {
+        fake6502_profile_frame *f = &p->frames[--p->depth];
+        uint16_t entry = p->nodes[f->node].entry;
+        int outer = 0;
+
+        // a recursive routine's time is inside its outermost call
+        for (int i = 0; i < p->depth && !outer; i++)
+            outer = p->nodes[p->frames[i].node].entry == entry;
+        if (!outer)
+            p->inclusive[entry] += p->last - f->start;
+    }
+}
+
+// a reset leaves every routine and starts the clock again from 0
+
+static void fake6502_profile_restart(fake6502_context *c)
+{
+    fake6502_profile *p = c->profile;
+
+    fake6502_profile_flush(c, p);
+    p->depth = 0;
+    p->last = 0;
+}
+
+#endif
+
+// one line for each call stack that ran, the entry addresses from the
+// outermost in and then its exclusive cycles, as flamegraph.pl and
+// speedscope read them
+
+void fake6502_profile_folded(fake6502_context *c, FILE *out)
+{
+    fake6502_profile *p = c->profile;
+    uint16_t path[FAKE6502_PROFILE_DEPTH + 1];
+
+    if (!p)
+        return;
+
+    fake6502_profile_flush(c, p);
+    for (uint32_t node = 0; node < p->node_count; node++)
+    {
+        int length = 0;
+
+        if (!p->nodes[node].cycles)
+            continue;
+
+        for (uint32_t n = node; length == 0 || n; n = p->nodes[n].parent)
+            path[length++] = p->nodes[n].entry;
+        if (node)
+            path[length++] = p->nodes[0].entry;
+
+        while (length--)
+            fprintf(out, "%04x%s", path[length], length ? ";" : "");
+        fprintf(out, " %llu\n", (unsigned long long)p->nodes[node].cycles);
+    }
+}
+
+// every routine called, by address; inclusive cycles are only counted on
+// return, so those still on the stack have less than they will
+
+void fake6502_profile_report(fake6502_context *c, FILE *out)
+{
+    fake6502_profile *p = c->profile;
+
+    if (!p)
+        return;
+
+    fake6502_profile_flush(c, p);
+    fprintf(out, "entry       calls       inclusive       exclusive\n");
+    for (int entry = 0; entry < 65536; entry++)
+        if (p->calls[entry])
+            fprintf(out, "%04x   %10lu  %14llu  %14llu\n", entry,
+                    (unsigned long)p->calls[entry],
+                    (unsigned long long)p->inclusive[entry],
+                    (unsigned long long)p->exclusive[entry]);
+    if (p->dropped)
+        fprintf(out, "%lu calls not followed\n", (unsigned long)p->dropped);
+}
+
+
+// -------------------------------------------------------------------
+
+// the timed events, see fake6502_events_attach()
+
+void fake6502_events_attach(fake6502_context *c, fake6502_events *events)
+{
+    if (events)
+    {
+        memset(events, 0, sizeof(*events));
+        events->last_ticks = (uint32_t)c->emu.clockticks;
+    }
+    c->events = events;
+}
+
+// bring the 64 bit count up to the context's clockticks
+
+static inline void fake6502_events_sync(fake6502_context *c, fake6502_events *e)
+{
+    e->now += (uint32_t)c->emu.clockticks - e->last_ticks;
+    e->last_ticks = (uint32_t)c->emu.clockticks;
+}
+
+uint64_t fake6502_events_now(fake6502_context *c)
+{
+    if (!c->events)
+        return(0);
+
+    fake6502_events_sync(c, c->events);
+    return(c->events->now);
+}
+
+// events due at the same cycle fire in the order they were added
+
+static inline bool fake6502_event_before(const fake6502_event *a, const fake6502_event *b)
+{ return(a->cycle < b->cycle || (a->cycle == b->cycle && a->id < b->id)); }
+
+static void fake6502_events_up(fake6502_events *e, int i)
+{
+    fake6502_event event = e->heap[i];
+
+    while (i && fake6502_event_before(&event, &e->heap[(i - 1) / 2]))
+    {
+        e->heap[i] = e->heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    e->heap[i] = event;
+}
+
+static void fake6502_events_down(fake6502_events *e, int i)
+{
+    fake6502_event event = e->heap[i];
+
+    for (;;)
+    {
+        int child = i * 2 + 1;
+
+        if (child >= e->count)
+            break;
+        if (child + 1 < e->count && fake6502_event_before(&e->heap[child + 1], &e->heap[child]))
+            child++;
+        if (!fake6502_event_before(&e->heap[child], &event))
+            break;
+        e->heap[i] = e->heap[child];
+        i = child;
+    }
+    e->heap[i] = event;
+}
+
+static void fake6502_events_remove(fake6502_events *e, int i)
+{
+    e->heap[i] = e->heap[--e->count];
+    if (i < e->count)
+    {
+        fake6502_events_up(e, i);
+        fake6502_events_down(e, i);
+    }
+}
+
+// an event due at cycle, as fake6502_events_now() counts them, and then
+// every period cycles if that is not 0; returns its id for
+// fake6502_event_cancel(), or 0 if there are no events attached or they
+// are full. fn is only called for FAKE6502_EVENT_CALL
+
+uint32_t fake6502_event_add(fake6502_context *c, uint64_t cycle, uint64_t period,
+                            fake6502_event_kind kind, fake6502_event_fn fn, void *user)
+{
+    fake6502_events *e = c->events;
+    fake6502_event *event;
+
+    if (!e || e->count == FAKE6502_EVENTS_MAX)
+        return(0);
+
+    event = &e->heap[e->count++];
+    event->cycle = cycle;
+    event->period = period;
+    event->kind = kind;
+    event->fn = fn;
+    event->user = user;
+    if (!++e->next_id)
+        e->next_id++;
+    event->id = e->next_id;
+    fake6502_events_up(e, e->count - 1);
+    return(event->id);
+}
+
+bool fake6502_event_cancel(fake6502_context *c, uint32_t id)
+{
+    fake6502_events *e = c->events;
+
+    for (int i = 0; e && i < e->count; i++)
+        if (e->heap[i].id == id)
+        {
+            fake6502_events_remove(e, i);
+            return(true);
+        }
+    return(false);
+}
+
+// fire every event that is due, then take a held IRQ if interrupts are
+// enabled; returns why to stop, if a callback called fake6502_stop() or an
+// interrupt hit a watchpoint, or FAKE6502_STOP_NONE
+
+static fake6502_stop_reason fake6502_events_fire(fake6502_context *c)
+{
+    fake6502_events *e = c->events;
+
+    fake6502_events_sync(c, e);
+    c->emu.stop = FAKE6502_STOP_NONE;
+
+    while (e->count && e->heap[0].cycle <= e->now)
+    {
+        fake6502_event event = e->heap[0];
+
+        // a periodic event keeps its place, and its id, for next time,
+        // firing once however many periods the last instruction took
+        if (event.period)
+        {
+            e->heap[0].cycle += ((e->now - event.cycle) / event.period + 1) * event.period;
+            fake6502_events_down(e, 0);
+        }
+        else
+            fake6502_events_remove(e, 0);
+
+        switch (event.kind)
+        {
+        case FAKE6502_EVENT_IRQ:
+            e->irq_held = true;
+            break;
+        case FAKE6502_EVENT_NMI:
+            fake6502_nmi(c);
+            break;
+        default:
+            event.fn(c, event.user);
+            break;
+        }
+    }
+
+    if (fake6502_irq_due(c))
+    {
+        e->irq_held = false;
+        fake6502_irq(c);
+    }
+
+    return(c->emu.stop);
+}
+
+
+// -------------------------------------------------------------------
+
+// the breakpoints and watchpoints, see FAKE6502_BREAKPOINTS
+
+void fake6502_breakpoints_attach(fake6502_context *c, fake6502_breakpoints *breakpoints)
+{
+    if (breakpoints)
+        memset(breakpoints, 0, sizeof(*breakpoints));
+    c->breakpoints = breakpoints;
+}
+
+// set or clear count addresses from address, wrapping at $ffff
+
+void fake6502_breakpoint_set(fake6502_breakpoints *breakpoints,
+                             fake6502_breakpoint_kind kind, uint16_t address,
+                             int count, bool on)
+{
+    for (int i = 0; i < count; i++, address++)
+    {
+        if (on)
+            breakpoints->bits[kind][address >> 3] |= 1 << (address & 7);
+        else
+            breakpoints->bits[kind][address >> 3] &= ~(1 << (address & 7));
+    }
+}
+
+
+// -------------------------------------------------------------------
+
+// fake 6502 - API
+
+// the main functions, for use by the host
+
+void fake6502_init(fake6502_context *c, fake6502_mem_read_fn read,
+                   fake6502_mem_write_fn write, void *state_host)
+{
+    memset(c, 0, sizeof(*c));
+
+    c->bus.read = read;
+    c->bus.write = write;
+    c->engine = FAKE6502_ENGINE_TABLE;
+    c->variant = FAKE6502_VARIANT_DEFAULT;
+    c->state_host = state_host;
+
+    arith_ready();
+}
+
+// run the table lookups used by ADC and SBC against add8()/sub8() for
+// every A, operand, carry and decimal, returns the number that differ
+
+int fake6502_arith_check(void)
+{
+    fake6502_context table, ref;
+    int errors = 0;
+
+    arith_ready();
+
+    memset(&table, 0, sizeof(table));
+    memset(&ref, 0, sizeof(ref));
+
+    for (int i = 0; i < 2 * FAKE6502_ARITH_SIZE; i++)
+    {
+        bool sbc = i & 0x40000, decimal = i & 0x20000, carry = i & 0x10000;
+        uint8_t a = i >> 8, b = i;
+
+        table.cpu.a = a;
+        table.cpu.flags = (decimal ? FAKE6502_DECIMAL_FLAG : 0) | (carry ? FAKE6502_CARRY_FLAG : 0);
+        fake6502_flags_unpack(&table);
+        ref.cpu.flags = table.cpu.flags;
+        fake6502_flags_unpack(&ref);
+
+        arith(&table, sbc ? fake6502_sbc_table : fake6502_adc_table, b,
+              table.cpu.flags & FAKE6502_DECIMAL_FLAG);
+        if (sbc)
+            ref.cpu.a = sub8(&ref, a, b, carry, decimal);
+        else
+            ref.cpu.a = add8(&ref, a, b, carry, decimal);
+
+        if (table.cpu.a != ref.cpu.a || fake6502_flags_get(&table) != fake6502_flags_get(&ref))
+            errors++;
+    }
+
+    return(errors);
+}
+
+void fake6502_reset(fake6502_context *c)
+{
+    // The 6502 normally does some fake reads after reset because
+    // reset is a hacked-up version of NMI/IRQ/BRK
+    // See https://www.pagetable.com/?p=410
+    if (c->mode == FAKE6502_MODE_ACCURATE)
+    {
+        fake6502_mem_read(c, 0x00ff);
+        fake6502_mem_read(c, 0x00ff);
+        fake6502_mem_read(c, 0x00ff);
+        fake6502_mem_read(c, 0x0100);
+        fake6502_mem_read(c, 0x01ff);
+        fake6502_mem_read(c, 0x01fe);
+    }
+    c->cpu.pc = fake6502_mem_read16(c, 0xfffc);
+    c->cpu.s = 0xfd;
+    c->cpu.flags |= FAKE6502_CONSTANT_FLAG | FAKE6502_INTERRUPT_FLAG;
+
+    c->emu.instructions = 0;
+#ifdef FAKE6502_PROFILE
+    if (c->profile)
+        fake6502_profile_restart(c);
+#endif
+    if (c->events)
+    {
+        fake6502_events_sync(c, c->events);
+        c->events->last_ticks = 0;
+        c->events->irq_held = false;
+    }
+    c->emu.clockticks = 0;
+}
+
+void fake6502_nmi(fake6502_context *c)
+{
+    fake6502_push_16(c, c->cpu.pc);
+    fake6502_push_8(c, c->cpu.flags & ~FAKE6502_BREAK_FLAG);
+    c->cpu.flags |= FAKE6502_INTERRUPT_FLAG;
+    c->cpu.pc = fake6502_mem_read16(c, 0xfffa);
+#ifdef FAKE6502_PROFILE
+    if (c->profile)
+        fake6502_profile_call(c, c->cpu.pc, c->cpu.s + 3);
+#endif
+}
+
+void fake6502_irq(fake6502_context *c)
+{
+    if ((c->cpu.flags & FAKE6502_INTERRUPT_FLAG) == 0)
+    {
+        fake6502_push_16(c, c->cpu.pc);
+        fake6502_push_8(c, c->cpu.flags & ~FAKE6502_BREAK_FLAG);
+        c->cpu.flags |= FAKE6502_INTERRUPT_FLAG;
+        c->cpu.pc = fake6502_mem_read16(c, 0xfffe);
+#ifdef FAKE6502_PROFILE
+        if (c->profile)
+            fake6502_profile_call(c, c->cpu.pc, c->cpu.s + 3);
+#endif
+    }
+}
+
+// the table engine: look the addressing mode and operation up in
+// the variant's opcode table and call them through their function pointers
+
+static inline void fake6502_execute_table(fake6502_context *c, fake6502_opcode *table)
+{
+    uint8_t opcode = fake6502_mem_read(c, c->cpu.pc++);
+    c->emu.opcode = opcode;
+    c->cpu.flags |= FAKE6502_CONSTANT_FLAG;
+
+    table[opcode].addr_mode(c);
+    table[opcode].opcode(c);
+    c->emu.clockticks += table[opcode].clockticks;
+}
+
+// the fused engine: the same opcode list expanded into one switch case
+// per opcode, so the addressing mode, the operation and the clockticks
+// are all resolved at compile time and are inlined together
+
+#define FAKE6502_FUSED_CASE(m_op, m_mode, m_fn, m_ticks)  \
+    case m_op:                                          \
+        m_mode(c);                                      \
+        m_fn(c);                                        \
+        c->emu.clockticks += m_ticks;                   \
+        break;
+
+static inline void fake6502_execute_fused(fake6502_context *c, fake6502_variant variant)
+{
+    uint8_t opcode = fake6502_mem_read(c, c->cpu.pc++);
+    c->emu.opcode = opcode;
+    c->cpu.flags |= FAKE6502_CONSTANT_FLAG;
+
+    if (variant == FAKE6502_VARIANT_CMOS)
+    {
+        switch (opcode)
+        {
+            FAKE6502_OPCODES_CMOS(FAKE6502_FUSED_CASE)
+        }
+    }
+    else if (variant == FAKE6502_VARIANT_2A03)
+    {
+        switch (opcode)
+        {
+            FAKE6502_OPCODES_2A03(FAKE6502_FUSED_CASE)
+        }
+    }
+    else
+    {
+        switch (opcode)
+        {
+            FAKE6502_OPCODES_NMOS(FAKE6502_FUSED_CASE)
+        }
+    }
+}
+
+// the cache engine: instructions in pages mapped with fake6502_pages_map()
+// are decoded once into c->cache, and afterwards run straight from their
+// entry, without fetching or decoding the opcode and operand again; code
+// anywhere else runs through the fused engine
+
+#ifndef FAKE6502_BUS_FLAT
+static inline uint8_t fake6502_cache_byte(fake6502_context *c, uint16_t address)
+{ return(c->bus.read_pages[address >> 8][address & 0xFF]); }
+#endif
+
+static inline bool fake6502_cache_decode(fake6502_context *c, fake6502_variant variant,
+                                         uint16_t pc, fake6502_decoded *d)
+{
+#ifdef FAKE6502_BUS_FLAT
+    (void)c;
+    (void)variant;
+    (void)pc;
+    (void)d;
+    return(false);
+#else
+    const uint8_t *operands = variant == FAKE6502_VARIANT_CMOS ? fake6502_operands_cmos
+                                                               : fake6502_operands_nmos;
+    uint8_t kind;
+
+    if (!c->bus.read_pages[pc >> 8])
+        return(false);
+
+    d->opcode = fake6502_cache_byte(c, pc);
+    kind = operands[d->opcode];
+    d->length = kind == FAKE6502_OPERAND_WORD ? 3 : kind == FAKE6502_OPERAND_NONE ? 1 : 2;
+
+    // the whole instruction has to be in mapped pages
+    if (!c->bus.read_pages[(uint16_t)(pc + d->length - 1) >> 8])
+        return(false);
+
+    if (kind == FAKE6502_OPERAND_ADDR)
+        d->operand = pc + 1;
+    else if (kind == FAKE6502_OPERAND_BYTE)
+        d->operand = fake6502_cache_byte(c, pc + 1);
+    else if (kind == FAKE6502_OPERAND_WORD)
+        d->operand = fake6502_cache_byte(c, pc + 1) |
+                     (uint16_t)fake6502_cache_byte(c, pc + 2) << 8;
+    else
+        d->operand = 0;
+
+    for (int i = 0; i < d->length; i++)
+        fake6502_cache_protect(c, (uint16_t)(pc + i) >> 8);
+
+    c->cache->entries[pc] = *d;
+    return(true);
+#endif
+}
+
+#define FAKE6502_CACHED_CASE(m_op, m_mode, m_fn, m_ticks)  \
+    case m_op:                                           \
+        m_mode##_pre(c, d.operand);                      \
+        m_fn(c);                                         \
+        c->emu.clockticks += m_ticks;                    \
+        break;
+
+static inline void fake6502_execute_cached(fake6502_context *c, fake6502_variant variant)
+{
+    // a copy, as the instruction may overwrite itself
+    fake6502_decoded d = c->cache->entries[c->cpu.pc];
+
+    // not in mapped memory; the table engine keeps this path small
+    if (!d.length && !fake6502_cache_decode(c, variant, c->cpu.pc, &d))
+    {
+        fake6502_execute_table(c, fake6502_opcode_tables[variant]);
+        return;
+    }
+
+    c->emu.opcode = d.opcode;
+    c->cpu.pc += d.length;
+    c->cpu.flags |= FAKE6502_CONSTANT_FLAG;
+
+    if (variant == FAKE6502_VARIANT_CMOS)
+    {
+        switch (d.opcode)
+        {
+            FAKE6502_OPCODES_CMOS(FAKE6502_CACHED_CASE)
+        }
+    }
+    else if (variant == FAKE6502_VARIANT_2A03)
+    {
+        switch (d.opcode)
+        {
+            FAKE6502_OPCODES_2A03(FAKE6502_CACHED_CASE)
+        }
+    }
+    else
+    {
+        switch (d.opcode)
+        {
+            FAKE6502_OPCODES_NMOS(FAKE6502_CACHED_CASE)
+        }
+    }
+}
+
+// the cache is decoded for one variant; start again if the context changed
+
+static inline void fake6502_cache_check(fake6502_context *c, fake6502_variant variant)
+{
+    if (c->cache->variant != variant)
+    {
+        fake6502_cache_flush(c);
+        c->cache->variant = variant;
+    }
+}
+
+// the JIT: a block of instructions that has been run FAKE6502_JIT_HOT
+// times is translated into x86-64 code that sets the pc, works out the ea
+// and calls the handler for each instruction in turn, with no fetching,
+// decoding or dispatch; constant eas (zp, abs, #imm) are stored directly.
+// A block ends after a branch, jump, return, BRK or halt, or at the end
+// of the page it starts in. Blocks return the number of instructions
+// they ran, and stop early if the host calls fake6502_stop() or a write
+// hits translated code.
+
+#ifdef FAKE6502_JIT_X86_64
+
+#define FAKE6502_JIT_OFFSET(m_field)    ((uint32_t)offsetof(fake6502_context, m_field))
+
+static void jit_bytes(uint8_t **p, const void *bytes, size_t n)
+{
+    memcpy(*p, bytes, n);
+    *p += n;
+}
+
+static void jit_modrm_rbx(uint8_t **p, uint8_t opcode, uint8_t reg, uint32_t disp)
+{
+    uint8_t modrm = 0x83 | (reg << 3);  // [rbx + disp32]
+
+    jit_bytes(p, &opcode, 1);
+    jit_bytes(p, &modrm, 1);
+    jit_bytes(p, &disp, 4);
+}
+
+// mov rdi, rbx; mov esi, operand; mov rax, fn; call rax
+
+static void jit_call(uint8_t **p, void (*fn)(void), bool with_operand, uint32_t operand)
+{
+    static const uint8_t mov_rdi_rbx[] = {0x48, 0x89, 0xdf};
+    static const uint8_t mov_rax[] = {0x48, 0xb8};
+    static const uint8_t call_rax[] = {0xff, 0xd0};
+    uint8_t mov_esi = 0xbe;
+
+    jit_bytes(p, mov_rdi_rbx, sizeof(mov_rdi_rbx));
+    if (with_operand)
+    {
+        jit_bytes(p, &mov_esi, 1);
+        jit_bytes(p, &operand, 4);
+    }
+    jit_bytes(p, mov_rax, sizeof(mov_rax));
+    jit_bytes(p, &fn, 8);
+    jit_bytes(p, call_rax, sizeof(call_rax));
+}
+
+static bool jit_ends_block(void (*fn)(fake6502_context *c))
+{
+    return( fn == bcc || fn == bcs || fn == beq || fn == bmi || fn == bne ||
+            fn == bpl || fn == bvc || fn == bvs || fn == bra || fn == jmp ||
+            fn == jsr || fn == rts || fn == rti || fn == brk || fn == hlt );
+}
+
+static fake6502_jit_block *fake6502_jit_compile(fake6502_context *c, fake6502_variant variant,
+                                                uint16_t start)
+{
+    static const uint8_t prologue[] = {0x53, 0x48, 0x89, 0xfb};  // push rbx; mov rbx, rdi
+    static const uint8_t epilogue[] = {0x5b, 0xc3};              // pop rbx; ret
+    const fake6502_opcode *table = fake6502_opcode_tables[variant];
+    const fake6502_addr_pre *pres = variant == FAKE6502_VARIANT_CMOS ? fake6502_pres_cmos
+                                                                      : fake6502_pres_nmos;
+    fake6502_jit *jit = c->jit;
+    fake6502_jit_block *block;
+    uint8_t *exits[FAKE6502_JIT_BLOCK_MAX];
+    uint8_t *code, *p;
+    uint16_t pc = start;
+    int count = 0;
+
+    if (jit->code_used + FAKE6502_JIT_BLOCK_CODE > FAKE6502_JIT_CODE_SIZE ||
+        jit->header_count == FAKE6502_JIT_BLOCKS)
+        fake6502_cache_flush(c);
+
+    // a failure here or below can leave other blocks not executable
+    if (!fake6502_jit_protect(jit, jit->code_used, PROT_READ | PROT_WRITE))
+    {
+        fake6502_jit_flush(jit);
+        return(NULL);
+    }
+
+    block = &jit->headers[jit->header_count];
+    memset(block, 0, sizeof(*block));
+    block->start = start;
+    block->first_page = start >> 8;
+
+    code = p = jit->code + jit->code_used;
+    memcpy(&block->fn, &p, sizeof(p));
+    jit_bytes(&p, prologue, sizeof(prologue));
+    jit_modrm_rbx(&p, 0x80, 1, FAKE6502_JIT_OFFSET(cpu.flags));     // or byte
+    *p++ = FAKE6502_CONSTANT_FLAG;
+
+    while (count < FAKE6502_JIT_BLOCK_MAX)
+    {
+        fake6502_decoded d;
+        const fake6502_opcode *op;
+        fake6502_addr_pre pre;
+        uint16_t next;
+        uint32_t ticks;
+
+        if (!fake6502_cache_decode(c, variant, pc, &d))
+            break;
+
+        op = &table[d.opcode];
+        pre = pres[d.opcode];
+        next = pc + d.length;
+        ticks = op->clockticks;
+
+        // stop early if the previous instruction wrote to code or the host
+        // asked to stop; eax is the count so far
+        if (count)
+        {
+            *p++ = 0xb8;                                            // mov eax, count
+            jit_bytes(&p, &count, 4);
+            jit_modrm_rbx(&p, 0x83, 7, FAKE6502_JIT_OFFSET(emu.stop)); // cmp dword, 0
+            *p++ = 0;
+            *p++ = 0x0f; *p++ = 0x85; exits[count - 1] = p; p += 4;    // jne exit
+            jit_modrm_rbx(&p, 0x80, 7, FAKE6502_JIT_OFFSET(emu.code_written)); // cmp byte, 0
+            *p++ = 0;
+            *p++ = 0x0f; *p++ = 0x85; p += 4;                          // jne exit
+        }
+
+        jit_bytes(&p, (uint8_t[]){0x66, 0xc7, 0x83}, 3);               // mov word pc, next
+        jit_bytes(&p, &(uint32_t){FAKE6502_JIT_OFFSET(cpu.pc)}, 4);
+        jit_bytes(&p, &next, 2);
+        jit_modrm_rbx(&p, 0xc6, 0, FAKE6502_JIT_OFFSET(emu.opcode));   // mov byte opcode
+        *p++ = d.opcode;
+
+        if (pre == zp_pre || pre == abso_pre || pre == imm_pre)
+        {
+            jit_bytes(&p, (uint8_t[]){0x66, 0xc7, 0x83}, 3);           // mov word ea, operand
+            jit_bytes(&p, &(uint32_t){FAKE6502_JIT_OFFSET(emu.ea)}, 4);
+            jit_bytes(&p, &d.operand, 2);
+        }
+        else if (pre != imp_pre && pre != acc_pre)
+            jit_call(&p, (void (*)(void))pre, true, d.operand);
+
+        jit_call(&p, (void (*)(void))op->opcode, false, 0);
+        jit_modrm_rbx(&p, 0x81, 0, FAKE6502_JIT_OFFSET(emu.clockticks)); // add dword
+        jit_bytes(&p, &ticks, 4);
+
+        // a page crossing costs 1, a branch taken up to 2
+        block->max_ticks += ticks + 3;
+        block->end = next - 1;
+        block->last_page = block->end >> 8;
+        count++;
+        pc = next;
+
+        if (jit_ends_block(op->opcode) || (pc >> 8) != block->first_page)
+            break;
+    }
+
+    if (count)
+    {
+        // the second jne of each check follows the first by 13 bytes
+        *p++ = 0xb8;                                                // mov eax, count
+        jit_bytes(&p, &count, 4);
+        for (int i = 0; i < count - 1; i++)
+        {
+            int32_t rel = (int32_t)(p - (exits[i] + 4));
+            memcpy(exits[i], &rel, 4);
+            rel = (int32_t)(p - (exits[i] + 17));
+            memcpy(exits[i] + 13, &rel, 4);
+        }
+        jit_bytes(&p, epilogue, sizeof(epilogue));
+    }
+
+    if (!fake6502_jit_protect(jit, jit->code_used, PROT_READ | PROT_EXEC))
+    {
+        fake6502_jit_flush(jit);
+        return(NULL);
+    }
+
+    if (!count)
+        return(NULL);
+
+    block->count = count;
+    block->live = 1;
+    jit->header_count++;
+    jit->code_used += (size_t)(p - code + 15) & ~(size_t)15;
+    jit->blocks[start] = block;
+    jit->page_blocks[block->first_page]++;
+    block->next[0] = jit->page_lists[block->first_page];
+    jit->page_lists[block->first_page] = block;
+    if (block->last_page != block->first_page)
+    {
+        jit->page_blocks[block->last_page]++;
+        block->next[1] = jit->page_lists[block->last_page];
+        jit->page_lists[block->last_page] = block;
+    }
+
+    return(block);
+}
+
+// run translated blocks where the budgets allow the whole block to run,
+// and the cached engine everywhere else
+
+static inline fake6502_stop_reason fake6502_run_jit(fake6502_context *c,
+    int cycle_budget, int instr_budget, fake6502_variant variant)
+{
+    unsigned cycle_limit = cycle_budget > 0 ? (unsigned)cycle_budget : UINT_MAX;
+    unsigned instr_limit = instr_budget > 0 ? (unsigned)instr_budget : UINT_MAX;
+    unsigned start_ticks = (unsigned)c->emu.clockticks;
+    unsigned instructions = 0;
+    fake6502_jit *jit = c->jit;
+    fake6502_stop_reason reason;
+
+    c->emu.stop = FAKE6502_STOP_NONE;
+    fake6502_flags_unpack(c);
+
+    do
+    {
+        uint16_t pc = c->cpu.pc;
+        fake6502_jit_block *block = jit->blocks[pc];
+
+        if (!block && c->bus.read_pages[pc >> 8] && ++jit->heat[pc] >= FAKE6502_JIT_HOT)
+        {
+            jit->heat[pc] = 0;
+            block = fake6502_jit_compile(c, variant, pc);
+        }
+
+        if (block && block->count <= instr_limit - instructions &&
+            block->max_ticks < cycle_limit - ((unsigned)c->emu.clockticks - start_ticks))
+        {
+            c->emu.code_written = 0;
+            instructions += block->fn(c);
+        }
+        else
+        {
+            fake6502_execute_cached(c, variant);
+            instructions++;
+        }
+    } while (!c->emu.stop &&
+             (unsigned)c->emu.clockticks - start_ticks < cycle_limit &&
+             instructions < instr_limit);
+
+    fake6502_flags_pack(c);
+    c->emu.instructions += instructions;
+
+    reason = c->emu.stop ? c->emu.stop : FAKE6502_STOP_BUDGET;
+    c->emu.stop = FAKE6502_STOP_NONE;
+    return(reason);
+}
+
+#endif
+
+// the engine and the variant are constants at each call site, so every
+// combination gets its own copy of the loop, with no per-instruction
+// check of c->engine or c->variant
+
+static inline void fake6502_execute(fake6502_context *c, fake6502_engine engine,
+                                    fake6502_variant variant)
+{
+    if (engine == FAKE6502_ENGINE_CACHED)
+        fake6502_execute_cached(c, variant);
+    else if (engine == FAKE6502_ENGINE_FUSED)
+        fake6502_execute_fused(c, variant);
+    else if (variant == FAKE6502_VARIANT_CMOS)
+        fake6502_execute_table(c, fake6502_opcodes_cmos);
+    else if (variant == FAKE6502_VARIANT_2A03)
+        fake6502_execute_table(c, fake6502_opcodes_2a03);
+    else
+        fake6502_execute_table(c, fake6502_opcodes_nmos);
+}
+
+// record the instruction about to run, and once it has, its opcode and
+// effective address
+
+#ifdef FAKE6502_TRACE
+static inline fake6502_trace_entry *fake6502_trace_begin(fake6502_context *c)
+{
+    fake6502_trace_entry *e;
+
+    if (!c->trace)
+        return(NULL);
+
+    e = &c->trace->entries[c->trace->next++ & (FAKE6502_TRACE_SIZE - 1)];
+    e->clockticks = c->emu.clockticks;
+    e->pc = c->cpu.pc;
+    e->a = c->cpu.a;
+    e->x = c->cpu.x;
+    e->y = c->cpu.y;
+    e->s = c->cpu.s;
+    e->flags = fake6502_flags_get(c);
+    return(e);
+}
+
+static inline void fake6502_trace_end(fake6502_context *c, fake6502_trace_entry *e)
+{
+    if (!e)
+        return;
+
+    e->opcode = c->emu.opcode;
+    e->ea = c->emu.ea;
+}
+#endif
+
+// an instruction, with whatever the options record around it
+
+static inline void fake6502_execute_observed(fake6502_context *c, fake6502_engine engine,
+                                             fake6502_variant variant)
+{
+#ifdef FAKE6502_TRACE
+    fake6502_trace_entry *e = fake6502_trace_begin(c);
+#endif
+#ifdef FAKE6502_COUNTERS
+    int clockticks = c->emu.clockticks;
+#endif
+
+    fake6502_execute(c, engine, variant);
+
+#ifdef FAKE6502_TRACE
+    fake6502_trace_end(c, e);
+#endif
+#ifdef FAKE6502_COUNTERS
+    if (c->counters)
+    {
+        c->counters->executed[c->emu.opcode]++;
+        c->counters->cycles[c->emu.opcode] += c->emu.clockticks - clockticks;
+    }
+#endif
+#ifdef FAKE6502_BREAKPOINTS
+    if (c->breakpoints && !c->emu.stop &&
+        fake6502_breakpoint_test(c->breakpoints, FAKE6502_BREAK_EXEC, c->cpu.pc))
+        c->emu.stop = FAKE6502_STOP_BREAKPOINT;
+#endif
+#ifdef FAKE6502_PROFILE
+    if (c->profile)
+    {
+        switch (c->emu.opcode)
+        {
+        case 0x00:  // brk
+            fake6502_profile_call(c, c->cpu.pc, c->cpu.s + 3);
+            break;
+        case 0x20:  // jsr
+            fake6502_profile_call(c, c->cpu.pc, c->cpu.s + 2);
+            break;
+        case 0x40:  // rti
+        case 0x60:  // rts
+            fake6502_profile_return(c);
+            break;
+        }
+    }
+#endif
+}
+
+static inline fake6502_stop_reason fake6502_run_engine(fake6502_context *c,
+    int cycle_budget, int instr_budget, fake6502_engine engine, fake6502_variant variant)
+{
+    // a budget of 0 means no limit, so turn it into the largest count
+    unsigned cycle_limit = cycle_budget > 0 ? (unsigned)cycle_budget : UINT_MAX;
+    unsigned instr_limit = instr_budget > 0 ? (unsigned)instr_budget : UINT_MAX;
+    unsigned start_ticks = (unsigned)c->emu.clockticks;
+    unsigned instructions = 0;
+    fake6502_stop_reason reason;
+
+    c->emu.stop = FAKE6502_STOP_NONE;
+    fake6502_flags_unpack(c);
+
+    do
+    {
+        fake6502_execute_observed(c, engine, variant);
+        instructions++;
+    } while (!c->emu.stop &&
+             (unsigned)c->emu.clockticks - start_ticks < cycle_limit &&
+             instructions < instr_limit);
+
+    fake6502_flags_pack(c);
+    c->emu.instructions += instructions;
+
+    reason = c->emu.stop ? c->emu.stop : FAKE6502_STOP_BUDGET;
+    c->emu.stop = FAKE6502_STOP_NONE;
+    return(reason);
+}
+
+// whether the options are recording anything for the context
+
+#ifdef FAKE6502_TRACE
+#define FAKE6502_OBSERVED_TRACE(c)      ((c)->trace != NULL)
+#else
+#define FAKE6502_OBSERVED_TRACE(c)      false
+#endif
+#ifdef FAKE6502_COUNTERS
+#define FAKE6502_OBSERVED_COUNTERS(c)   ((c)->counters != NULL)
+#else
+#define FAKE6502_OBSERVED_COUNTERS(c)   false
+#endif
+#ifdef FAKE6502_PROFILE
+#define FAKE6502_OBSERVED_PROFILE(c)    ((c)->profile != NULL)
+#else
+#define FAKE6502_OBSERVED_PROFILE(c)    false
+#endif
+#ifdef FAKE6502_BREAKPOINTS
+#define FAKE6502_OBSERVED_BREAKPOINTS(c) ((c)->breakpoints != NULL)
+#else
+#define FAKE6502_OBSERVED_BREAKPOINTS(c) false
+#endif
+#define FAKE6502_OBSERVED(c)            (FAKE6502_OBSERVED_TRACE(c) ||                \
+                                         FAKE6502_OBSERVED_COUNTERS(c) ||             \
+                                         FAKE6502_OBSERVED_PROFILE(c) ||              \
+                                         FAKE6502_OBSERVED_BREAKPOINTS(c))
+
+// one loop per engine and variant, each flattened on its own so that the
+// compiler only has one switch of inlined handlers to deal with at a time;
+// without a JIT, or a cache for it to use, FAKE6502_ENGINE_JIT runs the
+// cached engine, and without a cache, or with breakpoints that have to see
+// every fetch, the fused one
+
+#ifdef FAKE6502_JIT_X86_64
+#define FAKE6502_RUN_JIT(m_variant, m_suffix)                                       \
+    static FAKE6502_FLATTEN fake6502_stop_reason fake6502_run_jit_##m_suffix(       \
+        fake6502_context *c, int cycle_budget, int instr_budget)                    \
+    {                                                                               \
+        fake6502_cache_check(c, m_variant);                                         \
+        return(fake6502_run_jit(c, cycle_budget, instr_budget, m_variant));         \
+    }
+#define FAKE6502_RUN_JIT_CALL(m_suffix)                                             \
+        if (c->engine == FAKE6502_ENGINE_JIT && c->cache && c->jit &&               \
+            !FAKE6502_OBSERVED(c))                                                   \
+            return(fake6502_run_jit_##m_suffix(c, cycle_budget, instr_budget));
+#else
+#define FAKE6502_RUN_JIT(m_variant, m_suffix)
+#define FAKE6502_RUN_JIT_CALL(m_suffix)
+#endif
+
+#define FAKE6502_RUN_LOOPS(m_variant, m_suffix)                                     \
+    static fake6502_stop_reason fake6502_run_table_##m_suffix(fake6502_context *c, \
+        int cycle_budget, int instr_budget)                                         \
+    {                                                                               \
+        return(fake6502_run_engine(c, cycle_budget, instr_budget,                   \
+                                   FAKE6502_ENGINE_TABLE, m_variant));              \
+    }                                                                               \
+    static FAKE6502_FLATTEN fake6502_stop_reason fake6502_run_fused_##m_suffix(     \
+        fake6502_context *c, int cycle_budget, int instr_budget)                    \
+    {                                                                               \
+        return(fake6502_run_engine(c, cycle_budget, instr_budget,                   \
+                                   FAKE6502_ENGINE_FUSED, m_variant));              \
+    }                                                                               \
+    static FAKE6502_FLATTEN fake6502_stop_reason fake6502_run_cached_##m_suffix(    \
+        fake6502_context *c, int cycle_budget, int instr_budget)                    \
+    {                                                                               \
+        fake6502_cache_check(c, m_variant);                                         \
+        return(fake6502_run_engine(c, cycle_budget, instr_budget,                   \
+                                   FAKE6502_ENGINE_CACHED, m_variant));             \
+    }                                                                               \
+    FAKE6502_RUN_JIT(m_variant, m_suffix)                                           \
+    fake6502_stop_reason fake6502_run_##m_suffix(fake6502_context *c,               \
+        int cycle_budget, int instr_budget)                                         \
+    {                                                                               \
+        FAKE6502_RUN_JIT_CALL(m_suffix)                                             \
+        if (c->engine >= FAKE6502_ENGINE_CACHED && c->cache &&                      \
+            !FAKE6502_OBSERVED_BREAKPOINTS(c))                                      \
+            return(fake6502_run_cached_##m_suffix(c, cycle_budget, instr_budget));  \
+        if (c->engine != FAKE6502_ENGINE_TABLE)                                     \
+            return(fake6502_run_fused_##m_suffix(c, cycle_budget, instr_budget));   \
+        return(fake6502_run_table_##m_suffix(c, cycle_budget, instr_budget));       \
+    }                                                                               \
+    void fake6502_step_##m_suffix(fake6502_context *c)                              \
+    { fake6502_run_##m_suffix(c, 0, 1); }
+
+FAKE6502_RUN_LOOPS(FAKE6502_VARIANT_NMOS, nmos)
+FAKE6502_RUN_LOOPS(FAKE6502_VARIANT_CMOS, cmos)
+FAKE6502_RUN_LOOPS(FAKE6502_VARIANT_2A03, 2a03)
+
+void fake6502_step(fake6502_context *c)
+{
+    if (c->events)
+        fake6502_events_fire(c);
+
+    switch (c->variant)
+    {
+    case FAKE6502_VARIANT_CMOS:
+        fake6502_step_cmos(c);
+        break;
+    case FAKE6502_VARIANT_2A03:
+        fake6502_step_2a03(c);
+        break;
+    default:
+        fake6502_step_nmos(c);
+        break;
+    }
+}
+
+static fake6502_stop_reason fake6502_run_variant(fake6502_context *c, int cycle_budget,
+                                                 int instr_budget)
+{
+    switch (c->variant)
+    {
+    case FAKE6502_VARIANT_CMOS:
+        return(fake6502_run_cmos(c, cycle_budget, instr_budget));
+    case FAKE6502_VARIANT_2A03:
+        return(fake6502_run_2a03(c, cycle_budget, instr_budget));
+    default:
+        return(fake6502_run_nmos(c, cycle_budget, instr_budget));
+    }
+}
+
+// idle loop detection, see fake6502_idle_attach()
+
+void fake6502_idle_attach(fake6502_context *c, fake6502_idle *idle)
+{
+    if (idle)
+        memset(idle, 0, sizeof(*idle));
+    c->idle = idle;
+}
+
+// whether a read from address comes straight from memory, with nothing
+// the host does on the way
+
+static inline bool fake6502_idle_ram(fake6502_context *c, uint16_t address)
+{
+#ifdef FAKE6502_BUS_FLAT
+    (void)c;
+    (void)address;
+    return(true);
+#else
+    return(c->bus.read_pages[address >> 8] != NULL);
+#endif
+}
+
+// run the instructions from the pc one at a time, while each only reads
+// memory that comes straight from the page table and writes none, and
+// does not go through a pointer or the stack. If the registers, flags
+// and pc come back to where they started, the next round reads the same
+// memory and goes the same way, and so does every round after it until
+// an interrupt; skip as many of them as fit in the cycles and
+// instructions left, where there is a limit
+
+static fake6502_stop_reason fake6502_idle_skip(fake6502_context *c, int cycle_left,
+                                               int instr_left, bool bounded)
+{
+    const fake6502_opcode_info *infos = fake6502_opcode_infos[c->variant];
+    fake6502_cpu_state start = c->cpu;
+    unsigned start_ticks = (unsigned)c->emu.clockticks;
+    unsigned start_instructions = (unsigned)c->emu.instructions;
+
+    if (cycle_left < FAKE6502_IDLE_LENGTH * 8 ||
+        (instr_left > 0 && instr_left < FAKE6502_IDLE_LENGTH))
+        return(FAKE6502_STOP_BUDGET);
+
+    for (int i = 0; i < FAKE6502_IDLE_LENGTH; i++)
+    {
+        uint16_t pc = c->cpu.pc;
+        const fake6502_opcode_info *info;
+        fake6502_stop_reason reason;
+        uint64_t rounds, ticks, length;
+
+        if (!fake6502_idle_ram(c, pc))
+            break;
+        info = &infos[fake6502_mem_read(c, pc)];
+        if (!fake6502_idle_ram(c, pc + info->size - 1) ||
+            (info->memory & ~FAKE6502_MEM_READ) || info->flow > FAKE6502_FLOW_JUMP ||
+            info->addressing == FAKE6502_ADDR_IND || info->addressing >= FAKE6502_ADDR_INDX)
+            break;
+
+        reason = fake6502_run_variant(c, 0, 1);
+        if (reason != FAKE6502_STOP_BUDGET)
+            return(reason);
+        if ((info->memory & FAKE6502_MEM_READ) && info->addressing != FAKE6502_ADDR_IMM &&
+            !fake6502_idle_ram(c, c->emu.ea))
+            break;
+
+        if (c->cpu.pc != start.pc || c->cpu.a != start.a || c->cpu.x != start.x ||
+            c->cpu.y != start.y || c->cpu.s != start.s || c->cpu.flags != start.flags)
+            continue;
+
+        // with no limit there is nothing to skip to
+        if (!bounded && instr_left <= 0)
+            break;
+
+        ticks = (unsigned)c->emu.clockticks - start_ticks;
+        length = (unsigned)c->emu.instructions - start_instructions;
+        rounds = (uint64_t)cycle_left > ticks ? ((uint64_t)cycle_left - ticks) / ticks : 0;
+        if (instr_left > 0 && ((uint64_t)instr_left - length) / length < rounds)
+            rounds = ((uint64_t)instr_left - length) / length;
+
+        c->emu.clockticks = (int)((unsigned)c->emu.clockticks + rounds * ticks);
+        c->emu.instructions = (int)((unsigned)c->emu.instructions + rounds * length);
+        c->idle->skipped_cycles += rounds * ticks;
+        c->idle->skipped_instructions += rounds * length;
+        c->idle->skips++;
+        break;
+    }
+
+    return(FAKE6502_STOP_BUDGET);
+}
+
+// run a stretch in chunks of FAKE6502_IDLE_CHUNK cycles, looking for an
+// idle loop after each; bounded is false when cycle_budget is no limit
+
+static fake6502_stop_reason fake6502_idle_run(fake6502_context *c, int cycle_budget,
+                                              int instr_budget, bool bounded)
+{
+    unsigned cycles = 0, instructions = 0;
+
+    for (;;)
+    {
+        int cycle_left = bounded ? cycle_budget - (int)cycles : INT_MAX;
+        int instr_left = instr_budget > 0 ? instr_budget - (int)instructions : 0;
+        unsigned start_ticks = (unsigned)c->emu.clockticks;
+        unsigned start_instructions = (unsigned)c->emu.instructions;
+        fake6502_stop_reason reason;
+
+        reason = fake6502_run_variant(c, cycle_left < FAKE6502_IDLE_CHUNK ?
+                                         cycle_left : FAKE6502_IDLE_CHUNK, instr_left);
+        if (reason == FAKE6502_STOP_BUDGET && !FAKE6502_OBSERVED(c))
+        {
+            int ran = (int)((unsigned)c->emu.clockticks - start_ticks);
+            int counted = (int)((unsigned)c->emu.instructions - start_instructions);
+
+            reason = fake6502_idle_skip(c, cycle_left - ran,
+                                        instr_left > 0 ? instr_left - counted : 0, bounded);
+        }
+        cycles += (unsigned)c->emu.clockticks - start_ticks;
+        instructions += (unsigned)c->emu.instructions - start_instructions;
+
+        if (reason != FAKE6502_STOP_BUDGET)
+            return(reason);
+        if ((bounded && cycles >= (unsigned)cycle_budget) ||
+            (instr_budget > 0 && instructions >= (unsigned)instr_budget) ||
+            fake6502_irq_due(c))
+            return(FAKE6502_STOP_BUDGET);
+    }
+}
+
+// with events attached, the budgets are cut at each event's cycle, so
+// nothing is checked between the instructions of each stretch; with idle
+// detection too, each stretch is where a loop can be skipped to
+
+fake6502_stop_reason fake6502_run(fake6502_context *c, int cycle_budget, int instr_budget)
+{
+    fake6502_events *e = c->events;
+    unsigned cycles = 0, instructions = 0;
+
+    if (!e && !c->idle)
+        return(fake6502_run_variant(c, cycle_budget, instr_budget));
+
+    for (;;)
+    {
+        int cycle_slice = cycle_budget > 0 ? cycle_budget - (int)cycles : INT_MAX;
+        int instr_slice = instr_budget > 0 ? instr_budget - (int)instructions : 0;
+        bool bounded = cycle_budget > 0;
+        unsigned start_ticks, start_instructions;
+        fake6502_stop_reason reason;
+
+        if (e && (reason = fake6502_events_fire(c)) != FAKE6502_STOP_NONE)
+        {
+            c->emu.stop = FAKE6502_STOP_NONE;
+            return(reason);
+        }
+        if (e && e->count && e->heap[0].cycle - e->now < (uint64_t)cycle_slice)
+        {
+            cycle_slice = (int)(e->heap[0].cycle - e->now);
+            bounded = true;
+        }
+
+        start_ticks = (unsigned)c->emu.clockticks;
+        start_instructions = (unsigned)c->emu.instructions;
+        if (c->idle)
+            reason = fake6502_idle_run(c, cycle_slice, instr_slice, bounded);
+        else
+            reason = fake6502_run_variant(c, cycle_slice, instr_slice);
+        cycles += (unsigned)c->emu.clockticks - start_ticks;
+        instructions += (unsigned)c->emu.instructions - start_instructions;
+
+        if (reason != FAKE6502_STOP_BUDGET)
+            return(reason);
+        if ((cycle_budget > 0 && cycles >= (unsigned)cycle_budget) ||
+            (instr_budget > 0 && instructions >= (unsigned)instr_budget))
+            return(FAKE6502_STOP_BUDGET);
+    }
+}
+
+void fake6502_stop(fake6502_context *c)
+{
+    c->emu.stop = FAKE6502_STOP_HOST;
+}
+
+
+// -------------------------------------------------------------------
+
+// the batch engine
+
+// each step runs the instruction at the lowest pc of the lanes still
+// running, in every lane at that pc; lanes whose branches went the other
+// way wait, masked off, until the others catch up with them. The common
+// instructions with simple addressing modes run on whole vectors of lanes,
+// the rest lane by lane through a scratch context
+
+#ifndef FAKE6502_BUS_FLAT
+
+// lane vectors, AVX2 or SSE2 where the compiler targets them
+
+#if defined(__AVX2__)
+
+typedef __m256i fake6502_vec;
+#define FAKE6502_VEC_BYTES              32
+#define vec_load(p)                     _mm256_loadu_si256((const __m256i *)(p))
+#define vec_store(p, v)                 _mm256_storeu_si256((__m256i *)(p), v)
+#define vec_set(n)                      _mm256_set1_epi8((char)(n))
+#define vec_and(a, b)                   _mm256_and_si256(a, b)
+#define vec_or(a, b)                    _mm256_or_si256(a, b)
+#define vec_xor(a, b)                   _mm256_xor_si256(a, b)
+#define vec_andnot(m, a)                _mm256_andnot_si256(m, a)
+#define vec_add(a, b)                   _mm256_add_epi8(a, b)
+#define vec_sub(a, b)                   _mm256_sub_epi8(a, b)
+#define vec_eq(a, b)                    _mm256_cmpeq_epi8(a, b)
+#define vec_max(a, b)                   _mm256_max_epu8(a, b)
+#define vec_shr1(a)                     vec_and(_mm256_srli_epi16(a, 1), vec_set(0x7f))
+#define vec_any(m)                      (_mm256_movemask_epi8(m) != 0)
+
+#elif defined(__SSE2__)
+
+typedef __m128i fake6502_vec;
+#define FAKE6502_VEC_BYTES              16
+#define vec_load(p)                     _mm_loadu_si128((const __m128i *)(p))
+#define vec_store(p, v)                 _mm_storeu_si128((__m128i *)(p), v)
+#define vec_set(n)                      _mm_set1_epi8((char)(n))
+#define vec_and(a, b)                   _mm_and_si128(a, b)
+#define vec_or(a, b)                    _mm_or_si128(a, b)
+#define vec_xor(a, b)                   _mm_xor_si128(a, b)
+#define vec_andnot(m, a)                _mm_andnot_si128(m, a)
+#define vec_add(a, b)                   _mm_add_epi8(a, b)
+#define vec_sub(a, b)                   _mm_sub_epi8(a, b)
+#define vec_eq(a, b)                    _mm_cmpeq_epi8(a, b)
+#define vec_max(a, b)                   _mm_max_epu8(a, b)
+#define vec_shr1(a)                     vec_and(_mm_srli_epi16(a, 1), vec_set(0x7f))
+#define vec_any(m)                      (_mm_movemask_epi8(m) != 0)
+
+#else
+
+// plain loops, which the compiler may still vectorize
+
+typedef struct { uint8_t b[16]; } fake6502_vec;
+#define FAKE6502_VEC_BYTES              16
+
+#define FAKE6502_VEC_FN(m_name, m_expr)                             \
+    static inline fake6502_vec m_name(fake6502_vec a, fake6502_vec b) \
+    {                                                               \
+        for (int k = 0; k < FAKE6502_VEC_BYTES; k++)                \
+            a.b[k] = (m_expr);                                      \
+        return(a);                                                  \
+    }
+
+FAKE6502_VEC_FN(vec_and, a.b[k] & b.b[k])
+FAKE6502_VEC_FN(vec_or, a.b[k] | b.b[k])
+FAKE6502_VEC_FN(vec_xor, a.b[k] ^ b.b[k])
+FAKE6502_VEC_FN(vec_andnot, ~a.b[k] & b.b[k])
+FAKE6502_VEC_FN(vec_add, a.b[k] + b.b[k])
+FAKE6502_VEC_FN(vec_sub, a.b[k] - b.b[k])
+FAKE6502_VEC_FN(vec_eq, a.b[k] == b.b[k] ? 0xff : 0)
+FAKE6502_VEC_FN(vec_max, a.b[k] > b.b[k] ? a.b[k] : b.b[k])
+
+static inline fake6502_vec vec_load(const uint8_t *p)
+{ fake6502_vec v; memcpy(v.b, p, FAKE6502_VEC_BYTES); return(v); }
+
+static inline void vec_store(uint8_t *p, fake6502_vec v)
+{ memcpy(p, v.b, FAKE6502_VEC_BYTES); }
+
+static inline fake6502_vec vec_set(uint8_t n)
+{ fake6502_vec v; memset(v.b, n, FAKE6502_VEC_BYTES); return(v); }
+
+static inline fake6502_vec vec_shr1(fake6502_vec a)
+{
+    for (int k = 0; k < FAKE6502_VEC_BYTES; k++)
+        a.b[k] >>= 1;
+    return(a);
 }
 
-uint8_t boolean_and(fake6502_context *c, uint8_t a, uint8_t b)
+static inline bool vec_any(fake6502_vec m)
 {
-    uint16_t result = (uint16_t)a & b;
+    uint8_t any = 0;
+    for (int k = 0; k < FAKE6502_VEC_BYTES; k++)
+        any |= m.b[k];
+    return(any != 0);
+}
 
-    fake6502_zero_calc(c, result);
-    fake6502_sign_calc(c, result);
-    return(result);
+#endif
+
+// m ? a : b, lane by lane
+
+static inline fake6502_vec vec_sel(fake6502_vec m, fake6502_vec a, fake6502_vec b)
+{ return(vec_or(vec_and(m, a), vec_andnot(m, b))); }
+
+// `out` in the lanes where the bits in `bits` are all set
+
+static inline fake6502_vec vec_bit(fake6502_vec v, uint8_t bits, uint8_t out)
+{ return(vec_and(vec_eq(vec_and(v, vec_set(bits)), vec_set(bits)), vec_set(out))); }
+
+// N and Z of a result
+
+static inline fake6502_vec vec_nz(fake6502_vec r)
+{
+    return(vec_or(vec_and(r, vec_set(FAKE6502_SIGN_FLAG)),
+                  vec_and(vec_eq(r, vec_set(0)), vec_set(FAKE6502_ZERO_FLAG))));
 }
 
-uint8_t increment(fake6502_context *c, uint8_t r)
+
+// what each opcode does in a vector of lanes; anything not listed runs
+// lane by lane
+
+enum {
+    FAKE6502_BATCH_SCALAR,
+    FAKE6502_BATCH_LDA, FAKE6502_BATCH_LDX, FAKE6502_BATCH_LDY,
+    FAKE6502_BATCH_STA, FAKE6502_BATCH_STX, FAKE6502_BATCH_STY, FAKE6502_BATCH_STZ,
+    FAKE6502_BATCH_AND, FAKE6502_BATCH_ORA, FAKE6502_BATCH_EOR,
+    FAKE6502_BATCH_ADC, FAKE6502_BATCH_SBC, FAKE6502_BATCH_ADC_2A03, FAKE6502_BATCH_SBC_2A03,
+    FAKE6502_BATCH_CMP, FAKE6502_BATCH_CPX, FAKE6502_BATCH_CPY,
+    FAKE6502_BATCH_BIT, FAKE6502_BATCH_BIT_IMM,
+    FAKE6502_BATCH_INC, FAKE6502_BATCH_DEC, FAKE6502_BATCH_ASL, FAKE6502_BATCH_LSR,
+    FAKE6502_BATCH_ROL, FAKE6502_BATCH_ROR,
+    FAKE6502_BATCH_INC_A, FAKE6502_BATCH_DEC_A, FAKE6502_BATCH_ASL_A, FAKE6502_BATCH_LSR_A,
+    FAKE6502_BATCH_ROL_A, FAKE6502_BATCH_ROR_A,
+    FAKE6502_BATCH_INX, FAKE6502_BATCH_INY, FAKE6502_BATCH_DEX, FAKE6502_BATCH_DEY,
+    FAKE6502_BATCH_TAX, FAKE6502_BATCH_TAY, FAKE6502_BATCH_TXA, FAKE6502_BATCH_TYA,
+    FAKE6502_BATCH_TSX, FAKE6502_BATCH_TXS,
+    FAKE6502_BATCH_CLC, FAKE6502_BATCH_SEC, FAKE6502_BATCH_CLD, FAKE6502_BATCH_SED,
+    FAKE6502_BATCH_CLI, FAKE6502_BATCH_SEI, FAKE6502_BATCH_CLV, FAKE6502_BATCH_NOP,
+    // the branches in pairs, taken when one flag is clear and when it is set
+    FAKE6502_BATCH_BCC, FAKE6502_BATCH_BCS, FAKE6502_BATCH_BNE, FAKE6502_BATCH_BEQ,
+    FAKE6502_BATCH_BPL, FAKE6502_BATCH_BMI, FAKE6502_BATCH_BVC, FAKE6502_BATCH_BVS,
+    FAKE6502_BATCH_BRA, FAKE6502_BATCH_JMP, FAKE6502_BATCH_JSR, FAKE6502_BATCH_RTS,
+    FAKE6502_BATCH_BRK, FAKE6502_BATCH_PHA, FAKE6502_BATCH_PHP, FAKE6502_BATCH_PLA,
+    FAKE6502_BATCH_PLP
+};
+
+// the addressing modes the vector kernels handle; _P adds the page
+// crossing cycle
+
+enum {
+    FAKE6502_BATCH_IMP, FAKE6502_BATCH_IMM, FAKE6502_BATCH_ZP, FAKE6502_BATCH_ABS,
+    FAKE6502_BATCH_ZPX, FAKE6502_BATCH_ZPY, FAKE6502_BATCH_ABSX, FAKE6502_BATCH_ABSY,
+    FAKE6502_BATCH_ABSX_P, FAKE6502_BATCH_ABSY_P, FAKE6502_BATCH_REL,
+    FAKE6502_BATCH_OTHER
+};
+
+static int batch_mode(void (*mode)(fake6502_context *c))
 {
-    uint16_t result = r + 1;
-    fake6502_zero_calc(c, result);
-    fake6502_sign_calc(c, result);
-    return(result);
+    if (mode == imp || mode == acc)
+        return(FAKE6502_BATCH_IMP);
+    if (mode == imm)
+        return(FAKE6502_BATCH_IMM);
+    if (mode == zp)
+        return(FAKE6502_BATCH_ZP);
+    if (mode == abso)
+        return(FAKE6502_BATCH_ABS);
+    if (mode == zpx)
+        return(FAKE6502_BATCH_ZPX);
+    if (mode == zpy)
+        return(FAKE6502_BATCH_ZPY);
+    if (mode == absx)
+        return(FAKE6502_BATCH_ABSX);
+    if (mode == absy)
+        return(FAKE6502_BATCH_ABSY);
+    if (mode == absx_p)
+        return(FAKE6502_BATCH_ABSX_P);
+    if (mode == absy_p)
+        return(FAKE6502_BATCH_ABSY_P);
+    if (mode == rel)
+        return(FAKE6502_BATCH_REL);
+    return(FAKE6502_BATCH_OTHER);
 }
 
-uint8_t decrement(fake6502_context *c, uint8_t r)
+static int batch_kernel(void (*fn)(fake6502_context *c))
 {
-    uint16_t result = r - 1;
-    fake6502_zero_calc(c, result);
-    fake6502_sign_calc(c, result);
-    return(result);
+    static const struct {
+        void (*fn)(fake6502_context *c);
+        int kernel;
+    } kernels[] = {
+        {lda, FAKE6502_BATCH_LDA}, {ldx, FAKE6502_BATCH_LDX}, {ldy, FAKE6502_BATCH_LDY},
+        {sta, FAKE6502_BATCH_STA}, {stx, FAKE6502_BATCH_STX}, {sty, FAKE6502_BATCH_STY},
+        {stz, FAKE6502_BATCH_STZ}, {and, FAKE6502_BATCH_AND}, {ora, FAKE6502_BATCH_ORA},
+        {eor, FAKE6502_BATCH_EOR}, {adc, FAKE6502_BATCH_ADC}, {sbc, FAKE6502_BATCH_SBC},
+        {adc_2a03, FAKE6502_BATCH_ADC_2A03}, {sbc_2a03, FAKE6502_BATCH_SBC_2A03},
+        {cmp, FAKE6502_BATCH_CMP}, {cpx, FAKE6502_BATCH_CPX}, {cpy, FAKE6502_BATCH_CPY},
+        {bit, FAKE6502_BATCH_BIT}, {bit_imm, FAKE6502_BATCH_BIT_IMM},
+        {inc, FAKE6502_BATCH_INC}, {dec, FAKE6502_BATCH_DEC}, {asl, FAKE6502_BATCH_ASL},
+        {lsr, FAKE6502_BATCH_LSR}, {rol, FAKE6502_BATCH_ROL}, {ror, FAKE6502_BATCH_ROR},
+        {inc_acc, FAKE6502_BATCH_INC_A}, {dec_acc, FAKE6502_BATCH_DEC_A},
+        {asl_acc, FAKE6502_BATCH_ASL_A}, {lsr_acc, FAKE6502_BATCH_LSR_A},
+        {rol_acc, FAKE6502_BATCH_ROL_A}, {ror_acc, FAKE6502_BATCH_ROR_A},
+        {inx, FAKE6502_BATCH_INX}, {iny, FAKE6502_BATCH_INY}, {dex, FAKE6502_BATCH_DEX},
+        {dey, FAKE6502_BATCH_DEY}, {tax, FAKE6502_BATCH_TAX}, {tay, FAKE6502_BATCH_TAY},
+        {txa, FAKE6502_BATCH_TXA}, {tya, FAKE6502_BATCH_TYA}, {tsx, FAKE6502_BATCH_TSX},
+        {txs, FAKE6502_BATCH_TXS}, {clc, FAKE6502_BATCH_CLC}, {sec, FAKE6502_BATCH_SEC},
+        {cld, FAKE6502_BATCH_CLD}, {sed, FAKE6502_BATCH_SED}, {cli, FAKE6502_BATCH_CLI},
+        {sei, FAKE6502_BATCH_SEI}, {clv, FAKE6502_BATCH_CLV}, {nop, FAKE6502_BATCH_NOP},
+        {bcc, FAKE6502_BATCH_BCC}, {bcs, FAKE6502_BATCH_BCS}, {beq, FAKE6502_BATCH_BEQ},
+        {bne, FAKE6502_BATCH_BNE}, {bmi, FAKE6502_BATCH_BMI}, {bpl, FAKE6502_BATCH_BPL},
+        {bvc, FAKE6502_BATCH_BVC}, {bvs, FAKE6502_BATCH_BVS}, {bra, FAKE6502_BATCH_BRA},
+        {jmp, FAKE6502_BATCH_JMP}, {jsr, FAKE6502_BATCH_JSR}, {rts, FAKE6502_BATCH_RTS},
+        {brk, FAKE6502_BATCH_BRK}, {pha, FAKE6502_BATCH_PHA}, {php, FAKE6502_BATCH_PHP},
+        {pla, FAKE6502_BATCH_PLA}, {plp, FAKE6502_BATCH_PLP}};
+
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++)
+        if (kernels[i].fn == fn)
+            return(kernels[i].kernel);
+    return(FAKE6502_BATCH_SCALAR);
 }
 
-void compare(fake6502_context *c, uint16_t r)
+
+// lane memory
+
+uint8_t fake6502_batch_peek(fake6502_batch *b, int lane, uint16_t address)
 {
-    uint16_t value = fake6502_get_value(c);
-    uint16_t result = r - value;
+    uint8_t column = b->column[address];
+    return(column ? b->values[column][lane] : b->memory[address]);
+}
 
-    if (r >= (uint8_t)(value & 0x00FF))
-        fake6502_carry_set(c);
-    else
-        fake6502_carry_clear(c);
-    if (r == (uint8_t)(value & 0x00FF))
-        fake6502_zero_set(c);
-    else
-        fake6502_zero_clear(c);
-    fake6502_sign_calc(c, result);
+// the column for an address, 0 when they have all been used
+
+static uint8_t batch_column(fake6502_batch *b, uint16_t address)
+{
+    if (!b->column[address])
+    {
+        if (b->columns == FAKE6502_BATCH_COLUMNS)
+            return(0);
+
+        b->column[address] = ++b->columns;
+        b->addresses[b->columns] = address;
+        memset(b->values[b->columns], b->memory[address], FAKE6502_BATCH_LANES);
+    }
+
+    return(b->column[address]);
 }
 
+bool fake6502_batch_poke(fake6502_batch *b, int lane, uint16_t address, uint8_t val)
+{
+    uint8_t column = batch_column(b, address);
 
-// -------------------------------------------------------------------
+    if (column)
+        b->values[column][lane] = val;
+    return(column != 0);
+}
 
-// instruction handler functions
+static uint8_t batch_mem_read(fake6502_context *c, uint16_t address)
+{
+    fake6502_batch *b = c->state_host;
+    return(fake6502_batch_peek(b, b->lane, address));
+}
 
-FAKE6502_FN_OPCODE(adc)
+static void batch_mem_write(fake6502_context *c, uint16_t address, uint8_t val)
 {
-    uint16_t value = fake6502_get_value(c);
-    fake6502_accum_save(c, add8(c, c->cpu.a, value, c->cpu.flags & FAKE6502_CARRY_FLAG));
+    fake6502_batch *b = c->state_host;
+
+    if (!fake6502_batch_poke(b, b->lane, address, val))
+    {
+        b->fault = 1;
+        fake6502_stop(c);
+    }
 }
 
-FAKE6502_FN_OPCODE(and)
+// a write from a vector kernel, which stops the lane when it runs out of
+// columns
+
+static inline void batch_poke(fake6502_batch *b, int lane, uint16_t address, uint8_t val)
 {
-    uint8_t m = fake6502_get_value(c);
-    fake6502_accum_save(c, boolean_and(c, c->cpu.a, m));
+    if (!fake6502_batch_poke(b, lane, address, val))
+    {
+        b->stop[lane] = FAKE6502_STOP_FAULT;
+        b->fault = 1;
+    }
 }
 
-FAKE6502_FN_OPCODE(asl)
-{ fake6502_put_value(c, arithmetic_shift_left(c, fake6502_get_value(c))); }
 
-FAKE6502_FN_OPCODE(bra)
+// run the instruction in each active lane through a scratch context
+
+static void batch_scalar(fake6502_batch *b, fake6502_context *c)
 {
-    uint16_t oldpc = c->cpu.pc;
-    c->cpu.pc = c->emu.ea;
+    for (int lane = 0; lane < b->lanes; lane++)
+    {
+        fake6502_stop_reason reason;
+
+        if (!b->active[lane])
+            continue;
+
+        c->cpu.a = b->a[lane];
+        c->cpu.x = b->x[lane];
+        c->cpu.y = b->y[lane];
+        c->cpu.s = b->s[lane];
+        c->cpu.flags = b->flags[lane];
+        c->cpu.pc = b->pc[lane];
+        c->emu.clockticks = 0;
+        b->lane = lane;
+        b->fault = 0;
+
+        reason = fake6502_run(c, 0, 1);
+
+        if (b->fault)
+        {
+            b->stop[lane] = FAKE6502_STOP_FAULT;
+            continue;
+        }
+
+        b->a[lane] = c->cpu.a;
+        b->x[lane] = c->cpu.x;
+        b->y[lane] = c->cpu.y;
+        b->s[lane] = c->cpu.s;
+        b->flags[lane] = c->cpu.flags;
+        b->pc[lane] = c->cpu.pc;
+        b->clockticks[lane] += c->emu.clockticks;
+        if (reason != FAKE6502_STOP_BUDGET)
+            b->stop[lane] = reason;
+        if (++b->instructions[lane] >= b->budget && !b->stop[lane])
+            b->stop[lane] = FAKE6502_STOP_BUDGET;
+    }
+}
 
-    // check if jump crossed a page boundary
+// the effective address in each lane of the vector at `i`, for the
+// indexed modes, with the page crossing cycle
 
-    if ((oldpc & 0xFF00) != (c->cpu.pc & 0xFF00))
-        c->emu.clockticks += 2;
-    else
-        c->emu.clockticks++;
+static inline void batch_ea(fake6502_batch *b, int i, fake6502_vec m, int mode,
+                            uint16_t operand)
+{
+    const uint8_t *index = mode == FAKE6502_BATCH_ZPX || mode == FAKE6502_BATCH_ABSX ||
+                           mode == FAKE6502_BATCH_ABSX_P ? b->x : b->y;
+
+    for (int lane = i; lane < i + FAKE6502_VEC_BYTES; lane++)
+    {
+        if (mode == FAKE6502_BATCH_ZPX || mode == FAKE6502_BATCH_ZPY)
+            b->ea[lane] = (uint8_t)(operand + index[lane]);
+        else
+            b->ea[lane] = operand + index[lane];
+
+        if (mode >= FAKE6502_BATCH_ABSX_P)
+            b->extra[lane] = (b->ea[lane] & 0xff00) != (operand & 0xff00);
+    }
+
+    if (mode >= FAKE6502_BATCH_ABSX_P)
+        vec_store(b->pending + i, vec_add(vec_load(b->pending + i),
+                                          vec_and(m, vec_load(b->extra + i))));
 }
 
-FAKE6502_FN_OPCODE(bcc)
+static inline fake6502_vec batch_read(fake6502_batch *b, int i, int mode, uint16_t operand)
 {
-    if ((c->cpu.flags & FAKE6502_CARRY_FLAG) == 0)
-        bra(c);
+    uint8_t values[FAKE6502_VEC_BYTES];
+
+    if (mode == FAKE6502_BATCH_IMM)
+        return(vec_set(b->memory[operand]));
+
+    if (mode == FAKE6502_BATCH_ZP || mode == FAKE6502_BATCH_ABS)
+    {
+        uint8_t column = b->column[operand];
+        return(column ? vec_load(&b->values[column][i]) : vec_set(b->memory[operand]));
+    }
+
+    for (int k = 0; k < FAKE6502_VEC_BYTES; k++)
+        values[k] = fake6502_batch_peek(b, i + k, b->ea[i + k]);
+    return(vec_load(values));
 }
 
-FAKE6502_FN_OPCODE(bcs)
+static inline void batch_write(fake6502_batch *b, int i, int mode, uint16_t operand,
+                               fake6502_vec m, fake6502_vec v)
 {
-    if ((c->cpu.flags & FAKE6502_CARRY_FLAG) == FAKE6502_CARRY_FLAG)
-        bra(c);
+    uint8_t values[FAKE6502_VEC_BYTES], mask[FAKE6502_VEC_BYTES];
+    bool constant = mode == FAKE6502_BATCH_ZP || mode == FAKE6502_BATCH_ABS;
+
+    if (constant)
+    {
+        uint8_t column = batch_column(b, operand);
+
+        if (column)
+        {
+            uint8_t *row = &b->values[column][i];
+            vec_store(row, vec_sel(m, v, vec_load(row)));
+            return;
+        }
+    }
+
+    vec_store(values, v);
+    vec_store(mask, m);
+    for (int k = 0; k < FAKE6502_VEC_BYTES; k++)
+        if (mask[k])
+            batch_poke(b, i + k, constant ? operand : b->ea[i + k], values[k]);
 }
 
-FAKE6502_FN_OPCODE(beq)
+// the stack, lane by lane as each lane has its own S
+
+static inline void batch_push(fake6502_batch *b, int i, fake6502_vec m, fake6502_vec v)
 {
-    if ((c->cpu.flags & FAKE6502_ZERO_FLAG) == FAKE6502_ZERO_FLAG)
-        bra(c);
+    uint8_t values[FAKE6502_VEC_BYTES], mask[FAKE6502_VEC_BYTES];
+
+    vec_store(values, v);
+    vec_store(mask, m);
+    for (int k = 0; k < FAKE6502_VEC_BYTES; k++)
+        if (mask[k])
+            batch_poke(b, i + k, FAKE6502_STACK_BASE + b->s[i + k]--, values[k]);
 }
 
-FAKE6502_FN_OPCODE(bit)
+static inline fake6502_vec batch_pull(fake6502_batch *b, int i, fake6502_vec m)
 {
-    uint8_t value = fake6502_get_value(c);
-    uint8_t result = (uint16_t)c->cpu.a & value;
+    uint8_t values[FAKE6502_VEC_BYTES], mask[FAKE6502_VEC_BYTES];
 
-    fake6502_zero_calc(c, result);
-    c->cpu.flags = (c->cpu.flags & 0x3F) | (uint8_t)(value & 0xC0);
+    vec_store(mask, m);
+    for (int k = 0; k < FAKE6502_VEC_BYTES; k++)
+        values[k] = mask[k] ? fake6502_batch_peek(b, i + k, FAKE6502_STACK_BASE + ++b->s[i + k])
+                            : 0;
+    return(vec_load(values));
 }
 
-void bit_imm(fake6502_context *c)
+// replace the flags in `bits` with those in `set`, in the lanes in m
+
+static inline void batch_flags(fake6502_batch *b, int i, fake6502_vec m, uint8_t bits,
+                               fake6502_vec set)
 {
-    uint8_t value = fake6502_get_value(c);
-    uint8_t result = (uint16_t)c->cpu.a & value;
+    fake6502_vec p = vec_load(b->flags + i);
+    vec_store(b->flags + i, vec_sel(m, vec_or(vec_andnot(vec_set(bits), p), set), p));
+}
 
-    fake6502_zero_calc(c, result);
+static inline void batch_reg(uint8_t *reg, int i, fake6502_vec m, fake6502_vec v)
+{ vec_store(reg + i, vec_sel(m, v, vec_load(reg + i))); }
+
+// a register loaded with v, setting N and Z
+
+static inline void batch_load(fake6502_batch *b, uint8_t *reg, int i, fake6502_vec m,
+                              fake6502_vec v)
+{
+    batch_reg(reg, i, m, v);
+    batch_flags(b, i, m, FAKE6502_SIGN_FLAG | FAKE6502_ZERO_FLAG, vec_nz(v));
 }
 
-FAKE6502_FN_OPCODE(bmi)
+// binary ADC; SBC adds the operand's complement
+
+static inline void batch_add(fake6502_batch *b, int i, fake6502_vec m, fake6502_vec v)
 {
-    if ((c->cpu.flags & FAKE6502_SIGN_FLAG) == FAKE6502_SIGN_FLAG)
-        bra(c);
+    fake6502_vec a = vec_load(b->a + i);
+    fake6502_vec cin = vec_bit(vec_load(b->flags + i), FAKE6502_CARRY_FLAG, 0xff);
+    fake6502_vec sum = vec_add(a, v);
+    fake6502_vec r = vec_sub(sum, cin);
+    // carry out of a + v when the sum wrapped below a, or out of + 1 when r wrapped to 0
+    fake6502_vec carry = vec_or(vec_andnot(vec_eq(sum, a), vec_eq(vec_max(sum, a), a)),
+                                vec_and(cin, vec_eq(r, vec_set(0))));
+    fake6502_vec overflow = vec_and(vec_shr1(vec_and(vec_xor(a, r), vec_xor(v, r))),
+                                    vec_set(FAKE6502_OVERFLOW_FLAG));
+
+    batch_reg(b->a, i, m, r);
+    batch_flags(b, i, m, FAKE6502_NVZC_FLAGS,
+                vec_or(vec_or(vec_nz(r), overflow), vec_and(carry, vec_set(FAKE6502_CARRY_FLAG))));
 }
 
-FAKE6502_FN_OPCODE(bne)
+// ADC/SBC in decimal mode, lane by lane from the tables
+
+static inline void batch_decimal(fake6502_batch *b, int i, fake6502_vec m, fake6502_vec v,
+                                 const uint16_t *table)
 {
-    if ((c->cpu.flags & FAKE6502_ZERO_FLAG) == 0)
-        bra(c);
+    uint8_t values[FAKE6502_VEC_BYTES], mask[FAKE6502_VEC_BYTES];
+
+    vec_store(values, v);
+    vec_store(mask, m);
+    for (int k = 0; k < FAKE6502_VEC_BYTES; k++)
+    {
+        int lane = i + k;
+        uint16_t entry;
+
+        if (!mask[k])
+            continue;
+
+        entry = table[(FAKE6502_DECIMAL_FLAG << 14) |
+                      ((b->flags[lane] & FAKE6502_CARRY_FLAG) << 16) |
+                      (b->a[lane] << 8) | values[k]];
+        b->a[lane] = (uint8_t)entry;
+        b->flags[lane] = (b->flags[lane] & ~FAKE6502_NVZC_FLAGS) | (entry >> 8);
+    }
 }
 
-FAKE6502_FN_OPCODE(bpl)
+static inline void batch_compare(fake6502_batch *b, int i, fake6502_vec m, const uint8_t *reg,
+                                 fake6502_vec v)
 {
-    if ((c->cpu.flags & FAKE6502_SIGN_FLAG) == 0)
-        bra(c);
+    fake6502_vec r = vec_load(reg + i);
+    fake6502_vec carry = vec_and(vec_eq(vec_max(r, v), r), vec_set(FAKE6502_CARRY_FLAG));
+
+    batch_flags(b, i, m, FAKE6502_SIGN_FLAG | FAKE6502_ZERO_FLAG | FAKE6502_CARRY_FLAG,
+                vec_or(vec_nz(vec_sub(r, v)), carry));
 }
 
-FAKE6502_FN_OPCODE(brk)
+// the shifts and rotates, given the carry in and returning the carry out
+// in `carry`
+
+static inline fake6502_vec batch_shift(int kernel, fake6502_vec v, fake6502_vec p,
+                                       fake6502_vec *carry)
 {
-    c->cpu.pc++;
+    fake6502_vec cin = vec_and(p, vec_set(FAKE6502_CARRY_FLAG));
 
-    // push next instruction address onto stack
-    fake6502_push_16(c, c->cpu.pc);
+    switch (kernel)
+    {
+    case FAKE6502_BATCH_ASL:
+        *carry = vec_bit(v, 0x80, FAKE6502_CARRY_FLAG);
+        return(vec_add(v, v));
+    case FAKE6502_BATCH_ROL:
+        *carry = vec_bit(v, 0x80, FAKE6502_CARRY_FLAG);
+        return(vec_or(vec_add(v, v), cin));
+    case FAKE6502_BATCH_LSR:
+        *carry = vec_and(v, vec_set(FAKE6502_CARRY_FLAG));
+        return(vec_shr1(v));
+    default:
+        *carry = vec_and(v, vec_set(FAKE6502_CARRY_FLAG));
+        return(vec_or(vec_shr1(v), vec_bit(p, FAKE6502_CARRY_FLAG, 0x80)));
+    }
+}
 
-    // push CPU flags to stack
-    fake6502_push_8(c, c->cpu.flags | FAKE6502_BREAK_FLAG);
+// run one instruction in the lanes in m of the vector at `i`; next is the
+// address of the following instruction
 
-    // set interrupt flag
-    fake6502_interrupt_set(c);
+static inline void batch_vector(fake6502_batch *b, int i, fake6502_vec m, int kernel,
+                                int mode, uint16_t operand, uint16_t next)
+{
+    fake6502_vec v, r, carry, taken;
+    uint8_t flag = 0;
 
-    c->cpu.pc = fake6502_mem_read16(c, 0xfffe);
+    if (mode >= FAKE6502_BATCH_ZPX && mode <= FAKE6502_BATCH_ABSY_P)
+        batch_ea(b, i, m, mode, operand);
+
+    switch (kernel)
+    {
+    case FAKE6502_BATCH_LDA:
+        batch_load(b, b->a, i, m, batch_read(b, i, mode, operand));
+        break;
+    case FAKE6502_BATCH_LDX:
+        batch_load(b, b->x, i, m, batch_read(b, i, mode, operand));
+        break;
+    case FAKE6502_BATCH_LDY:
+        batch_load(b, b->y, i, m, batch_read(b, i, mode, operand));
+        break;
+    case FAKE6502_BATCH_STA:
+        batch_write(b, i, mode, operand, m, vec_load(b->a + i));
+        break;
+    case FAKE6502_BATCH_STX:
+        batch_write(b, i, mode, operand, m, vec_load(b->x + i));
+        break;
+    case FAKE6502_BATCH_STY:
+        batch_write(b, i, mode, operand, m, vec_load(b->y + i));
+        break;
+    case FAKE6502_BATCH_STZ:
+        batch_write(b, i, mode, operand, m, vec_set(0));
+        break;
+    case FAKE6502_BATCH_AND:
+        batch_load(b, b->a, i, m, vec_and(vec_load(b->a + i), batch_read(b, i, mode, operand)));
+        break;
+    case FAKE6502_BATCH_ORA:
+        batch_load(b, b->a, i, m, vec_or(vec_load(b->a + i), batch_read(b, i, mode, operand)));
+        break;
+    case FAKE6502_BATCH_EOR:
+        batch_load(b, b->a, i, m, vec_xor(vec_load(b->a + i), batch_read(b, i, mode, operand)));
+        break;
+    case FAKE6502_BATCH_ADC:
+    case FAKE6502_BATCH_SBC:
+    {
+        fake6502_vec decimal = vec_and(m, vec_bit(vec_load(b->flags + i),
+                                                  FAKE6502_DECIMAL_FLAG, 0xff));
+        v = batch_read(b, i, mode, operand);
+        if (vec_any(decimal))
+            batch_decimal(b, i, decimal, v, kernel == FAKE6502_BATCH_ADC ?
+                          fake6502_adc_table : fake6502_sbc_table);
+        batch_add(b, i, vec_andnot(decimal, m),
+                  kernel == FAKE6502_BATCH_ADC ? v : vec_xor(v, vec_set(0xff)));
+        break;
+    }
+    case FAKE6502_BATCH_ADC_2A03:
+        batch_add(b, i, m, batch_read(b, i, mode, operand));
+        break;
+    case FAKE6502_BATCH_SBC_2A03:
+        batch_add(b, i, m, vec_xor(batch_read(b, i, mode, operand), vec_set(0xff)));
+        break;
+    case FAKE6502_BATCH_CMP:
+        batch_compare(b, i, m, b->a, batch_read(b, i, mode, operand));
+        break;
+    case FAKE6502_BATCH_CPX:
+        batch_compare(b, i, m, b->x, batch_read(b, i, mode, operand));
+        break;
+    case FAKE6502_BATCH_CPY:
+        batch_compare(b, i, m, b->y, batch_read(b, i, mode, operand));
+        break;
+    case FAKE6502_BATCH_BIT:
+        v = batch_read(b, i, mode, operand);
+        r = vec_and(vec_eq(vec_and(vec_load(b->a + i), v), vec_set(0)), vec_set(FAKE6502_ZERO_FLAG));
+        batch_flags(b, i, m, FAKE6502_SIGN_FLAG | FAKE6502_OVERFLOW_FLAG | FAKE6502_ZERO_FLAG,
+                    vec_or(r, vec_and(v, vec_set(FAKE6502_SIGN_FLAG | FAKE6502_OVERFLOW_FLAG))));
+        break;
+    case FAKE6502_BATCH_BIT_IMM:
+        v = batch_read(b, i, mode, operand);
+        r = vec_and(vec_eq(vec_and(vec_load(b->a + i), v), vec_set(0)), vec_set(FAKE6502_ZERO_FLAG));
+        batch_flags(b, i, m, FAKE6502_ZERO_FLAG, r);
+        break;
+    case FAKE6502_BATCH_INC:
+    case FAKE6502_BATCH_DEC:
+        v = batch_read(b, i, mode, operand);
+        r = kernel == FAKE6502_BATCH_INC ? vec_add(v, vec_set(1)) : vec_sub(v, vec_set(1));
+        batch_write(b, i, mode, operand, m, r);
+        batch_flags(b, i, m, FAKE6502_SIGN_FLAG | FAKE6502_ZERO_FLAG, vec_nz(r));
+        break;
+    case FAKE6502_BATCH_ASL:
+    case FAKE6502_BATCH_LSR:
+    case FAKE6502_BATCH_ROL:
+    case FAKE6502_BATCH_ROR:
+        r = batch_shift(kernel, batch_read(b, i, mode, operand), vec_load(b->flags + i), &carry);
+        batch_write(b, i, mode, operand, m, r);
+        batch_flags(b, i, m, FAKE6502_SIGN_FLAG | FAKE6502_ZERO_FLAG | FAKE6502_CARRY_FLAG,
+                    vec_or(vec_nz(r), carry));
+        break;
+    case FAKE6502_BATCH_ASL_A:
+    case FAKE6502_BATCH_LSR_A:
+    case FAKE6502_BATCH_ROL_A:
+    case FAKE6502_BATCH_ROR_A:
+        r = batch_shift(kernel - FAKE6502_BATCH_ASL_A + FAKE6502_BATCH_ASL, vec_load(b->a + i),
+                        vec_load(b->flags + i), &carry);
+        batch_reg(b->a, i, m, r);
+        batch_flags(b, i, m, FAKE6502_SIGN_FLAG | FAKE6502_ZERO_FLAG | FAKE6502_CARRY_FLAG,
+                    vec_or(vec_nz(r), carry));
+        break;
+    case FAKE6502_BATCH_INC_A:
+        batch_load(b, b->a, i, m, vec_add(vec_load(b->a + i), vec_set(1)));
+        break;
+    case FAKE6502_BATCH_DEC_A:
+        batch_load(b, b->a, i, m, vec_sub(vec_load(b->a + i), vec_set(1)));
+        break;
+    case FAKE6502_BATCH_INX:
+        batch_load(b, b->x, i, m, vec_add(vec_load(b->x + i), vec_set(1)));
+        break;
+    case FAKE6502_BATCH_INY:
+        batch_load(b, b->y, i, m, vec_add(vec_load(b->y + i), vec_set(1)));
+        break;
+    case FAKE6502_BATCH_DEX:
+        batch_load(b, b->x, i, m, vec_sub(vec_load(b->x + i), vec_set(1)));
+        break;
+    case FAKE6502_BATCH_DEY:
+        batch_load(b, b->y, i, m, vec_sub(vec_load(b->y + i), vec_set(1)));
+        break;
+    case FAKE6502_BATCH_TAX:
+        batch_load(b, b->x, i, m, vec_load(b->a + i));
+        break;
+    case FAKE6502_BATCH_TAY:
+        batch_load(b, b->y, i, m, vec_load(b->a + i));
+        break;
+    case FAKE6502_BATCH_TXA:
+        batch_load(b, b->a, i, m, vec_load(b->x + i));
+        break;
+    case FAKE6502_BATCH_TYA:
+        batch_load(b, b->a, i, m, vec_load(b->y + i));
+        break;
+    case FAKE6502_BATCH_TSX:
+        batch_load(b, b->x, i, m, vec_load(b->s + i));
+        break;
+    case FAKE6502_BATCH_TXS:
+        batch_reg(b->s, i, m, vec_load(b->x + i));
+        break;
+    case FAKE6502_BATCH_CLC:
+        batch_flags(b, i, m, FAKE6502_CARRY_FLAG, vec_set(0));
+        break;
+    case FAKE6502_BATCH_SEC:
+        batch_flags(b, i, m, FAKE6502_CARRY_FLAG, vec_set(FAKE6502_CARRY_FLAG));
+        break;
+    case FAKE6502_BATCH_CLD:
+        batch_flags(b, i, m, FAKE6502_DECIMAL_FLAG, vec_set(0));
+        break;
+    case FAKE6502_BATCH_SED:
+        batch_flags(b, i, m, FAKE6502_DECIMAL_FLAG, vec_set(FAKE6502_DECIMAL_FLAG));
+        break;
+    case FAKE6502_BATCH_CLI:
+        batch_flags(b, i, m, FAKE6502_INTERRUPT_FLAG, vec_set(0));
+        break;
+    case FAKE6502_BATCH_SEI:
+        batch_flags(b, i, m, FAKE6502_INTERRUPT_FLAG, vec_set(FAKE6502_INTERRUPT_FLAG));
+        break;
+    case FAKE6502_BATCH_CLV:
+        batch_flags(b, i, m, FAKE6502_OVERFLOW_FLAG, vec_set(0));
+        break;
+    case FAKE6502_BATCH_BCC: case FAKE6502_BATCH_BCS:
+    case FAKE6502_BATCH_BNE: case FAKE6502_BATCH_BEQ:
+    case FAKE6502_BATCH_BPL: case FAKE6502_BATCH_BMI:
+    case FAKE6502_BATCH_BVC: case FAKE6502_BATCH_BVS:
+        flag = (uint8_t[]){FAKE6502_CARRY_FLAG, FAKE6502_ZERO_FLAG, FAKE6502_SIGN_FLAG,
+                           FAKE6502_OVERFLOW_FLAG}[(kernel - FAKE6502_BATCH_BCC) / 2];
+        taken = vec_bit(vec_load(b->flags + i), flag, 0xff);
+        if (!((kernel - FAKE6502_BATCH_BCC) & 1))
+            taken = vec_xor(taken, vec_set(0xff));
+        vec_store(b->extra + i, vec_and(m, taken));
+        break;
+    case FAKE6502_BATCH_BRA:
+        vec_store(b->extra + i, m);
+        break;
+    case FAKE6502_BATCH_JSR:
+        batch_push(b, i, m, vec_set((next - 1) >> 8));
+        batch_push(b, i, m, vec_set(next - 1));
+        break;
+    case FAKE6502_BATCH_RTS:
+    {
+        uint8_t lo[FAKE6502_VEC_BYTES], hi[FAKE6502_VEC_BYTES];
+
+        // each lane may return somewhere else
+        vec_store(lo, batch_pull(b, i, m));
+        vec_store(hi, batch_pull(b, i, m));
+        for (int k = 0; k < FAKE6502_VEC_BYTES; k++)
+            b->ea[i + k] = (lo[k] | hi[k] << 8) + 1;
+        break;
+    }
+    case FAKE6502_BATCH_BRK:
+        batch_push(b, i, m, vec_set((next + 1) >> 8));
+        batch_push(b, i, m, vec_set(next + 1));
+        batch_push(b, i, m, vec_or(vec_load(b->flags + i), vec_set(FAKE6502_BREAK_FLAG)));
+        batch_flags(b, i, m, FAKE6502_INTERRUPT_FLAG, vec_set(FAKE6502_INTERRUPT_FLAG));
+        vec_store(b->stop + i, vec_sel(m, vec_set(FAKE6502_STOP_BRK), vec_load(b->stop + i)));
+        break;
+    case FAKE6502_BATCH_PHA:
+        batch_push(b, i, m, vec_load(b->a + i));
+        break;
+    case FAKE6502_BATCH_PHP:
+        batch_push(b, i, m, vec_or(vec_load(b->flags + i), vec_set(FAKE6502_BREAK_FLAG)));
+        break;
+    case FAKE6502_BATCH_PLA:
+        batch_load(b, b->a, i, m, batch_pull(b, i, m));
+        break;
+    case FAKE6502_BATCH_PLP:
+        batch_reg(b->flags, i, m, vec_or(batch_pull(b, i, m),
+                                         vec_set(FAKE6502_CONSTANT_FLAG | FAKE6502_BREAK_FLAG)));
+        break;
+    default:
+        break;
+    }
 }
 
-FAKE6502_FN_OPCODE(bvc)
+
+// the lanes at the lowest pc of those still running make up a group,
+// which keeps running together until its lanes split up or it reaches
+// a lane that was left waiting; while it does, only the group's pc and
+// counts change, and each lane catches up when the group is settled
+
+static bool batch_group(fake6502_batch *b)
 {
-    if ((c->cpu.flags & FAKE6502_OVERFLOW_FLAG) == 0)
-        bra(c);
+    uint32_t pc = UINT32_MAX, waiting = UINT32_MAX, limit = 128;
+
+    for (int lane = 0; lane < b->lanes; lane++)
+        if (!b->stop[lane] && b->pc[lane] < pc)
+            pc = b->pc[lane];
+
+    if (pc == UINT32_MAX)
+        return(false);
+
+    for (int lane = 0; lane < b->lanes; lane++)
+    {
+        b->active[lane] = 0;
+        if (b->stop[lane])
+            continue;
+
+        if (b->pc[lane] != pc)
+        {
+            if (b->pc[lane] < waiting)
+                waiting = b->pc[lane];
+            continue;
+        }
+
+        // every instruction sets the unused flag bit before it runs
+        b->active[lane] = 0xff;
+        b->flags[lane] |= FAKE6502_CONSTANT_FLAG;
+        b->pending[lane] = 0;
+        if (b->budget - b->instructions[lane] < limit)
+            limit = b->budget - b->instructions[lane];
+    }
+
+    b->group_pc = pc;
+    b->group_waiting = waiting;
+    b->group_limit = limit;
+    b->group_instructions = 0;
+    b->group_ticks = 0;
+    return(true);
 }
 
-FAKE6502_FN_OPCODE(bvs)
+// bring each lane in the group up to date; after a branch that split the
+// group, lanes that took it go to `target`, after an RTS, to their own ea
+
+#define FAKE6502_BATCH_SPLIT_NONE       0
+#define FAKE6502_BATCH_SPLIT_BRANCH     1
+#define FAKE6502_BATCH_SPLIT_RETURN     2
+
+static void batch_settle(fake6502_batch *b, int split, uint16_t target)
 {
-    if ((c->cpu.flags & FAKE6502_OVERFLOW_FLAG) == FAKE6502_OVERFLOW_FLAG)
-        bra(c);
+    for (int lane = 0; lane < b->lanes; lane++)
+    {
+        if (!b->active[lane])
+            continue;
+
+        if (split == FAKE6502_BATCH_SPLIT_BRANCH && b->extra[lane])
+            b->pc[lane] = target;
+        else if (split == FAKE6502_BATCH_SPLIT_RETURN)
+            b->pc[lane] = b->ea[lane];
+        else
+            b->pc[lane] = b->group_pc;
+
+        b->instructions[lane] += b->group_instructions;
+        b->clockticks[lane] += b->group_ticks + b->pending[lane];
+        if (!b->stop[lane] && b->instructions[lane] >= b->budget)
+            b->stop[lane] = FAKE6502_STOP_BUDGET;
+    }
 }
 
-FAKE6502_FN_OPCODE(clc)
-{ fake6502_carry_clear(c); }
+// one instruction for the group; returns false once the group is settled
 
-FAKE6502_FN_OPCODE(cld)
-{ fake6502_decimal_clear(c); }
+static bool batch_step(fake6502_batch *b, fake6502_context *c)
+{
+    const fake6502_opcode *table = fake6502_opcode_tables[b->variant];
+    uint16_t pc = b->group_pc;
+    uint8_t opcode = b->memory[pc];
+    int kernel = b->kernels[opcode];
+    int mode = b->modes[opcode];
+    uint16_t operand = 0, next = pc + 1, target = 0;
+    bool any_taken = false, any_not_taken = false;
+
+    // a lane may have written over the code, so each lane fetches its own;
+    // so does BRK when a lane has written over the vector
+    for (int i = 0; i < 3; i++)
+        if (b->column[(uint16_t)(pc + i)])
+            kernel = FAKE6502_BATCH_SCALAR;
+    if (kernel == FAKE6502_BATCH_BRK && (b->column[0xfffe] || b->column[0xffff]))
+        kernel = FAKE6502_BATCH_SCALAR;
+
+    if (kernel == FAKE6502_BATCH_SCALAR)
+    {
+        batch_settle(b, FAKE6502_BATCH_SPLIT_NONE, 0);
+        batch_scalar(b, c);
+        return(false);
+    }
 
-FAKE6502_FN_OPCODE(cli)
-{ fake6502_interrupt_clear(c); }
+    if (mode == FAKE6502_BATCH_IMM)
+        operand = next++;
+    else if (mode == FAKE6502_BATCH_ZP || mode == FAKE6502_BATCH_ZPX ||
+             mode == FAKE6502_BATCH_ZPY || mode == FAKE6502_BATCH_REL)
+        operand = b->memory[next++];
+    else if (mode != FAKE6502_BATCH_IMP)
+    {
+        operand = b->memory[next] | (uint16_t)b->memory[(uint16_t)(next + 1)] << 8;
+        next += 2;
+    }
 
-FAKE6502_FN_OPCODE(clv)
-{ fake6502_overflow_clear(c); }
+    if (mode == FAKE6502_BATCH_REL)
+        target = next + (uint16_t)(int8_t)operand;
+    else if (kernel == FAKE6502_BATCH_JMP || kernel == FAKE6502_BATCH_JSR)
+        target = operand;
+    else if (kernel == FAKE6502_BATCH_BRK)
+        target = b->memory[0xfffe] | (uint16_t)b->memory[0xffff] << 8;
 
-FAKE6502_FN_OPCODE(cmp)
-{ compare(c, c->cpu.a); }
+    b->fault = 0;
+    for (int i = 0; i < b->lanes; i += FAKE6502_VEC_BYTES)
+    {
+        fake6502_vec m = vec_load(b->active + i);
 
-FAKE6502_FN_OPCODE(cpx)
-{ compare(c, c->cpu.x); }
+        if (!vec_any(m))
+            continue;
 
-FAKE6502_FN_OPCODE(cpy)
-{ compare(c, c->cpu.y); }
+        batch_vector(b, i, m, kernel, mode, operand, next);
 
-FAKE6502_FN_OPCODE(dec)
-{ fake6502_put_value(c, decrement(c, fake6502_get_value(c))); }
+        if (mode == FAKE6502_BATCH_REL)
+        {
+            // a taken branch costs 1, or 2 into another page
+            fake6502_vec taken = vec_load(b->extra + i);
+            uint8_t ticks = (target & 0xff00) != (next & 0xff00) ? 2 : 1;
 
-FAKE6502_FN_OPCODE(dex)
-{ c->cpu.x = decrement(c, c->cpu.x); }
+            vec_store(b->pending + i, vec_add(vec_load(b->pending + i),
+                                              vec_and(taken, vec_set(ticks))));
+            any_taken |= vec_any(taken);
+            any_not_taken |= vec_any(vec_andnot(taken, m));
+        }
+    }
 
-FAKE6502_FN_OPCODE(dey)
-{ c->cpu.y = decrement(c, c->cpu.y); }
+    b->group_instructions++;
+    b->group_ticks += table[opcode].clockticks;
 
-FAKE6502_FN_OPCODE(eor)
-{ fake6502_accum_save(c, exclusive_or(c, c->cpu.a, fake6502_get_value(c))); }
+    if (any_taken && any_not_taken)
+    {
+        b->group_pc = next;
+        batch_settle(b, FAKE6502_BATCH_SPLIT_BRANCH, target);
+        return(false);
+    }
 
-FAKE6502_FN_OPCODE(inc)
-{ fake6502_put_value(c, increment(c, fake6502_get_value(c))); }
+    if (kernel == FAKE6502_BATCH_RTS)
+    {
+        batch_settle(b, FAKE6502_BATCH_SPLIT_RETURN, 0);
+        return(false);
+    }
 
-FAKE6502_FN_OPCODE(inx)
-{ c->cpu.x = increment(c, c->cpu.x); }
+    b->group_pc = any_taken || kernel == FAKE6502_BATCH_JMP || kernel == FAKE6502_BATCH_JSR ||
+                  kernel == FAKE6502_BATCH_BRK ? target : next;
 
-FAKE6502_FN_OPCODE(iny)
-{ c->cpu.y = increment(c, c->cpu.y); }
+    if (b->fault || kernel == FAKE6502_BATCH_BRK ||
+        b->group_instructions == b->group_limit || b->group_pc >= b->group_waiting)
+    {
+        batch_settle(b, FAKE6502_BATCH_SPLIT_NONE, 0);
+        return(false);
+    }
 
-FAKE6502_FN_OPCODE(jmp)
-{ c->cpu.pc = c->emu.ea; }
+    return(true);
+}
 
-FAKE6502_FN_OPCODE(jsr)
+// lanes back to their starting state, and memory back to the shared image
+
+void fake6502_batch_reset(fake6502_batch *b)
 {
-    fake6502_push_16(c, c->cpu.pc - 1);
-    c->cpu.pc = c->emu.ea;
+    for (int column = 1; column <= b->columns; column++)
+        b->column[b->addresses[column]] = 0;
+    b->columns = 0;
+
+    for (int lane = 0; lane < FAKE6502_BATCH_LANES; lane++)
+    {
+        b->a[lane] = b->x[lane] = b->y[lane] = 0;
+        b->s[lane] = 0xfd;
+        b->flags[lane] = FAKE6502_CONSTANT_FLAG;
+        b->pc[lane] = 0;
+        b->clockticks[lane] = b->instructions[lane] = 0;
+        b->active[lane] = b->extra[lane] = b->pending[lane] = 0;
+        b->stop[lane] = lane < b->lanes ? FAKE6502_STOP_NONE : FAKE6502_STOP_BUDGET;
+    }
 }
 
-FAKE6502_FN_OPCODE(lda)
+// lanes is clamped to 1 to FAKE6502_BATCH_LANES, the size of every
+// per-lane array
+
+void fake6502_batch_init(fake6502_batch *b, fake6502_variant variant,
+                         const uint8_t *memory, int lanes)
 {
-    uint16_t value = fake6502_get_value(c);
-    c->cpu.a = (uint8_t)(value & 0x00FF);
+    const fake6502_opcode *table = fake6502_opcode_tables[variant];
 
-    fake6502_zero_calc(c, c->cpu.a);
-    fake6502_sign_calc(c, c->cpu.a);
+    memset(b, 0, sizeof(*b));
+    b->memory = memory;
+    b->variant = variant;
+    b->lanes = lanes < 1 ? 1 : lanes > FAKE6502_BATCH_LANES ? FAKE6502_BATCH_LANES : lanes;
+
+    for (int opcode = 0; opcode < 256; opcode++)
+    {
+        b->modes[opcode] = batch_mode(table[opcode].addr_mode);
+        if (b->modes[opcode] != FAKE6502_BATCH_OTHER)
+            b->kernels[opcode] = batch_kernel(table[opcode].opcode);
+    }
+
+    fake6502_batch_reset(b);
+
+    arith_ready();
 }
 
-FAKE6502_FN_OPCODE(ldx)
+// run every lane until it executes a BRK or a halt opcode, has run
+// instr_budget instructions (0 for no limit), or has written to more
+// addresses than there are columns
+
+void fake6502_batch_run(fake6502_batch *b, int instr_budget)
 {
-    uint16_t value = fake6502_get_value(c);
-    c->cpu.x = (uint8_t)(value & 0x00FF);
+    fake6502_context c;
 
-    fake6502_zero_calc(c, c->cpu.x);
-    fake6502_sign_calc(c, c->cpu.x);
+    fake6502_init(&c, batch_mem_read, batch_mem_write, b);
+    c.variant = b->variant;
+    c.engine = FAKE6502_ENGINE_FUSED;
+    b->budget = instr_budget > 0 ? (uint32_t)instr_budget : UINT32_MAX;
+
+    while (batch_group(b))
+        while (batch_step(b, &c))
+            ;
+}
+
+#endif
+
+
+// -------------------------------------------------------------------
+
+// the bitsliced engine
+
+// the circuits of add8(), compare(), the shifts and the logic helpers,
+// written out gate by gate on slices, so every lane is worked out with
+// the same few word operations; an operand is the same in every lane, so
+// each of its bits is a slice of all ones or all zeros. It takes its
+// opcodes from the batch engine's list of kernels
+
+#ifndef FAKE6502_BUS_FLAT
+
+// the flags' bit numbers in fake6502_sliced.flags
+
+#define FAKE6502_SLICED_C               0
+#define FAKE6502_SLICED_Z               1
+#define FAKE6502_SLICED_I               2
+#define FAKE6502_SLICED_D               3
+#define FAKE6502_SLICED_V               6
+#define FAKE6502_SLICED_N               7
+
+#define FAKE6502_SLICE_FN(m_name, m_expr)                                         \
+    static inline fake6502_slice m_name(fake6502_slice a, fake6502_slice b)     \
+    {                                                                           \
+        for (int k = 0; k < FAKE6502_SLICED_WORDS; k++)                         \
+            a.w[k] = (m_expr);                                                  \
+        return(a);                                                              \
+    }
+
+FAKE6502_SLICE_FN(slice_and, a.w[k] & b.w[k])
+FAKE6502_SLICE_FN(slice_or, a.w[k] | b.w[k])
+FAKE6502_SLICE_FN(slice_xor, a.w[k] ^ b.w[k])
+FAKE6502_SLICE_FN(slice_andnot, ~a.w[k] & b.w[k])
+
+static inline fake6502_slice slice_fill(bool on)
+{
+    fake6502_slice s;
+
+    for (int k = 0; k < FAKE6502_SLICED_WORDS; k++)
+        s.w[k] = on ? UINT64_MAX : 0;
+    return(s);
+}
+
+static inline fake6502_slice slice_not(fake6502_slice a)
+{ return(slice_andnot(a, slice_fill(true))); }
+
+// the low bits of value, one slice a bit
+
+static inline void slice_const(fake6502_slice *r, unsigned value, int bits)
+{
+    for (int i = 0; i < bits; i++)
+        r[i] = slice_fill((value >> i) & 1);
+}
+
+// r = a + b + carry over the low bits, returning the carry out of the top
+// bit; r may be a or b
+
+static inline fake6502_slice slice_add(fake6502_slice *r, const fake6502_slice *a,
+                                       const fake6502_slice *b, fake6502_slice carry, int bits)
+{
+    for (int i = 0; i < bits; i++)
+    {
+        fake6502_slice half = slice_xor(a[i], b[i]);
+        fake6502_slice both = slice_and(a[i], b[i]);
+
+        r[i] = slice_xor(half, carry);
+        carry = slice_or(both, slice_and(carry, half));
+    }
+    return(carry);
 }
 
-FAKE6502_FN_OPCODE(ldy)
+// fake6502_zero_calc() and fake6502_sign_calc() of an 8 bit result
+
+static inline void sliced_nz(fake6502_sliced *s, const fake6502_slice *r)
 {
-    uint16_t value = fake6502_get_value(c);
-    c->cpu.y = (uint8_t)(value & 0x00FF);
+    fake6502_slice any = r[0];
 
-    fake6502_zero_calc(c, c->cpu.y);
-    fake6502_sign_calc(c, c->cpu.y);
+    for (int i = 1; i < 8; i++)
+        any = slice_or(any, r[i]);
+    s->flags[FAKE6502_SLICED_Z] = slice_not(any);
+    s->flags[FAKE6502_SLICED_N] = r[7];
 }
 
-FAKE6502_FN_OPCODE(lsr)
-{ fake6502_put_value(c, logical_shift_right(c, fake6502_get_value(c))); }
+// add8() into A, of a 16 bit b as sub8() may pass it, with the decimal
+// fix in the lanes set in decimal
 
-FAKE6502_FN_OPCODE(nop)
-{}
+static void sliced_add8(fake6502_sliced *s, const fake6502_slice *b, fake6502_slice decimal)
+{
+    fake6502_slice a[16], result[16], fix[16], high;
+    fake6502_slice zero = slice_fill(false);
+
+    for (int i = 0; i < 16; i++)
+        a[i] = i < 8 ? s->a[i] : zero;
+
+    slice_add(result, a, b, s->flags[FAKE6502_SLICED_C], 16);
+    sliced_nz(s, result);
+    s->flags[FAKE6502_SLICED_V] = slice_and(slice_xor(result[7], a[7]),
+                                            slice_xor(result[7], b[7]));
+
+    // result += ((((result + 0x66) ^ a ^ b) >> 3) & 0x22) * 3, where the
+    // two bits kept are bits 4 and 8 of the sum, each times 3
+    slice_const(fix, 0x66, 16);
+    slice_add(fix, result, fix, zero, 16);
+    fix[1] = slice_and(decimal, slice_xor(slice_xor(fix[4], a[4]), b[4]));
+    fix[5] = slice_and(decimal, slice_xor(slice_xor(fix[8], a[8]), b[8]));
+    fix[2] = fix[1];
+    fix[6] = fix[5];
+    fix[0] = fix[3] = fix[4] = fix[7] = zero;
+    for (int i = 8; i < 16; i++)
+        fix[i] = zero;
+    slice_add(result, result, fix, zero, 16);
+
+    high = result[8];
+    for (int i = 9; i < 16; i++)
+        high = slice_or(high, result[i]);
+    s->flags[FAKE6502_SLICED_C] = high;
+
+    for (int i = 0; i < 8; i++)
+        s->a[i] = result[i];
+}
 
-FAKE6502_FN_OPCODE(ora)
+// ADC and SBC of an operand; decimal is false for the 2A03
+
+static void sliced_arith(fake6502_sliced *s, uint8_t value, bool subtract, bool decimal)
 {
-    uint16_t value = fake6502_get_value(c);
-    uint16_t result = (uint16_t)c->cpu.a | value;
+    fake6502_slice b[16], bcd[16];
+    fake6502_slice d = decimal ? s->flags[FAKE6502_SLICED_D] : slice_fill(false);
 
-    fake6502_zero_calc(c, result);
-    fake6502_sign_calc(c, result);
+    if (!subtract)
+    {
+        slice_const(b, value, 16);
+        sliced_add8(s, b, d);
+        return;
+    }
 
-    fake6502_accum_save(c, result);
+    // sub8(): the ones complement, less 0x66 in 16 bits in decimal lanes
+    slice_const(b, value ^ 0x00ff, 16);
+    slice_const(bcd, (uint16_t)((value ^ 0x00ff) - 0x0066), 16);
+    for (int i = 0; i < 16; i++)
+        b[i] = slice_or(slice_and(d, bcd[i]), slice_andnot(d, b[i]));
+    sliced_add8(s, b, d);
 }
 
-FAKE6502_FN_OPCODE(pha)
-{ fake6502_push_8(c, c->cpu.a); }
+// compare(): C from r + 0x100 - value, Z and N from r - value
 
-FAKE6502_FN_OPCODE(phx)
-{ fake6502_push_8(c, c->cpu.x); }
+static void sliced_compare(fake6502_sliced *s, const fake6502_slice *r, uint8_t value)
+{
+    fake6502_slice b[8], result[8];
 
-FAKE6502_FN_OPCODE(phy)
-{ fake6502_push_8(c, c->cpu.y); }
+    slice_const(b, value ^ 0xff, 8);
+    s->flags[FAKE6502_SLICED_C] = slice_add(result, r, b, slice_fill(true), 8);
+    sliced_nz(s, result);
+}
 
-FAKE6502_FN_OPCODE(php)
-{ fake6502_push_8(c, c->cpu.flags | FAKE6502_BREAK_FLAG); }
+// increment() and decrement()
 
-FAKE6502_FN_OPCODE(pla)
+static void sliced_step(fake6502_sliced *s, fake6502_slice *r, uint8_t by)
 {
-    c->cpu.a = fake6502_pull_8(c);
+    fake6502_slice b[8];
 
-    fake6502_zero_calc(c, c->cpu.a);
-    fake6502_sign_calc(c, c->cpu.a);
+    slice_const(b, by, 8);
+    slice_add(r, r, b, slice_fill(false), 8);
+    sliced_nz(s, r);
 }
 
-FAKE6502_FN_OPCODE(plx)
+// the shifts and rotates of A, shifting carry in and the bit shifted out
+// into C
+
+static void sliced_shift(fake6502_sliced *s, bool right, fake6502_slice carry)
 {
-    c->cpu.x = fake6502_pull_8(c);
+    fake6502_slice out;
 
-    fake6502_zero_calc(c, c->cpu.x);
-    fake6502_sign_calc(c, c->cpu.x);
+    if (right)
+    {
+        out = s->a[0];
+        for (int i = 0; i < 7; i++)
+            s->a[i] = s->a[i + 1];
+        s->a[7] = carry;
+    }
+    else
+    {
+        out = s->a[7];
+        for (int i = 7; i > 0; i--)
+            s->a[i] = s->a[i - 1];
+        s->a[0] = carry;
+    }
+    s->flags[FAKE6502_SLICED_C] = out;
+    sliced_nz(s, s->a);
 }
 
-FAKE6502_FN_OPCODE(ply)
-{
-    c->cpu.y = fake6502_pull_8(c);
+// copy a register, setting N and Z
 
-    fake6502_zero_calc(c, c->cpu.y);
-    fake6502_sign_calc(c, c->cpu.y);
+static void sliced_load(fake6502_sliced *s, fake6502_slice *r, const fake6502_slice *from)
+{
+    memmove(r, from, 8 * sizeof(fake6502_slice));
+    sliced_nz(s, r);
 }
 
-FAKE6502_FN_OPCODE(plp)
-{ c->cpu.flags = fake6502_pull_8(c) | FAKE6502_CONSTANT_FLAG | FAKE6502_BREAK_FLAG; }
+// the lanes keep their registers; only the opcodes are looked up
 
-FAKE6502_FN_OPCODE(rol)
+void fake6502_sliced_init(fake6502_sliced *s, fake6502_variant variant)
 {
-    uint16_t value = fake6502_get_value(c);
+    const fake6502_opcode *table = fake6502_opcode_tables[variant];
 
-    fake6502_put_value(c, value);
-    fake6502_put_value(c, rotate_left(c, value));
+    memset(s, 0, sizeof(*s));
+    s->variant = variant;
+
+    for (int opcode = 0; opcode < 256; opcode++)
+    {
+        int mode = batch_mode(table[opcode].addr_mode);
+
+        // fake6502_sliced_run() stops at those of these using S, the stack
+        // or the pc
+        if (mode != FAKE6502_BATCH_IMP && mode != FAKE6502_BATCH_IMM)
+            continue;
+
+        s->kernels[opcode] = batch_kernel(table[opcode].opcode);
+        s->sizes[opcode] = mode == FAKE6502_BATCH_IMM ? 2 : 1;
+    }
 }
 
-FAKE6502_FN_OPCODE(ror)
+// set or get a lane's A, X, Y and flags; S and the pc are not used
+
+void fake6502_sliced_set(fake6502_sliced *s, int lane, const fake6502_cpu_state *cpu)
 {
-    uint16_t value = fake6502_get_value(c);
+    uint64_t bit = (uint64_t)1 << (lane & 63);
+    int word = lane >> 6;
 
-    fake6502_put_value(c, value);
-    fake6502_put_value(c, rotate_right(c, value));
+    for (int i = 0; i < 8; i++)
+    {
+        s->a[i].w[word] = (s->a[i].w[word] & ~bit) | ((cpu->a >> i) & 1 ? bit : 0);
+        s->x[i].w[word] = (s->x[i].w[word] & ~bit) | ((cpu->x >> i) & 1 ? bit : 0);
+        s->y[i].w[word] = (s->y[i].w[word] & ~bit) | ((cpu->y >> i) & 1 ? bit : 0);
+        s->flags[i].w[word] = (s->flags[i].w[word] & ~bit) | ((cpu->flags >> i) & 1 ? bit : 0);
+    }
 }
 
-FAKE6502_FN_OPCODE(rti)
+void fake6502_sliced_get(const fake6502_sliced *s, int lane, fake6502_cpu_state *cpu)
 {
-    c->cpu.flags = fake6502_pull_8(c) | FAKE6502_CONSTANT_FLAG | FAKE6502_BREAK_FLAG;
-    c->cpu.pc = fake6502_pull_16(c);
+    int bit = lane & 63, word = lane >> 6;
+
+    cpu->a = cpu->x = cpu->y = cpu->flags = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        cpu->a |= ((s->a[i].w[word] >> bit) & 1) << i;
+        cpu->x |= ((s->x[i].w[word] >> bit) & 1) << i;
+        cpu->y |= ((s->y[i].w[word] >> bit) & 1) << i;
+        cpu->flags |= ((s->flags[i].w[word] >> bit) & 1) << i;
+    }
 }
 
-FAKE6502_FN_OPCODE(rts)
-{ c->cpu.pc = fake6502_pull_16(c) + 1; }
+// run code from its start in every lane, up to its end or the first
+// instruction that uses memory, S, the stack or the pc, returning how
+// many bytes it ran
 
-FAKE6502_FN_OPCODE(sbc)
+size_t fake6502_sliced_run(fake6502_sliced *s, const uint8_t *code, size_t size)
 {
-    uint16_t value = fake6502_get_value(c) ^ 0x00ff; // ones complement
+    size_t pc = 0;
+    bool bcd = s->variant != FAKE6502_VARIANT_2A03;
 
-    #ifdef DECIMALMODE
-        // Apply decimal mode fix from http://forum.6502.org/viewtopic.php?p=37758#p37758
-        if(c->cpu.flags & FAKE6502_DECIMAL_FLAG)
-          value -= 0x0066; // use nines complement for BCD
-    #endif
+    while (pc < size)
+    {
+        uint8_t opcode = code[pc];
+        uint8_t value;
+
+        if (!s->sizes[opcode] || pc + s->sizes[opcode] > size)
+            break;
+        value = s->sizes[opcode] == 2 ? code[pc + 1] : 0;
+
+        switch (s->kernels[opcode])
+        {
+        case FAKE6502_BATCH_LDA: slice_const(s->a, value, 8); sliced_nz(s, s->a); break;
+        case FAKE6502_BATCH_LDX: slice_const(s->x, value, 8); sliced_nz(s, s->x); break;
+        case FAKE6502_BATCH_LDY: slice_const(s->y, value, 8); sliced_nz(s, s->y); break;
+
+        case FAKE6502_BATCH_AND:
+        case FAKE6502_BATCH_ORA:
+        case FAKE6502_BATCH_EOR:
+        {
+            fake6502_slice b[8];
+
+            slice_const(b, value, 8);
+            for (int i = 0; i < 8; i++)
+                s->a[i] = s->kernels[opcode] == FAKE6502_BATCH_AND ? slice_and(s->a[i], b[i]) :
+                          s->kernels[opcode] == FAKE6502_BATCH_ORA ? slice_or(s->a[i], b[i]) :
+                                                                    slice_xor(s->a[i], b[i]);
+            sliced_nz(s, s->a);
+            break;
+        }
+
+        case FAKE6502_BATCH_BIT_IMM:
+        {
+            fake6502_slice any = slice_fill(false);
+
+            for (int i = 0; i < 8; i++)
+                if ((value >> i) & 1)
+                    any = slice_or(any, s->a[i]);
+            s->flags[FAKE6502_SLICED_Z] = slice_not(any);
+            break;
+        }
+
+        case FAKE6502_BATCH_ADC:        sliced_arith(s, value, false, bcd); break;
+        case FAKE6502_BATCH_SBC:        sliced_arith(s, value, true, bcd); break;
+        case FAKE6502_BATCH_ADC_2A03:   sliced_arith(s, value, false, false); break;
+        case FAKE6502_BATCH_SBC_2A03:   sliced_arith(s, value, true, false); break;
+
+        case FAKE6502_BATCH_CMP:        sliced_compare(s, s->a, value); break;
+        case FAKE6502_BATCH_CPX:        sliced_compare(s, s->x, value); break;
+        case FAKE6502_BATCH_CPY:        sliced_compare(s, s->y, value); break;
+
+        case FAKE6502_BATCH_INC_A:      sliced_step(s, s->a, 0x01); break;
+        case FAKE6502_BATCH_DEC_A:      sliced_step(s, s->a, 0xff); break;
+        case FAKE6502_BATCH_INX:        sliced_step(s, s->x, 0x01); break;
+        case FAKE6502_BATCH_DEX:        sliced_step(s, s->x, 0xff); break;
+        case FAKE6502_BATCH_INY:        sliced_step(s, s->y, 0x01); break;
+        case FAKE6502_BATCH_DEY:        sliced_step(s, s->y, 0xff); break;
+
+        case FAKE6502_BATCH_ASL_A:      sliced_shift(s, false, slice_fill(false)); break;
+        case FAKE6502_BATCH_LSR_A:      sliced_shift(s, true, slice_fill(false)); break;
+        case FAKE6502_BATCH_ROL_A:      sliced_shift(s, false, s->flags[FAKE6502_SLICED_C]); break;
+        case FAKE6502_BATCH_ROR_A:      sliced_shift(s, true, s->flags[FAKE6502_SLICED_C]); break;
+
+        case FAKE6502_BATCH_TAX:        sliced_load(s, s->x, s->a); break;
+        case FAKE6502_BATCH_TAY:        sliced_load(s, s->y, s->a); break;
+        case FAKE6502_BATCH_TXA:        sliced_load(s, s->a, s->x); break;
+        case FAKE6502_BATCH_TYA:        sliced_load(s, s->a, s->y); break;
+
+        case FAKE6502_BATCH_CLC:  s->flags[FAKE6502_SLICED_C] = slice_fill(false); break;
+        case FAKE6502_BATCH_SEC:  s->flags[FAKE6502_SLICED_C] = slice_fill(true); break;
+        case FAKE6502_BATCH_CLD:  s->flags[FAKE6502_SLICED_D] = slice_fill(false); break;
+        case FAKE6502_BATCH_SED:  s->flags[FAKE6502_SLICED_D] = slice_fill(true); break;
+        case FAKE6502_BATCH_CLI:  s->flags[FAKE6502_SLICED_I] = slice_fill(false); break;
+        case FAKE6502_BATCH_SEI:  s->flags[FAKE6502_SLICED_I] = slice_fill(true); break;
+        case FAKE6502_BATCH_CLV:  s->flags[FAKE6502_SLICED_V] = slice_fill(false); break;
+
+        case FAKE6502_BATCH_NOP:
+            break;
+
+        default:
+            return(pc);
+        }
+        pc += s->sizes[opcode];
+    }
 
-    fake6502_accum_save(c, add8(c, c->cpu.a, value, c->cpu.flags & FAKE6502_CARRY_FLAG));
+    return(pc);
 }
 
-FAKE6502_FN_OPCODE(sec)
-{ fake6502_carry_set(c); }
+#endif
 
-FAKE6502_FN_OPCODE(sed)
-{ fake6502_decimal_set(c); }
 
-FAKE6502_FN_OPCODE(sei)
-{ fake6502_interrupt_set(c); }
+// -------------------------------------------------------------------
 
-FAKE6502_FN_OPCODE(sta)
-{ fake6502_put_value(c, c->cpu.a); }
+// the equivalence checker
 
-FAKE6502_FN_OPCODE(stx)
-{ fake6502_put_value(c, c->cpu.x); }
+#ifndef FAKE6502_BUS_FLAT
 
-FAKE6502_FN_OPCODE(sty)
-{ fake6502_put_value(c, c->cpu.y); }
+// reads come straight from the pages; every write is logged with the
+// value it replaces, so that the side can be put back after each input
 
-FAKE6502_FN_OPCODE(stz)
-{ fake6502_put_value(c, 0); }
+static uint8_t equiv_mem_read(fake6502_context *c, uint16_t address)
+{
+    fake6502_equiv *e = c->state_host;
 
-FAKE6502_FN_OPCODE(tax)
+    return(e->memory[c == &e->sides[1]][address]);
+}
+
+static void equiv_mem_write(fake6502_context *c, uint16_t address, uint8_t val)
 {
-    c->cpu.x = c->cpu.a;
+    fake6502_equiv *e = c->state_host;
+    int side = c == &e->sides[1];
+    int n = e->undo_count[side];
 
-    fake6502_zero_calc(c, c->cpu.x);
-    fake6502_sign_calc(c, c->cpu.x);
+    if (n < FAKE6502_EQUIV_UNDO)
+    {
+        e->undo[side][n].address = address;
+        e->undo[side][n].val = e->memory[side][address];
+    }
+    if (n <= FAKE6502_EQUIV_UNDO)
+        e->undo_count[side] = n + 1;
+    e->memory[side][address] = val;
 }
 
-FAKE6502_FN_OPCODE(tay)
+// put a side's memory back to the image with its code in it; once the
+// log has overflowed, all of it is copied
+
+static void equiv_undo(fake6502_equiv *e, int side, const uint8_t *code)
 {
-    c->cpu.y = c->cpu.a;
+    uint8_t *memory = e->memory[side];
+    int n = e->undo_count[side];
 
-    fake6502_zero_calc(c, c->cpu.y);
-    fake6502_sign_calc(c, c->cpu.y);
+    if (n > FAKE6502_EQUIV_UNDO)
+    {
+        if (e->image)
+            memcpy(memory, e->image, 65536);
+        else
+            memset(memory, 0, 65536);
+        if (code)
+            memcpy(memory + e->origin, code, e->code_size[side]);
+    }
+    else
+        while (n--)
+            memory[e->undo[side][n].address] = e->undo[side][n].val;
+
+    e->undo_count[side] = 0;
 }
 
-FAKE6502_FN_OPCODE(tsx)
+// replace the code the last check left at the origin
+
+static void equiv_load(fake6502_equiv *e, int side, const uint8_t *code, size_t size)
 {
-    c->cpu.x = c->cpu.s;
+    uint8_t *memory = e->memory[side];
 
-    fake6502_zero_calc(c, c->cpu.x);
-    fake6502_sign_calc(c, c->cpu.x);
+    equiv_undo(e, side, NULL);
+    if (e->image)
+        memcpy(memory + e->origin, e->image + e->origin, e->code_size[side]);
+    else
+        memset(memory + e->origin, 0, e->code_size[side]);
+
+    e->code_size[side] = size < 65536u - e->origin ? size : 65536u - e->origin;
+    memcpy(memory + e->origin, code, e->code_size[side]);
 }
 
-FAKE6502_FN_OPCODE(trb)
+static fake6502_stop_reason equiv_run(fake6502_equiv *e, int side,
+                                      const fake6502_equiv_vector *v)
 {
-    uint16_t value = fake6502_get_value(c);
-    uint16_t result = (uint16_t)c->cpu.a & ~value;
-    fake6502_put_value(c, result);
-    fake6502_zero_calc(c, (c->cpu.a | result) & 0x00ff);
+    fake6502_context *c = &e->sides[side];
+
+    for (int i = 0; i < e->input_count; i++)
+        fake6502_mem_write(c, e->inputs[i], v->memory[i]);
+
+    c->cpu.a = v->a;
+    c->cpu.x = v->x;
+    c->cpu.y = v->y;
+    c->cpu.s = v->s;
+    c->cpu.flags = v->flags | FAKE6502_CONSTANT_FLAG;
+    c->cpu.pc = e->origin;
+    return(fake6502_run(c, 0, e->instr_budget));
 }
 
-FAKE6502_FN_OPCODE(tsb)
+// an output that differs, outside the code, which differs anyway
+
+static inline bool equiv_output_differs(fake6502_equiv *e, const fake6502_equiv_mask *mask,
+                                        uint16_t address)
 {
-    uint16_t value = fake6502_get_value(c);
-    uint16_t result = (uint16_t)c->cpu.a | value;
-    fake6502_put_value(c, result);
-    fake6502_zero_calc(c, (c->cpu.a | result) & 0x00ff);
+    size_t code_size = e->code_size[0] > e->code_size[1] ? e->code_size[0] : e->code_size[1];
+
+    return((mask->memory[address >> 3] >> (address & 7) & 1) &&
+           (uint16_t)(address - e->origin) >= code_size &&
+           e->memory[0][address] != e->memory[1][address]);
 }
 
-FAKE6502_FN_OPCODE(txa)
+static bool equiv_differ(fake6502_equiv *e, const fake6502_equiv_mask *mask)
 {
-    c->cpu.a = c->cpu.x;
+    const fake6502_cpu_state *a = &e->sides[0].cpu, *b = &e->sides[1].cpu;
+
+    if (e->reasons[0] != e->reasons[1] ||
+        ((mask->registers & FAKE6502_EQUIV_A) && a->a != b->a) ||
+        ((mask->registers & FAKE6502_EQUIV_X) && a->x != b->x) ||
+        ((mask->registers & FAKE6502_EQUIV_Y) && a->y != b->y) ||
+        ((mask->registers & FAKE6502_EQUIV_S) && a->s != b->s) ||
+        ((a->flags ^ b->flags) & mask->flags))
+        return(true);
+
+    // memory neither side wrote to is still the same on both, but for
+    // the code; without the logs every output has to be looked at
+    if (e->undo_count[0] > FAKE6502_EQUIV_UNDO || e->undo_count[1] > FAKE6502_EQUIV_UNDO)
+    {
+        for (int i = 0; i < 8192; i++)
+            for (int bit = 0; mask->memory[i] >> bit; bit++)
+                if (equiv_output_differs(e, mask, i * 8 + bit))
+                    return(true);
+        return(false);
+    }
 
-    fake6502_zero_calc(c, c->cpu.a);
-    fake6502_sign_calc(c, c->cpu.a);
+    for (int side = 0; side < 2; side++)
+        for (int i = 0; i < e->undo_count[side]; i++)
+            if (equiv_output_differs(e, mask, e->undo[side][i].address))
+                return(true);
+    return(false);
 }
 
-FAKE6502_FN_OPCODE(txs)
-{ c->cpu.s = c->cpu.x; }
+// both sides start from image, or zeroed memory, with their code at
+// origin; each input's bytes go to the input_count addresses in inputs,
+// and each side runs until it stops or has run instr_budget instructions
 
-FAKE6502_FN_OPCODE(tya)
+void fake6502_equiv_init(fake6502_equiv *e, fake6502_variant variant,
+                         const uint8_t *image, uint16_t origin,
+                         const uint16_t *inputs, int input_count, int instr_budget)
 {
-    c->cpu.a = c->cpu.y;
+    e->image = image;
+    e->origin = origin;
+    e->input_count = input_count < FAKE6502_EQUIV_INPUTS ? input_count : FAKE6502_EQUIV_INPUTS;
+    memcpy(e->inputs, inputs, e->input_count * sizeof(uint16_t));
+    e->instr_budget = instr_budget;
 
-    fake6502_zero_calc(c, c->cpu.a);
-    fake6502_sign_calc(c, c->cpu.a);
+    for (int side = 0; side < 2; side++)
+    {
+        fake6502_context *c = &e->sides[side];
+
+        if (image)
+            memcpy(e->memory[side], image, 65536);
+        else
+            memset(e->memory[side], 0, 65536);
+        e->code_size[side] = 0;
+        e->undo_count[side] = 0;
+
+        fake6502_init(c, equiv_mem_read, equiv_mem_write, e);
+        c->variant = variant;
+        c->engine = FAKE6502_ENGINE_FUSED;
+        c->mode = FAKE6502_MODE_FAST;
+        fake6502_pages_map(c, 0x00, 256, e->memory[side], NULL);
+    }
 }
 
-FAKE6502_FN_OPCODE(lax)
+// run both programs on each input in turn, returning the index of the
+// first on which the outputs in mask differ, or -1 if there is none. The
+// input that differs has its mismatches counted and is moved ahead of
+// those that have found fewer, so the inputs that tell programs apart
+// are tried first next time; the index is where it has moved to. The
+// sides are left as that input left them, for the host to look at,
+// until the next check
+
+int fake6502_equiv_check(fake6502_equiv *e, const uint8_t *code_a, size_t size_a,
+                         const uint8_t *code_b, size_t size_b,
+                         fake6502_equiv_vector *vectors, int count,
+                         const fake6502_equiv_mask *mask)
 {
-    uint16_t value = fake6502_get_value(c);
-    c->cpu.x = c->cpu.a = (uint8_t)(value & 0x00FF);
+    const uint8_t *code[2] = {code_a, code_b};
 
-    fake6502_zero_calc(c, c->cpu.a);
-    fake6502_sign_calc(c, c->cpu.a);
-}
+    equiv_load(e, 0, code_a, size_a);
+    equiv_load(e, 1, code_b, size_b);
 
-FAKE6502_FN_OPCODE(sax)
-{ fake6502_put_value(c, c->cpu.a & c->cpu.x); }
+    for (int i = 0; i < count; i++)
+    {
+        e->reasons[0] = equiv_run(e, 0, &vectors[i]);
+        e->reasons[1] = equiv_run(e, 1, &vectors[i]);
+
+        if (equiv_differ(e, mask))
+        {
+            vectors[i].mismatches++;
+            for (; i && vectors[i - 1].mismatches < vectors[i].mismatches; i--)
+            {
+                fake6502_equiv_vector v = vectors[i];
+
+                vectors[i] = vectors[i - 1];
+                vectors[i - 1] = v;
+            }
+            return(i);
+        }
+
+        equiv_undo(e, 0, code[0]);
+        equiv_undo(e, 1, code[1]);
+    }
 
-FAKE6502_FN_OPCODE(dcp)
-{
-    dec(c);
-    cmp(c);
+    return(-1);
 }
 
-FAKE6502_FN_OPCODE(isb)
+#endif
+
+
+// -------------------------------------------------------------------
+
+// the thread pool
+
+// run one context, returning the instructions it executed
+
+static int pool_context(fake6502_context *c, int cycle_budget, int instr_budget,
+                        fake6502_pool_done_fn done, void *user)
 {
-    inc(c);
-    sbc(c);
+    int instructions = c->emu.instructions;
+    fake6502_stop_reason reason = fake6502_run(c, cycle_budget, instr_budget);
+
+    if (done)
+        done(c, reason, user);
+    return(c->emu.instructions - instructions);
 }
 
-FAKE6502_FN_OPCODE(slo)
+#ifdef FAKE6502_POOL_PTHREADS
+
+// each worker's share of the contexts is [next, end); it takes from the
+// front, and other workers steal from the back
+
+typedef struct fake6502_pool_worker {
+    fake6502_pool *pool;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    int next;
+    int end;
+    int index;
+} fake6502_pool_worker;
+
+struct fake6502_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t finished;
+    unsigned generation;
+    int running;
+    bool quit;
+
+    // the current run
+    fake6502_context *contexts;
+    int cycle_budget;
+    int instr_budget;
+    fake6502_pool_done_fn done;
+    void *user;
+    uint64_t instructions;
+
+    int threads;
+    fake6502_pool_worker workers[];
+};
+
+static double pool_now(void)
 {
-    asl(c);
-    ora(c);
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return(now.tv_sec + now.tv_nsec / 1e9);
 }
 
-FAKE6502_FN_OPCODE(rla)
+// the next context from the worker's own share, or -1
+
+static int pool_take(fake6502_pool_worker *w)
 {
-    uint16_t value = fake6502_get_value(c);
-    uint16_t result = rotate_left(c, value);
-    fake6502_put_value(c, value);
-    fake6502_put_value(c, result);
-    fake6502_accum_save(c, boolean_and(c, c->cpu.a, result));
+    int index = -1;
+
+    pthread_mutex_lock(&w->lock);
+    if (w->next < w->end)
+        index = w->next++;
+    pthread_mutex_unlock(&w->lock);
+    return(index);
 }
 
-FAKE6502_FN_OPCODE(sre)
+// move half of another worker's share to this one; false if there was
+// nothing left anywhere
+
+static bool pool_steal(fake6502_pool_worker *w)
 {
-    uint16_t value = fake6502_get_value(c);
-    uint16_t result = logical_shift_right(c, value);
-    fake6502_put_value(c, value);
-    fake6502_put_value(c, result);
-    fake6502_accum_save(c, exclusive_or(c, c->cpu.a, result));
+    fake6502_pool *pool = w->pool;
+
+    for (int k = 1; k < pool->threads; k++)
+    {
+        fake6502_pool_worker *victim = &pool->workers[(w->index + k) % pool->threads];
+        int next = 0, end = 0;
+
+        pthread_mutex_lock(&victim->lock);
+        if (victim->next < victim->end)
+        {
+            end = victim->end;
+            victim->end -= (victim->end - victim->next + 1) / 2;
+            next = victim->end;
+        }
+        pthread_mutex_unlock(&victim->lock);
+
+        if (next < end)
+        {
+            pthread_mutex_lock(&w->lock);
+            w->next = next;
+            w->end = end;
+            pthread_mutex_unlock(&w->lock);
+            return(true);
+        }
+    }
+
+    return(false);
 }
 
-FAKE6502_FN_OPCODE(rra)
+static void *pool_worker(void *arg)
 {
-    uint16_t value = fake6502_get_value(c);
-    uint16_t result = rotate_right(c, value);
-    fake6502_put_value(c, value);
-    fake6502_put_value(c, result);
-    fake6502_accum_save(c, add8(c, c->cpu.a, result, c->cpu.flags & FAKE6502_CARRY_FLAG));
+    fake6502_pool_worker *w = arg;
+    fake6502_pool *pool = w->pool;
+    unsigned generation = 0;
+
+    for (;;)
+    {
+        uint64_t instructions = 0;
+        bool quit;
+        int index;
+
+        pthread_mutex_lock(&pool->lock);
+        while (!pool->quit && pool->generation == generation)
+            pthread_cond_wait(&pool->start, &pool->lock);
+        generation = pool->generation;
+        quit = pool->quit;
+        pthread_mutex_unlock(&pool->lock);
+
+        if (quit)
+            return(NULL);
+
+        do
+            while ((index = pool_take(w)) >= 0)
+                instructions += pool_context(&pool->contexts[index], pool->cycle_budget,
+                                             pool->instr_budget, pool->done, pool->user);
+        while (pool_steal(w));
+
+        pthread_mutex_lock(&pool->lock);
+        pool->instructions += instructions;
+        if (--pool->running == 0)
+            pthread_cond_signal(&pool->finished);
+        pthread_mutex_unlock(&pool->lock);
+    }
 }
 
+// threads of 0 or less starts one per CPU the process may run on; with
+// pin, worker n runs only on the nth of those CPUs. Both need Linux, elsewhere the pool
+// has one thread unless told otherwise and is not pinned
 
-// -------------------------------------------------------------------
-// global's
-// -------------------------------------------------------------------
+fake6502_pool *fake6502_pool_create(int threads, bool pin)
+{
+    fake6502_pool *pool;
 
-// the opcode table - NMOS version
+#ifdef __linux__
+    cpu_set_t cpus;
+    int count = 0;
 
-#ifdef NMOS6502
-fake6502_opcode fake6502_opcodes[256] = {
-    /* 00 */
-    {imp, brk, 7},
-    {indx, ora, 6},
-    {imp, nop, 2},
-    {indx, slo, 8},
-    {zp, nop, 3},
-    {zp, ora, 3},
-    {zp, asl, 5},
-    {zp, slo, 5},
-    {imp, php, 3},
-    {imm, ora, 2},
-    {acc, asl, 2},
-    {imm, nop, 2},
-    {abso, nop, 4},
-    {abso, ora, 4},
-    {abso, asl, 6},
-    {abso, slo, 6},
-    /* 01 */
-    {rel, bpl, 2},
-    {indy_p, ora, 5},
-    {imp, nop, 2},
-    {indy, slo, 8},
-    {zpx, nop, 4},
-    {zpx, ora, 4},
-    {zpx, asl, 6},
-    {zpx, slo, 6},
-    {imp, clc, 2},
-    {absy_p, ora, 4},
-    {imp, nop, 2},
-    {absy, slo, 7},
-    {absx, nop, 4},
-    {absx_p, ora, 4},
-    {absx, asl, 7},
-    {absx, slo, 7},
-    /* 02 */
-    {abso, jsr, 6},
-    {indx, and, 6},
-    {imp, nop, 2},
-    {indx, rla, 8},
-    {zp, bit, 3},
-    {zp, and, 3},
-    {zp, rol, 5},
-    {zp, rla, 5},
-    {imp, plp, 4},
-    {imm, and, 2},
-    {acc, rol, 2},
-    {imm, nop, 2},
-    {abso, bit, 4},
-    {abso, and, 4},
-    {abso, rol, 6},
-    {abso, rla, 6},
-    /* 30 */
-    {rel, bmi, 2},
-    {indy_p, and, 5},
-    {imp, nop, 2},
-    {indy, rla, 8},
-    {zpx, nop, 4},
-    {zpx, and, 4},
-    {zpx, rol, 6},
-    {zpx, rla, 6},
-    {imp, sec, 2},
-    {absy_p, and, 4},
-    {imp, nop, 2},
-    {absy, rla, 7},
-    {absx, nop, 4},
-    {absx_p, and, 4},
-    {absx, rol, 7},
-    {absx, rla, 7},
-    /* 40 */
-    {imp, rti, 6},
-    {indx, eor, 6},
-    {imp, nop, 2},
-    {indx, sre, 8},
-    {zp, nop, 3},
-    {zp, eor, 3},
-    {zp, lsr, 5},
-    {zp, sre, 5},
-    {imp, pha, 3},
-    {imm, eor, 2},
-    {acc, lsr, 2},
-    {imm, nop, 2},
-    {abso, jmp, 3},
-    {abso, eor, 4},
-    {abso, lsr, 6},
-    {abso, sre, 6},
-    /* 50 */
-    {rel, bvc, 2},
-    {indy_p, eor, 5},
-    {imp, nop, 2},
-    {indy, sre, 8},
-    {zpx, nop, 4},
-    {zpx, eor, 4},
-    {zpx, lsr, 6},
-    {zpx, sre, 6},
-    {imp, cli, 2},
-    {absy_p, eor, 4},
-    {imp, nop, 2},
-    {absy, sre, 7},
-    {absx, nop, 4},
-    {absx_p, eor, 4},
-    {absx, lsr, 7},
-    {absx, sre, 7},
-    /* 60 */
-    {imp, rts, 6},
-    {indx, adc, 6},
-    {imp, nop, 2},
-    {indx, rra, 8},
-    {zp, nop, 3},
-    {zp, adc, 3},
-    {zp, ror, 5},
-    {zp, rra, 5},
-    {imp, pla, 4},
-    {imm, adc, 2},
-    {acc, ror, 2},
-    {imm, nop, 2},
-    {ind, jmp, 5},
-    {abso, adc, 4},
-    {abso, ror, 6},
-    {abso, rra, 6},
-    /* 70 */
-    {rel, bvs, 2},
-    {indy_p, adc, 5},
-    {imp, nop, 2},
-    {indy, rra, 8},
-    {zpx, nop, 4},
-    {zpx, adc, 4},
-    {zpx, ror, 6},
-    {zpx, rra, 6},
-    {imp, sei, 2},
-    {absy_p, adc, 4},
-    {imp, nop, 2},
-    {absy, rra, 7},
-    {absx, nop, 4},
-    {absx_p, adc, 4},
-    {absx, ror, 7},
-    {absx, rra, 7},
-    /* 80*/
-    {imm, nop, 2},
-    {indx, sta, 6},
-    {imm, nop, 2},
-    {indx, sax, 6},
-    {zp, sty, 3},
-    {zp, sta, 3},
-    {zp, stx, 3},
-    {zp, sax, 3},
-    {imp, dey, 2},
-    {imm, nop, 2},
-    {imp, txa, 2},
-    {imm, nop, 2},
-    {abso, sty, 4},
-    {abso, sta, 4},
-    {abso, stx, 4},
-    {abso, sax, 4},
-    /*90*/
-    {rel, bcc, 2},
-    {indy, sta, 6},
-    {imp, nop, 2},
-    {indy, nop, 6},
-    {zpx, sty, 4},
-    {zpx, sta, 4},
-    {zpy, stx, 4},
-    {zpy, sax, 4},
-    {imp, tya, 2},
-    {absy, sta, 5},
-    {imp, txs, 2},
-    {absy, nop, 5},
-    {absx, nop, 5},
-    {absx, sta, 5},
-    {absy, nop, 5},
-    {absy, nop, 5},
-    /* A0 */
-    {imm, ldy, 2},
-    {indx, lda, 6},
-    {imm, ldx, 2},
-    {indx, lax, 6},
-    {zp, ldy, 3},
-    {zp, lda, 3},
-    {zp, ldx, 3},
-    {zp, lax, 3},
-    {imp, tay, 2},
-    {imm, lda, 2},
-    {imp, tax, 2},
-    {imm, nop, 2},
-    {abso, ldy, 4},
-    {abso, lda, 4},
-    {abso, ldx, 4},
-    {abso, lax, 4},
-    /* B0 */
-    {rel, bcs, 2},
-    {indy_p, lda, 5},
-    {imp, nop, 2},
-    {indy_p, lax, 5},
-    {zpx, ldy, 4},
-    {zpx, lda, 4},
-    {zpy, ldx, 4},
-    {zpy, lax, 4},
-    {imp, clv, 2},
-    {absy_p, lda, 4},
-    {imp, tsx, 2},
-    {absy_p, lax, 4},
-    {absx_p, ldy, 4},
-    {absx_p, lda, 4},
-    {absy_p, ldx, 4},
-    {absy_p, lax, 4},
-    /* C0 */
-    {imm, cpy, 2},
-    {indx, cmp, 6},
-    {imm, nop, 2},
-    {indx, dcp, 8},
-    {zp, cpy, 3},
-    {zp, cmp, 3},
-    {zp, dec, 5},
-    {zp, dcp, 5},
-    {imp, iny, 2},
-    {imm, cmp, 2},
-    {imp, dex, 2},
-    {imm, nop, 2},
-    {abso, cpy, 4},
-    {abso, cmp, 4},
-    {abso, dec, 6},
-    {abso, dcp, 6},
-    /* D0 */
-    {rel, bne, 2},
-    {indy_p, cmp, 5},
-    {imp, nop, 2},
-    {indy, dcp, 8},
-    {zpx, nop, 4},
-    {zpx, cmp, 4},
-    {zpx, dec, 6},
-    {zpx, dcp, 6},
-    {imp, cld, 2},
-    {absy_p, cmp, 4},
-    {imp, nop, 2},
-    {absy, dcp, 7},
-    {absx, nop, 4},
-    {absx_p, cmp, 4},
-    {absx, dec, 7},
-    {absx, dcp, 7},
-    /* E0 */
-    {imm, cpx, 2},
-    {indx, sbc, 6},
-    {imm, nop, 2},
-    {indx, isb, 8},
-    {zp, cpx, 3},
-    {zp, sbc, 3},
-    {zp, inc, 5},
-    {zp, isb, 5},
-    {imp, inx, 2},
-    {imm, sbc, 2},
-    {imp, nop, 2},
-    {imm, sbc, 2},
-    {abso, cpx, 4},
-    {abso, sbc, 4},
-    {abso, inc, 6},
-    {abso, isb, 6},
-    /* F0 */
-    {rel, beq, 2},
-    {indy_p, sbc, 5},
-    {imp, nop, 2},
-    {indy, isb, 8},
-    {zpx, nop, 4},
-    {zpx, sbc, 4},
-    {zpx, inc, 6},
-    {zpx, isb, 6},
-    {imp, sed, 2},
-    {absy_p, sbc, 4},
-    {imp, nop, 2},
-    {absy, isb, 7},
-    {absx, nop, 4},
-    {absx_p, sbc, 4},
-    {absx, inc, 7},
-    {absx, isb, 7}};
+    if (!sched_getaffinity(0, sizeof(cpus), &cpus))
+        count = CPU_COUNT(&cpus);
+    if (threads <= 0)
+        threads = count;
 #endif
+    if (threads <= 0)
+        threads = 1;
 
+    pool = calloc(1, sizeof(fake6502_pool) + threads * sizeof(fake6502_pool_worker));
+    if (!pool)
+        return(NULL);
 
-// -------------------------------------------------------------------
-
-// the opcode table - CMOS version
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->finished, NULL);
 
-#ifdef CMOS6502
-fake6502_opcode fake6502_opcodes[256] = {
-    /* 00 */
-    {imp, brk, 7},
-    {indx, ora, 6},
-    {imp, nop, 2},
-    {indx, slo, 8},
-    {zp, tsb, 5},
-    {zp, ora, 3},
-    {zp, asl, 5},
-    {zp, slo, 5},
-    {imp, php, 3},
-    {imm, ora, 2},
-    {acc, asl, 2},
-    {imm, nop, 2},
-    {abso, tsb, 6},
-    {abso, ora, 4},
-    {abso, asl, 6},
-    {abso, slo, 6},
-    /* 01 */
-    {rel, bpl, 2},
-    {indy_p, ora, 5},
-    {zpi, ora, 5},
-    {indy, slo, 8},
-    {zp, trb, 5},
-    {zpx, ora, 4},
-    {zpx, asl, 6},
-    {zpx, slo, 6},
-    {imp, clc, 2},
-    {absy_p, ora, 4},
-    {acc, inc, 2},
-    {absy, slo, 7},
-    {abso, trb, 6},
-    {absx_p, ora, 4},
-    {absx, asl, 7},
-    {absx, slo, 7},
-    /* 02 */
-    {abso, jsr, 6},
-    {indx, and, 6},
-    {imp, nop, 2},
-    {indx, rla, 8},
-    {zp, bit, 3},
-    {zp, and, 3},
-    {zp, rol, 5},
-    {zp, rla, 5},
-    {imp, plp, 4},
-    {imm, and, 2},
-    {acc, rol, 2},
-    {imm, nop, 2},
-    {abso, bit, 4},
-    {abso, and, 4},
-    {abso, rol, 6},
-    {abso, rla, 6},
-    /* 30 */
-    {rel, bmi, 2},
-    {indy_p, and, 5},
-    {zpi, adc, 5},
-    {indy, rla, 8},
-    {zpx, bit, 4},
-    {zpx, and, 4},
-    {zpx, rol, 6},
-    {zpx, rla, 6},
-    {imp, sec, 2},
-    {absy_p, and, 4},
-    {acc, dec, 2},
-    {absy, rla, 7},
-    {absx_p, bit, 4},
-    {absx_p, and, 4},
-    {absx, rol, 7},
-    {absx, rla, 7},
-    /* 40 */
-    {imp, rti, 6},
-    {indx, eor, 6},
-    {imp, nop, 2},
-    {indx, sre, 8},
-    {zp, nop, 3},
-    {zp, eor, 3},
-    {zp, lsr, 5},
-    {zp, sre, 5},
-    {imp, pha, 3},
-    {imm, eor, 2},
-    {acc, lsr, 2},
-    {imm, nop, 2},
-    {abso, jmp, 3},
-    {abso, eor, 4},
-    {abso, lsr, 6},
-    {abso, sre, 6},
-    /* 50 */
-    {rel, bvc, 2},
-    {indy_p, eor, 5},
-    {zpi, eor, 5},
-    {indy, sre, 8},
-    {zpx, nop, 4},
-    {zpx, eor, 4},
-    {zpx, lsr, 6},
-    {zpx, sre, 6},
-    {imp, cli, 2},
-    {absy_p, eor, 4},
-    {imp, phy, 2},
-    {absy, sre, 7},
-    {absx, nop, 4},
-    {absx_p, eor, 4},
-    {absx, lsr, 7},
-    {absx, sre, 7},
-    /* 60 */
-    {imp, rts, 6},
-    {indx, adc, 6},
-    {imp, nop, 2},
-    {indx, rra, 8},
-    {zp, stz, 3},
-    {zp, adc, 3},
-    {zp, ror, 5},
-    {zp, rra, 5},
-    {imp, pla, 4},
-    {imm, adc, 2},
-    {acc, ror, 2},
-    {imm, nop, 2},
-    {ind, jmp, 5},
-    {abso, adc, 4},
-    {abso, ror, 6},
-    {abso, rra, 6},
-    /* 70 */
-    {rel, bvs, 2},
-    {indy_p, adc, 5},
-    {zpi, adc, 5},
-    {indy, rra, 8},
-    {zpx, stz, 4},
-    {zpx, adc, 4},
-    {zpx, ror, 6},
-    {zpx, rra, 6},
-    {imp, sei, 2},
-    {absy_p, adc, 4},
-    {imp, ply, 6},
-    {absy, rra, 7},
-    {absxi, jmp, 6},
-    {absx_p, adc, 4},
-    {absx, ror, 7},
-    {absx, rra, 7},
-    /* 80 */
-    {rel, bra, 3},
-    {indx, sta, 6},
-    {imm, nop, 2},
-    {indx, sax, 6},
-    {zp, sty, 3},
-    {zp, sta, 3},
-    {zp, stx, 3},
-    {zp, sax, 3},
-    {imp, dey, 2},
-    {imm, bit_imm, 2},
-    {imp, txa, 2},
-    {imm, nop, 2},
-    {abso, sty, 4},
-    {abso, sta, 4},
-    {abso, stx, 4},
-    {abso, sax, 4},
-    /* 90 */
-    {rel, bcc, 2},
-    {indy, sta, 6},
-    {zpi, sta, 5},
-    {indy, nop, 6},
-    {zpx, sty, 4},
-    {zpx, sta, 4},
-    {zpy, stx, 4},
-    {zpy, sax, 4},
-    {imp, tya, 2},
-    {absy, sta, 5},
-    {imp, txs, 2},
-    {absy, nop, 5},
-    {abso, stz, 4},
-    {absx, sta, 5},
-    {absx, stz, 5},
-    {absy, nop, 5},
-    /* A0 */
-    {imm, ldy, 2},
-    {indx, lda, 6},
-    {imm, ldx, 2},
-    {indx, lax, 6},
-    {zp, ldy, 3},
-    {zp, lda, 3},
-    {zp, ldx, 3},
-    {zp, lax, 3},
-    {imp, tay, 2},
-    {imm, lda, 2},
-    {imp, tax, 2},
-    {imm, nop, 2},
-    {abso, ldy, 4},
-    {abso, lda, 4},
-    {abso, ldx, 4},
-    {abso, lax, 4},
-    /* B0 */
-    {rel, bcs, 2},
-    {indy_p, lda, 5},
-    {zpi, lda, 5},
-    {indy_p, lax, 5},
-    {zpx, ldy, 4},
-    {zpx, lda, 4},
-    {zpy, ldx, 4},
-    {zpy, lax, 4},
-    {imp, clv, 2},
-    {absy_p, lda, 4},
-    {imp, tsx, 2},
-    {absy_p, lax, 4},
-    {absx_p, ldy, 4},
-    {absx_p, lda, 4},
-    {absy_p, ldx, 4},
-    {absy_p, lax, 4},
-    /* C0 */
-    {imm, cpy, 2},
-    {indx, cmp, 6},
-    {imm, nop, 2},
-    {indx, dcp, 8},
-    {zp, cpy, 3},
-    {zp, cmp, 3},
-    {zp, dec, 5},
-    {zp, dcp, 5},
-    {imp, iny, 2},
-    {imm, cmp, 2},
-    {imp, dex, 2},
-    {imm, nop, 2},
-    {abso, cpy, 4},
-    {abso, cmp, 4},
-    {abso, dec, 6},
-    {abso, dcp, 6},
-    /* D0 */
-    {rel, bne, 2},
-    {indy_p, cmp, 5},
-    {zpi, cmp, 5},
-    {indy, dcp, 8},
-    {zpx, nop, 4},
-    {zpx, cmp, 4},
-    {zpx, dec, 6},
-    {zpx, dcp, 6},
-    {imp, cld, 2},
-    {absy_p, cmp, 4},
-    {imp, phx, 3},
-    {absy, dcp, 7},
-    {absx, nop, 4},
-    {absx_p, cmp, 4},
-    {absx, dec, 7},
-    {absx, dcp, 7},
-    /* E0 */
-    {imm, cpx, 2},
-    {indx, sbc, 6},
-    {imm, nop, 2},
-    {indx, isb, 8},
-    {zp, cpx, 3},
-    {zp, sbc, 3},
-    {zp, inc, 5},
-    {zp, isb, 5},
-    {imp, inx, 2},
-    {imm, sbc, 2},
-    {imp, nop, 2},
-    {imm, sbc, 2},
-    {abso, cpx, 4},
-    {abso, sbc, 4},
-    {abso, inc, 6},
-    {abso, isb, 6},
-    /* F0 */
-    {rel, beq, 2},
-    {indy_p, sbc, 5},
-    {zpi, sbc, 5},
-    {indy, isb, 8},
-    {zpx, nop, 4},
-    {zpx, sbc, 4},
-    {zpx, inc, 6},
-    {zpx, isb, 6},
-    {imp, sed, 2},
-    {absy_p, sbc, 4},
-    {imp, plx, 2},
-    {absy, isb, 7},
-    {absx, nop, 4},
-    {absx_p, sbc, 4},
-    {absx, inc, 7},
-    {absx, isb, 7}};
+    for (pool->threads = 0; pool->threads < threads; pool->threads++)
+    {
+        fake6502_pool_worker *w = &pool->workers[pool->threads];
+
+        w->pool = pool;
+        w->index = pool->threads;
+        pthread_mutex_init(&w->lock, NULL);
+        if (pthread_create(&w->thread, NULL, pool_worker, w))
+        {
+            pthread_mutex_destroy(&w->lock);
+            break;
+        }
+
+#ifdef __linux__
+        if (pin && count)
+        {
+            cpu_set_t cpu;
+            int cpu_index = 0;
+
+            // the worker's CPU among those the process may run on
+            for (int n = w->index % count; !CPU_ISSET(cpu_index, &cpus) || n--; cpu_index++)
+                ;
+            CPU_ZERO(&cpu);
+            CPU_SET(cpu_index, &cpu);
+            pthread_setaffinity_np(w->thread, sizeof(cpu), &cpu);
+        }
 #endif
+    }
 
+    if (!pool->threads)
+    {
+        fake6502_pool_destroy(pool);
+        return(NULL);
+    }
 
-// -------------------------------------------------------------------
+    return(pool);
+}
 
-// fake 6502 - API
+void fake6502_pool_destroy(fake6502_pool *pool)
+{
+    if (!pool)
+        return;
 
-// the main functions, for use by the host
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
 
-void fake6502_reset(fake6502_context *c)
-{
-    // The 6502 normally does some fake reads after reset because
-    // reset is a hacked-up version of NMI/IRQ/BRK
-    // See https://www.pagetable.com/?p=410
-    fake6502_mem_read(c, 0x00ff);
-    fake6502_mem_read(c, 0x00ff);
-    fake6502_mem_read(c, 0x00ff);
-    fake6502_mem_read(c, 0x0100);
-    fake6502_mem_read(c, 0x01ff);
-    fake6502_mem_read(c, 0x01fe);
-    c->cpu.pc = fake6502_mem_read16(c, 0xfffc);
-    c->cpu.s = 0xfd;
-    c->cpu.flags |= FAKE6502_CONSTANT_FLAG | FAKE6502_INTERRUPT_FLAG;
+    for (int i = 0; i < pool->threads; i++)
+    {
+        pthread_join(pool->workers[i].thread, NULL);
+        pthread_mutex_destroy(&pool->workers[i].lock);
+    }
 
-    c->emu.instructions = 0;
-    c->emu.clockticks = 0;
+    pthread_cond_destroy(&pool->finished);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
 }
 
-void fake6502_nmi(fake6502_context *c)
+#else
+
+struct fake6502_pool {
+    int threads;
+};
+
+static double pool_now(void)
+{ return((double)clock() / CLOCKS_PER_SEC); }
+
+fake6502_pool *fake6502_pool_create(int threads, bool pin)
 {
-    fake6502_push_16(c, c->cpu.pc);
-    fake6502_push_8(c, c->cpu.flags & ~FAKE6502_BREAK_FLAG);
-    c->cpu.flags |= FAKE6502_INTERRUPT_FLAG;
-    c->cpu.pc = fake6502_mem_read16(c, 0xfffa);
+    (void)threads;
+    (void)pin;
+    return(NULL);
 }
 
-void fake6502_irq(fake6502_context *c)
+void fake6502_pool_destroy(fake6502_pool *pool)
 {
-    if ((c->cpu.flags & FAKE6502_INTERRUPT_FLAG) == 0)
-    {
-        fake6502_push_16(c, c->cpu.pc);
-        fake6502_push_8(c, c->cpu.flags & ~FAKE6502_BREAK_FLAG);
-        c->cpu.flags |= FAKE6502_INTERRUPT_FLAG;
-        c->cpu.pc = fake6502_mem_read16(c, 0xfffe);
-    }
+    (void)pool;
 }
 
-void fake6502_step(fake6502_context *c)
+#endif
+
+// run every context in the pool, or on this thread when pool is NULL;
+// stats may be NULL
+
+void fake6502_pool_run(fake6502_pool *pool, fake6502_context *contexts, int count,
+                       int cycle_budget, int instr_budget,
+                       fake6502_pool_done_fn done, void *user,
+                       fake6502_pool_stats *stats)
 {
-    uint8_t opcode = fake6502_mem_read(c, c->cpu.pc++);
-    c->emu.opcode = opcode;
-    c->cpu.flags |= FAKE6502_CONSTANT_FLAG;
+    double start = pool_now();
+    uint64_t instructions = 0;
+
+#ifdef FAKE6502_POOL_PTHREADS
+    if (pool)
+    {
+        pthread_mutex_lock(&pool->lock);
+        pool->contexts = contexts;
+        pool->cycle_budget = cycle_budget;
+        pool->instr_budget = instr_budget;
+        pool->done = done;
+        pool->user = user;
+        pool->instructions = 0;
+
+        // the workers are all waiting, so their shares can be set unlocked
+        for (int i = 0; i < pool->threads; i++)
+        {
+            pool->workers[i].next = (int)((int64_t)count * i / pool->threads);
+            pool->workers[i].end = (int)((int64_t)count * (i + 1) / pool->threads);
+        }
+
+        pool->running = pool->threads;
+        pool->generation++;
+        pthread_cond_broadcast(&pool->start);
+        while (pool->running)
+            pthread_cond_wait(&pool->finished, &pool->lock);
+        instructions = pool->instructions;
+        pthread_mutex_unlock(&pool->lock);
+    }
+    else
+#else
+    (void)pool;
+#endif
+    for (int i = 0; i < count; i++)
+        instructions += pool_context(&contexts[i], cycle_budget, instr_budget, done, user);
 
-    fake6502_opcodes[opcode].addr_mode(c);
-    fake6502_opcodes[opcode].opcode(c);
-    c->emu.clockticks += fake6502_opcodes[opcode].clockticks;
+    if (stats)
+    {
+        stats->contexts = count;
+        stats->instructions = instructions;
+        stats->seconds = pool_now() - start;
+        stats->instructions_per_second = stats->seconds > 0 ?
+                                         instructions / stats->seconds : 0;
+    }
 }
 
 
@@ -14,7 +14,10 @@ extern "C" {
 // include's
 // -------------------------------------------------------------------
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 
 
 // -------------------------------------------------------------------
@@ -30,6 +33,9 @@ extern "C" {
 #define FAKE6502_OVERFLOW_FLAG          0x40
 #define FAKE6502_SIGN_FLAG              0x80
 
+#define FAKE6502_NVZC_FLAGS             (FAKE6502_SIGN_FLAG | FAKE6502_OVERFLOW_FLAG | \
+                                         FAKE6502_ZERO_FLAG | FAKE6502_CARRY_FLAG)
+
 #define FAKE6502_STACK_BASE             0x100
 
 
@@ -63,24 +69,59 @@ extern "C" {
 
 // flag modifier macros
 
+#ifdef FAKE6502_LAZY_FLAGS
+
+// N, Z, C and V live in c->emu.flag_n etc. while instructions execute,
+// and are only packed into c->cpu.flags when the emulator returns to the
+// host; setting or clearing one keeps both places up to date
+
+#define fake6502_carry_set(c)           ((c)->cpu.flags |= FAKE6502_CARRY_FLAG, (c)->emu.flag_c = 1)
+#define fake6502_carry_clear(c)         ((c)->cpu.flags &= (~FAKE6502_CARRY_FLAG), (c)->emu.flag_c = 0)
+#define fake6502_zero_set(c)            ((c)->cpu.flags |= FAKE6502_ZERO_FLAG, (c)->emu.flag_z = 0)
+#define fake6502_zero_clear(c)          ((c)->cpu.flags &= (~FAKE6502_ZERO_FLAG), (c)->emu.flag_z = 1)
+#define fake6502_overflow_set(c)        ((c)->cpu.flags |= FAKE6502_OVERFLOW_FLAG, (c)->emu.flag_v = 0x80)
+#define fake6502_overflow_clear(c)      ((c)->cpu.flags &= (~FAKE6502_OVERFLOW_FLAG), (c)->emu.flag_v = 0)
+#define fake6502_sign_set(c)            ((c)->cpu.flags |= FAKE6502_SIGN_FLAG, (c)->emu.flag_n = 0x80)
+#define fake6502_sign_clear(c)          ((c)->cpu.flags &= (~FAKE6502_SIGN_FLAG), (c)->emu.flag_n = 0)
+
+#else
+
 #define fake6502_carry_set(c)           (c)->cpu.flags |= FAKE6502_CARRY_FLAG
 #define fake6502_carry_clear(c)         (c)->cpu.flags &= (~FAKE6502_CARRY_FLAG)
 #define fake6502_zero_set(c)            (c)->cpu.flags |= FAKE6502_ZERO_FLAG
 #define fake6502_zero_clear(c)          (c)->cpu.flags &= (~FAKE6502_ZERO_FLAG)
-#define fake6502_interrupt_set(c)       (c)->cpu.flags |= FAKE6502_INTERRUPT_FLAG
-#define fake6502_interrupt_clear(c)     (c)->cpu.flags &= (~FAKE6502_INTERRUPT_FLAG)
-#define fake6502_decimal_set(c)         (c)->cpu.flags |= FAKE6502_DECIMAL_FLAG
-#define fake6502_decimal_clear(c)       (c)->cpu.flags &= (~FAKE6502_DECIMAL_FLAG)
 #define fake6502_overflow_set(c)        (c)->cpu.flags |= FAKE6502_OVERFLOW_FLAG
 #define fake6502_overflow_clear(c)      (c)->cpu.flags &= (~FAKE6502_OVERFLOW_FLAG)
 #define fake6502_sign_set(c)            (c)->cpu.flags |= FAKE6502_SIGN_FLAG
 #define fake6502_sign_clear(c)          (c)->cpu.flags &= (~FAKE6502_SIGN_FLAG)
 
+#endif
+
+#define fake6502_interrupt_set(c)       (c)->cpu.flags |= FAKE6502_INTERRUPT_FLAG
+#define fake6502_interrupt_clear(c)     (c)->cpu.flags &= (~FAKE6502_INTERRUPT_FLAG)
+#define fake6502_decimal_set(c)         (c)->cpu.flags |= FAKE6502_DECIMAL_FLAG
+#define fake6502_decimal_clear(c)       (c)->cpu.flags &= (~FAKE6502_DECIMAL_FLAG)
+
 #define fake6502_accum_save(c, n)       (c)->cpu.a = (uint8_t)((n)&0x00FF)
 
 
 // flag calculation macros
 
+#ifdef FAKE6502_LAZY_FLAGS
+
+// store what the flag depends on; no branches, no read-modify-write
+
+#define fake6502_zero_calc(c, n)        (c)->emu.flag_z = (uint8_t)(n)
+#define fake6502_sign_calc(c, n)        (c)->emu.flag_n = (uint8_t)(n)
+#define fake6502_carry_calc(c, n)       (c)->emu.flag_c = (((n) & 0xFF00) != 0)
+
+// n = result, m = accumulator, o = memory
+
+#define fake6502_overflow_calc(c, n, m, o)  \
+    (c)->emu.flag_v = (uint8_t)(((n) ^ (uint16_t)(m)) & ((n) ^ (o)))
+
+#else
+
 #define fake6502_zero_calc(c, n)        \
 {                                       \
     if ((n) & 0x00FF)                   \
@@ -116,6 +157,69 @@ extern "C" {
         fake6502_overflow_clear(c);     \
 }
 
+#endif
+
+
+// flag reading macros, for use while an instruction executes;
+// carry is 0 or 1, the others are zero or non-zero
+
+#ifdef FAKE6502_LAZY_FLAGS
+
+#define fake6502_carry_get(c)           ((c)->emu.flag_c)
+#define fake6502_zero_get(c)            ((c)->emu.flag_z == 0)
+#define fake6502_overflow_get(c)        ((c)->emu.flag_v & 0x80)
+#define fake6502_sign_get(c)            ((c)->emu.flag_n & 0x80)
+
+#define fake6502_flags_get(c)           (uint8_t)(                            \
+    ((c)->cpu.flags & ~FAKE6502_NVZC_FLAGS) |                                  \
+    ((c)->emu.flag_n & 0x80) | (((c)->emu.flag_v & 0x80) >> 1) |              \
+    ((c)->emu.flag_z ? 0 : FAKE6502_ZERO_FLAG) | (c)->emu.flag_c)
+
+#define fake6502_flags_put(c, n)        \
+{                                       \
+    uint8_t m_flags = (n);              \
+    (c)->cpu.flags = m_flags;           \
+    (c)->emu.flag_n = m_flags;          \
+    (c)->emu.flag_z = ~m_flags & FAKE6502_ZERO_FLAG;  \
+    (c)->emu.flag_c = m_flags & FAKE6502_CARRY_FLAG;  \
+    (c)->emu.flag_v = m_flags << 1;     \
+}
+
+// set N, V, Z and C together from a value laid out like c->cpu.flags
+
+#define fake6502_nvzc_put(c, n)         \
+{                                       \
+    uint8_t m_nvzc = (n);               \
+    (c)->emu.flag_n = m_nvzc;           \
+    (c)->emu.flag_z = ~m_nvzc & FAKE6502_ZERO_FLAG;  \
+    (c)->emu.flag_c = m_nvzc & FAKE6502_CARRY_FLAG;  \
+    (c)->emu.flag_v = m_nvzc << 1;      \
+}
+
+// moving the flags between c->cpu.flags, where the host sees them,
+// and the lazy state, when entering and leaving the emulator
+
+#define fake6502_flags_unpack(c)        fake6502_flags_put(c, (c)->cpu.flags)
+#define fake6502_flags_pack(c)          (c)->cpu.flags = fake6502_flags_get(c)
+
+#else
+
+#define fake6502_carry_get(c)           ((c)->cpu.flags & FAKE6502_CARRY_FLAG)
+#define fake6502_zero_get(c)            ((c)->cpu.flags & FAKE6502_ZERO_FLAG)
+#define fake6502_overflow_get(c)        ((c)->cpu.flags & FAKE6502_OVERFLOW_FLAG)
+#define fake6502_sign_get(c)            ((c)->cpu.flags & FAKE6502_SIGN_FLAG)
+
+#define fake6502_flags_get(c)           ((c)->cpu.flags)
+#define fake6502_flags_put(c, n)        (c)->cpu.flags = (n)
+
+#define fake6502_nvzc_put(c, n)         \
+    (c)->cpu.flags = ((c)->cpu.flags & ~FAKE6502_NVZC_FLAGS) | ((n) & FAKE6502_NVZC_FLAGS)
+
+#define fake6502_flags_unpack(c)
+#define fake6502_flags_pack(c)
+
+#endif
+
 
 // -------------------------------------------------------------------
 // typedef's
@@ -130,18 +234,489 @@ typedef struct fake6502_cpu_state {
     uint16_t pc;
 } fake6502_cpu_state;
 
+typedef struct fake6502_context fake6502_context;
+
+
+typedef enum fake6502_variant {
+    FAKE6502_VARIANT_NMOS,
+    FAKE6502_VARIANT_CMOS,
+    FAKE6502_VARIANT_2A03
+} fake6502_variant;
+
+
+// the host's memory accessing functions, called for every bus access
+
+typedef uint8_t (*fake6502_mem_read_fn)(fake6502_context *c, uint16_t address);
+typedef void (*fake6502_mem_write_fn)(fake6502_context *c, uint16_t address, uint8_t val);
+
+// a page of memory from fake6502_pages_alloc(), which forks of a context
+// share until one of them writes to it
+
+typedef struct fake6502_page fake6502_page;
+
+// read_pages[]/write_pages[] point at 256 bytes of host memory for each
+// page of RAM or ROM; a NULL page goes through read()/write() instead.
+// pages[] holds the context's own pages, write protected while shared
+
+typedef struct fake6502_bus_state {
+    fake6502_mem_read_fn read;
+    fake6502_mem_write_fn write;
+    uint8_t *read_pages[256];
+    uint8_t *write_pages[256];
+    fake6502_page *pages[256];
+    uint8_t *memory;
+} fake6502_bus_state;
+
+
+typedef enum fake6502_stop_reason {
+    FAKE6502_STOP_NONE,
+    FAKE6502_STOP_BUDGET,
+    FAKE6502_STOP_BRK,
+    FAKE6502_STOP_HALT,
+    FAKE6502_STOP_HOST,
+    FAKE6502_STOP_FAULT,
+    FAKE6502_STOP_BREAKPOINT,
+    FAKE6502_STOP_READ_WATCH,
+    FAKE6502_STOP_WRITE_WATCH
+} fake6502_stop_reason;
+
 typedef struct fake6502_emu_state {
     int instructions;
     int clockticks;
     uint16_t ea;
     uint8_t opcode;
+    fake6502_stop_reason stop;
+    // the sources of N, Z, C and V under FAKE6502_LAZY_FLAGS
+    uint8_t flag_n, flag_z, flag_c, flag_v;
+    // set when a write hits decoded or translated code
+    uint8_t code_written;
 } fake6502_emu_state;
 
-typedef struct fake6502_context {
+typedef enum fake6502_engine {
+    FAKE6502_ENGINE_TABLE,
+    FAKE6502_ENGINE_FUSED,
+    FAKE6502_ENGINE_CACHED,
+    FAKE6502_ENGINE_JIT
+} fake6502_engine;
+
+// whether the bus accesses that only hardware watching the bus would
+// notice are made: the dummy reads of a reset, and the unchanged value
+// some read-modify-write instructions write back before the result
+
+typedef enum fake6502_mode {
+    FAKE6502_MODE_ACCURATE,
+    FAKE6502_MODE_FAST
+} fake6502_mode;
+
+
+// an instruction decoded by the cache engine, stored at the address it
+// starts at; a length of 0 means nothing is cached there
+
+typedef struct fake6502_decoded {
+    uint16_t operand;
+    uint8_t opcode;
+    uint8_t length;
+} fake6502_decoded;
+
+// the host allocates this and gives it to fake6502_cache_attach();
+// while a page holds cached code, its write_pages[] entry is moved to
+// held_write[], so every write to it is seen and invalidates what it hits
+
+typedef struct fake6502_cache {
+    fake6502_decoded entries[65536];
+    uint8_t code[256];
+    uint8_t *held_write[256];
+    fake6502_variant variant;
+} fake6502_cache;
+
+// translated native code, created by fake6502_jit_create()
+
+typedef struct fake6502_jit fake6502_jit;
+
+// the last FAKE6502_TRACE_SIZE instructions, recorded under FAKE6502_TRACE
+// once the host gives one to fake6502_trace_attach(); each entry holds
+// the registers and cycle count as the instruction started, and its
+// opcode and effective address
+
+#ifndef FAKE6502_TRACE_SIZE
+#define FAKE6502_TRACE_SIZE             4096    // a power of 2
+#endif
+
+typedef struct fake6502_trace_entry {
+    uint32_t clockticks;
+    uint16_t pc;
+    uint16_t ea;
+    uint8_t opcode;
+    uint8_t a;
+    uint8_t x;
+    uint8_t y;
+    uint8_t s;
+    uint8_t flags;
+} fake6502_trace_entry;
+
+typedef struct fake6502_trace {
+    fake6502_trace_entry entries[FAKE6502_TRACE_SIZE];
+    // how many have been recorded, the next goes at next % FAKE6502_TRACE_SIZE
+    uint32_t next;
+} fake6502_trace;
+
+// how often each opcode ran and the cycles it took, page crossings and
+// taken branches included, counted under FAKE6502_COUNTERS once the host
+// gives them to fake6502_counters_attach()
+
+typedef struct fake6502_counters {
+    uint64_t executed[256];
+    uint64_t cycles[256];
+} fake6502_counters;
+
+// a call graph profile, kept under FAKE6502_PROFILE once the host gives one
+// to fake6502_profile_attach(): a shadow call stack follows JSR, BRK, IRQ
+// and NMI in, and RTS and RTI out, and cycles go to the routine on top.
+// Each distinct call stack is a node, with its routine's entry address
+// and its caller's node; node 0 is whatever ran outside any routine
+
+#ifndef FAKE6502_PROFILE_DEPTH
+#define FAKE6502_PROFILE_DEPTH          256
+#endif
+#ifndef FAKE6502_PROFILE_NODES
+#define FAKE6502_PROFILE_NODES          8192    // a power of 2
+#endif
+
+typedef struct fake6502_profile_node {
+    uint64_t cycles;
+    uint32_t parent;
+    uint32_t chain;
+    uint16_t entry;
+} fake6502_profile_node;
+
+typedef struct fake6502_profile_frame {
+    uint32_t node;
+    uint32_t start;
+    // the stack pointer the routine returns to
+    uint8_t s;
+} fake6502_profile_frame;
+
+typedef struct fake6502_profile {
+    // by entry address, inclusive cycles count recursive calls once each
+    uint64_t inclusive[65536];
+    uint64_t exclusive[65536];
+    uint32_t calls[65536];
+
+    fake6502_profile_node nodes[FAKE6502_PROFILE_NODES];
+    uint32_t buckets[FAKE6502_PROFILE_NODES];
+    uint32_t node_count;
+    fake6502_profile_frame frames[FAKE6502_PROFILE_DEPTH];
+    int depth;
+    uint32_t last;
+    // calls not followed, as the stack or the nodes were full
+    uint32_t dropped;
+} fake6502_profile;
+
+// timed events, kept once the host gives a `fake6502_events` to
+// fake6502_events_attach() in a min-heap by the cycle they are due at,
+// counted in 64 bits from the attach. fake6502_run() runs straight
+// through to the next one and fires it at the instruction boundary at or
+// after its cycle, raising an IRQ or NMI or calling the host back; those
+// with a period are then due again that many cycles later, firing once at
+// a boundary even if several periods went by. An IRQ that falls due while
+// interrupts are disabled is held, and taken as soon as CLI, PLP or RTI
+// enables them; any more falling due meanwhile are the same one
+
+#ifndef FAKE6502_EVENTS_MAX
+#define FAKE6502_EVENTS_MAX             64
+#endif
+
+typedef enum fake6502_event_kind {
+    FAKE6502_EVENT_CALL,
+    FAKE6502_EVENT_IRQ,
+    FAKE6502_EVENT_NMI
+} fake6502_event_kind;
+
+typedef void (*fake6502_event_fn)(fake6502_context *c, void *user);
+
+typedef struct fake6502_event {
+    uint64_t cycle;
+    uint64_t period;
+    fake6502_event_fn fn;
+    void *user;
+    uint32_t id;
+    fake6502_event_kind kind;
+} fake6502_event;
+
+typedef struct fake6502_events {
+    fake6502_event heap[FAKE6502_EVENTS_MAX];
+    int count;
+    uint32_t next_id;
+    // the cycle count as of clockticks being last_ticks
+    uint64_t now;
+    uint32_t last_ticks;
+    // an IRQ is due but interrupts are disabled
+    bool irq_held;
+} fake6502_events;
+
+// breakpoints and watchpoints under FAKE6502_BREAKPOINTS, once the host
+// gives these to fake6502_breakpoints_attach(): a bit per address for
+// each kind. A run stops before an instruction at an execution
+// breakpoint, and after one that reads or writes a watched address,
+// which is kept with the value read or written
+
+typedef enum fake6502_breakpoint_kind {
+    FAKE6502_BREAK_EXEC,
+    FAKE6502_BREAK_READ,
+    FAKE6502_BREAK_WRITE
+} fake6502_breakpoint_kind;
+
+typedef struct fake6502_breakpoints {
+    uint8_t bits[3][8192];
+    uint16_t address;
+    uint8_t value;
+} fake6502_breakpoints;
+
+#define fake6502_breakpoint_test(m_bp, m_kind, m_address)                          \
+    ((m_bp)->bits[m_kind][(uint16_t)(m_address) >> 3] & (1 << ((m_address) & 7)))
+
+// idle loop detection, once the host gives this to fake6502_idle_attach():
+// fake6502_run() looks for a loop at the pc every FAKE6502_IDLE_CHUNK
+// cycles, of up to FAKE6502_IDLE_LENGTH instructions, and skips the
+// rounds of it that fit before the next event or the end of the budget
+
+#ifndef FAKE6502_IDLE_CHUNK
+#define FAKE6502_IDLE_CHUNK             4096
+#endif
+#ifndef FAKE6502_IDLE_LENGTH
+#define FAKE6502_IDLE_LENGTH            8
+#endif
+
+typedef struct fake6502_idle {
+    uint64_t skipped_cycles;
+    uint64_t skipped_instructions;
+    // the times a loop was skipped
+    uint64_t skips;
+} fake6502_idle;
+
+// memory mapped devices, once the host gives these to
+// fake6502_devices_attach(): each device added with fake6502_device_add()
+// gets the accesses to its range of addresses, found through a table of
+// pages and, for pages shared with other devices or memory, a table of
+// the addresses in the page. Not available under FAKE6502_BUS_FLAT
+
+#ifndef FAKE6502_DEVICES_MAX
+#define FAKE6502_DEVICES_MAX            32      // at most 127
+#endif
+#ifndef FAKE6502_DEVICES_FINE
+#define FAKE6502_DEVICES_FINE           16      // pages split between devices
+#endif
+#define FAKE6502_DEVICE_SPLIT           0x80
+
+typedef uint8_t (*fake6502_device_read_fn)(fake6502_context *c, void *state, uint16_t address);
+typedef void (*fake6502_device_write_fn)(fake6502_context *c, void *state, uint16_t address,
+                                         uint8_t val);
+
+typedef struct fake6502_device {
+    uint16_t first;
+    uint16_t last;
+    // either may be NULL, to leave those accesses to what is underneath
+    fake6502_device_read_fn read;
+    fake6502_device_write_fn write;
+    void *state;
+} fake6502_device;
+
+typedef struct fake6502_devices {
+    fake6502_device devices[FAKE6502_DEVICES_MAX];
+    int count;
+    // for each page, 0 for none, the device number from 1, or
+    // FAKE6502_DEVICE_SPLIT with the number of its table in fine[]
+    uint8_t pages[256];
+    uint8_t fine[FAKE6502_DEVICES_FINE][256];
+    int fine_count;
+    // the memory mapped in the pages before the devices took them over,
+    // and the host's functions, for everything else
+    uint8_t *read_pages[256];
+    uint8_t *write_pages[256];
+    fake6502_mem_read_fn read;
+    fake6502_mem_write_fn write;
+} fake6502_devices;
+
+// the batch engine runs one program over many machine states in lockstep,
+// with each register held as an array with one lane per machine.
+// Memory is the shared image plus, for each address any lane writes to,
+// a column holding that address's value in every lane. It needs the
+// paged bus, so it is left out under FAKE6502_BUS_FLAT.
+
+#ifndef FAKE6502_BATCH_LANES
+#define FAKE6502_BATCH_LANES            256     // a multiple of 32
+#endif
+#define FAKE6502_BATCH_COLUMNS          255
+
+typedef struct fake6502_batch {
+    uint8_t a[FAKE6502_BATCH_LANES];
+    uint8_t x[FAKE6502_BATCH_LANES];
+    uint8_t y[FAKE6502_BATCH_LANES];
+    uint8_t s[FAKE6502_BATCH_LANES];
+    uint8_t flags[FAKE6502_BATCH_LANES];
+    uint16_t pc[FAKE6502_BATCH_LANES];
+    uint32_t clockticks[FAKE6502_BATCH_LANES];
+    uint32_t instructions[FAKE6502_BATCH_LANES];
+    // why each lane stopped, FAKE6502_STOP_NONE while it runs
+    uint8_t stop[FAKE6502_BATCH_LANES];
+
+    const uint8_t *memory;
+    uint8_t column[65536];
+    uint8_t values[FAKE6502_BATCH_COLUMNS + 1][FAKE6502_BATCH_LANES];
+    uint16_t addresses[FAKE6502_BATCH_COLUMNS + 1];
+    int columns;
+
+    int lanes;
+    fake6502_variant variant;
+
+    // used while running
+    uint8_t active[FAKE6502_BATCH_LANES];
+    uint8_t extra[FAKE6502_BATCH_LANES];
+    uint8_t pending[FAKE6502_BATCH_LANES];
+    uint16_t ea[FAKE6502_BATCH_LANES];
+    uint8_t kernels[256];
+    uint8_t modes[256];
+    uint32_t budget;
+    uint32_t group_waiting;
+    uint32_t group_limit;
+    uint32_t group_instructions;
+    uint32_t group_ticks;
+    uint16_t group_pc;
+    int lane;
+    uint8_t fault;
+} fake6502_batch;
+
+// the bitsliced engine runs straight-line code that only touches A, X, Y
+// and the flags over FAKE6502_SLICED_LANES machine states at once. Each
+// bit of each register is a slice holding that bit for every lane, so an
+// ADC is a few dozen word operations whatever the number of lanes. Like
+// the batch engine, it is left out under FAKE6502_BUS_FLAT.
+
+#ifndef FAKE6502_SLICED_WORDS
+#define FAKE6502_SLICED_WORDS           4       // 64 bit words a slice
+#endif
+#define FAKE6502_SLICED_LANES           (FAKE6502_SLICED_WORDS * 64)
+
+typedef struct fake6502_slice {
+    uint64_t w[FAKE6502_SLICED_WORDS];
+} fake6502_slice;
+
+typedef struct fake6502_sliced {
+    // bit n of each register, laid out like c->cpu.flags for the flags
+    fake6502_slice a[8];
+    fake6502_slice x[8];
+    fake6502_slice y[8];
+    fake6502_slice flags[8];
+
+    fake6502_variant variant;
+    uint8_t kernels[256];
+    // each opcode's length, 0 for those with a memory operand
+    uint8_t sizes[256];
+} fake6502_sliced;
+
+
+// save states, see fake6502_save()
+
+#define FAKE6502_SAVE_VERSION           2
+#define FAKE6502_SAVE_HEADER            1024    // where the page data starts
+#define FAKE6502_SAVE_WRITABLE          0x8000  // in a page's entry
+
+
+// worker threads for running many contexts at once, created by
+// fake6502_pool_create()
+
+typedef struct fake6502_pool fake6502_pool;
+
+// called from a worker thread as each context stops
+
+typedef void (*fake6502_pool_done_fn)(fake6502_context *c, fake6502_stop_reason reason,
+                                      void *user);
+
+// the totals for one fake6502_pool_run()
+
+typedef struct fake6502_pool_stats {
+    uint64_t contexts;
+    uint64_t instructions;
+    double seconds;
+    double instructions_per_second;
+} fake6502_pool_stats;
+
+struct fake6502_context {
     fake6502_cpu_state cpu;
     fake6502_emu_state emu;
+    fake6502_bus_state bus;
+    fake6502_cache *cache;
+    fake6502_jit *jit;
+    fake6502_trace *trace;
+    fake6502_counters *counters;
+    fake6502_profile *profile;
+    fake6502_events *events;
+    fake6502_breakpoints *breakpoints;
+    fake6502_idle *idle;
+    fake6502_devices *devices;
+    fake6502_engine engine;
+    fake6502_variant variant;
+    fake6502_mode mode;
     void *state_host;
-} fake6502_context;
+};
+
+
+// the equivalence checker runs two programs side by side on each of a
+// set of inputs, comparing the outputs chosen by a mask, until they
+// differ. Each side has its own memory, put back after every input from
+// a log of the bytes written, so it needs the paged bus and is left out
+// under FAKE6502_BUS_FLAT.
+
+#ifndef FAKE6502_EQUIV_INPUTS
+#define FAKE6502_EQUIV_INPUTS           8
+#endif
+#ifndef FAKE6502_EQUIV_UNDO
+#define FAKE6502_EQUIV_UNDO             1024
+#endif
+
+#define FAKE6502_EQUIV_A                0x01
+#define FAKE6502_EQUIV_X                0x02
+#define FAKE6502_EQUIV_Y                0x04
+#define FAKE6502_EQUIV_S                0x08
+
+// an input: the registers, and the bytes for the checker's input
+// addresses; mismatches counts the programs it has told apart
+
+typedef struct fake6502_equiv_vector {
+    uint8_t a, x, y, s, flags;
+    uint8_t memory[FAKE6502_EQUIV_INPUTS];
+    uint32_t mismatches;
+} fake6502_equiv_vector;
+
+// the outputs: FAKE6502_EQUIV_ registers, bits of the flags, and a bit per
+// address of memory
+
+typedef struct fake6502_equiv_mask {
+    uint8_t registers;
+    uint8_t flags;
+    uint8_t memory[8192];
+} fake6502_equiv_mask;
+
+typedef struct fake6502_equiv_undo {
+    uint16_t address;
+    uint8_t val;
+} fake6502_equiv_undo;
+
+typedef struct fake6502_equiv {
+    fake6502_context sides[2];
+    uint8_t memory[2][65536];
+    const uint8_t *image;
+    uint16_t origin;
+    uint16_t inputs[FAKE6502_EQUIV_INPUTS];
+    int input_count;
+    int instr_budget;
+    size_t code_size[2];
+    fake6502_stop_reason reasons[2];
+    // the bytes each side wrote over, and their old values; a count over
+    // FAKE6502_EQUIV_UNDO means memory is copied back from the image
+    fake6502_equiv_undo undo[2][FAKE6502_EQUIV_UNDO];
+    int undo_count[2];
+} fake6502_equiv;
 
 
 typedef struct fake6502_opcode {
@@ -151,11 +726,115 @@ typedef struct fake6502_opcode {
 } fake6502_opcode;
 
 
+// what each opcode does, as static data, in fake6502_opcode_infos; the
+// mnemonic follows the operation's handler, so the illegal opcodes the
+// core runs as NOPs are NOPs
+
+#define FAKE6502_MNEMONICS(X)                                                   \
+    X(ADC) X(AND) X(ASL) X(BCC) X(BCS) X(BEQ) X(BIT) X(BMI) X(BNE) X(BPL)      \
+    X(BRA) X(BRK) X(BVC) X(BVS) X(CLC) X(CLD) X(CLI) X(CLV) X(CMP) X(CPX)      \
+    X(CPY) X(DCP) X(DEC) X(DEX) X(DEY) X(EOR) X(HLT) X(INC) X(INX) X(INY)      \
+    X(ISB) X(JMP) X(JSR) X(LAX) X(LDA) X(LDX) X(LDY) X(LSR) X(NOP) X(ORA)      \
+    X(PHA) X(PHP) X(PHX) X(PHY) X(PLA) X(PLP) X(PLX) X(PLY) X(RLA) X(ROL)      \
+    X(ROR) X(RRA) X(RTI) X(RTS) X(SAX) X(SBC) X(SEC) X(SED) X(SEI) X(SLO)      \
+    X(SRE) X(STA) X(STX) X(STY) X(STZ) X(TAX) X(TAY) X(TRB) X(TSB) X(TSX)      \
+    X(TXA) X(TXS) X(TYA)
+
+#define FAKE6502_MNEMONIC_ENUM(m_name)  FAKE6502_OP_##m_name,
+
+typedef enum fake6502_mnemonic {
+    FAKE6502_MNEMONICS(FAKE6502_MNEMONIC_ENUM)
+    FAKE6502_OP_COUNT
+} fake6502_mnemonic;
+
+// the page crossing forms of the indexed modes share the mode, and have
+// FAKE6502_PENALTY_PAGE set instead
+
+typedef enum fake6502_addressing {
+    FAKE6502_ADDR_IMP,
+    FAKE6502_ADDR_ACC,
+    FAKE6502_ADDR_IMM,
+    FAKE6502_ADDR_ZP,
+    FAKE6502_ADDR_ZPX,
+    FAKE6502_ADDR_ZPY,
+    FAKE6502_ADDR_REL,
+    FAKE6502_ADDR_ABS,
+    FAKE6502_ADDR_ABSX,
+    FAKE6502_ADDR_ABSY,
+    FAKE6502_ADDR_IND,
+    FAKE6502_ADDR_INDX,
+    FAKE6502_ADDR_INDY,
+    FAKE6502_ADDR_ZPI,
+    FAKE6502_ADDR_ABSXI,
+    FAKE6502_ADDR_COUNT
+} fake6502_addressing;
+
+typedef enum fake6502_flow {
+    FAKE6502_FLOW_NONE,
+    FAKE6502_FLOW_BRANCH,               // relative, taken or not; BRA always
+    FAKE6502_FLOW_JUMP,
+    FAKE6502_FLOW_CALL,
+    FAKE6502_FLOW_RETURN,               // RTS and RTI
+    FAKE6502_FLOW_INTERRUPT,            // BRK
+    FAKE6502_FLOW_HALT
+} fake6502_flow;
+
+// the registers read and written, including the index of the addressing mode
+
+#define FAKE6502_REG_A                  0x01
+#define FAKE6502_REG_X                  0x02
+#define FAKE6502_REG_Y                  0x04
+#define FAKE6502_REG_S                  0x08
+
+// how the operation uses memory: its operand at the effective address, the
+// stack, and the BRK vector; the pointers read by the indirect modes
+// follow from the addressing mode
+
+#define FAKE6502_MEM_READ               0x01
+#define FAKE6502_MEM_WRITE              0x02
+#define FAKE6502_MEM_RMW                (FAKE6502_MEM_READ | FAKE6502_MEM_WRITE)
+#define FAKE6502_MEM_STACK              0x04
+#define FAKE6502_MEM_VECTOR             0x08
+
+// the cycles added to the base count
+
+#define FAKE6502_PENALTY_PAGE           0x01    // index carries into the next page
+#define FAKE6502_PENALTY_BRANCH         0x02    // 1 when taken, 2 into another page
+#define FAKE6502_PENALTY_POINTER        0x04    // JMP ($xxff) on the CMOS
+
+typedef struct fake6502_opcode_info {
+    uint8_t size;                       // in bytes, with the operand
+    uint8_t mnemonic;                   // fake6502_mnemonic
+    uint8_t addressing;                 // fake6502_addressing
+    uint8_t clockticks;                 // before any penalty
+    uint8_t reads;                      // FAKE6502_REG_ bits
+    uint8_t writes;
+    uint8_t flags_read;                 // bits as in c->cpu.flags
+    uint8_t flags_written;
+    uint8_t memory;                     // FAKE6502_MEM_ bits
+    uint8_t flow;                       // fake6502_flow
+    uint8_t penalty;                    // FAKE6502_PENALTY_ bits
+} fake6502_opcode_info;
+
+
 // -------------------------------------------------------------------
 // global's
 // -------------------------------------------------------------------
 
-extern fake6502_opcode fake6502_opcodes[];
+extern fake6502_opcode fake6502_opcodes_nmos[];
+extern fake6502_opcode fake6502_opcodes_cmos[];
+extern fake6502_opcode fake6502_opcodes_2a03[];
+
+// indexed by fake6502_variant
+extern fake6502_opcode *fake6502_opcode_tables[];
+
+// the table of the default variant, see fake6502_init()
+extern fake6502_opcode *const fake6502_opcodes;
+
+// indexed by fake6502_variant and opcode
+extern const fake6502_opcode_info fake6502_opcode_infos[3][256];
+extern const char *const fake6502_mnemonic_names[];
+extern const char *const fake6502_addressing_names[];
 
 
 // -------------------------------------------------------------------
@@ -167,17 +846,152 @@ extern void fake6502_push_16(fake6502_context *c, uint16_t pushval);
 extern uint8_t fake6502_pull_8(fake6502_context *c);
 extern uint16_t fake6502_pull_16(fake6502_context *c);
 
+extern uint16_t fake6502_mem_read16(fake6502_context *c, uint16_t addr);
+extern void fake6502_pages_map(fake6502_context *c, uint8_t page, int count,
+                               uint8_t *read, uint8_t *write);
+
+extern bool fake6502_pages_alloc(fake6502_context *c, uint8_t page, int count);
+extern void fake6502_pages_release(fake6502_context *c);
+extern void fake6502_fork(fake6502_context *parent, fake6502_context *child);
+extern void fake6502_restore(fake6502_context *c, fake6502_context *snapshot);
+
+extern size_t fake6502_save_size(fake6502_context *c);
+extern size_t fake6502_save(fake6502_context *c, uint8_t *image, size_t size);
+extern bool fake6502_load(fake6502_context *c, const uint8_t *image, size_t size);
+
+extern void fake6502_cache_attach(fake6502_context *c, fake6502_cache *cache);
+extern void fake6502_cache_flush(fake6502_context *c);
+extern void fake6502_cache_invalidate(fake6502_context *c, uint16_t address, int count);
+
+extern fake6502_jit *fake6502_jit_create(void);
+extern void fake6502_jit_destroy(fake6502_jit *jit);
+extern void fake6502_jit_attach(fake6502_context *c, fake6502_jit *jit);
+
+extern void fake6502_trace_attach(fake6502_context *c, fake6502_trace *trace);
+extern int fake6502_trace_copy(fake6502_context *c, fake6502_trace_entry *entries, int count);
+extern void fake6502_trace_dump(fake6502_context *c, FILE *out);
+
+extern void fake6502_counters_attach(fake6502_context *c, fake6502_counters *counters);
+extern void fake6502_counters_snapshot(fake6502_context *c, fake6502_counters *snapshot);
+extern void fake6502_counters_reset(fake6502_context *c);
+extern void fake6502_counters_report(const fake6502_counters *counters,
+                                     fake6502_variant variant, FILE *out);
+
+extern void fake6502_profile_attach(fake6502_context *c, fake6502_profile *profile);
+extern void fake6502_profile_folded(fake6502_context *c, FILE *out);
+extern void fake6502_profile_report(fake6502_context *c, FILE *out);
+
+extern void fake6502_events_attach(fake6502_context *c, fake6502_events *events);
+extern uint64_t fake6502_events_now(fake6502_context *c);
+extern uint32_t fake6502_event_add(fake6502_context *c, uint64_t cycle, uint64_t period,
+                                   fake6502_event_kind kind, fake6502_event_fn fn, void *user);
+extern bool fake6502_event_cancel(fake6502_context *c, uint32_t id);
+
+extern void fake6502_breakpoints_attach(fake6502_context *c, fake6502_breakpoints *breakpoints);
+extern void fake6502_breakpoint_set(fake6502_breakpoints *breakpoints,
+                                    fake6502_breakpoint_kind kind, uint16_t address,
+                                    int count, bool on);
+
+extern void fake6502_idle_attach(fake6502_context *c, fake6502_idle *idle);
+
+extern void fake6502_devices_attach(fake6502_context *c, fake6502_devices *devices);
+extern bool fake6502_device_add(fake6502_context *c, uint16_t first, uint16_t last,
+                                fake6502_device_read_fn read, fake6502_device_write_fn write,
+                                void *state);
+
+// lanes from 1 to FAKE6502_BATCH_LANES; others are clamped to that
+extern void fake6502_batch_init(fake6502_batch *b, fake6502_variant variant,
+                                const uint8_t *memory, int lanes);
+extern void fake6502_batch_reset(fake6502_batch *b);
+extern bool fake6502_batch_poke(fake6502_batch *b, int lane, uint16_t address, uint8_t val);
+extern uint8_t fake6502_batch_peek(fake6502_batch *b, int lane, uint16_t address);
+extern void fake6502_batch_run(fake6502_batch *b, int instr_budget);
+
+extern void fake6502_sliced_init(fake6502_sliced *s, fake6502_variant variant);
+extern void fake6502_sliced_set(fake6502_sliced *s, int lane, const fake6502_cpu_state *cpu);
+extern void fake6502_sliced_get(const fake6502_sliced *s, int lane, fake6502_cpu_state *cpu);
+extern size_t fake6502_sliced_run(fake6502_sliced *s, const uint8_t *code, size_t size);
+
+extern void fake6502_equiv_init(fake6502_equiv *e, fake6502_variant variant,
+                                const uint8_t *image, uint16_t origin,
+                                const uint16_t *inputs, int input_count, int instr_budget);
+extern int fake6502_equiv_check(fake6502_equiv *e, const uint8_t *code_a, size_t size_a,
+                                const uint8_t *code_b, size_t size_b,
+                                fake6502_equiv_vector *vectors, int count,
+                                const fake6502_equiv_mask *mask);
+
+extern fake6502_pool *fake6502_pool_create(int threads, bool pin);
+extern void fake6502_pool_destroy(fake6502_pool *pool);
+extern void fake6502_pool_run(fake6502_pool *pool, fake6502_context *contexts, int count,
+                              int cycle_budget, int instr_budget,
+                              fake6502_pool_done_fn done, void *user,
+                              fake6502_pool_stats *stats);
+
 extern uint16_t fake6502_get_value(fake6502_context *c);
 extern void fake6502_put_value(fake6502_context *c, uint16_t saveval);
 
+extern int fake6502_arith_check(void);
+
+extern void fake6502_init(fake6502_context *c, fake6502_mem_read_fn read,
+                          fake6502_mem_write_fn write, void *state_host);
 extern void fake6502_reset(fake6502_context *c);
 extern void fake6502_irq(fake6502_context *c);
 extern void fake6502_nmi(fake6502_context *c);
 extern void fake6502_step(fake6502_context *c);
+extern fake6502_stop_reason fake6502_run(fake6502_context *c, int cycle_budget, int instr_budget);
+
+extern void fake6502_step_nmos(fake6502_context *c);
+extern void fake6502_step_cmos(fake6502_context *c);
+extern void fake6502_step_2a03(fake6502_context *c);
+extern fake6502_stop_reason fake6502_run_nmos(fake6502_context *c, int cycle_budget, int instr_budget);
+extern fake6502_stop_reason fake6502_run_cmos(fake6502_context *c, int cycle_budget, int instr_budget);
+extern fake6502_stop_reason fake6502_run_2a03(fake6502_context *c, int cycle_budget, int instr_budget);
+extern void fake6502_stop(fake6502_context *c);
+
+#ifdef FAKE6502_BREAKPOINTS
+
+// stop after an access to a watched address
+
+static inline void fake6502_watch(fake6502_context *c, fake6502_breakpoint_kind kind,
+                                  uint16_t address, uint8_t val)
+{
+    if (c->breakpoints && fake6502_breakpoint_test(c->breakpoints, kind, address))
+    {
+        c->breakpoints->address = address;
+        c->breakpoints->value = val;
+        c->emu.stop = kind == FAKE6502_BREAK_READ ? FAKE6502_STOP_READ_WATCH
+                                                  : FAKE6502_STOP_WRITE_WATCH;
+    }
+}
+
+#else
+#define fake6502_watch(c, kind, address, val)
+#endif
+
+#ifdef FAKE6502_BUS_FLAT
+
+// the flat bus: all 64K is plain RAM at c->bus.memory,
+// so loads and stores are inlined into the emulator
+
+static inline uint8_t fake6502_mem_read(fake6502_context *c, uint16_t address)
+{
+    fake6502_watch(c, FAKE6502_BREAK_READ, address, c->bus.memory[address]);
+    return(c->bus.memory[address]);
+}
+
+static inline void fake6502_mem_write(fake6502_context *c, uint16_t address, uint8_t val)
+{
+    fake6502_watch(c, FAKE6502_BREAK_WRITE, address, val);
+    c->bus.memory[address] = val;
+}
+
+#else
 
 extern uint8_t fake6502_mem_read(fake6502_context *c, uint16_t address);
 extern void fake6502_mem_write(fake6502_context *c, uint16_t address, uint8_t val);
 
+#endif
+
 
 // -------------------------------------------------------------------
 
@@ -73,11 +73,75 @@ typedef struct test_fn {
 // -------------------------------------------------------------------
 
 uint8_t test_mem[65536];
+uint8_t test_mem_other[65536];
 
 int test_reads, test_writes;
 
 test_host_state test_data;
 
+fake6502_cache test_cache;
+
+// a loop writing a count through memory, for the tests that fork, save or
+// trace a context part way through it
+// loop: inc $10; ldx $10; txa; sta $0400,x; jmp loop
+
+uint8_t test_loop[] = {0xe6, 0x10, 0xa6, 0x10, 0x8a, 0x9d, 0x00, 0x04, 0x4c, 0x00, 0x02};
+
+fake6502_variant test_variant = FAKE6502_VARIANT_NMOS;
+
+fake6502_batch test_batch, test_batch_start;
+
+fake6502_sliced test_sliced;
+
+fake6502_equiv test_equiv;
+fake6502_equiv_mask test_equiv_mask;
+fake6502_equiv_vector test_equiv_vectors[64];
+
+// contexts for the thread pool, each with its own first 1K, run in a pool
+// and then one after another
+
+#define TEST_POOL_CONTEXTS              256
+
+fake6502_context test_pool_contexts[2][TEST_POOL_CONTEXTS];
+uint8_t test_pool_mem[2][TEST_POOL_CONTEXTS][0x0400];
+int test_pool_done[TEST_POOL_CONTEXTS];
+
+// instructions the batch engine runs on whole vectors of lanes, and a few
+// it does not
+
+uint8_t test_batch_opcodes[] = {
+    0xa9, 0xa5, 0xb5, 0xad, 0xbd, 0xb9, 0xa2, 0xa6, 0xb6, 0xae, 0xbe, 0xa0, 0xa4,
+    0x69, 0x65, 0x75, 0x6d, 0x7d, 0xe9, 0xe5, 0xed, 0xf9, 0x29, 0x25, 0x09, 0x05,
+    0x49, 0x45, 0xc9, 0xc5, 0xdd, 0xe0, 0xe4, 0xc0, 0xcc, 0x24, 0x2c,
+    0x85, 0x95, 0x8d, 0x9d, 0x99, 0x86, 0x96, 0x84, 0x94, 0x8c,
+    0xe6, 0xc6, 0xf6, 0xee, 0x06, 0x46, 0x26, 0x66, 0x1e, 0x0a, 0x4a, 0x2a, 0x6a,
+    0xe8, 0xc8, 0xca, 0x88, 0xaa, 0xa8, 0x8a, 0x98, 0xba, 0x9a,
+    0x18, 0x38, 0xd8, 0xf8, 0xb8, 0x58, 0x78, 0xea,
+    0x90, 0xb0, 0xd0, 0xf0, 0x10, 0x30, 0x50, 0x70,
+    0x48, 0x68, 0x08, 0xa1, 0xb1, 0x00};
+
+// straight-line register code for the bitsliced engine, with how many
+// instructions it is; the byte at patch, if any, is set to each operand
+// in turn
+
+struct {
+    uint8_t code[10];
+    int size, count, patch;
+} test_sliced_code[] = {
+    {{0x69, 0x00}, 2, 1, 1},                                    // adc #
+    {{0xe9, 0x00}, 2, 1, 1},                                    // sbc #
+    {{0xc9, 0x00}, 2, 1, 1},                                    // cmp #
+    {{0xaa, 0xe0, 0x00}, 3, 2, 2},                              // tax, cpx #
+    {{0xa8, 0xc0, 0x00}, 3, 2, 2},                              // tay, cpy #
+    {{0x29, 0x00}, 2, 1, 1},                                    // and #
+    {{0x09, 0x00}, 2, 1, 1},                                    // ora #
+    {{0x49, 0x00}, 2, 1, 1},                                    // eor #
+    {{0x89, 0x00}, 2, 1, 1},                                    // bit # on the CMOS
+    {{0x2a, 0x6a, 0x6a, 0x0a, 0x4a, 0x18, 0x2a, 0x38, 0x6a}, 9, 9, 0},
+    {{0xe8, 0xc8, 0x8a, 0xca, 0x98, 0x88, 0xaa, 0xa8, 0xea}, 9, 9, 0},
+    {{0xf8, 0x69, 0x00, 0xe9, 0x27, 0xd8, 0xb8, 0x58, 0x78}, 9, 7, 2},
+    {{0xa2, 0x00, 0x8a, 0x38, 0xe9, 0x99, 0xa0, 0x80, 0x98}, 9, 6, 1}};
+
 
 // -------------------------------------------------------------------
 // function's
@@ -85,18 +149,24 @@ test_host_state test_data;
 
 // emulator support
 
-uint8_t fake6502_mem_read(fake6502_context *c, uint16_t addr)
+uint8_t test_mem_read(fake6502_context *c, uint16_t addr)
 {
     test_reads++;
     return( ((test_host_state*)c->state_host)->memory[addr] );
 }
 
-void fake6502_mem_write(fake6502_context *c, uint16_t addr, uint8_t val)
+void test_mem_write(fake6502_context *c, uint16_t addr, uint8_t val)
 {
     test_writes++;
     ((test_host_state*)c->state_host)->memory[addr] = val;
 }
 
+uint8_t test_other_read(fake6502_context *c, uint16_t addr)
+{ return( test_mem_other[addr] ); }
+
+void test_other_write(fake6502_context *c, uint16_t addr, uint8_t val)
+{ test_mem_other[addr] = val; }
+
 
 // -------------------------------------------------------------------
 
@@ -106,11 +176,27 @@ void test_init(fake6502_context *cpu)
 {
 
     test_data.memory = test_mem;
-    cpu->state_host = (void*)&test_data;
+    fake6502_init(cpu, test_mem_read, test_mem_write, (void*)&test_data);
+    cpu->variant = test_variant;
 
     fake6502_reset(cpu);
 }
 
+// a context with its own pages, at the start of test_loop; false if out
+// of memory
+
+int test_init_loop(fake6502_context *c)
+{
+    fake6502_init(c, test_other_read, test_other_write, NULL);
+    c->variant = test_variant;
+    if (!fake6502_pages_alloc(c, 0x00, 256))
+        return(0);
+    for (int i = 0; i < sizeof(test_loop); i++)
+        fake6502_mem_write(c, 0x0200 + i, test_loop[i]);
+    c->cpu.pc = 0x0200;
+    return(1);
+}
+
 void test_exec_instruction(fake6502_context *cpu, uint8_t opcode, uint8_t op1,
                            uint8_t op2)
 {
@@ -123,6 +209,14 @@ void test_exec_instruction(fake6502_context *cpu, uint8_t opcode, uint8_t op1,
     fake6502_step(cpu);
 }
 
+int test_same_state(fake6502_context *a, fake6502_context *b)
+{
+    return( a->cpu.a == b->cpu.a && a->cpu.x == b->cpu.x &&
+            a->cpu.y == b->cpu.y && a->cpu.s == b->cpu.s &&
+            a->cpu.flags == b->cpu.flags && a->cpu.pc == b->cpu.pc &&
+            a->emu.ea == b->emu.ea && a->emu.clockticks == b->emu.clockticks );
+}
+
 int test_interrupt()
 {
     fake6502_context f6502;
@@ -1457,6 +1551,1659 @@ int test_pushme_pullyou()
     return(0);
 }
 
+int test_run()
+{
+    fake6502_context f6502;
+    fake6502_stop_reason reason;
+
+    // ldx #$03; loop: dex; bne loop; brk
+    uint8_t program[] = {0xa2, 0x03, 0xca, 0xd0, 0xfd, 0x00};
+
+    test_init(&f6502);
+
+    for (int i = 0; i < sizeof(program); i++)
+        fake6502_mem_write(&f6502, 0x0200 + i, program[i]);
+    fake6502_mem_write(&f6502, 0xfffe, 0x00);
+    fake6502_mem_write(&f6502, 0xffff, 0x60);
+
+    f6502.cpu.pc = 0x0200;
+    f6502.emu.instructions = f6502.emu.clockticks = 0;
+
+    reason = fake6502_run(&f6502, 0, 3);
+    if (reason != FAKE6502_STOP_BUDGET)
+        return( printf("line %d: stopped for reason %d\n", __LINE__, reason) );
+    CHECK(emu.instructions, 3);
+    CHECK(cpu.x, 0x02);
+    CHECK(cpu.pc, 0x0202);
+
+    reason = fake6502_run(&f6502, 5, 0);
+    if (reason != FAKE6502_STOP_BUDGET)
+        return( printf("line %d: stopped for reason %d\n", __LINE__, reason) );
+    CHECK(emu.instructions, 5);
+    CHECK(emu.clockticks, 12);
+
+    reason = fake6502_run(&f6502, 0, 0);
+    if (reason != FAKE6502_STOP_BRK)
+        return( printf("line %d: stopped for reason %d\n", __LINE__, reason) );
+    CHECK(cpu.x, 0x00);
+    CHECK(cpu.pc, 0x6000);
+    CHECK(emu.instructions, 8);
+
+    return(0);
+}
+
+int test_run_halt()
+{
+    fake6502_context f6502;
+    fake6502_stop_reason reason;
+
+    test_init(&f6502);
+
+    f6502.cpu.pc = 0x0200;
+    fake6502_mem_write(&f6502, 0x0200, 0xea); // nop
+    fake6502_mem_write(&f6502, 0x0201, 0x02); // jam
+
+    reason = fake6502_run(&f6502, 0, 100);
+    if (reason != FAKE6502_STOP_HALT)
+        return( printf("line %d: stopped for reason %d\n", __LINE__, reason) );
+    CHECK(cpu.pc, 0x0201);
+
+    return(0);
+}
+
+int test_fused_engine()
+{
+    fake6502_context table, fused;
+    test_host_state fused_data;
+
+    test_init(&table);
+    fused_data.memory = test_mem_other;
+
+    srand(6502);
+
+    for (int opcode = 0; opcode < 256; opcode++)
+    {
+        for (int i = 0; i < sizeof(test_mem); i++)
+            test_mem[i] = rand();
+
+        for (int trial = 0; trial < 8; trial++)
+        {
+            table.cpu.a = rand();
+            table.cpu.x = rand();
+            table.cpu.y = rand();
+            table.cpu.s = rand();
+            table.cpu.flags = rand();
+            table.cpu.pc = 0x0200 + rand() % 0xfd00;
+            table.emu.clockticks = 0;
+            test_mem[table.cpu.pc] = opcode;
+
+            fused = table;
+            fused.engine = FAKE6502_ENGINE_FUSED;
+            fused.state_host = (void*)&fused_data;
+            memcpy(test_mem_other, test_mem, sizeof(test_mem));
+
+            fake6502_step(&table);
+            fake6502_step(&fused);
+
+            if (!test_same_state(&table, &fused) ||
+                memcmp(test_mem, test_mem_other, sizeof(test_mem)))
+                return( printf("line %d: opcode %02x differs between engines\n",
+                               __LINE__, opcode) );
+        }
+    }
+
+    return(0);
+}
+
+int test_bus()
+{
+    fake6502_context f6502, other;
+
+    test_init(&f6502);
+    fake6502_init(&other, test_other_read, test_other_write, NULL);
+
+    f6502.cpu.pc = other.cpu.pc = 0x0200;
+    f6502.cpu.a = 0x11;
+    other.cpu.a = 0x22;
+    test_mem[0x0010] = test_mem_other[0x0010] = 0x00;
+    test_mem_other[0x0200] = 0x85; // sta $10
+    test_mem_other[0x0201] = 0x10;
+
+    test_exec_instruction(&f6502, 0x85, 0x10, 0x00); // sta $10
+    fake6502_step(&other);
+
+    CHECKCYCLES(2, 1);
+    CHECKMEM(0x0010, 0x11);
+    if (test_mem_other[0x0010] != 0x22)
+        return( printf("line %d: the other context wrote %02x\n", __LINE__,
+                       test_mem_other[0x0010]) );
+
+    return(0);
+}
+
+int test_pages()
+{
+    fake6502_context f6502;
+    uint8_t ram[512], rom[256];
+
+    test_init(&f6502);
+
+    // RAM at $0200-$03ff, ROM at $0400-$04ff, everything else via the host
+    memset(ram, 0, sizeof(ram));
+    memset(rom, 0x5a, sizeof(rom));
+    fake6502_pages_map(&f6502, 0x02, 2, ram, ram);
+    fake6502_pages_map(&f6502, 0x04, 1, rom, NULL);
+
+    ram[0x0000] = 0xad; // lda $04ff
+    ram[0x0001] = 0xff;
+    ram[0x0002] = 0x04;
+    ram[0x0003] = 0x8d; // sta $0400
+    ram[0x0004] = 0x00;
+    ram[0x0005] = 0x04;
+    ram[0x0006] = 0x8d; // sta $03ff
+    ram[0x0007] = 0xff;
+    ram[0x0008] = 0x03;
+
+    f6502.cpu.pc = 0x0200;
+    test_reads = test_writes = 0;
+
+    fake6502_run(&f6502, 0, 3);
+    CHECK(cpu.a, 0x5a);
+    CHECKCYCLES(0, 1);
+    CHECKMEM(0x0400, 0x5a);
+    if (test_mem[0x0400] != 0x5a || ram[0x01ff] != 0x5a)
+        return( printf("line %d: wrote to the wrong place\n", __LINE__) );
+
+    return(0);
+}
+
+int test_bus_mode()
+{
+    fake6502_context f6502;
+
+    // accurate: the reset's dummy reads, and rol $01 writing $81 back first
+    test_init(&f6502);
+    test_reads = test_writes = 0;
+    fake6502_reset(&f6502);
+    CHECKCYCLES(8, 0);
+
+    fake6502_mem_write(&f6502, 0x01, 0x81);
+    f6502.cpu.pc = 0x0200;
+    f6502.cpu.flags = 0x00;
+    test_exec_instruction(&f6502, 0x26, 0x01, 0x00);
+    CHECKCYCLES(3, 2);
+    CHECKMEM(0x01, 0x02);
+    CHECKFLAG(FAKE6502_CARRY_FLAG, 1);
+    CHECK(emu.clockticks, 5);
+
+    // fast: only the reset vector, and only the result
+    f6502.mode = FAKE6502_MODE_FAST;
+    test_reads = test_writes = 0;
+    fake6502_reset(&f6502);
+    CHECKCYCLES(2, 0);
+
+    fake6502_mem_write(&f6502, 0x01, 0x81);
+    f6502.cpu.pc = 0x0200;
+    f6502.cpu.flags = 0x00;
+    test_exec_instruction(&f6502, 0x66, 0x01, 0x00); // ror $01
+    CHECKCYCLES(3, 1);
+    CHECKMEM(0x01, 0x40);
+    CHECKFLAG(FAKE6502_CARRY_FLAG, 1);
+    CHECK(emu.clockticks, 5);
+
+    return(0);
+}
+
+int test_variants()
+{
+    fake6502_context nmos, cmos;
+
+    test_init(&nmos);
+    test_init(&cmos);
+    nmos.variant = FAKE6502_VARIANT_NMOS;
+    cmos.variant = FAKE6502_VARIANT_CMOS;
+
+    // jmp ($80ff): the NMOS part wraps within the page, the CMOS part doesn't
+    nmos.cpu.pc = cmos.cpu.pc = 0x0200;
+    test_mem[0x0200] = 0x6c;
+    test_mem[0x0201] = 0xff;
+    test_mem[0x0202] = 0x80;
+    test_mem[0x80ff] = 0x34;
+    test_mem[0x8000] = 0x12;
+    test_mem[0x8100] = 0x56;
+
+    fake6502_step(&nmos);
+    fake6502_step(&cmos);
+
+    if (nmos.cpu.pc != 0x1234 || cmos.cpu.pc != 0x5634)
+        return( printf("line %d: nmos went to %04x, cmos went to %04x\n",
+                       __LINE__, nmos.cpu.pc, cmos.cpu.pc) );
+
+    // the old single table is the one fake6502_init() picks
+    fake6502_init(&nmos, test_mem_read, test_mem_write, (void*)&test_data);
+    if (fake6502_opcodes != fake6502_opcode_tables[nmos.variant])
+        return( printf("line %d: fake6502_opcodes is not the default table\n", __LINE__) );
+
+    return(0);
+}
+
+int test_2a03_decimal()
+{
+    fake6502_context f6502;
+
+    test_init(&f6502);
+
+    f6502.cpu.pc = 0x200;
+    f6502.cpu.a = 0x09;
+    fake6502_decimal_set(&f6502);
+    fake6502_carry_clear(&f6502);
+
+    test_exec_instruction(&f6502, 0x69, 0x01, 0x00); // ADC #$01
+    CHECK(cpu.a, 0x0a);
+
+    test_exec_instruction(&f6502, 0x38, 0x00, 0x00); // SEC
+    test_exec_instruction(&f6502, 0xe9, 0x01, 0x00); // SBC #$01
+    CHECK(cpu.a, 0x09);
+    CHECKFLAG(FAKE6502_DECIMAL_FLAG, 1);
+
+    return(0);
+}
+
+int test_flags_host()
+{
+    fake6502_context f6502;
+
+    test_init(&f6502);
+
+    f6502.cpu.pc = 0x0200;
+    f6502.cpu.s = 0xff;
+    test_mem[0x0200] = 0xa9; // lda #$00
+    test_mem[0x0201] = 0x00;
+    test_mem[0x0202] = 0xd0; // bne *+$02
+    test_mem[0x0203] = 0x02;
+    test_mem[0x0206] = 0x69; // adc #$00
+    test_mem[0x0207] = 0x00;
+    test_mem[0x0208] = 0x08; // php
+
+    fake6502_run(&f6502, 0, 1);
+    CHECKFLAG(FAKE6502_ZERO_FLAG, 1);
+    CHECKFLAG(FAKE6502_SIGN_FLAG, 0);
+
+    // the emulator has to pick up changes the host makes between calls
+    f6502.cpu.flags &= ~FAKE6502_ZERO_FLAG;
+    fake6502_carry_set(&f6502);
+    fake6502_decimal_clear(&f6502);
+
+    fake6502_run(&f6502, 0, 3);
+    CHECK(cpu.pc, 0x0209);
+    CHECK(cpu.a, 0x01);
+    CHECKFLAG(FAKE6502_CARRY_FLAG, 0);
+    CHECKFLAG(FAKE6502_ZERO_FLAG, 0);
+    CHECKMEM(0x01ff, f6502.cpu.flags | FAKE6502_BREAK_FLAG);
+
+    return(0);
+}
+
+int test_arith_table()
+{
+    int errors = fake6502_arith_check();
+
+    if (errors)
+        return( printf("line %d: %d ADC/SBC table entries are wrong\n", __LINE__, errors) );
+
+    return(0);
+}
+
+int test_cached_engine()
+{
+    fake6502_context table, cached;
+
+    test_init(&table);
+    test_init(&cached);
+    cached.engine = FAKE6502_ENGINE_CACHED;
+    fake6502_pages_map(&cached, 0x00, 256, test_mem_other, test_mem_other);
+    fake6502_cache_attach(&cached, &test_cache);
+
+    srand(6502);
+
+    for (int opcode = 0; opcode < 256; opcode++)
+    {
+        for (int i = 0; i < sizeof(test_mem); i++)
+            test_mem[i] = rand();
+
+        for (int trial = 0; trial < 8; trial++)
+        {
+            table.cpu.a = rand();
+            table.cpu.x = rand();
+            table.cpu.y = rand();
+            table.cpu.s = rand();
+            table.cpu.flags = rand();
+            table.cpu.pc = 0x0200 + rand() % 0xfd00;
+            table.emu.clockticks = 0;
+            test_mem[table.cpu.pc] = opcode;
+
+            cached.cpu = table.cpu;
+            cached.emu.clockticks = 0;
+
+            // the host changed memory behind the cache's back
+            memcpy(test_mem_other, test_mem, sizeof(test_mem));
+            fake6502_cache_flush(&cached);
+
+            fake6502_step(&table);
+            fake6502_step(&cached);
+
+            if (!test_same_state(&table, &cached) ||
+                memcmp(test_mem, test_mem_other, sizeof(test_mem)))
+                return( printf("line %d: opcode %02x differs between engines\n",
+                               __LINE__, opcode) );
+        }
+    }
+
+    fake6502_cache_attach(&cached, NULL);
+    return(0);
+}
+
+int test_cache_smc()
+{
+    fake6502_context f6502;
+    uint8_t ram[0x400];
+
+    // ldx #$00; loop: lda #$00; sta $0300,x; inc loop+1; inx; bne loop; brk
+    uint8_t program[] = {0xa2, 0x00, 0xa9, 0x00, 0x9d, 0x00, 0x03, 0xee,
+                         0x03, 0x02, 0xe8, 0xd0, 0xf5, 0x00};
+
+    test_init(&f6502);
+    f6502.engine = FAKE6502_ENGINE_CACHED;
+
+    memset(ram, 0, sizeof(ram));
+    memcpy(ram + 0x0200, program, sizeof(program));
+    fake6502_pages_map(&f6502, 0x00, 4, ram, ram);
+    fake6502_cache_attach(&f6502, &test_cache);
+
+    f6502.cpu.pc = 0x0200;
+    if (fake6502_run(&f6502, 0, 0) != FAKE6502_STOP_BRK)
+        return( printf("line %d: did not reach the brk\n", __LINE__) );
+
+    for (int i = 0; i < 256; i++)
+        if (ram[0x0300 + i] != i)
+            return( printf("line %d: $%04x is %02x\n", __LINE__, 0x0300 + i, ram[0x0300 + i]) );
+
+    if (test_cache.entries[0x0204].length != 3 || test_cache.entries[0x0202].length != 0)
+        return( printf("line %d: the cache did not hold the loop\n", __LINE__) );
+
+    // the host changes the code, and tells the cache
+    ram[0x0203] = 0x42;
+    ram[0x020d] = 0x00;
+    fake6502_cache_invalidate(&f6502, 0x0203, 1);
+    f6502.cpu.pc = 0x0202;
+    fake6502_step(&f6502);
+    CHECK(cpu.a, 0x42);
+
+    fake6502_cache_attach(&f6502, NULL);
+    if (f6502.bus.write_pages[0x02] != ram + 0x0200)
+        return( printf("line %d: page $02 is still write protected\n", __LINE__) );
+
+    return(0);
+}
+
+int test_batch_engine()
+{
+    fake6502_context ref;
+    int lanes = 64, compared = 0;
+
+    srand(6502);
+
+    for (int trial = 0; trial < 16; trial++)
+    {
+        // code at $0200, and inputs in zero page that differ between lanes;
+        // BRKs everywhere else
+        memset(test_mem_other, 0, sizeof(test_mem_other));
+        for (int i = 0; i < 0x0400; i++)
+            test_mem_other[i] = rand();
+        for (int i = 0x0200; i < 0x0400; i++)
+            if (rand() % 4)
+                test_mem_other[i] = test_batch_opcodes[rand() % sizeof(test_batch_opcodes)];
+
+        fake6502_batch_init(&test_batch, test_variant, test_mem_other, lanes);
+        for (int lane = 0; lane < lanes; lane++)
+        {
+            test_batch.a[lane] = rand();
+            test_batch.x[lane] = rand() % 8;
+            test_batch.y[lane] = rand() % 8;
+            test_batch.s[lane] = 0xff - rand() % 8;
+            test_batch.flags[lane] = rand() | FAKE6502_CONSTANT_FLAG;
+            test_batch.pc[lane] = 0x0200;
+            for (int i = 0; i < 4; i++)
+                fake6502_batch_poke(&test_batch, lane, rand() % 256, rand());
+        }
+
+        test_batch_start = test_batch;
+        fake6502_batch_run(&test_batch, 200);
+
+        // each lane against a context of its own
+        for (int lane = 0; lane < lanes; lane++)
+        {
+            fake6502_stop_reason reason;
+
+            if (test_batch.stop[lane] == FAKE6502_STOP_FAULT)
+                continue;
+
+            for (int i = 0; i < sizeof(test_mem); i++)
+                test_mem[i] = fake6502_batch_peek(&test_batch_start, lane, i);
+
+            test_init(&ref);
+            ref.cpu.a = test_batch_start.a[lane];
+            ref.cpu.x = test_batch_start.x[lane];
+            ref.cpu.y = test_batch_start.y[lane];
+            ref.cpu.s = test_batch_start.s[lane];
+            ref.cpu.flags = test_batch_start.flags[lane];
+            ref.cpu.pc = 0x0200;
+            ref.emu.clockticks = ref.emu.instructions = 0;
+            reason = fake6502_run(&ref, 0, 200);
+
+            if (reason != test_batch.stop[lane] || ref.cpu.a != test_batch.a[lane] ||
+                ref.cpu.x != test_batch.x[lane] || ref.cpu.y != test_batch.y[lane] ||
+                ref.cpu.s != test_batch.s[lane] || ref.cpu.flags != test_batch.flags[lane] ||
+                ref.cpu.pc != test_batch.pc[lane] ||
+                ref.emu.clockticks != test_batch.clockticks[lane] ||
+                ref.emu.instructions != test_batch.instructions[lane])
+                return( printf("line %d: trial %d lane %d differs\n", __LINE__, trial, lane) );
+
+            for (int i = 0; i < sizeof(test_mem); i++)
+                if (test_mem[i] != fake6502_batch_peek(&test_batch, lane, i))
+                    return( printf("line %d: trial %d lane %d differs at $%04x\n",
+                                   __LINE__, trial, lane, i) );
+            compared++;
+        }
+    }
+
+    // the random code may write to more addresses than there are columns
+    if (compared < 16 * lanes / 2)
+        return( printf("line %d: only %d lanes compared\n", __LINE__, compared) );
+
+    // more lanes than there are is as many as there are
+    fake6502_batch_init(&test_batch, test_variant, test_mem_other, FAKE6502_BATCH_LANES + 1);
+    if (test_batch.lanes != FAKE6502_BATCH_LANES)
+        return( printf("line %d: %d lanes\n", __LINE__, test_batch.lanes) );
+
+    return(0);
+}
+
+// every A, operand, carry and decimal flag, one lane per A
+
+int test_batch_arith()
+{
+    fake6502_context ref;
+
+    for (int i = 0; i < 4 * 2 * 256; i++)
+    {
+        uint8_t opcode = i & 0x400 ? 0xe9 : 0x69, value = i;
+        uint8_t flags = FAKE6502_CONSTANT_FLAG | (i & 0x100 ? FAKE6502_CARRY_FLAG : 0) |
+                        (i & 0x200 ? FAKE6502_DECIMAL_FLAG : 0);
+
+        memset(test_mem_other, 0, sizeof(test_mem_other));
+        test_mem_other[0x0200] = opcode;
+        test_mem_other[0x0201] = value;
+        memcpy(test_mem, test_mem_other, sizeof(test_mem));
+
+        fake6502_batch_init(&test_batch, test_variant, test_mem_other, 256);
+        for (int lane = 0; lane < 256; lane++)
+        {
+            test_batch.a[lane] = lane;
+            test_batch.flags[lane] = flags;
+            test_batch.pc[lane] = 0x0200;
+        }
+        fake6502_batch_run(&test_batch, 1);
+
+        for (int lane = 0; lane < 256; lane++)
+        {
+            test_init(&ref);
+            ref.cpu.a = lane;
+            ref.cpu.flags = flags;
+            ref.cpu.pc = 0x0200;
+            fake6502_run(&ref, 0, 1);
+
+            if (ref.cpu.a != test_batch.a[lane] || ref.cpu.flags != test_batch.flags[lane])
+                return( printf("line %d: %02x %02x with A=%02x P=%02x gave %02x P=%02x\n",
+                               __LINE__, opcode, value, lane, flags, test_batch.a[lane],
+                               test_batch.flags[lane]) );
+        }
+    }
+
+    return(0);
+}
+
+// every A in the lanes, against the scalar core for every operand and
+// every carry and decimal flag
+
+int test_sliced_engine()
+{
+    fake6502_context ref;
+    fake6502_cpu_state cpu;
+
+    for (int t = 0; t < sizeof(test_sliced_code) / sizeof(test_sliced_code[0]); t++)
+        for (int i = 0; i < 4 * 256; i++)
+        {
+            uint8_t *code = test_sliced_code[t].code;
+            int size = test_sliced_code[t].size;
+            uint8_t value = i;
+            uint8_t flags = FAKE6502_CONSTANT_FLAG | (i & 0x100 ? FAKE6502_CARRY_FLAG : 0) |
+                            (i & 0x200 ? FAKE6502_DECIMAL_FLAG : 0) |
+                            (i & 0x01 ? FAKE6502_OVERFLOW_FLAG : 0) |
+                            (i & 0x02 ? FAKE6502_INTERRUPT_FLAG : 0);
+
+            if (test_sliced_code[t].patch)
+                code[test_sliced_code[t].patch] = value;
+
+            fake6502_sliced_init(&test_sliced, test_variant);
+            for (int lane = 0; lane < 256; lane++)
+            {
+                cpu.a = lane;
+                cpu.x = value;
+                cpu.y = ~value;
+                cpu.flags = flags;
+                fake6502_sliced_set(&test_sliced, lane, &cpu);
+            }
+            if (fake6502_sliced_run(&test_sliced, code, size) != size)
+                return( printf("line %d: code %d stopped early\n", __LINE__, t) );
+
+            memset(test_mem, 0, sizeof(test_mem));
+            memcpy(&test_mem[0x0200], code, size);
+
+            for (int lane = 0; lane < 256; lane++)
+            {
+                test_init(&ref);
+                ref.cpu.a = lane;
+                ref.cpu.x = value;
+                ref.cpu.y = ~value;
+                ref.cpu.flags = flags;
+                ref.cpu.pc = 0x0200;
+                fake6502_run(&ref, 0, test_sliced_code[t].count);
+
+                fake6502_sliced_get(&test_sliced, lane, &cpu);
+                if (ref.cpu.a != cpu.a || ref.cpu.x != cpu.x || ref.cpu.y != cpu.y ||
+                    ref.cpu.flags != cpu.flags)
+                    return( printf("line %d: code %d with A=%02x X=%02x P=%02x gave "
+                                   "A=%02x X=%02x Y=%02x P=%02x, not %02x %02x %02x %02x\n",
+                                   __LINE__, t, lane, value, flags, cpu.a, cpu.x, cpu.y,
+                                   cpu.flags, ref.cpu.a, ref.cpu.x, ref.cpu.y,
+                                   ref.cpu.flags) );
+            }
+        }
+
+    // stops at the first instruction using memory, and at a cut operand
+    fake6502_sliced_init(&test_sliced, test_variant);
+    if (fake6502_sliced_run(&test_sliced, (uint8_t[]){0xe8, 0x18, 0x85, 0x10}, 4) != 2 ||
+        fake6502_sliced_run(&test_sliced, (uint8_t[]){0xe8, 0x69}, 2) != 1)
+        return( printf("line %d: ran past the end of the subset\n", __LINE__) );
+
+    return(0);
+}
+
+// the static opcode data against what each instruction that does not
+// change the flow does when run: its size, its cycles with no page
+// crossed, and no register, flag or memory touched that it does not list
+
+int test_opcode_info()
+{
+    fake6502_context c;
+    const fake6502_opcode_info *info = fake6502_opcode_infos[test_variant];
+    const fake6502_opcode_info *jmp_ind = &info[0x6c], *lda_absx = &info[0xbd];
+
+    if (info[0x69].size != 2 || info[0x69].mnemonic != FAKE6502_OP_ADC ||
+        info[0x69].addressing != FAKE6502_ADDR_IMM ||
+        !(info[0x69].flags_read & FAKE6502_DECIMAL_FLAG) != (test_variant == FAKE6502_VARIANT_2A03) ||
+        jmp_ind->flow != FAKE6502_FLOW_JUMP || jmp_ind->size != 3 ||
+        (jmp_ind->penalty == FAKE6502_PENALTY_POINTER) != (test_variant == FAKE6502_VARIANT_CMOS) ||
+        lda_absx->penalty != FAKE6502_PENALTY_PAGE || lda_absx->reads != FAKE6502_REG_X ||
+        lda_absx->addressing != FAKE6502_ADDR_ABSX || info[0xd0].flow != FAKE6502_FLOW_BRANCH ||
+        info[0xd0].penalty != FAKE6502_PENALTY_BRANCH || info[0x20].flow != FAKE6502_FLOW_CALL ||
+        strcmp(fake6502_mnemonic_names[info[0x20].mnemonic], "JSR") ||
+        strcmp(fake6502_addressing_names[info[0x91].addressing], "indy") ||
+        info[0x91].memory != FAKE6502_MEM_WRITE)
+        return( printf("line %d: wrong data for a known opcode\n", __LINE__) );
+
+    for (int opcode = 0; opcode < 256; opcode++)
+    {
+        uint8_t start[4] = {0x5a, 0x03, 0x04, 0xfd}, end[4];
+        uint32_t ticks;
+        int writes;
+
+        if (info[opcode].flow != FAKE6502_FLOW_NONE)
+            continue;
+
+        memset(test_mem, 0, sizeof(test_mem));
+        test_mem[0x0200] = opcode;
+        test_mem[0x0201] = 0x10;
+
+        for (int flags = 0; flags < 2; flags++)
+        {
+            test_init(&c);
+            c.cpu.a = start[0];
+            c.cpu.x = start[1];
+            c.cpu.y = start[2];
+            c.cpu.s = start[3];
+            c.cpu.flags = flags ? 0xff : FAKE6502_CONSTANT_FLAG;
+            c.cpu.pc = 0x0200;
+            ticks = c.emu.clockticks;
+            test_writes = 0;
+            fake6502_run(&c, 0, 1);
+            writes = test_writes;
+
+            end[0] = c.cpu.a;
+            end[1] = c.cpu.x;
+            end[2] = c.cpu.y;
+            end[3] = c.cpu.s;
+            for (int r = 0; r < 4; r++)
+                if (start[r] != end[r] && !(info[opcode].writes & (1 << r)))
+                    return( printf("line %d: %02x wrote register %d\n", __LINE__, opcode, r) );
+
+            if (c.cpu.pc != 0x0200 + info[opcode].size ||
+                c.emu.clockticks - ticks != info[opcode].clockticks ||
+                ((c.cpu.flags ^ (flags ? 0xff : FAKE6502_CONSTANT_FLAG)) & ~info[opcode].flags_written) ||
+                (writes && !(info[opcode].memory & (FAKE6502_MEM_WRITE | FAKE6502_MEM_STACK))) ||
+                (!writes && (info[opcode].memory & FAKE6502_MEM_WRITE)))
+                return( printf("line %d: %02x ran to %04x in %d cycles, with %d writes and P=%02x\n",
+                               __LINE__, opcode, c.cpu.pc, (int)(c.emu.clockticks - ticks),
+                               writes, c.cpu.flags) );
+        }
+    }
+
+    return(0);
+}
+
+#ifdef FAKE6502_JIT
+// whether any of the process's memory is writable and executable at once
+
+bool test_rwx_mapped()
+{
+    bool rwx = false;
+#ifdef __linux__
+    FILE *maps = fopen("/proc/self/maps", "r");
+    char line[512];
+
+    while (maps && fgets(line, sizeof(line), maps))
+        if (strstr(line, " rwx"))
+            rwx = true;
+    if (maps)
+        fclose(maps);
+#endif
+    return(rwx);
+}
+
+int test_jit_engine()
+{
+    fake6502_context ref, jit;
+    fake6502_jit *blocks = fake6502_jit_create();
+
+    test_init(&ref);
+    test_init(&jit);
+    jit.engine = FAKE6502_ENGINE_JIT;
+    fake6502_pages_map(&jit, 0x00, 256, test_mem_other, test_mem_other);
+    fake6502_cache_attach(&jit, &test_cache);
+    fake6502_jit_attach(&jit, blocks);
+
+    srand(6502);
+
+    // random code, run in random slices; both have to stop at the same
+    // instruction for every budget, through writes to their own code
+    for (int trial = 0; trial < 64; trial++)
+    {
+        for (int i = 0; i < sizeof(test_mem); i++)
+            test_mem[i] = rand();
+        memcpy(test_mem_other, test_mem, sizeof(test_mem));
+        fake6502_cache_flush(&jit);
+
+        ref.cpu.a = rand();
+        ref.cpu.x = rand();
+        ref.cpu.y = rand();
+        ref.cpu.s = rand();
+        ref.cpu.flags = rand();
+        ref.cpu.pc = rand();
+        ref.emu.clockticks = ref.emu.instructions = 0;
+        jit.cpu = ref.cpu;
+        jit.emu.clockticks = jit.emu.instructions = 0;
+
+        for (int slice = 0; slice < 256; slice++)
+        {
+            int cycles = rand() % 200;
+            int instructions = 1 + rand() % 64;
+            fake6502_stop_reason reason_ref = fake6502_run(&ref, cycles, instructions);
+            fake6502_stop_reason reason_jit = fake6502_run(&jit, cycles, instructions);
+
+            if (reason_ref != reason_jit || ref.emu.instructions != jit.emu.instructions ||
+                !test_same_state(&ref, &jit) ||
+                memcmp(test_mem, test_mem_other, sizeof(test_mem)))
+                return( printf("line %d: trial %d slice %d differs at pc %04x\n",
+                               __LINE__, trial, slice, ref.cpu.pc) );
+
+            if (reason_ref == FAKE6502_STOP_HALT)
+                break;
+        }
+    }
+
+    if (test_rwx_mapped())
+        return( printf("line %d: translated code is writable\n", __LINE__) );
+
+    fake6502_jit_attach(&jit, NULL);
+    fake6502_cache_attach(&jit, NULL);
+    fake6502_jit_destroy(blocks);
+    return(0);
+}
+#endif
+
+int test_fork()
+{
+    fake6502_context a, b, snapshot, b_ran;
+
+    if (!test_init_loop(&a))
+        return( printf("line %d: no memory for pages\n", __LINE__) );
+    a.engine = FAKE6502_ENGINE_CACHED;
+    fake6502_cache_attach(&a, &test_cache);
+    fake6502_run(&a, 0, 100);
+
+    fake6502_fork(&a, &snapshot);
+    fake6502_fork(&a, &b);
+    for (int i = 0; i < sizeof(test_mem); i++)
+        test_mem[i] = fake6502_mem_read(&snapshot, i);
+
+    // the parent and child go their own ways
+    fake6502_run(&a, 0, 500);
+    fake6502_run(&b, 0, 37);
+    b_ran = b;
+    fake6502_mem_write(&b, 0x0010, 0x99);
+
+    for (int i = 0; i < sizeof(test_mem); i++)
+        if (fake6502_mem_read(&snapshot, i) != test_mem[i])
+            return( printf("line %d: snapshot changed at $%04x\n", __LINE__, i) );
+    if (fake6502_mem_read(&a, 0x0010) == 0x99 || a.cpu.pc == 0)
+        return( printf("line %d: child wrote to its parent\n", __LINE__) );
+
+    // back to the snapshot, sharing every page with it again
+    fake6502_restore(&a, &snapshot);
+    if (!test_same_state(&a, &snapshot))
+        return( printf("line %d: registers not restored\n", __LINE__) );
+    for (int i = 0; i < 256; i++)
+        if (a.bus.pages[i] != snapshot.bus.pages[i])
+            return( printf("line %d: page $%02x not restored\n", __LINE__, i) );
+    for (int i = 0; i < sizeof(test_mem); i++)
+        if (fake6502_mem_read(&a, i) != test_mem[i])
+            return( printf("line %d: memory not restored at $%04x\n", __LINE__, i) );
+
+    // and from there the same as the child, with the cache seeing the
+    // restored code
+    fake6502_run(&a, 0, 37);
+    if (!test_same_state(&a, &b_ran))
+        return( printf("line %d: restored run differs\n", __LINE__) );
+    for (int i = 0; i < sizeof(test_mem); i++)
+        if (i != 0x0010 && fake6502_mem_read(&a, i) != fake6502_mem_read(&b, i))
+            return( printf("line %d: restored run differs at $%04x\n", __LINE__, i) );
+
+    fake6502_cache_attach(&a, NULL);
+    fake6502_pages_release(&a);
+    fake6502_pages_release(&b);
+    fake6502_pages_release(&snapshot);
+    return(0);
+}
+
+int test_save()
+{
+    static uint8_t image[FAKE6502_SAVE_HEADER + 65536], saved[sizeof(image)];
+    fake6502_context a, b;
+    size_t size;
+
+    if (!test_init_loop(&a))
+        return( printf("line %d: no memory for pages\n", __LINE__) );
+    fake6502_run(&a, 0, 100);
+
+    // and a page of ROM
+    test_mem[0x0000] = 0xa5;
+    fake6502_pages_map(&a, 0xf0, 1, test_mem, NULL);
+
+    size = fake6502_save(&a, image, sizeof(image));
+    if (size != sizeof(image) || size != fake6502_save_size(&a))
+        return( printf("line %d: save state is %zu bytes\n", __LINE__, size) );
+    if (image[22] != (a.cpu.pc & 0xFF) || image[23] != a.cpu.pc >> 8)
+        return( printf("line %d: pc not saved little endian\n", __LINE__) );
+    memcpy(saved, image, size);
+
+    fake6502_init(&b, test_other_read, test_other_write, NULL);
+    if (!fake6502_load(&b, image, size))
+        return( printf("line %d: save state not loaded\n", __LINE__) );
+    if (!test_same_state(&a, &b) || a.variant != b.variant ||
+        a.emu.instructions != b.emu.instructions)
+        return( printf("line %d: registers not loaded\n", __LINE__) );
+
+    // both carry on the same, and the image is only read
+    fake6502_run(&a, 0, 300);
+    fake6502_run(&b, 0, 300);
+    if (!test_same_state(&a, &b))
+        return( printf("line %d: loaded context runs differently\n", __LINE__) );
+    for (int i = 0; i < 65536; i++)
+        if (fake6502_mem_read(&a, i) != fake6502_mem_read(&b, i))
+            return( printf("line %d: loaded context differs at $%04x\n", __LINE__, i) );
+    if (memcmp(image, saved, size))
+        return( printf("line %d: save state written to\n", __LINE__) );
+
+    image[8]++;
+    if (fake6502_load(&b, image, size))
+        return( printf("line %d: loaded another version\n", __LINE__) );
+    image[8]--;
+    if (fake6502_load(&b, image, size - 1))
+        return( printf("line %d: loaded a short save state\n", __LINE__) );
+
+    // the ROM is still ROM, with writes going to the host
+    test_mem_other[0xf000] = 0;
+    fake6502_mem_write(&b, 0xf000, 0x5a);
+    if (fake6502_mem_read(&b, 0xf000) != 0xa5 || test_mem_other[0xf000] != 0x5a)
+        return( printf("line %d: ROM loaded writable\n", __LINE__) );
+
+    fake6502_pages_release(&a);
+    fake6502_pages_release(&b);
+    return(0);
+}
+
+#ifdef FAKE6502_TRACE
+
+fake6502_trace test_trace;
+fake6502_trace_entry test_trace_entries[FAKE6502_TRACE_SIZE];
+
+int test_trace_ring()
+{
+    fake6502_context f6502, ref;
+    int count;
+
+    memset(test_mem, 0, sizeof(test_mem));
+    memcpy(test_mem + 0x0200, test_loop, sizeof(test_loop));
+    test_init(&f6502);
+    f6502.cpu.pc = 0x0200;
+    ref = f6502;
+    fake6502_trace_attach(&f6502, &test_trace);
+
+    fake6502_run(&f6502, 0, 20);
+    if (fake6502_trace_copy(&f6502, test_trace_entries, FAKE6502_TRACE_SIZE) != 20)
+        return( printf("line %d: trace does not hold 20 instructions\n", __LINE__) );
+
+    // the registers before each instruction, and its opcode and ea after,
+    // from the start again
+    memset(test_mem + 0x0400, 0, 0x100);
+    test_mem[0x0010] = 0;
+    for (int i = 0; i < 20; i++)
+    {
+        fake6502_trace_entry *e = &test_trace_entries[i];
+
+        if (e->pc != ref.cpu.pc || e->a != ref.cpu.a || e->x != ref.cpu.x ||
+            e->y != ref.cpu.y || e->s != ref.cpu.s || e->flags != ref.cpu.flags ||
+            e->clockticks != ref.emu.clockticks)
+            return( printf("line %d: entry %d has the wrong registers\n", __LINE__, i) );
+        fake6502_step(&ref);
+        if (e->opcode != ref.emu.opcode || e->ea != ref.emu.ea)
+            return( printf("line %d: entry %d has the wrong opcode or ea\n", __LINE__, i) );
+    }
+
+    // once full, the oldest are overwritten
+    fake6502_run(&f6502, 0, FAKE6502_TRACE_SIZE);
+    count = fake6502_trace_copy(&f6502, test_trace_entries, FAKE6502_TRACE_SIZE);
+    if (count != FAKE6502_TRACE_SIZE || test_trace.next != FAKE6502_TRACE_SIZE + 20)
+        return( printf("line %d: trace holds %d instructions\n", __LINE__, count) );
+    if (test_trace_entries[count - 1].pc != 0x0200 || test_trace_entries[count - 2].pc != 0x0208)
+        return( printf("line %d: latest instructions not last\n", __LINE__) );
+    if (fake6502_trace_copy(&f6502, test_trace_entries, 2) != 2 ||
+        test_trace_entries[1].pc != 0x0200)
+        return( printf("line %d: latest instructions not copied\n", __LINE__) );
+
+    // a header and a line for each entry
+    {
+        FILE *out = tmpfile();
+        int lines = 0;
+
+        fake6502_trace_dump(&f6502, out);
+        rewind(out);
+        for (int ch; (ch = fgetc(out)) != EOF;)
+            lines += ch == '\n';
+        fclose(out);
+        if (lines != FAKE6502_TRACE_SIZE + 1)
+            return( printf("line %d: dump has %d lines\n", __LINE__, lines) );
+    }
+
+    fake6502_trace_attach(&f6502, NULL);
+    return(0);
+}
+
+#endif
+
+#ifdef FAKE6502_COUNTERS
+
+fake6502_counters test_counters, test_counters_snapshot;
+
+int test_opcode_counters()
+{
+    fake6502_context f6502;
+    FILE *out;
+    int lines = 0, first = 0;
+
+    // ldx #$ff; lda $1000,x; lda $1001,x; ldy #$01; dey; bne +0; beq +0; brk
+    // the second lda crosses a page, and only the beq is taken
+    uint8_t program[] = {0xa2, 0xff, 0xbd, 0x00, 0x10, 0xbd, 0x01, 0x10, 0xa0, 0x01,
+                         0x88, 0xd0, 0x00, 0xf0, 0x00, 0x00};
+
+    memset(test_mem, 0, sizeof(test_mem));
+    memcpy(test_mem + 0x0200, program, sizeof(program));
+    test_init(&f6502);
+    f6502.cpu.pc = 0x0200;
+    fake6502_counters_attach(&f6502, &test_counters);
+    fake6502_run(&f6502, 0, 0);
+
+    if (test_counters.executed[0xbd] != 2 || test_counters.cycles[0xbd] != 9)
+        return( printf("line %d: lda abs,x ran %d times in %d cycles\n", __LINE__,
+                       (int)test_counters.executed[0xbd], (int)test_counters.cycles[0xbd]) );
+    if (test_counters.executed[0xd0] != 1 || test_counters.cycles[0xd0] != 2 ||
+        test_counters.executed[0xf0] != 1 || test_counters.cycles[0xf0] != 3)
+        return( printf("line %d: branches counted wrongly\n", __LINE__) );
+    if (test_counters.executed[0x00] != 1 || test_counters.executed[0xa9] != 0)
+        return( printf("line %d: wrong opcodes counted\n", __LINE__) );
+
+    fake6502_counters_snapshot(&f6502, &test_counters_snapshot);
+    fake6502_counters_reset(&f6502);
+    if (test_counters_snapshot.cycles[0xbd] != 9 || test_counters.cycles[0xbd] != 0)
+        return( printf("line %d: snapshot or reset failed\n", __LINE__) );
+
+    // a header and a line for each of the 7 opcodes, lda abs,x first
+    out = tmpfile();
+    fake6502_counters_report(&test_counters_snapshot, test_variant, out);
+    rewind(out);
+    for (int ch; (ch = fgetc(out)) != EOF;)
+    {
+        if (lines == 1 && !first)
+            first = ch;
+        lines += ch == '\n';
+    }
+    fclose(out);
+    if (lines != 8 || first != 'b')
+        return( printf("line %d: report has %d lines\n", __LINE__, lines) );
+
+    fake6502_counters_attach(&f6502, NULL);
+    return(0);
+}
+
+#endif
+
+#ifdef FAKE6502_PROFILE
+
+fake6502_profile test_profile;
+
+int test_call_profile()
+{
+    fake6502_context f6502;
+    char folded[256];
+    size_t length;
+    FILE *out;
+
+    // 0200: jsr $0300; jsr $0310; brk
+    // 0300: jsr $0310; rts
+    // 0310: nop; lda #$03; pha; lda #$1f; pha; rts, which jumps to 0320
+    // 0320: nop; rts
+    uint8_t top[] = {0x20, 0x00, 0x03, 0x20, 0x10, 0x03, 0x00};
+    uint8_t outer[] = {0x20, 0x10, 0x03, 0x60};
+    uint8_t inner[] = {0xea, 0xa9, 0x03, 0x48, 0xa9, 0x1f, 0x48, 0x60};
+    uint8_t tail[] = {0xea, 0x60};
+
+    memset(test_mem, 0, sizeof(test_mem));
+    memcpy(test_mem + 0x0200, top, sizeof(top));
+    memcpy(test_mem + 0x0300, outer, sizeof(outer));
+    memcpy(test_mem + 0x0310, inner, sizeof(inner));
+    memcpy(test_mem + 0x0320, tail, sizeof(tail));
+    test_init(&f6502);
+    f6502.cpu.pc = 0x0200;
+    fake6502_profile_attach(&f6502, &test_profile);
+    fake6502_run(&f6502, 0, 0);
+
+    if (test_profile.calls[0x0300] != 1 || test_profile.calls[0x0310] != 2)
+        return( printf("line %d: calls counted wrongly\n", __LINE__) );
+    if (test_profile.inclusive[0x0300] != 38 || test_profile.exclusive[0x0300] != 12 ||
+        test_profile.inclusive[0x0310] != 52 || test_profile.exclusive[0x0310] != 52)
+        return( printf("line %d: cycles %d/%d and %d/%d\n", __LINE__,
+                       (int)test_profile.inclusive[0x0300], (int)test_profile.exclusive[0x0300],
+                       (int)test_profile.inclusive[0x0310], (int)test_profile.exclusive[0x0310]) );
+
+    // the brk is still on the stack, with no cycles yet
+    out = tmpfile();
+    fake6502_profile_folded(&f6502, out);
+    rewind(out);
+    length = fread(folded, 1, sizeof(folded) - 1, out);
+    folded[length] = 0;
+    fclose(out);
+    if (test_profile.depth != 1 ||
+        strcmp(folded, "0200 19\n0200;0300 12\n0200;0300;0310 26\n0200;0310 26\n"))
+        return( printf("line %d: folded stacks\n%s", __LINE__, folded) );
+
+    fake6502_reset(&f6502);
+    if (test_profile.depth != 0)
+        return( printf("line %d: reset left %d frames\n", __LINE__, test_profile.depth) );
+
+    fake6502_profile_attach(&f6502, NULL);
+    return(0);
+}
+
+#endif
+
+fake6502_events test_events;
+uint64_t test_event_cycle;
+
+void test_event_stop(fake6502_context *c, void *user)
+{
+    test_event_cycle = fake6502_events_now(c);
+    fake6502_stop(c);
+}
+
+int test_event_queue()
+{
+    fake6502_context f6502;
+    uint32_t nmi;
+
+    // 0200: cli; loop: inx; jmp loop
+    // 0300: inc $10; rti, the IRQ handler
+    // 0310: inc $11; rti, the NMI handler
+    uint8_t program[] = {0x58, 0xe8, 0x4c, 0x01, 0x02};
+
+    memset(test_mem, 0, sizeof(test_mem));
+    memcpy(test_mem + 0x0200, program, sizeof(program));
+    memcpy(test_mem + 0x0300, (uint8_t[]){0xe6, 0x10, 0x40}, 3);
+    memcpy(test_mem + 0x0310, (uint8_t[]){0xe6, 0x11, 0x40}, 3);
+    test_mem[0xfffa] = 0x10;
+    test_mem[0xfffb] = 0x03;
+    test_mem[0xfffe] = 0x00;
+    test_mem[0xffff] = 0x03;
+    test_init(&f6502);
+    f6502.cpu.pc = 0x0200;
+    fake6502_events_attach(&f6502, &test_events);
+
+    // an IRQ every 100 cycles, a stop at 1000 and a cancelled NMI
+    fake6502_event_add(&f6502, 100, 100, FAKE6502_EVENT_IRQ, NULL, NULL);
+    fake6502_event_add(&f6502, 1000, 0, FAKE6502_EVENT_CALL, test_event_stop, NULL);
+    nmi = fake6502_event_add(&f6502, 500, 0, FAKE6502_EVENT_NMI, NULL, NULL);
+    if (!fake6502_event_cancel(&f6502, nmi) || fake6502_event_cancel(&f6502, nmi))
+        return( printf("line %d: cancel failed\n", __LINE__) );
+
+    if (fake6502_run(&f6502, 0, 0) != FAKE6502_STOP_HOST)
+        return( printf("line %d: not stopped by the event\n", __LINE__) );
+    if (test_event_cycle < 1000 || test_event_cycle > 1003)
+        return( printf("line %d: event fired at %d\n", __LINE__, (int)test_event_cycle) );
+    CHECKMEM(0x10, 9);
+    CHECKMEM(0x11, 0);
+
+    // the IRQ at 1000 was raised before the stop, and those at 1100 and
+    // 1200 follow
+    if (fake6502_run(&f6502, 250, 0) != FAKE6502_STOP_BUDGET ||
+        fake6502_events_now(&f6502) < test_event_cycle + 250)
+        return( printf("line %d: budget not kept\n", __LINE__) );
+    CHECKMEM(0x10, 12);
+    if (test_events.count != 1)
+        return( printf("line %d: %d events left\n", __LINE__, test_events.count) );
+
+    fake6502_events_attach(&f6502, NULL);
+    return(0);
+}
+
+int test_event_count;
+
+void test_event_counter(fake6502_context *c, void *user)
+{
+    test_event_count++;
+}
+
+int test_event_irq_held()
+{
+    fake6502_engine engines[] = {FAKE6502_ENGINE_TABLE, FAKE6502_ENGINE_FUSED,
+                                 FAKE6502_ENGINE_CACHED, FAKE6502_ENGINE_JIT};
+    fake6502_jit *jit = fake6502_jit_create();
+
+    // 0200: sei; ldy #$40; delay: dey; bne delay; cli; loop: inx; jmp loop
+    // 0300: inc $10, and where it was called from to $11/$12; rti
+    uint8_t program[] = {0x78, 0xa0, 0x40, 0x88, 0xd0, 0xfd, 0x58, 0xe8, 0x4c, 0x07, 0x02};
+    uint8_t handler[] = {0xe6, 0x10, 0xba, 0xbd, 0x02, 0x01, 0x85, 0x11,
+                         0xbd, 0x03, 0x01, 0x85, 0x12, 0x40};
+
+    for (int i = 0; i < sizeof(engines) / sizeof(engines[0]); i++)
+    {
+        fake6502_context f6502;
+
+        memset(test_mem, 0, sizeof(test_mem));
+        memcpy(test_mem + 0x0200, program, sizeof(program));
+        memcpy(test_mem + 0x0300, handler, sizeof(handler));
+        test_mem[0xfffe] = 0x00;
+        test_mem[0xffff] = 0x03;
+        test_init(&f6502);
+        fake6502_pages_map(&f6502, 0x00, 256, test_mem, test_mem);
+        fake6502_cache_attach(&f6502, &test_cache);
+        fake6502_jit_attach(&f6502, jit);
+        f6502.engine = engines[i];
+        f6502.cpu.pc = 0x0200;
+        fake6502_events_attach(&f6502, &test_events);
+
+        // two IRQs fall due while they are disabled, and are taken as one
+        // straight after the cli
+        fake6502_event_add(&f6502, 50, 0, FAKE6502_EVENT_IRQ, NULL, NULL);
+        fake6502_event_add(&f6502, 60, 0, FAKE6502_EVENT_IRQ, NULL, NULL);
+        fake6502_event_add(&f6502, 2000, 0, FAKE6502_EVENT_CALL, test_event_stop, NULL);
+        if (fake6502_run(&f6502, 0, 0) != FAKE6502_STOP_HOST)
+            return( printf("line %d: engine %d not stopped by the event\n", __LINE__, i) );
+        if (test_mem[0x10] != 1 || test_mem[0x11] != 0x07 || test_mem[0x12] != 0x02)
+            return( printf("line %d: engine %d took %d IRQs, from %02x%02x\n", __LINE__, i,
+                           test_mem[0x10], test_mem[0x12], test_mem[0x11]) );
+
+        fake6502_events_attach(&f6502, NULL);
+        fake6502_jit_attach(&f6502, NULL);
+        fake6502_cache_attach(&f6502, NULL);
+    }
+    fake6502_jit_destroy(jit);
+
+    // an event due every cycle fires once at each instruction boundary
+    {
+        fake6502_context f6502;
+
+        test_init(&f6502);
+        f6502.cpu.pc = 0x0207;
+        fake6502_events_attach(&f6502, &test_events);
+        test_event_count = 0;
+        fake6502_event_add(&f6502, 0, 1, FAKE6502_EVENT_CALL, test_event_counter, NULL);
+        fake6502_run(&f6502, 0, 100);
+        if (test_event_count != 100)
+            return( printf("line %d: fired %d times in 100 instructions\n", __LINE__,
+                           test_event_count) );
+        fake6502_events_attach(&f6502, NULL);
+    }
+
+    return(0);
+}
+
+// a run with idle detection and one without must end at the same cycle,
+// with the same state; the cycles skipped are left in test_idle
+
+fake6502_idle test_idle;
+fake6502_events test_idle_events[2];
+fake6502_stop_reason test_idle_reasons[2];
+
+void test_idle_wake(fake6502_context *c, void *user)
+{
+    ((uint8_t *)user)[0x10] = 1;
+}
+
+int test_idle_run(uint16_t pc, int cycle_budget, int instr_budget, bool events)
+{
+    fake6502_context runs[2];
+    uint8_t *memory[2] = {test_mem, test_mem_other};
+
+    memcpy(test_mem_other, test_mem, 0x400);
+    for (int i = 0; i < 2; i++)
+    {
+        test_init(&runs[i]);
+        fake6502_pages_map(&runs[i], 0x00, 0xd0, memory[i], memory[i]);
+        runs[i].cpu.pc = pc;
+        fake6502_idle_attach(&runs[i], i ? NULL : &test_idle);
+        if (events)
+        {
+            fake6502_events_attach(&runs[i], &test_idle_events[i]);
+            fake6502_event_add(&runs[i], 20000, 0, FAKE6502_EVENT_CALL, test_idle_wake, memory[i]);
+            fake6502_event_add(&runs[i], 40000, 0, FAKE6502_EVENT_CALL, test_event_stop, NULL);
+        }
+        test_idle_reasons[i] = fake6502_run(&runs[i], cycle_budget, instr_budget);
+    }
+
+    if (test_idle_reasons[0] != test_idle_reasons[1] ||
+        runs[0].emu.clockticks != runs[1].emu.clockticks ||
+        runs[0].emu.instructions != runs[1].emu.instructions ||
+        runs[0].cpu.pc != runs[1].cpu.pc || runs[0].cpu.a != runs[1].cpu.a ||
+        runs[0].cpu.flags != runs[1].cpu.flags)
+        return( printf("line %d: from %04x, stopped %d at %04x after %d cycles, not %d at %04x after %d\n",
+                       __LINE__, pc, test_idle_reasons[0], runs[0].cpu.pc, runs[0].emu.clockticks,
+                       test_idle_reasons[1], runs[1].cpu.pc, runs[1].emu.clockticks) );
+    return(0);
+}
+
+int test_idle_loops()
+{
+    // 0200: lda $10; beq $0200, waiting on RAM
+    // 0204: lda $d012; bpl $0204, polling an I/O page
+    // 0300: jmp $0300
+    // 0310: sta $11; jmp $0310, which writes
+    uint8_t program[] = {0xa5, 0x10, 0xf0, 0xfc, 0xad, 0x12, 0xd0, 0x10, 0xfb, 0x00};
+
+    memset(test_mem, 0, sizeof(test_mem));
+    memcpy(test_mem + 0x0200, program, sizeof(program));
+    memcpy(test_mem + 0x0300, (uint8_t[]){0x4c, 0x00, 0x03}, 3);
+    memcpy(test_mem + 0x0310, (uint8_t[]){0x85, 0x11, 0x4c, 0x10, 0x03}, 5);
+
+    // the RAM loop is skipped from the end of the first chunk up to the
+    // event that ends it, the I/O one runs until the stop
+    if (test_idle_run(0x0200, 0, 0, true))
+        return(1);
+    if (test_idle_reasons[0] != FAKE6502_STOP_HOST || test_idle.skips != 1 ||
+        test_idle.skipped_cycles < 20000 - FAKE6502_IDLE_CHUNK - 100 ||
+        test_idle.skipped_cycles > 20000 - FAKE6502_IDLE_CHUNK)
+        return( printf("line %d: %d skips of %d cycles\n", __LINE__, (int)test_idle.skips,
+                       (int)test_idle.skipped_cycles) );
+
+    // to the end of a cycle or an instruction budget
+    if (test_idle_run(0x0300, 100000, 0, false) ||
+        test_idle.skipped_cycles < 100000 - FAKE6502_IDLE_CHUNK - 100 ||
+        test_idle_run(0x0300, 0, 30001, false) ||
+        test_idle.skipped_instructions < 30001 - FAKE6502_IDLE_CHUNK / 3 - 100)
+        return( printf("line %d: budget not skipped to\n", __LINE__) );
+
+    if (test_idle_run(0x0310, 100000, 0, false) || test_idle.skips)
+        return( printf("line %d: a loop that writes was skipped\n", __LINE__) );
+
+    return(0);
+}
+
+// a memory mapped device, which reads as its tag with the low byte of the
+// address, and keeps the last write
+
+typedef struct test_device {
+    uint8_t tag;
+    uint16_t address;
+    uint8_t val;
+    int writes;
+} test_device;
+
+fake6502_devices test_devices;
+test_device test_device_state[3];
+
+uint8_t test_device_read(fake6502_context *c, void *state, uint16_t address)
+{
+    return(((test_device *)state)->tag ^ (address & 0xff));
+}
+
+void test_device_write(fake6502_context *c, void *state, uint16_t address, uint8_t val)
+{
+    test_device *device = state;
+
+    device->address = address;
+    device->val = val;
+    device->writes++;
+}
+
+int test_device_map()
+{
+    fake6502_context f6502;
+    test_device *s = test_device_state;
+
+    // 0200: lda $c012; sta $c015; lda $d123; sta $c020; sta $d000
+    uint8_t program[] = {0xad, 0x12, 0xc0, 0x8d, 0x15, 0xc0, 0xad, 0x23, 0xd1,
+                         0x8d, 0x20, 0xc0, 0x8d, 0x00, 0xd0};
+
+    // RAM below $e000, the host above
+    memset(test_mem, 0, sizeof(test_mem));
+    memset(test_mem_other, 0x11, sizeof(test_mem_other));
+    memcpy(test_mem_other + 0x0200, program, sizeof(program));
+    test_mem[0xe000] = 0x77;
+    test_init(&f6502);
+    fake6502_pages_map(&f6502, 0x00, 0xe0, test_mem_other, test_mem_other);
+
+    // one over four whole pages that only reads, one over part of a page
+    // of RAM, and one over part of the first
+    memset(test_device_state, 0, sizeof(test_device_state));
+    s[0].tag = 0x40;
+    s[1].tag = 0x80;
+    s[2].tag = 0xc0;
+    fake6502_devices_attach(&f6502, &test_devices);
+    if (!fake6502_device_add(&f6502, 0xd000, 0xd3ff, test_device_read, NULL, &s[0]) ||
+        !fake6502_device_add(&f6502, 0xc010, 0xc01f, test_device_read, test_device_write, &s[1]) ||
+        !fake6502_device_add(&f6502, 0xd100, 0xd17f, test_device_read, test_device_write, &s[2]))
+        return( printf("line %d: devices not added\n", __LINE__) );
+
+    f6502.cpu.pc = 0x0200;
+    fake6502_run(&f6502, 0, 5);
+    CHECK(cpu.a, 0xe3);
+    if (s[1].writes != 1 || s[1].address != 0xc015 || s[1].val != 0x92 ||
+        s[0].writes || s[2].writes || test_mem_other[0xc020] != 0xe3 ||
+        test_mem_other[0xd000] != 0xe3)
+        return( printf("line %d: writes went astray\n", __LINE__) );
+
+    if (fake6502_mem_read(&f6502, 0xd1ff) != (0x40 ^ 0xff) ||
+        fake6502_mem_read(&f6502, 0xd17f) != (0xc0 ^ 0x7f) ||
+        fake6502_mem_read(&f6502, 0xc00f) != 0x11 ||
+        fake6502_mem_read(&f6502, 0xe000) != 0x77)
+        return( printf("line %d: reads went astray\n", __LINE__) );
+
+    // until there is no more room
+    for (int i = 3; i < FAKE6502_DEVICES_MAX; i++)
+        if (!fake6502_device_add(&f6502, 0xd180 + i, 0xd180 + i, test_device_read, NULL, &s[0]))
+            return( printf("line %d: device %d not added\n", __LINE__, i) );
+    if (fake6502_device_add(&f6502, 0xd300, 0xd3ff, test_device_read, NULL, &s[0]))
+        return( printf("line %d: too many devices\n", __LINE__) );
+
+    fake6502_devices_attach(&f6502, NULL);
+    if (f6502.bus.read != test_mem_read || fake6502_mem_read(&f6502, 0xe000) != 0x77)
+        return( printf("line %d: host functions not given back\n", __LINE__) );
+
+    return(0);
+}
+
+// devices over pages of mapped RAM leave the rest of the page as it was
+
+int test_device_pages()
+{
+    static uint8_t image[FAKE6502_SAVE_HEADER + 65536];
+    fake6502_context f6502;
+
+    // 0200: lda #$55; sta $0290
+    uint8_t program[] = {0xa9, 0x55, 0x8d, 0x90, 0x02};
+
+    memset(test_mem_other, 0, sizeof(test_mem_other));
+    memcpy(test_mem_other + 0x0200, program, sizeof(program));
+    test_init(&f6502);
+    f6502.engine = FAKE6502_ENGINE_CACHED;
+    fake6502_pages_map(&f6502, 0x00, 256, test_mem_other, test_mem_other);
+    fake6502_cache_attach(&f6502, &test_cache);
+    fake6502_devices_attach(&f6502, &test_devices);
+
+    // the code on page $02 is cached when the device takes part of it
+    f6502.cpu.pc = 0x0200;
+    fake6502_run(&f6502, 0, 1);
+    if (!fake6502_device_add(&f6502, 0x0280, 0x028f, test_device_read, NULL,
+                             &test_device_state[0]))
+        return( printf("line %d: device not added\n", __LINE__) );
+
+    test_writes = 0;
+    fake6502_run(&f6502, 0, 1);
+    if (test_mem_other[0x0290] != 0x55 || test_writes)
+        return( printf("line %d: the write went to the host\n", __LINE__) );
+
+    // the context's own pages are not given up to a device
+    if (!fake6502_pages_alloc(&f6502, 0x03, 1))
+        return( printf("line %d: out of memory\n", __LINE__) );
+    if (fake6502_device_add(&f6502, 0x02f0, 0x030f, test_device_read, NULL,
+                            &test_device_state[0]))
+        return( printf("line %d: device added over its own page\n", __LINE__) );
+    if (fake6502_mem_read(&f6502, 0x0310) != 0x00)
+        return( printf("line %d: its own page was lost\n", __LINE__) );
+
+    // the page goes back to the page table without the devices
+    fake6502_devices_attach(&f6502, NULL);
+    if (f6502.bus.read_pages[0x02] != test_mem_other + 0x0200 ||
+        f6502.bus.write_pages[0x02] != test_mem_other + 0x0200 ||
+        fake6502_mem_read(&f6502, 0x0290) != 0x55)
+        return( printf("line %d: page $02 not mapped again\n", __LINE__) );
+
+    fake6502_cache_attach(&f6502, NULL);
+    fake6502_pages_release(&f6502);
+
+    // a save state loaded under a device leaves its page to it
+    fake6502_pages_map(&f6502, 0x00, 256, test_mem_other, test_mem_other);
+    fake6502_save(&f6502, image, sizeof(image));
+    fake6502_devices_attach(&f6502, &test_devices);
+    test_device_state[0].tag = 0x40;
+    fake6502_device_add(&f6502, 0x0280, 0x028f, test_device_read, NULL, &test_device_state[0]);
+    if (!fake6502_load(&f6502, image, sizeof(image)) ||
+        fake6502_mem_read(&f6502, 0x0285) != (0x40 ^ 0x85) ||
+        fake6502_mem_read(&f6502, 0x0290) != 0x55)
+        return( printf("line %d: the load took the device's page\n", __LINE__) );
+
+    fake6502_devices_attach(&f6502, NULL);
+    fake6502_pages_release(&f6502);
+    return(0);
+}
+
+#ifdef FAKE6502_BREAKPOINTS
+
+fake6502_breakpoints test_breakpoints;
+
+int test_breakpoint_stops()
+{
+    // lda #$05; sta $1000; lda $1100; loop: inx; jmp loop
+    // 0300: lda $1234; brk
+    uint8_t program[] = {0xa9, 0x05, 0x8d, 0x00, 0x10, 0xad, 0x00, 0x11,
+                         0xe8, 0x4c, 0x08, 0x02};
+    uint8_t words[] = {0xad, 0x34, 0x12, 0x00};
+
+    // on the callback bus, then with every page mapped
+    for (int mapped = 0; mapped < 2; mapped++)
+    {
+        fake6502_context f6502;
+
+        memset(test_mem, 0, sizeof(test_mem));
+        memcpy(test_mem + 0x0200, program, sizeof(program));
+        memcpy(test_mem + 0x0300, words, sizeof(words));
+        test_mem[0x1100] = 0x42;
+        test_mem[0xfffe] = 0x10;
+        test_mem[0xffff] = 0x03;
+        test_init(&f6502);
+        if (mapped)
+            fake6502_pages_map(&f6502, 0x00, 256, test_mem, test_mem);
+        f6502.cpu.pc = 0x0200;
+        f6502.cpu.x = 0;
+        fake6502_breakpoints_attach(&f6502, &test_breakpoints);
+        fake6502_breakpoint_set(&test_breakpoints, FAKE6502_BREAK_WRITE, 0x1000, 1, true);
+        fake6502_breakpoint_set(&test_breakpoints, FAKE6502_BREAK_READ, 0x10ff, 3, true);
+        fake6502_breakpoint_set(&test_breakpoints, FAKE6502_BREAK_READ, 0x10ff, 1, false);
+        fake6502_breakpoint_set(&test_breakpoints, FAKE6502_BREAK_EXEC, 0x0208, 1, true);
+
+        if (fake6502_run(&f6502, 0, 0) != FAKE6502_STOP_WRITE_WATCH ||
+            test_breakpoints.address != 0x1000 || test_breakpoints.value != 0x05)
+            return( printf("line %d: write not caught\n", __LINE__) );
+        CHECK(cpu.pc, 0x0205);
+
+        // the read is reported, rather than the breakpoint the pc is now at
+        if (fake6502_run(&f6502, 0, 0) != FAKE6502_STOP_READ_WATCH ||
+            test_breakpoints.address != 0x1100 || test_breakpoints.value != 0x42)
+            return( printf("line %d: read not caught\n", __LINE__) );
+        CHECK(cpu.pc, 0x0208);
+
+        // each run goes round the loop once more
+        for (int i = 1; i <= 3; i++)
+        {
+            if (fake6502_run(&f6502, 0, 0) != FAKE6502_STOP_BREAKPOINT)
+                return( printf("line %d: breakpoint missed\n", __LINE__) );
+            CHECK(cpu.pc, 0x0208);
+            CHECK(cpu.x, i);
+        }
+
+        // words read at once: an absolute operand, then the BRK vector,
+        // which is reported rather than the BRK
+        fake6502_breakpoints_attach(&f6502, &test_breakpoints);
+        fake6502_breakpoint_set(&test_breakpoints, FAKE6502_BREAK_READ, 0x0302, 1, true);
+        fake6502_breakpoint_set(&test_breakpoints, FAKE6502_BREAK_READ, 0xffff, 1, true);
+        f6502.cpu.pc = 0x0300;
+        if (fake6502_run(&f6502, 0, 0) != FAKE6502_STOP_READ_WATCH ||
+            test_breakpoints.address != 0x0302 || test_breakpoints.value != 0x12)
+            return( printf("line %d: operand read not caught\n", __LINE__) );
+        if (fake6502_run(&f6502, 0, 0) != FAKE6502_STOP_READ_WATCH ||
+            test_breakpoints.address != 0xffff || test_breakpoints.value != 0x03)
+            return( printf("line %d: vector read not caught\n", __LINE__) );
+        CHECK(cpu.pc, 0x0310);
+
+        // and the IRQ vector, read as an event raises one
+        f6502.cpu.pc = 0x0208;
+        fake6502_interrupt_clear(&f6502);
+        fake6502_events_attach(&f6502, &test_events);
+        fake6502_event_add(&f6502, 0, 0, FAKE6502_EVENT_IRQ, NULL, NULL);
+        if (fake6502_run(&f6502, 0, 0) != FAKE6502_STOP_READ_WATCH ||
+            test_breakpoints.address != 0xffff)
+            return( printf("line %d: IRQ vector read not caught\n", __LINE__) );
+        CHECK(cpu.pc, 0x0310);
+        fake6502_events_attach(&f6502, NULL);
+
+        // fetches of code the cached engine has decoded are checked too
+        f6502.engine = FAKE6502_ENGINE_CACHED;
+        fake6502_cache_attach(&f6502, &test_cache);
+        f6502.cpu.pc = 0x0208;
+        if (fake6502_run(&f6502, 0, 10) != FAKE6502_STOP_BUDGET)
+            return( printf("line %d: stopped in the loop\n", __LINE__) );
+        fake6502_breakpoint_set(&test_breakpoints, FAKE6502_BREAK_READ, 0x0209, 1, true);
+        if (fake6502_run(&f6502, 0, 10) != FAKE6502_STOP_READ_WATCH ||
+            test_breakpoints.address != 0x0209 || test_breakpoints.value != 0x4c)
+            return( printf("line %d: cached fetch not caught\n", __LINE__) );
+        fake6502_breakpoint_set(&test_breakpoints, FAKE6502_BREAK_READ, 0x0209, 1, false);
+
+        fake6502_breakpoints_attach(&f6502, NULL);
+        f6502.cpu.pc = 0x0208;
+        if (fake6502_run(&f6502, 0, 100) != FAKE6502_STOP_BUDGET)
+            return( printf("line %d: stopped with no breakpoints\n", __LINE__) );
+        fake6502_cache_attach(&f6502, NULL);
+    }
+
+    return(0);
+}
+
+#endif
+
+// two programs adding $00 and $01 into $02, another that sets the carry
+// first, and one that only differs when $00 is $80
+
+int test_equiv_check()
+{
+    uint16_t inputs[] = {0x00, 0x01};
+    uint8_t add[] = {0x18, 0xa5, 0x00, 0x65, 0x01, 0x85, 0x02, 0x00};
+    uint8_t add_too[] = {0xa5, 0x00, 0x18, 0x65, 0x01, 0x85, 0x02, 0x00};
+    uint8_t add_carry[] = {0x38, 0xa5, 0x00, 0x65, 0x01, 0x85, 0x02, 0x00};
+    // ldx $00; cpx #$80; beq odd; clc; lda $00; adc $01; sta $02; brk
+    // odd: lda #$00; sta $02; brk
+    uint8_t add_odd[] = {0xa6, 0x00, 0xe0, 0x80, 0xf0, 0x08,
+                         0x18, 0xa5, 0x00, 0x65, 0x01, 0x85, 0x02, 0x00,
+                         0xa9, 0x00, 0x85, 0x02, 0x00};
+    // lda #$55; ldx #$00; loop: sta $0400,x ... sta $0800,x; inx; bne loop;
+    // brk, and with the stores the other way round
+    uint8_t fill_up[] = {0xa9, 0x55, 0xa2, 0x00, 0x9d, 0x00, 0x04, 0x9d, 0x00, 0x05,
+                         0x9d, 0x00, 0x06, 0x9d, 0x00, 0x07, 0x9d, 0x00, 0x08,
+                         0xe8, 0xd0, 0xee, 0x00};
+    uint8_t fill_down[] = {0xa9, 0x55, 0xa2, 0x00, 0x9d, 0x00, 0x08, 0x9d, 0x00, 0x07,
+                           0x9d, 0x00, 0x06, 0x9d, 0x00, 0x05, 0x9d, 0x00, 0x04,
+                           0xe8, 0xd0, 0xee, 0x00};
+    int found;
+
+    memset(test_mem_other, 0, sizeof(test_mem_other));
+    test_mem_other[0x02] = 0x77;
+    fake6502_equiv_init(&test_equiv, test_variant, test_mem_other, 0x0200, inputs, 2, 100);
+
+    memset(&test_equiv_mask, 0, sizeof(test_equiv_mask));
+    test_equiv_mask.registers = FAKE6502_EQUIV_A;
+    test_equiv_mask.flags = FAKE6502_CARRY_FLAG | FAKE6502_ZERO_FLAG | FAKE6502_SIGN_FLAG;
+    test_equiv_mask.memory[0x02 >> 3] = 1 << 2;
+
+    memset(test_equiv_vectors, 0, sizeof(test_equiv_vectors));
+    for (int i = 0; i < 64; i++)
+    {
+        test_equiv_vectors[i].s = 0xff;
+        test_equiv_vectors[i].memory[0] = i * 37;
+        test_equiv_vectors[i].memory[1] = i * 11;
+    }
+    test_equiv_vectors[5].memory[0] = 0x80;
+
+    found = fake6502_equiv_check(&test_equiv, add, sizeof(add), add_too, sizeof(add_too),
+                                 test_equiv_vectors, 64, &test_equiv_mask);
+    if (found != -1 || test_equiv.memory[0][0x02] != 0x77 || test_equiv.memory[1][0x00] != 0)
+        return( printf("line %d: equivalent programs differ at %d\n", __LINE__, found) );
+
+    found = fake6502_equiv_check(&test_equiv, add, sizeof(add), add_carry, sizeof(add_carry),
+                                 test_equiv_vectors, 64, &test_equiv_mask);
+    if (found != 0 || test_equiv_vectors[0].mismatches != 1)
+        return( printf("line %d: carry not told apart, %d\n", __LINE__, found) );
+
+    // the input that tells these apart moves up ahead of those with none
+    found = fake6502_equiv_check(&test_equiv, add, sizeof(add), add_odd, sizeof(add_odd),
+                                 test_equiv_vectors, 64, &test_equiv_mask);
+    if (found != 1 || test_equiv_vectors[1].memory[0] != 0x80 ||
+        test_equiv.sides[1].cpu.a != 0x00 || test_equiv.memory[1][0x02] != 0x00)
+        return( printf("line %d: found %d\n", __LINE__, found) );
+
+    found = fake6502_equiv_check(&test_equiv, add, sizeof(add), add_odd, sizeof(add_odd),
+                                 test_equiv_vectors, 64, &test_equiv_mask);
+    if (found != 0 || test_equiv_vectors[0].mismatches != 2)
+        return( printf("line %d: found %d\n", __LINE__, found) );
+
+    // with only the registers as outputs, both are the same
+    test_equiv_mask.memory[0x02 >> 3] = 0;
+    test_equiv_mask.registers = FAKE6502_EQUIV_Y | FAKE6502_EQUIV_S;
+    test_equiv_mask.flags = 0;
+    found = fake6502_equiv_check(&test_equiv, add, sizeof(add), add_odd, sizeof(add_odd),
+                                 test_equiv_vectors, 64, &test_equiv_mask);
+    if (found != -1)
+        return( printf("line %d: found %d\n", __LINE__, found) );
+
+    // programs writing more than the logs hold, with all memory but the
+    // stack as outputs; the code differs, and is left out
+    fake6502_equiv_init(&test_equiv, test_variant, test_mem_other, 0x0200, inputs, 2, 5000);
+    memset(test_equiv_mask.memory, 0xff, sizeof(test_equiv_mask.memory));
+    memset(test_equiv_mask.memory + (0x0100 >> 3), 0, 0x100 >> 3);
+    found = fake6502_equiv_check(&test_equiv, fill_up, sizeof(fill_up), fill_down,
+                                 sizeof(fill_down), test_equiv_vectors, 1, &test_equiv_mask);
+    if (found != -1)
+        return( printf("line %d: found %d\n", __LINE__, found) );
+
+    return(0);
+}
+
+// count each context stopping; every context has its own entry, so this
+// needs no locking
+
+void test_pool_stopped(fake6502_context *c, fake6502_stop_reason reason, void *user)
+{
+    fake6502_context *contexts = user;
+
+    if (reason == FAKE6502_STOP_BRK)
+        test_pool_done[c - contexts]++;
+}
+
+int test_pool()
+{
+    fake6502_pool *pool = fake6502_pool_create(4, true);
+    fake6502_pool_stats stats[2];
+
+    // ldy #3; loop: ldx #n; inner: dex; bne inner; dey; bne loop
+    // lda #n; sta $10; brk
+    // with n different in each context, so some take much longer
+    uint8_t program[] = {0xa0, 0x03, 0xa2, 0x00, 0xca, 0xd0, 0xfd, 0x88, 0xd0, 0xf8,
+                         0xa9, 0x00, 0x85, 0x10, 0x00};
+
+    memset(test_pool_done, 0, sizeof(test_pool_done));
+    memset(test_mem_other, 0, sizeof(test_mem_other));
+
+    for (int run = 0; run < 2; run++)
+        for (int i = 0; i < TEST_POOL_CONTEXTS; i++)
+        {
+            fake6502_context *c = &test_pool_contexts[run][i];
+            uint8_t *mem = test_pool_mem[run][i];
+
+            memset(mem, 0, 0x0400);
+            memcpy(mem + 0x0200, program, sizeof(program));
+            mem[0x0203] = mem[0x020b] = i % 7 ? i : 255 - i;
+
+            fake6502_init(c, test_other_read, test_other_write, NULL);
+            c->variant = test_variant;
+            fake6502_pages_map(c, 0x00, 4, mem, mem);
+            c->cpu.pc = 0x0200;
+        }
+
+    fake6502_pool_run(pool, test_pool_contexts[0], TEST_POOL_CONTEXTS, 0, 0,
+                      test_pool_stopped, test_pool_contexts[0], &stats[0]);
+    fake6502_pool_run(NULL, test_pool_contexts[1], TEST_POOL_CONTEXTS, 0, 0,
+                      NULL, NULL, &stats[1]);
+    fake6502_pool_destroy(pool);
+
+    for (int i = 0; i < TEST_POOL_CONTEXTS; i++)
+    {
+        fake6502_context *c = &test_pool_contexts[0][i];
+
+        if (test_pool_done[i] != 1)
+            return( printf("line %d: context %d stopped %d times\n", __LINE__, i,
+                           test_pool_done[i]) );
+        if (test_pool_mem[0][i][0x10] != test_pool_mem[0][i][0x020b] ||
+            !test_same_state(c, &test_pool_contexts[1][i]) ||
+            c->emu.instructions != test_pool_contexts[1][i].emu.instructions)
+            return( printf("line %d: context %d differs\n", __LINE__, i) );
+    }
+
+    if (stats[0].contexts != TEST_POOL_CONTEXTS ||
+        stats[0].instructions != stats[1].instructions || !stats[0].instructions)
+        return( printf("line %d: %llu instructions, expected %llu\n", __LINE__,
+                       (unsigned long long)stats[0].instructions,
+                       (unsigned long long)stats[1].instructions) );
+
+    return(0);
+}
+
 
 // -------------------------------------------------------------------
 
@@ -1470,7 +3217,6 @@ test_fn tests_cmn[] = {{"interrupts", test_interrupt},
                       {"absolute,y addressing", test_absolute_y},
                       {"indirect,y addressing", test_indirect_y},
                       {"indirect,x addressing", test_indirect_x},
-                      {"decimal mode", test_decimal_mode},
                       {"flags set & reset", test_flags},
                       {"binary mode", test_binary_mode},
                       {"push & pull", test_pushpull},
@@ -1493,14 +3239,54 @@ test_fn tests_cmn[] = {{"interrupts", test_interrupt},
                       {"sta", test_sta_opcode},
                       {"stx", test_stx_opcode},
                       {"sty", test_sty_opcode},
+                      {"run", test_run},
+                      {"per-context bus", test_bus},
+                      {"page table", test_pages},
+                      {"fast and accurate bus modes", test_bus_mode},
+                      {"fused engine", test_fused_engine},
+                      {"variants side by side", test_variants},
+                      {"flags seen by the host", test_flags_host},
+                      {"ADC/SBC table", test_arith_table},
+                      {"cached engine", test_cached_engine},
+                      {"self-modifying code in the cache", test_cache_smc},
+                      {"batch engine", test_batch_engine},
+                      {"batch engine ADC/SBC", test_batch_arith},
+                      {"bitsliced engine", test_sliced_engine},
+                      {"opcode data", test_opcode_info},
+                      {"equivalence checker", test_equiv_check},
+                      {"fork and restore", test_fork},
+                      {"save states", test_save},
+                      {"thread pool", test_pool},
+                      {"event queue", test_event_queue},
+                      {"held IRQ events", test_event_irq_held},
+                      {"idle loops", test_idle_loops},
+                      {"memory mapped devices", test_device_map},
+                      {"memory mapped devices over RAM", test_device_pages},
+#ifdef FAKE6502_TRACE
+                      {"instruction trace", test_trace_ring},
+#endif
+#ifdef FAKE6502_COUNTERS
+                      {"opcode counters", test_opcode_counters},
+#endif
+#ifdef FAKE6502_PROFILE
+                      {"call profile", test_call_profile},
+#endif
+#ifdef FAKE6502_BREAKPOINTS
+                      {"breakpoints and watchpoints", test_breakpoint_stops},
+#endif
+#ifdef FAKE6502_JIT
+                      {"JIT engine", test_jit_engine},
+#endif
                       {NULL, NULL}};
 
 test_fn tests_nmos[] = {{"indirect addressing", test_indirect},
+                       {"decimal mode", test_decimal_mode},
                        {"rra", test_rra_opcode},
                        {"rla", test_rla_opcode},
                        {"sre", test_sre_opcode},
                        {"sax", test_sax_opcode},
                        {"lax", test_lax_opcode},
+                       {"halt", test_run_halt},
                        {NULL, NULL}};
 
 test_fn tests_cmos[] = {{"CMOS jmp indirect", test_cmos_jmp_indirect},
@@ -1509,6 +3295,13 @@ test_fn tests_cmos[] = {{"CMOS jmp indirect", test_cmos_jmp_indirect},
                        {"(zp) addressing", test_zpi},
                        {"pushes and pulls", test_pushme_pullyou},
                        {"stz", test_stz_opcode},
+                       {"decimal mode", test_decimal_mode},
+                       {NULL, NULL}};
+
+test_fn tests_2a03[] = {{"indirect addressing", test_indirect},
+                       {"rra", test_rra_opcode},
+                       {"halt", test_run_halt},
+                       {"decimal mode ignored", test_2a03_decimal},
                        {NULL, NULL}};
 
 int tests_run(test_fn tests[])
@@ -1526,6 +3319,15 @@ int tests_run(test_fn tests[])
 
 int main(int argc, char **argv)
 {
+  if (argc >= 2)
+  {
+    if (!strcmp(argv[1], "cmos"))
+        test_variant = FAKE6502_VARIANT_CMOS;
+
+    if (!strcmp(argv[1], "2a03"))
+        test_variant = FAKE6502_VARIANT_2A03;
+  }
+
   tests_run(tests_cmn);
 
   if (argc >= 2)
@@ -1535,6 +3337,9 @@ int main(int argc, char **argv)
 
     if (!strcmp(argv[1], "nmos"))
         tests_run(tests_nmos);
+
+    if (!strcmp(argv[1], "2a03"))
+        tests_run(tests_2a03);
   }
 
   return(0);